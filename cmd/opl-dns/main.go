@@ -3,11 +3,16 @@ package main
 
 import (
 	"context"
+	"errors"
 	"flag"
 	"fmt"
 	"log/slog"
+	"net"
+	"net/http"
+	"net/netip"
 	"os"
 	"os/signal"
+	"strconv"
 	"strings"
 	"syscall"
 	"time"
@@ -23,6 +28,10 @@ var (
 	buildTime = "unknown"
 )
 
+// upgradeTimeout bounds how long a SIGUSR2 upgrade waits for the new
+// process to start serving before giving up on it.
+const upgradeTimeout = time.Minute
+
 func main() {
 	// Parse command line flags
 	configPath := flag.String("config", "config.json", "Path to configuration file")
@@ -52,18 +61,9 @@ func main() {
 		os.Exit(1)
 	}
 
-	// Setup logging
-	var logLevel slog.Level
-	switch cfg.Logging.Level {
-	case "debug":
-		logLevel = slog.LevelDebug
-	case "warn":
-		logLevel = slog.LevelWarn
-	case "error":
-		logLevel = slog.LevelError
-	default:
-		logLevel = slog.LevelInfo
-	}
+	// Setup logging; the level can be changed by reloading the configuration
+	logLevel := new(slog.LevelVar)
+	logLevel.Set(parseLogLevel(cfg.Logging.Level))
 
 	var handler slog.Handler
 	if cfg.Logging.Format == "json" {
@@ -81,6 +81,13 @@ func main() {
 		os.Exit(1)
 	}
 
+	// A process started by an upgrade takes over its parent's sockets
+	handoff, err := dns.InheritHandoff()
+	if err != nil {
+		logger.Error("Error inheriting sockets", "error", err)
+		os.Exit(1)
+	}
+
 	// Create API client
 	apiClient := api.NewClient(
 		cfg.API.BaseURL,
@@ -90,8 +97,57 @@ func main() {
 
 	// Create stats collector
 	statsCollector := stats.NewCollector()
+	if cfg.Stats.Analytics {
+		statsCollector.EnableAnalytics()
+	}
 
 	// Create DNS server
+	dnsOpts := []dns.Option{
+		dns.WithListeners(cfg.DNS.Listeners),
+		dns.WithUDPBatch(cfg.DNS.UDPBatch),
+		dns.WithBlockLog(cfg.Logging.BlockLogBuffer, cfg.Logging.BlockLogPerDomain),
+		dns.WithStreamLimits(cfg.DNS.TCPIdleTimeout.Duration, cfg.DNS.StreamMaxInflight, cfg.DNS.StreamMaxConns),
+		dns.WithForwardLimit(cfg.DNS.ForwardWorkers, cfg.DNS.ForwardQueue),
+		dns.WithRateLimit(cfg.DNS.RateLimitQPS, cfg.DNS.RateLimitBurst),
+		dns.WithHandoff(handoff),
+	}
+	if cfg.DNS.DoTListenAddr != "" || cfg.DNS.DoHListenAddr != "" {
+		tlsConfig, err := dns.NewTLSConfig(cfg.DNS.TLSCertFile, cfg.DNS.TLSKeyFile)
+		if err != nil {
+			logger.Error("Error loading TLS configuration", "error", err)
+			os.Exit(1)
+		}
+		dnsOpts = append(dnsOpts, dns.WithTLS(tlsConfig, cfg.DNS.DoTListenAddr, cfg.DNS.DoHListenAddr))
+	}
+	if len(cfg.DNS.LocalZones) > 0 || len(cfg.DNS.LocalRecords) > 0 || cfg.DNS.SpecialUseNames {
+		localZones, err := dns.NewLocalZones(cfg.DNS.LocalZones, cfg.DNS.LocalRecords, cfg.DNS.SpecialUseNames)
+		if err != nil {
+			logger.Error("Error loading local zones", "error", err)
+			os.Exit(1)
+		}
+		dnsOpts = append(dnsOpts, dns.WithLocalZones(localZones))
+	}
+	if len(cfg.DNS.Views) > 0 {
+		policies, err := buildPolicies(cfg.DNS.Views)
+		if err != nil {
+			logger.Error("Error loading views", "error", err)
+			os.Exit(1)
+		}
+		dnsOpts = append(dnsOpts, dns.WithPolicies(policies))
+	}
+	if cfg.DNS.CacheTTL.Duration > 0 {
+		cache := dns.NewCache(cfg.DNS.CacheTTL.Duration, cfg.DNS.CacheSize, statsCollector,
+			dns.WithStaleTTL(cfg.DNS.CacheStaleTTL.Duration))
+		if handoff != nil {
+			if n, err := handoff.LoadCache(cache); err != nil {
+				logger.Warn("Error loading inherited cache", "error", err)
+			} else if n > 0 {
+				logger.Info("Loaded inherited cache", "entries", n)
+			}
+		}
+		dnsOpts = append(dnsOpts, dns.WithCache(cache), dns.WithPrefetch(cfg.DNS.CachePrefetch))
+	}
+
 	dnsServer, err := dns.NewServer(
 		cfg.DNS.ListenAddr,
 		cfg.DNS.UpstreamDNS,
@@ -99,6 +155,7 @@ func main() {
 		apiClient,
 		statsCollector,
 		logger.With("component", "dns"),
+		dnsOpts...,
 	)
 	if err != nil {
 		logger.Error("Error creating DNS server", "error", err)
@@ -109,56 +166,129 @@ func main() {
 	ctx, cancel := context.WithCancel(context.Background())
 	defer cancel()
 
+	// refreshBlocklist fetches the blocklist and saves a snapshot of it when
+	// it has changed
+	refreshBlocklist := func(ctx context.Context) error {
+		start := time.Now()
+		previous := apiClient.GetCachedBlocklist()
+		blocklist, err := apiClient.FetchBlocklist(ctx)
+		statsCollector.RecordRefresh(time.Since(start), err)
+		if err != nil {
+			return err
+		}
+		if cfg.API.SnapshotPath != "" && blocklist != previous {
+			if err := apiClient.SaveSnapshot(cfg.API.SnapshotPath); err != nil {
+				logger.Warn("Error saving blocklist snapshot", "error", err)
+			}
+		}
+		return nil
+	}
+
+	// A process started by an upgrade serves the blocklist its parent was
+	// serving. If that fails it exits before reporting ready, and the
+	// parent carries on.
+	blocklistLoaded := false
+	if handoff != nil {
+		blocklist, err := handoff.LoadBlocklist(apiClient)
+		if err != nil {
+			logger.Error("Error loading inherited blocklist", "error", err)
+			os.Exit(1)
+		}
+		if blocklist != nil {
+			blocklistLoaded = true
+			logger.Info("Loaded inherited blocklist", "urls", blocklist.TotalURLs, "employers", len(blocklist.Employers))
+		}
+	}
+
+	// Otherwise serve the last saved blocklist until the API has been
+	// reached
+	if !blocklistLoaded && cfg.API.SnapshotPath != "" {
+		start := time.Now()
+		if blocklist, err := apiClient.LoadSnapshot(cfg.API.SnapshotPath); err != nil {
+			if !errors.Is(err, os.ErrNotExist) {
+				logger.Warn("Error loading blocklist snapshot", "error", err)
+			}
+		} else {
+			blocklistLoaded = true
+			logger.Info("Blocklist snapshot loaded",
+				"urls", blocklist.TotalURLs,
+				"employers", len(blocklist.Employers),
+				"fetched", apiClient.LastFetchTime(),
+				"took", time.Since(start),
+			)
+		}
+	}
+
 	// Initial blocklist fetch with retries
-	logger.Info("Fetching initial blocklist...")
-	for attempt := 1; attempt <= 10; attempt++ {
-		if _, err := apiClient.FetchBlocklist(ctx); err != nil {
-			logger.Warn("Error fetching initial blocklist", "error", err, "attempt", attempt, "maxAttempts", 10)
-			if attempt < 10 {
-				delay := time.Duration(attempt) * 3 * time.Second
-				if delay > 30*time.Second {
-					delay = 30 * time.Second
+	fetchInitialBlocklist := func() {
+		logger.Info("Fetching initial blocklist...")
+		for attempt := 1; attempt <= 10; attempt++ {
+			if err := refreshBlocklist(ctx); err != nil {
+				logger.Warn("Error fetching initial blocklist", "error", err, "attempt", attempt, "maxAttempts", 10)
+				if attempt < 10 {
+					delay := time.Duration(attempt) * 3 * time.Second
+					if delay > 30*time.Second {
+						delay = 30 * time.Second
+					}
+					logger.Info("Retrying blocklist fetch...", "delay", delay)
+					select {
+					case <-time.After(delay):
+					case <-ctx.Done():
+						break
+					}
 				}
-				logger.Info("Retrying blocklist fetch...", "delay", delay)
-				select {
-				case <-time.After(delay):
-				case <-ctx.Done():
-					break
+			} else {
+				blocklist := apiClient.GetCachedBlocklist()
+				if blocklist != nil {
+					logger.Info("Blocklist loaded", "urls", blocklist.TotalURLs, "employers", len(blocklist.Employers))
 				}
+				break
 			}
-		} else {
-			blocklist := apiClient.GetCachedBlocklist()
-			if blocklist != nil {
-				logger.Info("Blocklist loaded", "urls", blocklist.TotalURLs, "employers", len(blocklist.Employers))
-			}
-			break
 		}
 	}
+	// The fetch runs in the background even without a snapshot, so that
+	// the listeners, and the readiness reported to systemd or to an
+	// upgrading parent, do not wait out its retries while the API is down
+	if !blocklistLoaded {
+		logger.Warn("No blocklist snapshot loaded, serving unfiltered until the blocklist is fetched")
+	}
+	go fetchInitialBlocklist()
 
-	// Start blocklist refresh goroutine
-	go func() {
-		ticker := time.NewTicker(cfg.API.RefreshInterval.Duration)
-		defer ticker.Stop()
-
-		for {
-			select {
-			case <-ctx.Done():
+	// Start the blocklist refresh loop; a send on refreshNow refreshes
+	// straight away
+	refreshNow := make(chan struct{}, 1)
+	go apiClient.Refresh(ctx, api.RefreshConfig{
+		Interval: cfg.API.RefreshInterval.Duration,
+		Jitter:   cfg.API.RefreshJitter,
+		Trigger:  refreshNow,
+		OnRefresh: func(res api.RefreshResult) {
+			statsCollector.RecordRefresh(res.Duration, res.Err)
+			if res.Err != nil {
+				logger.Error("Error refreshing blocklist", "error", res.Err, "retryIn", res.Next)
 				return
-			case <-ticker.C:
-				logger.Debug("Refreshing blocklist...")
-				if _, err := apiClient.FetchBlocklist(ctx); err != nil {
-					logger.Error("Error refreshing blocklist", "error", err)
-				} else {
-					blocklist := apiClient.GetCachedBlocklist()
-					if blocklist != nil {
-						logger.Debug("Blocklist refreshed", "urls", blocklist.TotalURLs)
-					}
+			}
+			if res.Changed && cfg.API.SnapshotPath != "" {
+				if err := apiClient.SaveSnapshot(cfg.API.SnapshotPath); err != nil {
+					logger.Warn("Error saving blocklist snapshot", "error", err)
 				}
 			}
+			if res.Blocklist != nil {
+				logger.Debug("Blocklist refreshed", "urls", res.Blocklist.TotalURLs, "changed", res.Changed, "next", res.Next)
+			}
+		},
+	})
+
+	blocklistSize := func() (int, int) {
+		blocklist := apiClient.GetCachedBlocklist()
+		if blocklist == nil {
+			return 0, 0
 		}
-	}()
+		return blocklist.TotalURLs, len(blocklist.Employers)
+	}
 
-	// Start stats reporter goroutine if enabled
+	// Start stats reporter goroutine if enabled; reporterDone is closed once
+	// it has flushed its last reports
+	var reporterDone chan struct{}
 	if cfg.Stats.Enabled {
 		// Determine instance ID
 		instanceID := cfg.Stats.InstanceID
@@ -177,31 +307,54 @@ func main() {
 		}
 
 		reporter := stats.NewReporter(stats.ReporterConfig{
-			Collector:  statsCollector,
-			InstanceID: instanceID,
-			Version:    version,
-			ReportURL:  reportURL,
-			APIKey:     cfg.API.APIKey,
-			Interval:   cfg.Stats.ReportInterval.Duration,
-			Logger:     logger.With("component", "stats"),
-			GetBlocklistSize: func() (int, int) {
-				blocklist := apiClient.GetCachedBlocklist()
-				if blocklist == nil {
-					return 0, 0
-				}
-				return blocklist.TotalURLs, len(blocklist.Employers)
-			},
-			GetLastRefresh: func() time.Time {
-				return apiClient.LastFetchTime()
-			},
+			Collector:        statsCollector,
+			InstanceID:       instanceID,
+			Version:          version,
+			ReportURL:        reportURL,
+			APIKey:           cfg.API.APIKey,
+			Interval:         cfg.Stats.ReportInterval.Duration,
+			Timeout:          cfg.API.Timeout.Duration,
+			Compress:         cfg.Stats.ReportGzip,
+			Logger:           logger.With("component", "stats"),
+			GetBlocklistSize: blocklistSize,
+			GetLastRefresh:   apiClient.LastFetchTime,
 		})
 
-		go reporter.Start(ctx)
+		reporterDone = make(chan struct{})
+		go func() {
+			defer close(reporterDone)
+			reporter.Start(ctx)
+		}()
 		logger.Info("Stats reporting enabled", "instanceId", instanceID, "interval", cfg.Stats.ReportInterval.Duration)
 	}
 
 	// Start servers
-	errChan := make(chan error, 2)
+	errChan := make(chan error, 5)
+
+	// Start metrics listener if configured
+	var metricsServer *http.Server
+	if cfg.Stats.MetricsAddr != "" {
+		ln, err := dnsServer.Listen(cfg.Stats.MetricsAddr)
+		if err != nil {
+			logger.Error("Error listening for metrics", "error", err)
+			os.Exit(1)
+		}
+		metricsServer = &http.Server{
+			Handler: stats.NewMetricsHandler(stats.MetricsConfig{
+				Collector:        statsCollector,
+				Pprof:            cfg.Stats.Pprof,
+				GetBlocklistSize: blocklistSize,
+				GetLastRefresh:   apiClient.LastFetchTime,
+			}),
+			ReadHeaderTimeout: 10 * time.Second,
+		}
+		go func() {
+			if err := metricsServer.Serve(ln); err != nil && !errors.Is(err, http.ErrServerClosed) {
+				errChan <- fmt.Errorf("metrics server: %w", err)
+			}
+		}()
+		logger.Info("Serving metrics", "addr", cfg.Stats.MetricsAddr, "pprof", cfg.Stats.Pprof)
+	}
 
 	// Start DNS server (UDP)
 	go func() {
@@ -217,15 +370,111 @@ func main() {
 		}
 	}()
 
-	// Wait for signals or errors
+	// Start encrypted DNS servers if configured
+	if cfg.DNS.DoTListenAddr != "" {
+		go func() {
+			if err := dnsServer.StartDoT(); err != nil {
+				errChan <- fmt.Errorf("DNS server (TLS): %w", err)
+			}
+		}()
+	}
+	if cfg.DNS.DoHListenAddr != "" {
+		go func() {
+			if err := dnsServer.StartDoH(); err != nil {
+				errChan <- fmt.Errorf("DNS server (HTTPS): %w", err)
+			}
+		}()
+	}
+
+	// Tell an upgrading parent, and systemd, that this process is serving.
+	// Inherited sockets are already open here, so queries that arrive
+	// before the listeners above start are queued rather than refused.
+	if handoff != nil {
+		if err := handoff.Ready(); err != nil {
+			logger.Warn("Error reporting readiness to the previous process", "error", err)
+		}
+	}
+	if err := notifySystemd(handoff != nil); err != nil {
+		logger.Warn("Error notifying systemd", "error", err)
+	}
+
+	// reload re-reads the configuration file and applies the settings that
+	// can change while running: the upstreams, the query timeout and the
+	// log level. Other changes take effect on the next restart.
+	reload := func() {
+		newCfg, err := config.Load(*configPath)
+		if err == nil {
+			err = newCfg.Validate()
+		}
+		if err == nil {
+			err = dnsServer.Reconfigure(newCfg.DNS.UpstreamDNS, newCfg.DNS.QueryTimeout.Duration)
+		}
+		if err != nil {
+			logger.Error("Error reloading configuration, keeping the current one", "error", err)
+			return
+		}
+		logLevel.Set(parseLogLevel(newCfg.Logging.Level))
+		logger.Info("Configuration reloaded",
+			"upstreams", newCfg.DNS.UpstreamDNS,
+			"queryTimeout", newCfg.DNS.QueryTimeout.Duration,
+			"logLevel", logLevel.Level(),
+		)
+	}
+
+	// upgrade starts a new instance of the binary that takes over the
+	// listening sockets, the blocklist and the cache, reporting whether it
+	// did. The snapshot file is brought up to date too, for later restarts.
+	upgrade := func() bool {
+		if cfg.API.SnapshotPath != "" {
+			if err := apiClient.SaveSnapshot(cfg.API.SnapshotPath); err != nil {
+				logger.Warn("Error saving blocklist snapshot", "error", err)
+			}
+		}
+		upgradeCtx, upgradeCancel := context.WithTimeout(ctx, upgradeTimeout)
+		defer upgradeCancel()
+		proc, err := dnsServer.Upgrade(upgradeCtx)
+		if err != nil {
+			logger.Error("Error upgrading, continuing to serve", "error", err)
+			return false
+		}
+		logger.Info("New process is serving, shutting down", "pid", proc.Pid)
+		return true
+	}
+
+	// Wait for signals or errors. SIGHUP reloads the configuration and
+	// SIGUSR1 refreshes the blocklist; the listeners stay open for both.
+	// SIGUSR2 hands the listeners to a new process and then shuts down.
 	sigChan := make(chan os.Signal, 1)
-	signal.Notify(sigChan, syscall.SIGINT, syscall.SIGTERM)
+	signal.Notify(sigChan, syscall.SIGINT, syscall.SIGTERM, syscall.SIGHUP, syscall.SIGUSR1, syscall.SIGUSR2)
 
-	select {
-	case sig := <-sigChan:
-		logger.Info("Received signal, shutting down...", "signal", sig)
-	case err := <-errChan:
-		logger.Error("Server error", "error", err)
+wait:
+	for {
+		select {
+		case sig := <-sigChan:
+			switch sig {
+			case syscall.SIGHUP:
+				logger.Info("Received SIGHUP, reloading configuration...")
+				reload()
+				continue
+			case syscall.SIGUSR1:
+				logger.Info("Received SIGUSR1, refreshing blocklist...")
+				select {
+				case refreshNow <- struct{}{}:
+				default: // a refresh is already pending
+				}
+				continue
+			case syscall.SIGUSR2:
+				logger.Info("Received SIGUSR2, upgrading...")
+				if !upgrade() {
+					continue
+				}
+				break wait
+			}
+			logger.Info("Received signal, shutting down...", "signal", sig)
+		case err := <-errChan:
+			logger.Error("Server error", "error", err)
+		}
+		break wait
 	}
 
 	// Cancel context to stop background goroutines
@@ -234,6 +483,86 @@ func main() {
 	// Shutdown servers
 	logger.Info("Stopping servers...")
 	dnsServer.Stop()
+	if metricsServer != nil {
+		shutdownCtx, shutdownCancel := context.WithTimeout(context.Background(), 5*time.Second)
+		metricsServer.Shutdown(shutdownCtx)
+		shutdownCancel()
+	}
+	if reporterDone != nil {
+		<-reporterDone
+	}
 
 	logger.Info("Shutdown complete")
 }
+
+// parseLogLevel maps a logging.level setting to a slog level, defaulting
+// to info.
+func parseLogLevel(level string) slog.Level {
+	switch level {
+	case "debug":
+		return slog.LevelDebug
+	case "warn":
+		return slog.LevelWarn
+	case "error":
+		return slog.LevelError
+	default:
+		return slog.LevelInfo
+	}
+}
+
+// buildPolicies converts the dns.views settings, which Validate has
+// checked, into the server's view table.
+func buildPolicies(cfgViews []config.ViewConfig) (*dns.Policies, error) {
+	views := make([]dns.View, len(cfgViews))
+	for i, v := range cfgViews {
+		mode, err := dns.ParseBlockMode(v.Mode)
+		if err != nil {
+			return nil, err
+		}
+		views[i] = dns.View{
+			Name: v.Name,
+			Mode: mode,
+			TTL:  uint32(v.TTL.Duration / time.Second),
+		}
+		for _, subnet := range v.Subnets {
+			prefix, err := netip.ParsePrefix(subnet)
+			if err != nil {
+				return nil, fmt.Errorf("view %q: %w", v.Name, err)
+			}
+			views[i].Subnets = append(views[i].Subnets, prefix)
+		}
+		if v.RedirectIPv4 != "" {
+			if views[i].RedirectA, err = netip.ParseAddr(v.RedirectIPv4); err != nil {
+				return nil, fmt.Errorf("view %q: %w", v.Name, err)
+			}
+		}
+		if v.RedirectIPv6 != "" {
+			if views[i].RedirectAAAA, err = netip.ParseAddr(v.RedirectIPv6); err != nil {
+				return nil, fmt.Errorf("view %q: %w", v.Name, err)
+			}
+		}
+	}
+	return dns.NewPolicies(views)
+}
+
+// notifySystemd tells systemd, when it started the process with
+// Type=notify, that the server is ready. A process started by an upgrade
+// also reports itself as the service's main process, since its parent is
+// about to exit.
+func notifySystemd(upgraded bool) error {
+	socket := os.Getenv("NOTIFY_SOCKET")
+	if socket == "" {
+		return nil
+	}
+	conn, err := net.DialUnix("unixgram", nil, &net.UnixAddr{Name: socket, Net: "unixgram"})
+	if err != nil {
+		return err
+	}
+	defer conn.Close()
+	state := "READY=1"
+	if upgraded {
+		state += "\nMAINPID=" + strconv.Itoa(os.Getpid())
+	}
+	_, err = conn.Write([]byte(state))
+	return err
+}
@@ -0,0 +1,262 @@
+// Package main provides a load generator for the OPL DNS server. It replays
+// a configurable query mix against a running server and reports throughput
+// and latency percentiles.
+package main
+
+import (
+	"errors"
+	"flag"
+	"fmt"
+	"math"
+	"math/rand"
+	"net"
+	"os"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/miekg/dns"
+)
+
+// mix describes the queries to send.
+type mix struct {
+	zone        string   // parent of the generated allowed names
+	hot         int      // number of distinct names that repeat
+	hitRatio    float64  // fraction of allowed queries for a hot name
+	blocked     []string // blocklisted names to query
+	blockedFrac float64  // fraction of queries for a blocked name
+	qtypes      []uint16 // weighted: one entry per unit of weight
+}
+
+// next returns the name and type of the next query from r. seq makes names
+// that miss the server's cache unique.
+func (m *mix) next(r *rand.Rand, worker int, seq int) (string, uint16) {
+	qtype := m.qtypes[r.Intn(len(m.qtypes))]
+	if len(m.blocked) > 0 && r.Float64() < m.blockedFrac {
+		return dns.Fqdn(m.blocked[r.Intn(len(m.blocked))]), qtype
+	}
+	if m.hot > 0 && r.Float64() < m.hitRatio {
+		return fmt.Sprintf("hot%d.%s.", r.Intn(m.hot), m.zone), qtype
+	}
+	return fmt.Sprintf("u%d-%d.%s.", worker, seq, m.zone), qtype
+}
+
+// parseQtypes parses a weighted type list such as "A:70,AAAA:25,HTTPS:5".
+func parseQtypes(spec string) ([]uint16, error) {
+	var qtypes []uint16
+	for _, part := range strings.Split(spec, ",") {
+		name, weight, found := strings.Cut(strings.TrimSpace(part), ":")
+		qtype, ok := dns.StringToType[strings.ToUpper(name)]
+		if !ok {
+			return nil, fmt.Errorf("unknown query type %q", name)
+		}
+		w := 1
+		if found {
+			var err error
+			if w, err = strconv.Atoi(weight); err != nil || w < 0 {
+				return nil, fmt.Errorf("invalid weight for %s: %q", name, weight)
+			}
+		}
+		for i := 0; i < w; i++ {
+			qtypes = append(qtypes, qtype)
+		}
+	}
+	if len(qtypes) == 0 {
+		return nil, errors.New("no query types")
+	}
+	return qtypes, nil
+}
+
+// result is what one worker measured.
+type result struct {
+	latencies []time.Duration
+	rcodes    map[int]int
+	timeouts  int
+	errors    int
+}
+
+// worker sends queries over one connection until the deadline. With an
+// interval, queries are paced to one per interval and latency is measured
+// from when each query was due rather than when it was sent, so that a
+// stalled server is not hidden by the generator slowing down with it.
+func worker(id int, client *dns.Client, server string, m *mix, seed int64, deadline time.Time, interval time.Duration, res *result) {
+	r := rand.New(rand.NewSource(seed))
+	res.rcodes = make(map[int]int)
+
+	var conn *dns.Conn
+	defer func() {
+		if conn != nil {
+			conn.Close()
+		}
+	}()
+
+	start := time.Now()
+	msg := new(dns.Msg)
+	for seq := 0; ; seq++ {
+		due := time.Now()
+		if interval > 0 {
+			due = start.Add(time.Duration(seq) * interval)
+			if wait := time.Until(due); wait > 0 {
+				time.Sleep(wait)
+			}
+		}
+		if !due.Before(deadline) {
+			return
+		}
+
+		if conn == nil {
+			var err error
+			if conn, err = client.Dial(server); err != nil {
+				res.errors++
+				time.Sleep(10 * time.Millisecond)
+				continue
+			}
+		}
+
+		name, qtype := m.next(r, id, seq)
+		msg.SetQuestion(name, qtype)
+		msg.Id = dns.Id()
+
+		resp, err := exchange(conn, msg, client.Timeout)
+		switch {
+		case err == nil:
+			res.latencies = append(res.latencies, time.Since(due))
+			res.rcodes[resp.Rcode]++
+			continue
+		case isTimeout(err):
+			res.timeouts++
+		default:
+			res.errors++
+		}
+		// Stream connections cannot be resynchronized after a failure
+		if client.Net != "udp" {
+			conn.Close()
+			conn = nil
+		}
+	}
+}
+
+// exchange sends msg and reads replies until the one matching its ID, so
+// that late answers to timed-out UDP queries are skipped.
+func exchange(conn *dns.Conn, msg *dns.Msg, timeout time.Duration) (*dns.Msg, error) {
+	conn.SetDeadline(time.Now().Add(timeout))
+	if err := conn.WriteMsg(msg); err != nil {
+		return nil, err
+	}
+	for {
+		resp, err := conn.ReadMsg()
+		if err != nil {
+			return nil, err
+		}
+		if resp.Id == msg.Id {
+			return resp, nil
+		}
+	}
+}
+
+func isTimeout(err error) bool {
+	var ne net.Error
+	return errors.As(err, &ne) && ne.Timeout()
+}
+
+// percentile returns the p-th quantile of sorted latencies.
+func percentile(sorted []time.Duration, p float64) time.Duration {
+	if len(sorted) == 0 {
+		return 0
+	}
+	i := int(math.Ceil(p*float64(len(sorted)))) - 1
+	return sorted[max(i, 0)]
+}
+
+func main() {
+	server := flag.String("server", "127.0.0.1:53", "Address of the DNS server to load")
+	network := flag.String("net", "udp", "Transport: udp or tcp")
+	duration := flag.Duration("duration", 30*time.Second, "How long to send queries for")
+	concurrency := flag.Int("concurrency", 64, "Number of concurrent clients, each with its own connection")
+	qps := flag.Float64("qps", 0, "Target queries per second across all clients (0 sends as fast as answers arrive)")
+	timeout := flag.Duration("timeout", 2*time.Second, "Time to wait for each answer")
+	zone := flag.String("zone", "loadgen.example", "Parent domain of generated names that are not blocked")
+	hot := flag.Int("hot", 1000, "Number of distinct names that repeat, and so can be answered from the cache")
+	hitRatio := flag.Float64("hit-ratio", 0.8, "Fraction of unblocked queries for a repeating name")
+	blocked := flag.String("blocked", "", "Comma-separated blocklisted names to query")
+	blockedFrac := flag.Float64("blocked-fraction", 0.1, "Fraction of queries for a name from -blocked")
+	qtypes := flag.String("qtypes", "A:70,AAAA:25,HTTPS:5", "Weighted query types")
+	seed := flag.Int64("seed", time.Now().UnixNano(), "Random seed for the query mix")
+	flag.Parse()
+
+	m := &mix{zone: strings.Trim(*zone, "."), hot: *hot, hitRatio: *hitRatio, blockedFrac: *blockedFrac}
+	var err error
+	if m.qtypes, err = parseQtypes(*qtypes); err != nil {
+		fmt.Fprintf(os.Stderr, "Invalid -qtypes: %v\n", err)
+		os.Exit(2)
+	}
+	for _, name := range strings.Split(*blocked, ",") {
+		if name = strings.TrimSpace(name); name != "" {
+			m.blocked = append(m.blocked, name)
+		}
+	}
+	if *network != "udp" && *network != "tcp" {
+		fmt.Fprintf(os.Stderr, "Invalid -net %q: must be udp or tcp\n", *network)
+		os.Exit(2)
+	}
+	if *concurrency <= 0 {
+		fmt.Fprintln(os.Stderr, "-concurrency must be positive")
+		os.Exit(2)
+	}
+
+	var interval time.Duration
+	if *qps > 0 {
+		interval = time.Duration(float64(*concurrency) / *qps * float64(time.Second))
+	}
+
+	client := &dns.Client{Net: *network, Timeout: *timeout, UDPSize: dns.DefaultMsgSize}
+	fmt.Printf("Sending queries to %s over %s for %v with %d clients\n", *server, *network, *duration, *concurrency)
+
+	start := time.Now()
+	deadline := start.Add(*duration)
+	results := make([]result, *concurrency)
+	var wg sync.WaitGroup
+	for i := range results {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			worker(i, client, *server, m, *seed+int64(i), deadline, interval, &results[i])
+		}(i)
+	}
+	wg.Wait()
+	elapsed := time.Since(start)
+
+	var all []time.Duration
+	rcodes := make(map[int]int)
+	timeouts, failures := 0, 0
+	for _, res := range results {
+		all = append(all, res.latencies...)
+		for rcode, n := range res.rcodes {
+			rcodes[rcode] += n
+		}
+		timeouts += res.timeouts
+		failures += res.errors
+	}
+	sort.Slice(all, func(i, j int) bool { return all[i] < all[j] })
+
+	fmt.Printf("answers   %d (%.0f qps)\n", len(all), float64(len(all))/elapsed.Seconds())
+	fmt.Printf("failures  %d timeouts, %d errors\n", timeouts, failures)
+
+	codes := make([]int, 0, len(rcodes))
+	for rcode := range rcodes {
+		codes = append(codes, rcode)
+	}
+	sort.Ints(codes)
+	var parts []string
+	for _, rcode := range codes {
+		parts = append(parts, fmt.Sprintf("%s=%d", dns.RcodeToString[rcode], rcodes[rcode]))
+	}
+	fmt.Printf("rcodes    %s\n", strings.Join(parts, " "))
+
+	if len(all) > 0 {
+		fmt.Printf("latency   p50=%v p90=%v p99=%v p999=%v max=%v\n",
+			percentile(all, 0.50), percentile(all, 0.90), percentile(all, 0.99), percentile(all, 0.999), all[len(all)-1])
+	}
+}
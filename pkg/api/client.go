@@ -3,13 +3,17 @@ package api
 
 import (
 	"context"
-	"encoding/json"
+	"crypto/tls"
 	"fmt"
 	"io"
+	"math"
+	"net"
 	"net/http"
 	"net/url"
+	"slices"
+	"strconv"
 	"strings"
-	"sync"
+	"sync/atomic"
 	"time"
 )
 
@@ -19,23 +23,45 @@ type Client struct {
 	apiKey     string
 	httpClient *http.Client
 
-	// Cached blocklist data
-	mu          sync.RWMutex
-	blocklist   *Blocklist
-	lastFetch   time.Time
-	contentHash string
+	// Cached blocklist data. Each refresh publishes a new immutable
+	// snapshot, so readers need a single atomic load and no locking.
+	blocklist atomic.Pointer[Blocklist]
+
+	// maxAge is the freshness lifetime the API gave its last answer, in
+	// nanoseconds; 0 if it gave none
+	maxAge atomic.Int64
 }
 
 // Blocklist represents the blocklist data from the API.
+// A Blocklist is never modified once it has been published to a Client.
 type Blocklist struct {
 	Version     string
 	GeneratedAt string
 	TotalURLs   int
 	Employers   []Employer
-	BlockList   []BlockListItem
 
-	// Pre-computed domain map for fast lookups
-	domainMap map[string]*BlockListItem
+	// records holds one item per employer action, shared by all of that
+	// employer's patterns. Its URL and Domain fields are empty. Slots of
+	// employers that have since been removed are zero until reused. In a
+	// blocklist set by SetBlocklistForTesting, each item is its own record.
+	// Use Items to list the contents of any blocklist.
+	records []BlockListItem
+
+	// sources records what each employer entry of the API response
+	// contributed, keyed by employer name, so the next refresh can reuse
+	// the entries that have not changed.
+	sources map[string]*employerSource
+
+	// Pre-computed domain index for fast lookups, and the patterns that
+	// are regular expressions, checked when the index has no match
+	index   *domainIndex
+	regexes *regexSet
+
+	// When this snapshot was fetched, and the API content hash and
+	// entity tag it carries
+	fetchedAt   time.Time
+	contentHash string
+	etag        string
 }
 
 // Employer represents an employer in the blocklist.
@@ -60,6 +86,25 @@ type BlockListItem struct {
 	ActionDetails ActionDetails
 }
 
+// employerSource is what one employer entry of the API response added to a
+// blocklist. It is shared by successive blocklists for as long as the
+// entry's JSON stays the same.
+type employerSource struct {
+	hash     uint64
+	record   int32
+	employer Employer
+	patterns []blockPattern
+}
+
+// blockPattern is one blocked URL pattern and either the domain it blocks
+// or, for patterns that are regular expressions, the expression host names
+// must match.
+type blockPattern struct {
+	URL    string
+	Domain string
+	Expr   string
+}
+
 // ActionDetails provides detailed information about the labor action.
 type ActionDetails struct {
 	ID           string `json:"id"`
@@ -90,22 +135,45 @@ func NewClient(baseURL, apiKey string, timeout time.Duration) *Client {
 		baseURL: strings.TrimSuffix(baseURL, "/"),
 		apiKey:  apiKey,
 		httpClient: &http.Client{
-			Timeout: timeout,
+			Timeout:   timeout,
+			Transport: newTransport(timeout),
+		},
+	}
+}
+
+// newTransport returns the HTTP transport for API requests. Requests are
+// minutes apart, so the idle connection is rarely still open for the next
+// one; the TLS session cache lets the new connection resume the session
+// instead of doing a full handshake. Responses are requested with gzip
+// and decompressed transparently.
+func newTransport(timeout time.Duration) *http.Transport {
+	return &http.Transport{
+		Proxy: http.ProxyFromEnvironment,
+		DialContext: (&net.Dialer{
+			Timeout:   timeout,
+			KeepAlive: 30 * time.Second,
+		}).DialContext,
+		TLSClientConfig: &tls.Config{
+			ClientSessionCache: tls.NewLRUClientSessionCache(0),
+			MinVersion:         tls.VersionTLS12,
 		},
+		ForceAttemptHTTP2:   true,
+		MaxIdleConns:        2,
+		IdleConnTimeout:     90 * time.Second,
+		TLSHandshakeTimeout: timeout,
 	}
 }
 
-// FetchBlocklist fetches the blocklist from the API.
+// FetchBlocklist fetches the blocklist from the API. The request is
+// conditional on the current blocklist's content hash and entity tag, and
+// returns the current blocklist if the API reports it unchanged.
 func (c *Client) FetchBlocklist(ctx context.Context) (*Blocklist, error) {
 	reqURL := fmt.Sprintf("%s/blocklist.json", c.baseURL)
 
 	// Add hash for conditional fetch if we have cached data
-	c.mu.RLock()
-	hash := c.contentHash
-	c.mu.RUnlock()
-
-	if hash != "" {
-		reqURL = fmt.Sprintf("%s?hash=%s", reqURL, url.QueryEscape(hash))
+	current := c.blocklist.Load()
+	if current != nil && current.contentHash != "" {
+		reqURL = fmt.Sprintf("%s?hash=%s", reqURL, url.QueryEscape(current.contentHash))
 	}
 
 	req, err := http.NewRequestWithContext(ctx, http.MethodGet, reqURL, nil)
@@ -118,6 +186,9 @@ func (c *Client) FetchBlocklist(ctx context.Context) (*Blocklist, error) {
 	}
 	req.Header.Set("Accept", "application/json")
 	req.Header.Set("User-Agent", "OPL-DNS-Server/1.0.0")
+	if current != nil && current.etag != "" {
+		req.Header.Set("If-None-Match", current.etag)
+	}
 
 	resp, err := c.httpClient.Do(req)
 	if err != nil {
@@ -127,9 +198,8 @@ func (c *Client) FetchBlocklist(ctx context.Context) (*Blocklist, error) {
 
 	// Handle 304 Not Modified
 	if resp.StatusCode == http.StatusNotModified {
-		c.mu.RLock()
-		defer c.mu.RUnlock()
-		return c.blocklist, nil
+		c.maxAge.Store(int64(parseMaxAge(resp.Header.Get("Cache-Control"))))
+		return current, nil
 	}
 
 	if resp.StatusCode != http.StatusOK {
@@ -137,157 +207,123 @@ func (c *Client) FetchBlocklist(ctx context.Context) (*Blocklist, error) {
 		return nil, fmt.Errorf("API returned status %d: %s", resp.StatusCode, string(body))
 	}
 
-	body, err := io.ReadAll(resp.Body)
-	if err != nil {
-		return nil, fmt.Errorf("reading response: %w", err)
-	}
-
 	// Parse the OPL blocklist format (map keyed by employer name)
-	var rawBlocklist map[string]json.RawMessage
-	if err := json.Unmarshal(body, &rawBlocklist); err != nil {
+	blocklist, err := decodeBlocklist(resp.Body, current)
+	if err != nil {
 		return nil, fmt.Errorf("parsing response: %w", err)
 	}
 
-	blocklist := &Blocklist{
-		GeneratedAt: time.Now().Format(time.RFC3339),
-		domainMap:   make(map[string]*BlockListItem),
+	blocklist.fetchedAt = time.Now()
+	blocklist.contentHash = resp.Header.Get("X-Content-Hash")
+	if blocklist.contentHash == "" && current != nil {
+		blocklist.contentHash = current.contentHash
 	}
+	blocklist.etag = resp.Header.Get("ETag")
 
-	employerSet := make(map[string]bool)
-
-	for employerName, rawEntry := range rawBlocklist {
-		// Skip internal fields like _optimizedPatterns
-		if strings.HasPrefix(employerName, "_") {
-			continue
-		}
-
-		var entry OPLBlocklistEntry
-		if err := json.Unmarshal(rawEntry, &entry); err != nil {
-			// Skip entries that don't match expected format
-			continue
-		}
-
-		// Add employer to set
-		if !employerSet[employerName] {
-			employerSet[employerName] = true
-			blocklist.Employers = append(blocklist.Employers, Employer{
-				ID:       entry.ActionDetails.ID,
-				Name:     employerName,
-				URLCount: len(entry.MatchingURLRegexes),
-			})
-		}
-
-		// Add each URL/domain to the blocklist
-		for _, urlPattern := range entry.MatchingURLRegexes {
-			domain := extractDomain(urlPattern)
-			if domain == "" {
-				continue
-			}
+	// Publish the new snapshot
+	c.blocklist.Store(blocklist)
+	c.maxAge.Store(int64(parseMaxAge(resp.Header.Get("Cache-Control"))))
 
-			item := BlockListItem{
-				URL:         urlPattern,
-				Domain:      domain,
-				Employer:    employerName,
-				EmployerID:  entry.ActionDetails.ID,
-				Reason:      entry.ActionDetails.ActionType,
-				StartDate:   entry.ActionDetails.StartDate,
-				MoreInfoURL: entry.MoreInfoURL,
-				Location:    entry.ActionDetails.Location,
-				ActionDetails: ActionDetails{
-					ID:           entry.ActionDetails.ID,
-					Organization: entry.ActionDetails.Organization,
-					ActionType:   entry.ActionDetails.ActionType,
-					Status:       entry.ActionDetails.Status,
-					StartDate:    entry.ActionDetails.StartDate,
-					Description:  entry.ActionDetails.Description,
-					Demands:      entry.ActionDetails.Demands,
-					Location:     entry.ActionDetails.Location,
-					UnionLogoURL: entry.ActionDetails.UnionLogoURL,
-					LearnMoreURL: entry.ActionDetails.LearnMoreURL,
-				},
-			}
-
-			blocklist.BlockList = append(blocklist.BlockList, item)
-			blocklist.TotalURLs++
+	return blocklist, nil
+}
 
-			// Add to domain map for fast lookup
-			normalizedDomain := strings.ToLower(domain)
-			blocklist.domainMap[normalizedDomain] = &blocklist.BlockList[len(blocklist.BlockList)-1]
-		}
+// Items returns one item per blocked URL pattern, with its URL and Domain
+// set, ordered by employer name. Fetched blocklists share one record per
+// employer, so for them Items allocates, fills and sorts the whole list on
+// every call; it is meant for status output and tests, not for the query
+// path, which uses Client.CheckDomain. The items of a blocklist set by
+// SetBlocklistForTesting are returned as they are and must not be modified.
+func (b *Blocklist) Items() []BlockListItem {
+	if b.sources == nil {
+		return b.records
 	}
-
-	// Update cache
-	c.mu.Lock()
-	c.blocklist = blocklist
-	c.lastFetch = time.Now()
-	if newHash := resp.Header.Get("X-Content-Hash"); newHash != "" {
-		c.contentHash = newHash
+	sources := make([]*employerSource, 0, len(b.sources))
+	for _, src := range b.sources {
+		sources = append(sources, src)
 	}
-	c.mu.Unlock()
-
-	return blocklist, nil
+	slices.SortFunc(sources, func(x, y *employerSource) int {
+		return strings.Compare(x.employer.Name, y.employer.Name)
+	})
+
+	items := make([]BlockListItem, 0, b.TotalURLs)
+	for _, src := range sources {
+		for _, p := range src.patterns {
+			item := b.records[src.record]
+			item.URL, item.Domain = p.URL, p.Domain
+			items = append(items, item)
+		}
+	}
+	return items
 }
 
 // GetCachedBlocklist returns the cached blocklist without making an API request.
 func (c *Client) GetCachedBlocklist() *Blocklist {
-	c.mu.RLock()
-	defer c.mu.RUnlock()
-	return c.blocklist
+	return c.blocklist.Load()
 }
 
-// CheckDomain checks if a domain is in the blocklist.
+// CheckDomain checks if a domain is in the blocklist. The returned item
+// describes the employer and labor action and is shared by every domain
+// blocked for that action, so it must not be modified. For fetched
+// blocklists its URL and Domain fields are empty. CheckDomain does not
+// retain domain. Names found in the domain index and names blocked by no
+// pattern are checked without allocating; a name blocked by a regular
+// pattern may cost one allocation (see regexSet.match).
 func (c *Client) CheckDomain(domain string) (*BlockListItem, bool) {
-	c.mu.RLock()
-	defer c.mu.RUnlock()
-
-	if c.blocklist == nil || c.blocklist.domainMap == nil {
+	blocklist := c.blocklist.Load()
+	if blocklist == nil || blocklist.index == nil {
 		return nil, false
 	}
 
-	// Normalize domain
-	domain = strings.ToLower(strings.TrimSuffix(domain, "."))
-
-	// Direct lookup
-	if item, ok := c.blocklist.domainMap[domain]; ok {
+	// Matches the domain itself or a parent domain (e.g., if "www.example.com"
+	// is not found, "example.com" is checked), ignoring case and trailing dots
+	if item, ok := blocklist.index.lookup(domain); ok {
 		return item, true
 	}
-
-	// Check parent domains (e.g., if "www.example.com" is not found, check "example.com")
-	parts := strings.Split(domain, ".")
-	for i := 1; i < len(parts)-1; i++ {
-		parentDomain := strings.Join(parts[i:], ".")
-		if item, ok := c.blocklist.domainMap[parentDomain]; ok {
-			return item, true
+	if blocklist.regexes != nil {
+		if record, ok := blocklist.regexes.match(domain); ok {
+			return &blocklist.records[record], true
 		}
 	}
-
 	return nil, false
 }
 
 // LastFetchTime returns the time of the last successful blocklist fetch.
 func (c *Client) LastFetchTime() time.Time {
-	c.mu.RLock()
-	defer c.mu.RUnlock()
-	return c.lastFetch
+	blocklist := c.blocklist.Load()
+	if blocklist == nil {
+		return time.Time{}
+	}
+	return blocklist.fetchedAt
+}
+
+// SetBlocklistForTesting publishes a blocklist of the given items (for
+// testing purposes). Each item becomes its own record, blocking the domain
+// of its URL.
+func (c *Client) SetBlocklistForTesting(items []BlockListItem) {
+	c.blocklist.Store(&Blocklist{
+		records:   items,
+		index:     newDomainIndex(items),
+		fetchedAt: time.Now(),
+	})
 }
 
-// SetBlocklistForTesting sets the blocklist directly (for testing purposes).
-func (c *Client) SetBlocklistForTesting(blocklist *Blocklist) {
-	c.mu.Lock()
-	defer c.mu.Unlock()
-
-	// Build domain map
-	blocklist.domainMap = make(map[string]*BlockListItem)
-	for i := range blocklist.BlockList {
-		item := &blocklist.BlockList[i]
-		domain := extractDomain(item.URL)
-		if domain != "" {
-			blocklist.domainMap[strings.ToLower(domain)] = item
+// parseMaxAge returns the max-age of a Cache-Control header, or 0 if it has
+// none or forbids reuse with no-cache or no-store.
+func parseMaxAge(cacheControl string) time.Duration {
+	var maxAge time.Duration
+	for _, directive := range strings.Split(cacheControl, ",") {
+		name, value, _ := strings.Cut(strings.TrimSpace(directive), "=")
+		switch strings.ToLower(name) {
+		case "no-cache", "no-store":
+			return 0
+		case "max-age":
+			secs, err := strconv.ParseInt(strings.Trim(value, `"`), 10, 64)
+			if err == nil && secs > 0 && secs < math.MaxInt64/int64(time.Second) {
+				maxAge = time.Duration(secs) * time.Second
+			}
 		}
 	}
-
-	c.blocklist = blocklist
-	c.lastFetch = time.Now()
+	return maxAge
 }
 
 // extractDomain extracts the domain from a URL.
@@ -1,10 +1,12 @@
 package api
 
 import (
+	"bytes"
 	"context"
 	"encoding/json"
 	"net/http"
 	"net/http/httptest"
+	"sync/atomic"
 	"testing"
 	"time"
 )
@@ -72,12 +74,28 @@ func TestFetchBlocklist(t *testing.T) {
 	if blocklist.TotalURLs != 2 {
 		t.Errorf("Expected 2 total URLs, got %d", blocklist.TotalURLs)
 	}
-	if len(blocklist.BlockList) != 2 {
-		t.Errorf("Expected 2 blocklist items, got %d", len(blocklist.BlockList))
+	if n := blocklist.index.len(); n != 2 {
+		t.Errorf("Expected 2 indexed domains, got %d", n)
+	}
+	if len(blocklist.records) != 1 {
+		t.Errorf("Expected 1 shared employer record, got %d", len(blocklist.records))
 	}
 	if len(blocklist.Employers) != 1 {
 		t.Errorf("Expected 1 employer, got %d", len(blocklist.Employers))
 	}
+
+	items := blocklist.Items()
+	if len(items) != 2 {
+		t.Fatalf("Expected 2 items, got %d", len(items))
+	}
+	for i, want := range []string{"example.com", "test.example.com"} {
+		if items[i].URL != want || items[i].Domain != want {
+			t.Errorf("Item %d: expected URL and domain %q, got %q and %q", i, want, items[i].URL, items[i].Domain)
+		}
+		if items[i].Employer != "Test Corp" || items[i].ActionDetails.ActionType != "strike" {
+			t.Errorf("Item %d: expected employer details, got %+v", i, items[i])
+		}
+	}
 }
 
 func TestFetchBlocklistNotModified(t *testing.T) {
@@ -123,6 +141,98 @@ func TestFetchBlocklistNotModified(t *testing.T) {
 	}
 }
 
+func TestFetchBlocklistKeepsSnapshotConsistent(t *testing.T) {
+	server := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		if r.URL.Query().Get("hash") != "" {
+			t.Errorf("Expected no hash on first fetch, got %q", r.URL.Query().Get("hash"))
+		}
+		w.Header().Set("X-Content-Hash", "hash123")
+		json.NewEncoder(w).Encode(map[string]OPLBlocklistEntry{
+			"Test": {MatchingURLRegexes: []string{"example.com"}},
+		})
+	}))
+	defer server.Close()
+
+	client := NewClient(server.URL, "", 10*time.Second)
+	blocklist, err := client.FetchBlocklist(context.Background())
+	if err != nil {
+		t.Fatalf("FetchBlocklist failed: %v", err)
+	}
+
+	if client.GetCachedBlocklist() != blocklist {
+		t.Error("Expected fetched blocklist to be the published snapshot")
+	}
+	if !client.LastFetchTime().Equal(blocklist.fetchedAt) {
+		t.Error("Expected LastFetchTime to come from the published snapshot")
+	}
+	if blocklist.contentHash != "hash123" {
+		t.Errorf("Expected content hash 'hash123', got %q", blocklist.contentHash)
+	}
+}
+
+func TestFetchBlocklistETag(t *testing.T) {
+	var requests atomic.Int32
+	server := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		requests.Add(1)
+		if r.Header.Get("If-None-Match") == `"v1"` {
+			w.Header().Set("Cache-Control", "max-age=1800")
+			w.WriteHeader(http.StatusNotModified)
+			return
+		}
+		w.Header().Set("ETag", `"v1"`)
+		json.NewEncoder(w).Encode(map[string]OPLBlocklistEntry{
+			"Test": {MatchingURLRegexes: []string{"example.com"}},
+		})
+	}))
+	defer server.Close()
+
+	client := NewClient(server.URL, "", 10*time.Second)
+	first, err := client.FetchBlocklist(context.Background())
+	if err != nil {
+		t.Fatalf("First fetch failed: %v", err)
+	}
+	if first.etag != `"v1"` {
+		t.Errorf("Expected entity tag %q, got %q", `"v1"`, first.etag)
+	}
+
+	second, err := client.FetchBlocklist(context.Background())
+	if err != nil {
+		t.Fatalf("Second fetch failed: %v", err)
+	}
+	if second != first {
+		t.Error("Expected 304 to keep the current blocklist")
+	}
+	if got := time.Duration(client.maxAge.Load()); got != 30*time.Minute {
+		t.Errorf("Expected max-age of 30m, got %v", got)
+	}
+	if requests.Load() != 2 {
+		t.Errorf("Expected 2 requests, got %d", requests.Load())
+	}
+}
+
+func TestParseMaxAge(t *testing.T) {
+	tests := []struct {
+		header string
+		want   time.Duration
+	}{
+		{"", 0},
+		{"max-age=600", 10 * time.Minute},
+		{"public, Max-Age=60", time.Minute},
+		{`max-age="120"`, 2 * time.Minute},
+		{"max-age=600, no-cache", 0},
+		{"no-store", 0},
+		{"max-age=-1", 0},
+		{"max-age=abc", 0},
+		{"max-age=99999999999999999", 0},
+	}
+
+	for _, tt := range tests {
+		if got := parseMaxAge(tt.header); got != tt.want {
+			t.Errorf("parseMaxAge(%q) = %v, want %v", tt.header, got, tt.want)
+		}
+	}
+}
+
 func TestFetchBlocklistError(t *testing.T) {
 	server := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
 		w.WriteHeader(http.StatusInternalServerError)
@@ -140,22 +250,11 @@ func TestFetchBlocklistError(t *testing.T) {
 func TestCheckDomain(t *testing.T) {
 	// Setup client with mock blocklist
 	client := NewClient("https://api.example.com", "", 10*time.Second)
-	client.blocklist = &Blocklist{
-		BlockList: []BlockListItem{
-			{URL: "https://example.com", Employer: "Test Corp"},
-			{URL: "https://www.blocked.com", Employer: "Another Corp"},
-			{URL: "facebook.com/testcorp", Employer: "Test Corp"},
-		},
-	}
-	// Build domain map
-	client.blocklist.domainMap = make(map[string]*BlockListItem)
-	for i := range client.blocklist.BlockList {
-		item := &client.blocklist.BlockList[i]
-		domain := extractDomain(item.URL)
-		if domain != "" {
-			client.blocklist.domainMap[domain] = item
-		}
-	}
+	client.SetBlocklistForTesting([]BlockListItem{
+		{URL: "https://example.com", Employer: "Test Corp"},
+		{URL: "https://www.blocked.com", Employer: "Another Corp"},
+		{URL: "facebook.com/testcorp", Employer: "Test Corp"},
+	})
 
 	tests := []struct {
 		domain   string
@@ -184,6 +283,47 @@ func TestCheckDomain(t *testing.T) {
 	}
 }
 
+// BenchmarkCheckDomain measures CheckDomain against a 100k-entry blocklist,
+// as called from ServeDNS for every A and AAAA query.
+func BenchmarkCheckDomain(b *testing.B) {
+	blocklist, err := decodeBlocklist(bytes.NewReader(syntheticBlocklist(1000, 100000)), nil)
+	if err != nil {
+		b.Fatal(err)
+	}
+	client := NewClient("https://api.example.com", "", 10*time.Second)
+	client.blocklist.Store(blocklist)
+
+	for _, bm := range []struct {
+		name   string
+		domain string
+	}{
+		{"Hit", "d4242.example.com"},
+		{"SubdomainHit", "www.cdn.d4242.example.com"},
+		{"Miss", "www.unrelated.example.org"},
+		{"MixedCaseMiss", "WWW.Unrelated.Example.ORG"},
+	} {
+		b.Run(bm.name, func(b *testing.B) {
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				client.CheckDomain(bm.domain)
+			}
+		})
+	}
+
+	b.Run("Parallel", func(b *testing.B) {
+		b.ReportAllocs()
+		b.RunParallel(func(pb *testing.PB) {
+			for i := 0; pb.Next(); i++ {
+				if i&1 == 0 {
+					client.CheckDomain("www.cdn.d4242.example.com")
+				} else {
+					client.CheckDomain("www.unrelated.example.org")
+				}
+			}
+		})
+	})
+}
+
 func TestCheckDomainNoBlocklist(t *testing.T) {
 	client := NewClient("https://api.example.com", "", 10*time.Second)
 	// No blocklist loaded
@@ -226,7 +366,7 @@ func TestGetCachedBlocklist(t *testing.T) {
 	}
 
 	// Set blocklist
-	client.blocklist = &Blocklist{Version: "1.0"}
+	client.blocklist.Store(&Blocklist{Version: "1.0"})
 
 	// Should return cached
 	if client.GetCachedBlocklist() == nil {
@@ -247,7 +387,7 @@ func TestLastFetchTime(t *testing.T) {
 
 	// Set last fetch time
 	now := time.Now()
-	client.lastFetch = now
+	client.blocklist.Store(&Blocklist{fetchedAt: now})
 
 	if !client.LastFetchTime().Equal(now) {
 		t.Error("Expected last fetch time to match")
@@ -0,0 +1,269 @@
+package api
+
+import (
+	"encoding/json"
+	"fmt"
+	"hash/fnv"
+	"io"
+	"slices"
+	"strings"
+	"time"
+)
+
+// decodeBlocklist parses the OPL blocklist format, a JSON object keyed by
+// employer name, straight from r. Only one employer entry is held in
+// decoded form at a time.
+//
+// Each employer's details are stored once, as a record shared by all of its
+// patterns, instead of being copied into every pattern's item. Patterns
+// that name a host go into the domain index; the ones that are regular
+// expressions are compiled into a regexSet.
+//
+// When prev is a blocklist decoded earlier, the new one is built as a diff
+// against it: employer entries whose JSON is byte-for-byte unchanged are
+// reused without being unmarshaled, and only the index shards holding
+// domains of added, changed or removed employers are copied and patched.
+// prev itself is not modified.
+func decodeBlocklist(r io.Reader, prev *Blocklist) (*Blocklist, error) {
+	dec := json.NewDecoder(r)
+
+	if err := expectDelim(dec, '{'); err != nil {
+		return nil, err
+	}
+
+	var prevSources map[string]*employerSource
+	var prevIndex *domainIndex
+	var records []BlockListItem
+	if prev != nil && prev.sources != nil {
+		prevSources = prev.sources
+		prevIndex = prev.index
+		records = slices.Clone(prev.records)
+	}
+	// The regular patterns are recompiled only when an employer that has
+	// some is added, changed or removed.
+	regexChanged := false
+	free := freeRecords(records, prevSources)
+
+	blocklist := &Blocklist{
+		GeneratedAt: time.Now().Format(time.RFC3339),
+		sources:     make(map[string]*employerSource, len(prevSources)),
+	}
+	index := newIndexBuilder(prevIndex)
+
+	for dec.More() {
+		tok, err := dec.Token()
+		if err != nil {
+			return nil, err
+		}
+		employerName, ok := tok.(string)
+		if !ok {
+			return nil, fmt.Errorf("unexpected token %v", tok)
+		}
+
+		// Internal fields like _optimizedPatterns are not employers. They
+		// list the patterns, so their size is a good capacity hint when
+		// building from scratch.
+		if strings.HasPrefix(employerName, "_") {
+			n, err := skipValue(dec)
+			if err != nil {
+				return nil, err
+			}
+			if prevIndex == nil {
+				index.presize(n)
+			}
+			continue
+		}
+
+		var raw json.RawMessage
+		if err := dec.Decode(&raw); err != nil {
+			return nil, err
+		}
+		hash := hashEntry(raw)
+
+		old := prevSources[employerName]
+		if _, dup := blocklist.sources[employerName]; dup {
+			// A repeated key replaces the entry decoded earlier in this
+			// response, like it would in a map.
+			old = blocklist.sources[employerName]
+		} else if old != nil && old.hash == hash {
+			blocklist.sources[employerName] = old
+			continue
+		}
+
+		var entry OPLBlocklistEntry
+		if err := json.Unmarshal(raw, &entry); err != nil {
+			// Skip entries that don't match expected format
+			continue
+		}
+
+		src := &employerSource{
+			hash: hash,
+			employer: Employer{
+				ID:       entry.ActionDetails.ID,
+				Name:     employerName,
+				URLCount: len(entry.MatchingURLRegexes),
+			},
+			patterns: make([]blockPattern, 0, len(entry.MatchingURLRegexes)),
+		}
+		item := BlockListItem{
+			Employer:      employerName,
+			EmployerID:    entry.ActionDetails.ID,
+			Reason:        entry.ActionDetails.ActionType,
+			StartDate:     entry.ActionDetails.StartDate,
+			MoreInfoURL:   entry.MoreInfoURL,
+			Location:      entry.ActionDetails.Location,
+			ActionDetails: entry.ActionDetails,
+		}
+
+		// A changed employer keeps its record slot; its old domains are
+		// withdrawn before the new ones are added.
+		if old != nil {
+			regexChanged = regexChanged || old.hasRegex()
+			src.record = old.record
+			for _, p := range old.patterns {
+				index.remove(p.Domain, old.record)
+			}
+		} else if len(free) > 0 {
+			src.record, free = free[len(free)-1], free[:len(free)-1]
+		} else {
+			src.record = int32(len(records))
+			records = append(records, BlockListItem{})
+		}
+		records[src.record] = item
+
+		// Add each URL/domain to the index; regular patterns are compiled
+		// once all entries are in
+		for _, urlPattern := range entry.MatchingURLRegexes {
+			domain, expr := classifyPattern(urlPattern)
+			if domain == "" && expr == "" {
+				continue
+			}
+			index.add(domain, src.record)
+			src.patterns = append(src.patterns, blockPattern{URL: urlPattern, Domain: domain, Expr: expr})
+		}
+		regexChanged = regexChanged || src.hasRegex()
+		blocklist.sources[employerName] = src
+	}
+
+	if err := expectDelim(dec, '}'); err != nil {
+		return nil, err
+	}
+
+	// Withdraw employers that are no longer listed
+	for name, old := range prevSources {
+		if _, ok := blocklist.sources[name]; ok {
+			continue
+		}
+		for _, p := range old.patterns {
+			index.remove(p.Domain, old.record)
+		}
+		records[old.record] = BlockListItem{}
+		regexChanged = regexChanged || old.hasRegex()
+	}
+
+	blocklist.records = records
+	blocklist.index = index.finish(records)
+	if regexChanged {
+		blocklist.regexes = newRegexSet(blocklist.sources)
+	} else if prevSources != nil {
+		blocklist.regexes = prev.regexes
+	}
+	blocklist.fillFromSources()
+	return blocklist, nil
+}
+
+// fillFromSources sets the exported summary fields from b.sources.
+func (b *Blocklist) fillFromSources() {
+	b.Employers = make([]Employer, 0, len(b.sources))
+	b.TotalURLs = 0
+	for _, src := range b.sources {
+		b.Employers = append(b.Employers, src.employer)
+		b.TotalURLs += len(src.patterns)
+	}
+	slices.SortFunc(b.Employers, func(a, b Employer) int { return strings.Compare(a.Name, b.Name) })
+}
+
+// hasRegex reports whether any of the source's patterns is a regular
+// expression.
+func (s *employerSource) hasRegex() bool {
+	for _, p := range s.patterns {
+		if p.Expr != "" {
+			return true
+		}
+	}
+	return false
+}
+
+// freeRecords returns the record slots not used by any source.
+func freeRecords(records []BlockListItem, sources map[string]*employerSource) []int32 {
+	used := make([]bool, len(records))
+	for _, src := range sources {
+		used[src.record] = true
+	}
+	var free []int32
+	for i := len(used) - 1; i >= 0; i-- {
+		if !used[i] {
+			free = append(free, int32(i))
+		}
+	}
+	return free
+}
+
+// hashEntry fingerprints an employer entry's JSON. It is stable across
+// processes, so fingerprints can be stored in snapshots.
+func hashEntry(raw []byte) uint64 {
+	h := fnv.New64a()
+	h.Write(raw)
+	return h.Sum64()
+}
+
+func expectDelim(dec *json.Decoder, want json.Delim) error {
+	tok, err := dec.Token()
+	if err != nil {
+		return err
+	}
+	if d, ok := tok.(json.Delim); !ok || d != want {
+		return fmt.Errorf("expected %v, got %v", want, tok)
+	}
+	return nil
+}
+
+// skipValue consumes the next JSON value and returns how many elements or
+// members it has when it is an array or object. It reads the value token
+// by token, so a large value such as _optimizedPatterns is never buffered
+// whole.
+func skipValue(dec *json.Decoder) (int, error) {
+	tok, err := dec.Token()
+	if err != nil {
+		return 0, err
+	}
+	open, ok := tok.(json.Delim)
+	if !ok {
+		return 0, nil
+	}
+
+	// Count the values that start at depth 1. In an object the member
+	// names are among them, two tokens per member.
+	n, depth := 0, 1
+	for depth > 0 {
+		tok, err := dec.Token()
+		if err != nil {
+			return 0, err
+		}
+		d, isDelim := tok.(json.Delim)
+		if isDelim && (d == ']' || d == '}') {
+			depth--
+			continue
+		}
+		if depth == 1 {
+			n++
+		}
+		if isDelim {
+			depth++
+		}
+	}
+	if open == '{' {
+		n /= 2
+	}
+	return n, nil
+}
@@ -0,0 +1,319 @@
+package api
+
+import (
+	"bytes"
+	"encoding/json"
+	"fmt"
+	"strings"
+	"testing"
+	"time"
+)
+
+func TestDecodeBlocklist(t *testing.T) {
+	body := `{
+		"_optimizedPatterns": ["example.com", "shop.example.com", "other.org"],
+		"Test Corp": {
+			"moreInfoUrl": "https://union.org",
+			"matchingUrlRegexes": ["example.com", "https://shop.example.com/path"],
+			"actionDetails": {"id": "emp-1", "actionType": "strike", "location": "Detroit"}
+		},
+		"Broken Corp": {"matchingUrlRegexes": "not-a-list"},
+		"Other Inc": {
+			"matchingUrlRegexes": ["other.org"],
+			"actionDetails": {"id": "emp-2", "actionType": "boycott"}
+		}
+	}`
+
+	blocklist, err := decodeBlocklist(strings.NewReader(body), nil)
+	if err != nil {
+		t.Fatalf("decodeBlocklist failed: %v", err)
+	}
+
+	if blocklist.TotalURLs != 3 {
+		t.Errorf("Expected 3 total URLs, got %d", blocklist.TotalURLs)
+	}
+	if len(blocklist.Employers) != 2 {
+		t.Errorf("Expected 2 employers (malformed entry skipped), got %d", len(blocklist.Employers))
+	}
+	if len(blocklist.records) != 2 {
+		t.Errorf("Expected one record per employer, got %d", len(blocklist.records))
+	}
+
+	item, ok := blocklist.index.lookup("www.shop.example.com")
+	if !ok {
+		t.Fatal("Expected www.shop.example.com to match")
+	}
+	if item.Employer != "Test Corp" || item.Location != "Detroit" {
+		t.Errorf("Unexpected item %+v", item)
+	}
+	if other, _ := blocklist.index.lookup("example.com"); other != item {
+		t.Error("Expected an employer's patterns to share one record")
+	}
+	if item, ok := blocklist.index.lookup("other.org"); !ok || item.ActionDetails.ActionType != "boycott" {
+		t.Errorf("Expected other.org to match the Other Inc entry, got %+v", item)
+	}
+}
+
+func TestDecodeBlocklistDiff(t *testing.T) {
+	v1 := `{
+		"A": {"matchingUrlRegexes": ["a.com", "b.com"], "actionDetails": {"actionType": "strike"}},
+		"B": {"matchingUrlRegexes": ["c.com"], "actionDetails": {"actionType": "strike"}},
+		"C": {"matchingUrlRegexes": ["shared.com"], "actionDetails": {"actionType": "boycott"}},
+		"D": {"matchingUrlRegexes": ["shared.com", "d.com"], "actionDetails": {"actionType": "lockout"}}
+	}`
+	v2 := `{
+		"A": {"matchingUrlRegexes": ["a.com", "b.com"], "actionDetails": {"actionType": "strike"}},
+		"B": {"matchingUrlRegexes": ["c2.com"], "actionDetails": {"actionType": "picket"}},
+		"C": {"matchingUrlRegexes": ["shared.com"], "actionDetails": {"actionType": "boycott"}},
+		"E": {"matchingUrlRegexes": ["e.com"], "actionDetails": {"actionType": "strike"}}
+	}`
+
+	prev, err := decodeBlocklist(strings.NewReader(v1), nil)
+	if err != nil {
+		t.Fatalf("decodeBlocklist v1 failed: %v", err)
+	}
+	next, err := decodeBlocklist(strings.NewReader(v2), prev)
+	if err != nil {
+		t.Fatalf("decodeBlocklist v2 failed: %v", err)
+	}
+
+	if next.sources["A"] != prev.sources["A"] || next.sources["C"] != prev.sources["C"] {
+		t.Error("Expected unchanged employers to be reused")
+	}
+	if next.sources["B"].record != prev.sources["B"].record {
+		t.Error("Expected a changed employer to keep its record slot")
+	}
+	if next.TotalURLs != 5 || len(next.Employers) != 4 {
+		t.Errorf("Expected 5 URLs from 4 employers, got %d from %d", next.TotalURLs, len(next.Employers))
+	}
+
+	// Only the shards of the five domains B, D and E added or withdrew may
+	// have been copied.
+	shared, populated := 0, 0
+	for i := range prev.index.shards {
+		if prev.index.shards[i] == nil {
+			continue
+		}
+		populated++
+		if fmt.Sprintf("%p", next.index.shards[i]) == fmt.Sprintf("%p", prev.index.shards[i]) {
+			shared++
+		}
+	}
+	if shared < populated-5 {
+		t.Errorf("Expected untouched shards to be shared, only %d of %d were", shared, populated)
+	}
+
+	tests := []struct {
+		list   *Blocklist
+		domain string
+		action string
+	}{
+		{next, "a.com", "strike"},
+		{next, "c.com", ""},
+		{next, "c2.com", "picket"},
+		{next, "shared.com", "boycott"}, // D withdrew, C still claims it
+		{next, "d.com", ""},
+		{next, "e.com", "strike"},
+		{prev, "c.com", "strike"}, // the previous version is unchanged
+		{prev, "shared.com", "lockout"},
+		{prev, "e.com", ""},
+	}
+	for _, tt := range tests {
+		item, ok := tt.list.index.lookup(tt.domain)
+		if got := ""; ok {
+			got = item.ActionDetails.ActionType
+			if got != tt.action {
+				t.Errorf("lookup(%q): expected action %q, got %q", tt.domain, tt.action, got)
+			}
+		} else if tt.action != "" {
+			t.Errorf("lookup(%q): expected action %q, got no match", tt.domain, tt.action)
+		}
+	}
+
+	// A later refresh fills the slot D left behind.
+	v3 := strings.Replace(v2, `"E":`, `"F": {"matchingUrlRegexes": ["f.com"]}, "E":`, 1)
+	third, err := decodeBlocklist(strings.NewReader(v3), next)
+	if err != nil {
+		t.Fatalf("decodeBlocklist v3 failed: %v", err)
+	}
+	if got, want := third.sources["F"].record, prev.sources["D"].record; got != want {
+		t.Errorf("Expected F to reuse record slot %d, got %d", want, got)
+	}
+	if len(third.records) != len(next.records) {
+		t.Errorf("Expected no new record slots, got %d (was %d)", len(third.records), len(next.records))
+	}
+}
+
+func TestDecodeBlocklistRegexPatterns(t *testing.T) {
+	v1 := `{
+		"A": {"matchingUrlRegexes": ["^https?://(www\\.)?a\\.com/.*", "^https?://[a-z]+[0-9]\\.shop\\.a\\.com"], "actionDetails": {"actionType": "strike"}},
+		"B": {"matchingUrlRegexes": ["b\\.(org|net)"], "actionDetails": {"actionType": "boycott"}}
+	}`
+	v2 := strings.Replace(v1, `"boycott"`, `"picket"`, 1)
+
+	prev, err := decodeBlocklist(strings.NewReader(v1), nil)
+	if err != nil {
+		t.Fatalf("decodeBlocklist failed: %v", err)
+	}
+	if prev.TotalURLs != 3 {
+		t.Errorf("Expected 3 total URLs, got %d", prev.TotalURLs)
+	}
+	if prev.index.len() != 0 || prev.regexes == nil {
+		t.Fatalf("Expected only regular patterns, got %d domains", prev.index.len())
+	}
+
+	client := NewClient("https://api.example.com", "", 10*time.Second)
+	client.blocklist.Store(prev)
+	tests := []struct {
+		domain string
+		action string
+	}{
+		{"www.a.com", "strike"},
+		{"store7.shop.a.com", "strike"},
+		{"B.NET.", "boycott"},
+		{"b.com", ""},
+	}
+	for _, tt := range tests {
+		item, ok := client.CheckDomain(tt.domain)
+		if got := ""; ok {
+			got = item.ActionDetails.ActionType
+			if got != tt.action {
+				t.Errorf("CheckDomain(%q): expected action %q, got %q", tt.domain, tt.action, got)
+			}
+		} else if tt.action != "" {
+			t.Errorf("CheckDomain(%q): expected action %q, got no match", tt.domain, tt.action)
+		}
+	}
+
+	// Unchanged regular patterns are not recompiled.
+	same, err := decodeBlocklist(strings.NewReader(v1), prev)
+	if err != nil {
+		t.Fatalf("decodeBlocklist failed: %v", err)
+	}
+	if same.regexes != prev.regexes {
+		t.Error("Expected the regex set to be reused when no patterns changed")
+	}
+	next, err := decodeBlocklist(strings.NewReader(v2), prev)
+	if err != nil {
+		t.Fatalf("decodeBlocklist failed: %v", err)
+	}
+	if next.regexes == prev.regexes {
+		t.Error("Expected the regex set to be rebuilt when an employer with patterns changed")
+	}
+	if record, ok := next.regexes.match("b.org"); !ok || next.records[record].ActionDetails.ActionType != "picket" {
+		t.Error("Expected b.org to match the changed entry")
+	}
+}
+
+func TestDecodeBlocklistErrors(t *testing.T) {
+	tests := []struct {
+		name string
+		body string
+	}{
+		{"not an object", `["example.com"]`},
+		{"truncated", `{"Test Corp": {"matchingUrlRegexes": ["example.com"]`},
+		{"syntax error", `{"Test Corp": {matchingUrlRegexes}}`},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			if _, err := decodeBlocklist(strings.NewReader(tt.body), nil); err == nil {
+				t.Error("Expected an error")
+			}
+		})
+	}
+}
+
+func TestSkipValueCounts(t *testing.T) {
+	tests := []struct {
+		body string
+		want int
+	}{
+		{`"scalar"`, 0},
+		{`[]`, 0},
+		{`["a", {"b": [1, 2]}, [3], 4]`, 4},
+		{`["a,b", "c\"]", "d"]`, 3},
+		{`{"a": 1, "b": {"c": 2}, "d": [3, 4]}`, 3},
+		{`{}`, 0},
+		{`{"a": [], "b": {}}`, 2},
+		{`[[], {}, [[1]], null]`, 4},
+	}
+
+	for _, tt := range tests {
+		dec := json.NewDecoder(strings.NewReader(tt.body + ` "next"`))
+		got, err := skipValue(dec)
+		if err != nil {
+			t.Fatalf("skipValue(%s) failed: %v", tt.body, err)
+		}
+		if got != tt.want {
+			t.Errorf("skipValue(%s) = %d, want %d", tt.body, got, tt.want)
+		}
+		if tok, _ := dec.Token(); tok != "next" {
+			t.Errorf("skipValue(%s) left the decoder at %v", tt.body, tok)
+		}
+	}
+}
+
+// syntheticBlocklist returns an API response with urls patterns spread
+// over employers.
+func syntheticBlocklist(employers, urls int) []byte {
+	var buf bytes.Buffer
+	buf.WriteString(`{"_optimizedPatterns":[`)
+	for i := 0; i < urls; i++ {
+		if i > 0 {
+			buf.WriteByte(',')
+		}
+		fmt.Fprintf(&buf, `"d%d.example.com"`, i)
+	}
+	buf.WriteByte(']')
+
+	perEmployer := urls / employers
+	for e := 0; e < employers; e++ {
+		fmt.Fprintf(&buf, `,"Employer %d":{"moreInfoUrl":"https://union.example/%d","matchingUrlRegexes":[`, e, e)
+		for i := 0; i < perEmployer; i++ {
+			if i > 0 {
+				buf.WriteByte(',')
+			}
+			fmt.Fprintf(&buf, `"d%d.example.com"`, e*perEmployer+i)
+		}
+		fmt.Fprintf(&buf, `],"actionDetails":{"id":"emp-%d","organization":"Local %d","actionType":"strike",`+
+			`"description":"Workers are on strike over pay and conditions.","demands":"Fair wages."}}`, e, e)
+	}
+	buf.WriteByte('}')
+	return buf.Bytes()
+}
+
+func BenchmarkDecodeBlocklistDiff100k(b *testing.B) {
+	body := syntheticBlocklist(1000, 100000)
+	prev, err := decodeBlocklist(bytes.NewReader(body), nil)
+	if err != nil {
+		b.Fatal(err)
+	}
+	changed := bytes.Replace(body, []byte(`"moreInfoUrl":"https://union.example/7"`), []byte(`"moreInfoUrl":"https://union.example/7b"`), 1)
+
+	b.ReportAllocs()
+	b.SetBytes(int64(len(changed)))
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := decodeBlocklist(bytes.NewReader(changed), prev); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkDecodeBlocklist100k(b *testing.B) {
+	body := syntheticBlocklist(1000, 100000)
+
+	b.ReportAllocs()
+	b.SetBytes(int64(len(body)))
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		blocklist, err := decodeBlocklist(bytes.NewReader(body), nil)
+		if err != nil {
+			b.Fatal(err)
+		}
+		if blocklist.TotalURLs != 100000 {
+			b.Fatalf("Expected 100000 URLs, got %d", blocklist.TotalURLs)
+		}
+	}
+}
@@ -0,0 +1,262 @@
+package api
+
+import (
+	"hash/maphash"
+	"maps"
+	"slices"
+	"strings"
+	"unsafe"
+)
+
+const (
+	// maxDomainLen is the longest domain name, without the trailing dot, that
+	// can appear in a DNS query (RFC 1035 section 2.3.4).
+	maxDomainLen = 253
+
+	// indexShards is the number of maps a domainIndex is split into. A
+	// refresh copies only the shards its changes touch, so shards are kept
+	// small: about a hundred entries each for a 100k-domain blocklist
+	// spread over many registered domains.
+	indexShards = 1024
+)
+
+// indexSeed selects shards. It is shared by every index in the process so
+// that successive versions of an index can share unchanged shards.
+var indexSeed = maphash.MakeSeed()
+
+// domainIndex maps normalized domains to blocklist records. It is built once
+// per blocklist refresh and never modified afterwards, so lookups need no
+// locking.
+//
+// Lookups probe each label-boundary suffix of the query name in place, or
+// from a stack buffer when the name needs lowercasing, which keeps both the
+// hit and miss paths allocation-free.
+// Entries hold positions in records rather than pointers, so the index can
+// be filled while records is still growing.
+//
+// The entries are split across shards, and a new version of the index made
+// by an indexBuilder shares every shard it did not modify with the version
+// it was derived from.
+type domainIndex struct {
+	shards [indexShards]map[string]int32
+
+	// dupes lists, for the rare domains claimed by more than one record,
+	// every claimant in the order they were added; the last one is the
+	// entry in shards. It is nil when there are none.
+	dupes map[string][]int32
+
+	records []BlockListItem
+}
+
+// newDomainIndex indexes items by their Domain, falling back to the host
+// part of URL, with each item as its own record. When several items share a
+// domain the last one wins.
+func newDomainIndex(items []BlockListItem) *domainIndex {
+	b := newIndexBuilder(nil)
+	for i := range items {
+		domain := items[i].Domain
+		if domain == "" {
+			domain = extractDomain(items[i].URL)
+		}
+		b.add(domain, int32(i))
+	}
+	return b.finish(items)
+}
+
+// shardOf picks the shard for a normalized key from its last two labels.
+// Every suffix a lookup probes shares those labels with the query name, so
+// one shard serves the whole lookup.
+func shardOf(key string) int {
+	if i := strings.LastIndexByte(key, '.'); i >= 0 {
+		if j := strings.LastIndexByte(key[:i], '.'); j >= 0 {
+			key = key[j+1:]
+		}
+	}
+	return int(maphash.String(indexSeed, key) % indexShards)
+}
+
+// normalizeDomain returns the index key for domain.
+func normalizeDomain(domain string) string {
+	return strings.ToLower(strings.TrimSuffix(domain, "."))
+}
+
+// len returns the number of indexed domains.
+func (ix *domainIndex) len() int {
+	n := 0
+	for _, shard := range ix.shards {
+		n += len(shard)
+	}
+	return n
+}
+
+// lookup finds the record for name or its closest indexed parent domain.
+// Matching ignores case and a trailing dot. Parent matching stops before
+// the top-level label, so "com" alone never matches.
+func (ix *domainIndex) lookup(name string) (*BlockListItem, bool) {
+	name = strings.TrimSuffix(name, ".")
+	if len(name) == 0 || len(name) > maxDomainLen {
+		return nil, false
+	}
+
+	// Names that are already lowercase, as ServeDNS passes them, are probed
+	// in place; others are lowercased into a stack buffer first.
+	if hasUpper(name) {
+		var buf [maxDomainLen]byte
+		b := buf[:len(name)]
+		for i := 0; i < len(name); i++ {
+			c := name[i]
+			if 'A' <= c && c <= 'Z' {
+				c += 'a' - 'A'
+			}
+			b[i] = c
+		}
+		return ix.probe(unsafe.String(&b[0], len(b)))
+	}
+	return ix.probe(name)
+}
+
+// probe looks up a normalized name and then each of its parent domains,
+// stopping before the top-level label. It does not retain name.
+func (ix *domainIndex) probe(name string) (*BlockListItem, bool) {
+	shard := ix.shards[shardOf(name)]
+	if i, ok := shard[name]; ok {
+		return &ix.records[i], true
+	}
+	lastDot := strings.LastIndexByte(name, '.')
+	for i := 0; i < lastDot; i++ {
+		if name[i] != '.' {
+			continue
+		}
+		if j, ok := shard[name[i+1:]]; ok {
+			return &ix.records[j], true
+		}
+	}
+	return nil, false
+}
+
+func hasUpper(s string) bool {
+	for i := 0; i < len(s); i++ {
+		if 'A' <= s[i] && s[i] <= 'Z' {
+			return true
+		}
+	}
+	return false
+}
+
+// indexBuilder makes a new domainIndex from an existing one, copying a
+// shard or the dupes table only the first time it is modified.
+type indexBuilder struct {
+	ix          *domainIndex
+	ownedShards [indexShards]bool
+	ownedDupes  bool
+}
+
+// newIndexBuilder starts a new index version based on prev, which is left
+// unchanged. A nil prev starts an empty index.
+func newIndexBuilder(prev *domainIndex) *indexBuilder {
+	b := &indexBuilder{ix: &domainIndex{}}
+	if prev != nil {
+		b.ix.shards = prev.shards
+		b.ix.dupes = prev.dupes
+	}
+	return b
+}
+
+// presize allocates empty shards sized for n domains in total. It only
+// affects shards that have not been created yet.
+func (b *indexBuilder) presize(n int) {
+	per := n / indexShards
+	if per == 0 {
+		return
+	}
+	per += per / 4
+	for i := range b.ix.shards {
+		if b.ix.shards[i] == nil {
+			b.ix.shards[i] = make(map[string]int32, per)
+			b.ownedShards[i] = true
+		}
+	}
+}
+
+func (b *indexBuilder) shard(key string) map[string]int32 {
+	i := shardOf(key)
+	if !b.ownedShards[i] {
+		if b.ix.shards[i] == nil {
+			b.ix.shards[i] = make(map[string]int32)
+		} else {
+			b.ix.shards[i] = maps.Clone(b.ix.shards[i])
+		}
+		b.ownedShards[i] = true
+	}
+	return b.ix.shards[i]
+}
+
+func (b *indexBuilder) dupes() map[string][]int32 {
+	if !b.ownedDupes {
+		b.ix.dupes = maps.Clone(b.ix.dupes)
+		if b.ix.dupes == nil {
+			b.ix.dupes = make(map[string][]int32)
+		}
+		b.ownedDupes = true
+	}
+	return b.ix.dupes
+}
+
+// add indexes record under domain. If another record already claims the
+// domain, record takes over the entry and both are remembered in dupes.
+func (b *indexBuilder) add(domain string, record int32) {
+	key := normalizeDomain(domain)
+	if key == "" {
+		return
+	}
+	m := b.shard(key)
+	if cur, ok := m[key]; ok && cur != record {
+		claims := b.ix.dupes[key]
+		if len(claims) == 0 {
+			claims = []int32{cur}
+		}
+		claims = slices.DeleteFunc(slices.Clone(claims), func(r int32) bool { return r == record })
+		b.dupes()[key] = append(claims, record)
+	}
+	m[key] = record
+}
+
+// remove withdraws record's claim on domain. If other records still claim
+// it, the most recently added of them takes over the entry.
+func (b *indexBuilder) remove(domain string, record int32) {
+	key := normalizeDomain(domain)
+	cur, ok := b.ix.shards[shardOf(key)][key]
+	if !ok {
+		return
+	}
+
+	if claims := b.ix.dupes[key]; len(claims) > 0 {
+		claims = slices.DeleteFunc(slices.Clone(claims), func(r int32) bool { return r == record })
+		switch len(claims) {
+		case 0:
+			delete(b.dupes(), key)
+			delete(b.shard(key), key)
+		case 1:
+			delete(b.dupes(), key)
+			b.shard(key)[key] = claims[0]
+		default:
+			b.dupes()[key] = claims
+			b.shard(key)[key] = claims[len(claims)-1]
+		}
+		return
+	}
+	if cur == record {
+		delete(b.shard(key), key)
+	}
+}
+
+// finish returns the new index, resolving entries against records.
+func (b *indexBuilder) finish(records []BlockListItem) *domainIndex {
+	if len(b.ix.dupes) == 0 {
+		b.ix.dupes = nil
+	}
+	b.ix.records = records
+	ix := b.ix
+	b.ix = nil
+	return ix
+}
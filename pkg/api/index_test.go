@@ -0,0 +1,98 @@
+package api
+
+import (
+	"fmt"
+	"testing"
+)
+
+func testIndex() *domainIndex {
+	return newDomainIndex([]BlockListItem{
+		{URL: "https://example.com", Employer: "Test Corp"},
+		{URL: "https://shop.example.net", Employer: "Shop Corp"},
+		{Domain: "Upper.Example.ORG.", Employer: "Upper Corp"},
+	})
+}
+
+func TestDomainIndexLookup(t *testing.T) {
+	ix := testIndex()
+
+	tests := []struct {
+		name     string
+		blocked  bool
+		employer string
+	}{
+		{"example.com", true, "Test Corp"},
+		{"example.com.", true, "Test Corp"},
+		{"WWW.Example.Com.", true, "Test Corp"},
+		{"a.b.c.example.com", true, "Test Corp"},
+		{"shop.example.net", true, "Shop Corp"},
+		{"example.net", false, ""},
+		{"upper.example.org", true, "Upper Corp"},
+		{"com", false, ""},
+		{"notexample.com", false, ""},
+		{"", false, ""},
+		{".", false, ""},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			item, blocked := ix.lookup(tt.name)
+			if blocked != tt.blocked {
+				t.Fatalf("lookup(%q): expected blocked=%v, got %v", tt.name, tt.blocked, blocked)
+			}
+			if blocked && item.Employer != tt.employer {
+				t.Errorf("lookup(%q): expected employer %q, got %q", tt.name, tt.employer, item.Employer)
+			}
+		})
+	}
+}
+
+func TestDomainIndexTopLevelOnlyEntry(t *testing.T) {
+	ix := newDomainIndex([]BlockListItem{{Domain: "com", Employer: "TLD"}})
+
+	if _, blocked := ix.lookup("com"); !blocked {
+		t.Error("Expected exact match on a single-label entry")
+	}
+	if _, blocked := ix.lookup("example.com"); blocked {
+		t.Error("Expected parent matching to stop before the top-level label")
+	}
+}
+
+func TestDomainIndexZeroAllocs(t *testing.T) {
+	ix := testIndex()
+
+	for _, name := range []string{"www.example.com.", "WWW.EXAMPLE.COM", "miss.example.invalid."} {
+		allocs := testing.AllocsPerRun(100, func() {
+			ix.lookup(name)
+		})
+		if allocs != 0 {
+			t.Errorf("lookup(%q): expected 0 allocs, got %v", name, allocs)
+		}
+	}
+}
+
+func benchmarkIndex(size int) *domainIndex {
+	items := make([]BlockListItem, size)
+	for i := range items {
+		items[i] = BlockListItem{Domain: fmt.Sprintf("employer%d.example.com", i)}
+	}
+	return newDomainIndex(items)
+}
+
+func BenchmarkDomainIndexHit(b *testing.B) {
+	ix := benchmarkIndex(100000)
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		ix.lookup("www.cdn.employer4242.example.com.")
+	}
+}
+
+func BenchmarkDomainIndexMiss(b *testing.B) {
+	ix := benchmarkIndex(100000)
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		ix.lookup("www.cdn.unrelated.example.org.")
+	}
+}
@@ -0,0 +1,39 @@
+//go:build unix
+
+package api
+
+import (
+	"fmt"
+	"os"
+
+	"golang.org/x/sys/unix"
+)
+
+// mapFile maps path read-only into memory. The returned release function
+// unmaps it; the data must not be used afterwards. The mapping is shared,
+// so callers copy out what they keep and release it promptly: a write to
+// the file shows through it, and reads past the end of a file truncated
+// meanwhile fault. SaveSnapshot only ever renames a new file into place,
+// which leaves an existing mapping untouched.
+func mapFile(path string) ([]byte, func(), error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return nil, nil, err
+	}
+	defer f.Close()
+
+	info, err := f.Stat()
+	if err != nil {
+		return nil, nil, err
+	}
+	size := info.Size()
+	if size == 0 || size != int64(int(size)) {
+		return nil, nil, fmt.Errorf("unexpected file size %d", size)
+	}
+
+	data, err := unix.Mmap(int(f.Fd()), 0, int(size), unix.PROT_READ, unix.MAP_SHARED)
+	if err != nil {
+		return nil, nil, err
+	}
+	return data, func() { unix.Munmap(data) }, nil
+}
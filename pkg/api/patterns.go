@@ -0,0 +1,395 @@
+package api
+
+import (
+	"regexp"
+	"regexp/syntax"
+	"slices"
+	"strings"
+)
+
+const (
+	// regexMetachars are the characters that make a pattern more than a
+	// plain URL or host name.
+	regexMetachars = `\^$*+?()[]{}|`
+
+	// maxGroupPatterns caps how many patterns are compiled into one
+	// expression, which keeps each program well within regexp's limits.
+	maxGroupPatterns = 256
+)
+
+// classifyPattern splits a matchingUrlRegexes entry into the domain it
+// names, for entries that are plain URLs or host names, or the regular
+// expression a host name must match. Only the host part of a pattern is
+// kept, since DNS queries carry no scheme or path.
+//
+// Entries that are not valid regular expressions are treated as URLs, as
+// before patterns were compiled.
+func classifyPattern(pattern string) (domain, expr string) {
+	if !strings.ContainsAny(pattern, regexMetachars) {
+		return extractDomain(pattern), ""
+	}
+
+	host := patternHost(pattern)
+	literal := strings.ReplaceAll(host, `\.`, ".")
+	if !strings.ContainsAny(literal, regexMetachars) {
+		return stripPort(literal), ""
+	}
+	// A "*.example.com" wildcard is what the index's parent matching does.
+	if rest, ok := strings.CutPrefix(literal, "*."); ok && !strings.ContainsAny(rest, regexMetachars) {
+		return stripPort(rest), ""
+	}
+
+	if host == "" {
+		return extractDomain(pattern), ""
+	}
+	if _, err := regexp.Compile(host); err != nil {
+		return extractDomain(pattern), ""
+	}
+	return "", host
+}
+
+// patternHost returns the part of a URL pattern that matches the host,
+// without anchors, scheme, path or a trailing wildcard.
+func patternHost(p string) string {
+	p = strings.TrimPrefix(p, "^")
+	p = strings.ReplaceAll(p, `\/`, "/")
+
+	// Drop a scheme such as "https://", "https?://" or "(https?://)?"
+	if i := strings.Index(p, "://"); i >= 0 && strings.Trim(p[:i], "(?:ptsh") == "" {
+		grouped := strings.Contains(p[:i], "(")
+		p = p[i+3:]
+		if grouped {
+			p = strings.TrimPrefix(p, ")?")
+		}
+	}
+
+	// Cut at the first slash outside a character class
+	inClass := false
+	for i := 0; i < len(p); i++ {
+		switch c := p[i]; {
+		case c == '\\':
+			i++
+		case c == '[':
+			inClass = true
+		case c == ']':
+			inClass = false
+		case c == '/' && !inClass:
+			p = p[:i]
+		}
+	}
+
+	for {
+		switch {
+		case strings.HasSuffix(p, "$") && !strings.HasSuffix(p, `\$`):
+			p = p[:len(p)-1]
+		case strings.HasSuffix(p, ".*") && !strings.HasSuffix(p, `\.*`):
+			p = p[:len(p)-2]
+		default:
+			return p
+		}
+	}
+}
+
+func stripPort(host string) string {
+	if i := strings.LastIndexByte(host, ':'); i >= 0 {
+		return host[:i]
+	}
+	return host
+}
+
+// suffixKey returns the last two labels that every host name matching expr
+// ends with, lowercased, or "" when expr does not pin them down.
+func suffixKey(expr string) string {
+	// Collect the trailing run of literal characters, and whether it always
+	// starts on a label boundary. Matching is anchored so that expr starts
+	// on one.
+	var (
+		tail     []byte
+		boundary = true
+		groups   []exprGroup
+		closed   exprGroup
+		prev     byte
+	)
+	atBoundary := func() bool {
+		if len(tail) > 0 {
+			return tail[len(tail)-1] == '.'
+		}
+		return boundary
+	}
+	reset := func(b bool) {
+		tail = tail[:0]
+		boundary = b
+	}
+
+	for i := 0; i < len(expr); i++ {
+		c := expr[i]
+		switch {
+		case c == '\\' && i+1 < len(expr):
+			i++
+			if e := expr[i]; e == '.' || e == '-' {
+				tail = append(tail, e)
+			} else {
+				reset(false)
+			}
+		case c == '[':
+			for i++; i < len(expr) && expr[i] != ']'; i++ {
+				if expr[i] == '\\' {
+					i++
+				}
+			}
+			reset(false)
+		case c == '(':
+			groups = append(groups, exprGroup{before: atBoundary()})
+			reset(groups[len(groups)-1].before)
+		case c == ')' && len(groups) > 0:
+			closed = groups[len(groups)-1]
+			groups = groups[:len(groups)-1]
+			closed.after = !closed.alt && atBoundary()
+			reset(closed.after)
+		case c == '|':
+			if len(groups) == 0 {
+				return ""
+			}
+			groups[len(groups)-1].alt = true
+			reset(groups[len(groups)-1].before)
+		case c == '?' && (prev == '?' || prev == '*' || prev == '+' || prev == '}'):
+			// A lazy quantifier matches the same strings
+		case c == '?' || c == '*' || c == '{':
+			if c == '{' {
+				for i < len(expr) && expr[i] != '}' {
+					i++
+				}
+			}
+			// A group that may be absent keeps the boundary only if one
+			// is on both sides of it.
+			reset(prev == ')' && closed.before && closed.after)
+		case c == '+':
+			reset(prev == ')' && closed.after)
+		case 'a' <= c && c <= 'z', '0' <= c && c <= '9', c == '-':
+			tail = append(tail, c)
+		case 'A' <= c && c <= 'Z':
+			tail = append(tail, c+'a'-'A')
+		default:
+			// Anchors and "." make what follows them unknown
+			reset(false)
+		}
+		prev = c
+	}
+
+	key := string(tail)
+	if boundary {
+		key = "." + key
+	}
+	last := strings.LastIndexByte(key, '.')
+	if last <= 0 || last == len(key)-1 {
+		return ""
+	}
+	first := strings.LastIndexByte(key[:last], '.')
+	if first < 0 || first == last-1 {
+		return ""
+	}
+	return key[first+1:]
+}
+
+// exprGroup tracks a parenthesized group while scanning an expression.
+type exprGroup struct {
+	before bool // the group starts on a label boundary
+	after  bool // the group ends on one
+	alt    bool // the group has alternatives
+}
+
+// lastTwoLabels returns the last two labels of a domain name, or all of it
+// when it has fewer.
+func lastTwoLabels(name string) string {
+	for i, dots := len(name)-1, 0; i >= 0; i-- {
+		if name[i] == '.' {
+			if dots++; dots == 2 {
+				return name[i+1:]
+			}
+		}
+	}
+	return name
+}
+
+// regexPattern is a regular pattern and the record it blocks for.
+type regexPattern struct {
+	expr   string
+	record int32
+}
+
+// regexSet matches host names against the patterns of a blocklist that are
+// regular expressions. Patterns are grouped by the last two labels they
+// require, so a lookup runs only the group for its own registered domain
+// plus the patterns that could match under any domain. Like domainIndex it
+// is never modified once built.
+type regexSet struct {
+	bySuffix map[string]*regexGroup
+	anywhere []*regexGroup
+}
+
+// regexGroup is several patterns compiled into one expression. Each pattern
+// is wrapped in a capture group so a match can be traced to its record.
+type regexGroup struct {
+	re      *regexp.Regexp
+	groups  []int
+	records []int32
+}
+
+// newRegexSet compiles the regular patterns of sources. It returns nil when
+// there are none.
+func newRegexSet(sources map[string]*employerSource) *regexSet {
+	var patterns []regexPattern
+	for _, src := range sources {
+		for _, p := range src.patterns {
+			if p.Expr != "" {
+				patterns = append(patterns, regexPattern{expr: p.Expr, record: src.record})
+			}
+		}
+	}
+	if len(patterns) == 0 {
+		return nil
+	}
+
+	// Compile in a stable order, so overlapping patterns resolve the same
+	// way on every refresh.
+	slices.SortFunc(patterns, func(a, b regexPattern) int {
+		if a.record != b.record {
+			return int(a.record - b.record)
+		}
+		return strings.Compare(a.expr, b.expr)
+	})
+
+	bySuffix := make(map[string][]regexPattern)
+	var anywhere []regexPattern
+	for _, p := range patterns {
+		if key := suffixKey(p.expr); key != "" {
+			bySuffix[key] = append(bySuffix[key], p)
+		} else {
+			anywhere = append(anywhere, p)
+		}
+	}
+
+	s := &regexSet{bySuffix: make(map[string]*regexGroup, len(bySuffix))}
+	for key, ps := range bySuffix {
+		// Groups sharing a suffix are rare and small; keep the first chunk
+		// in the map and any overflow with the unkeyed groups.
+		groups := compileGroups(ps)
+		if len(groups) == 0 {
+			continue
+		}
+		s.bySuffix[key] = groups[0]
+		s.anywhere = append(s.anywhere, groups[1:]...)
+	}
+	s.anywhere = append(s.anywhere, compileGroups(anywhere)...)
+	return s
+}
+
+// compileGroups compiles patterns into groups of at most maxGroupPatterns.
+func compileGroups(patterns []regexPattern) []*regexGroup {
+	var groups []*regexGroup
+	for len(patterns) > 0 {
+		chunk := patterns[:min(len(patterns), maxGroupPatterns)]
+		patterns = patterns[len(chunk):]
+		if g, ok := compileGroup(chunk); ok {
+			groups = append(groups, g)
+			continue
+		}
+		// Fall back to one group per pattern if the combined expression
+		// is rejected.
+		for i := range chunk {
+			if g, ok := compileGroup(chunk[i : i+1]); ok {
+				groups = append(groups, g)
+			}
+		}
+	}
+	return groups
+}
+
+func compileGroup(patterns []regexPattern) (*regexGroup, bool) {
+	g := &regexGroup{
+		groups:  make([]int, len(patterns)),
+		records: make([]int32, len(patterns)),
+	}
+
+	var expr strings.Builder
+	expr.WriteString(`(?i)(?:^|\.)(?:`)
+	group := 1
+	for i, p := range patterns {
+		re, err := syntax.Parse(p.expr, syntax.Perl)
+		if err != nil {
+			return nil, false
+		}
+		if i > 0 {
+			expr.WriteByte('|')
+		}
+		expr.WriteString("(" + p.expr + ")")
+		g.groups[i] = group
+		g.records[i] = p.record
+		group += 1 + re.MaxCap()
+	}
+	expr.WriteString(`)$`)
+
+	re, err := regexp.Compile(expr.String())
+	if err != nil || re.NumSubexp() != group-1 {
+		return nil, false
+	}
+	g.re = re
+	return g, true
+}
+
+// match reports which record's pattern name matches, if any. name must not
+// have a trailing dot. Only a match in a group of several records
+// allocates, for the submatch indexes.
+func (g *regexGroup) match(name string) (int32, bool) {
+	if !g.re.MatchString(name) {
+		return 0, false
+	}
+	if len(g.records) == 1 {
+		return g.records[0], true
+	}
+	loc := g.re.FindStringSubmatchIndex(name)
+	for i, group := range g.groups {
+		if loc[2*group] >= 0 {
+			return g.records[i], true
+		}
+	}
+	return 0, false
+}
+
+// match finds the record of a regular pattern that name or one of its
+// parent domains matches. Matching ignores case and a trailing dot.
+//
+// A lookup runs at most one keyed group, then every unkeyed group in turn,
+// so its cost grows with the number of patterns whose last two labels are
+// not literal. A miss does not allocate; a hit in a group of several
+// records allocates once to find which pattern matched.
+func (s *regexSet) match(name string) (int32, bool) {
+	name = strings.TrimSuffix(name, ".")
+	if len(name) == 0 || len(name) > maxDomainLen {
+		return 0, false
+	}
+
+	// The key is lowercased into buf, and the string(key) conversion in
+	// the map index expression does not allocate.
+	var buf [maxDomainLen]byte
+	suffix := lastTwoLabels(name)
+	key := buf[:len(suffix)]
+	for i := 0; i < len(suffix); i++ {
+		c := suffix[i]
+		if 'A' <= c && c <= 'Z' {
+			c += 'a' - 'A'
+		}
+		key[i] = c
+	}
+	if g := s.bySuffix[string(key)]; g != nil {
+		if record, ok := g.match(name); ok {
+			return record, true
+		}
+	}
+	for _, g := range s.anywhere {
+		if record, ok := g.match(name); ok {
+			return record, true
+		}
+	}
+	return 0, false
+}
@@ -0,0 +1,180 @@
+package api
+
+import (
+	"fmt"
+	"testing"
+)
+
+func TestClassifyPattern(t *testing.T) {
+	tests := []struct {
+		pattern string
+		domain  string
+		expr    string
+	}{
+		{"example.com", "example.com", ""},
+		{"https://shop.example.com/path", "shop.example.com", ""},
+		{`^https?://(www\.)?example\.com/.*$`, "", `(www\.)?example\.com`},
+		{`https?:\/\/example\.org\/jobs`, "example.org", ""},
+		{`(https?://)?store\.example\.net`, "store.example.net", ""},
+		{`example\.com/page?id=1`, "example.com", ""},
+		{`*.example.com`, "example.com", ""},
+		{`example\.com:443`, "example.com", ""},
+		{`^[a-z]+\.example\.com$`, "", `[a-z]+\.example\.com`},
+		{`example\.(com|org)`, "", `example\.(com|org)`},
+		{`.*\.example\.com.*`, "", `.*\.example\.com`},
+		{`**.example.com`, "**.example.com", ""},
+	}
+
+	for _, tt := range tests {
+		domain, expr := classifyPattern(tt.pattern)
+		if domain != tt.domain || expr != tt.expr {
+			t.Errorf("classifyPattern(%q) = (%q, %q), want (%q, %q)", tt.pattern, domain, expr, tt.domain, tt.expr)
+		}
+	}
+}
+
+func TestSuffixKey(t *testing.T) {
+	tests := []struct {
+		expr string
+		want string
+	}{
+		{`(www\.)?example\.com`, "example.com"},
+		{`[a-z]+\.Example\.COM`, "example.com"},
+		{`.*\.shop\.example\.co-op`, "example.co-op"},
+		{`[a-z]+example\.com`, ""},
+		{`example\.(com|org)`, ""},
+		{`a\.example\.com|b\.example\.org`, ""},
+		{`(a|b)\.example\.com?`, ""},
+		{`x\d\.example\.com`, "example.com"},
+		{`[.]example\.com`, ""},
+		{`([a-z0-9-]+\.)*example\.com`, "example.com"},
+		{`(www\.|shop)?example\.com`, ""},
+		{`(www\.)+?example\.com`, "example.com"},
+		{`x?example\.com`, ""},
+	}
+
+	for _, tt := range tests {
+		if got := suffixKey(tt.expr); got != tt.want {
+			t.Errorf("suffixKey(%q) = %q, want %q", tt.expr, got, tt.want)
+		}
+	}
+}
+
+func testRegexSet(t *testing.T) *regexSet {
+	t.Helper()
+	set := newRegexSet(map[string]*employerSource{
+		"A": {record: 0, patterns: []blockPattern{{Expr: `[a-z]+[0-9]\.example\.com`}}},
+		"B": {record: 1, patterns: []blockPattern{{Domain: "b.com"}, {Expr: `example\.(org|net)`}}},
+		"C": {record: 2, patterns: []blockPattern{{Expr: `(shop|store)\.example\.com`}, {Expr: `(x)(y)?\.example\.com`}}},
+	})
+	if set == nil {
+		t.Fatal("Expected a regex set")
+	}
+	return set
+}
+
+func TestRegexSetMatch(t *testing.T) {
+	set := testRegexSet(t)
+
+	tests := []struct {
+		name    string
+		blocked bool
+		record  int32
+	}{
+		{"abc1.example.com", true, 0},
+		{"WWW.ABC1.Example.Com.", true, 0},
+		{"abc.example.com", false, 0},
+		{"example.org", true, 1},
+		{"www.example.net", true, 1},
+		{"example.com", false, 0},
+		{"store.example.com", true, 2},
+		{"xy.example.com", true, 2},
+		{"notshop.example.com", false, 0},
+		{"b.com", false, 0},
+		{"", false, 0},
+	}
+
+	for _, tt := range tests {
+		record, blocked := set.match(tt.name)
+		if blocked != tt.blocked || (blocked && record != tt.record) {
+			t.Errorf("match(%q) = (%d, %v), want (%d, %v)", tt.name, record, blocked, tt.record, tt.blocked)
+		}
+	}
+}
+
+func TestNewRegexSetWithoutPatterns(t *testing.T) {
+	if set := newRegexSet(map[string]*employerSource{"A": {patterns: []blockPattern{{Domain: "a.com"}}}}); set != nil {
+		t.Error("Expected no regex set for literal patterns only")
+	}
+}
+
+// benchmarkRegexSet builds a set of n patterns per employer format. Keyed
+// patterns pin their last two labels; unkeyed ones end in an alternation,
+// so every lookup runs their groups.
+func benchmarkRegexSet(n int, format string) *regexSet {
+	sources := make(map[string]*employerSource, n)
+	for i := 0; i < n; i++ {
+		sources[fmt.Sprint(i)] = &employerSource{
+			record:   int32(i),
+			patterns: []blockPattern{{Expr: fmt.Sprintf(format, i)}},
+		}
+	}
+	return newRegexSet(sources)
+}
+
+func TestRegexSetMissDoesNotAllocate(t *testing.T) {
+	set := benchmarkRegexSet(1000, `(www|shop)[0-9]*\.employer%d\.(com|net)`)
+	if len(set.anywhere) == 0 {
+		t.Fatal("Expected unkeyed groups")
+	}
+	for _, name := range []string{"www.employer5.org", "WWW.Static-Content.CDN.Edge.Employer5.Example.ORG."} {
+		allocs := testing.AllocsPerRun(100, func() {
+			set.match(name)
+		})
+		if allocs != 0 {
+			t.Errorf("match(%q): expected no allocations, got %v", name, allocs)
+		}
+	}
+}
+
+func BenchmarkRegexSetMiss(b *testing.B) {
+	const longName = "static-content.cdn.edge.www.employer5.org"
+	for _, bm := range []struct {
+		name   string
+		format string
+	}{
+		{"Keyed", `(www|shop)[0-9]*\.employer%d\.com`},
+		{"Anywhere", `(www|shop)[0-9]*\.employer%d\.(com|net)`},
+	} {
+		for _, n := range []int{10, 1000, 10000} {
+			set := benchmarkRegexSet(n, bm.format)
+			for _, host := range []string{"www.employer5.org", longName} {
+				b.Run(fmt.Sprintf("%s/%d/%d", bm.name, n, len(host)), func(b *testing.B) {
+					b.ReportAllocs()
+					for i := 0; i < b.N; i++ {
+						set.match(host)
+					}
+				})
+			}
+		}
+	}
+}
+
+func BenchmarkRegexSetHit(b *testing.B) {
+	for _, bm := range []struct {
+		name, format, host string
+	}{
+		{"Keyed", `(www|shop)[0-9]*\.employer%d\.com`, "static-content.cdn.edge.www.employer5.com"},
+		{"Anywhere", `(www|shop)[0-9]*\.employer%d\.(com|net)`, "static-content.cdn.edge.www.employer5.net"},
+	} {
+		set := benchmarkRegexSet(1000, bm.format)
+		b.Run(bm.name, func(b *testing.B) {
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				if _, ok := set.match(bm.host); !ok {
+					b.Fatal("Expected a match")
+				}
+			}
+		})
+	}
+}
@@ -0,0 +1,122 @@
+package api
+
+import (
+	"context"
+	"math/rand"
+	"time"
+)
+
+const (
+	// minRefreshBackoff is the delay before retrying a failed refresh. It
+	// doubles with each further failure, up to the refresh interval.
+	minRefreshBackoff = 5 * time.Second
+
+	// maxAgeIntervals caps how far a Cache-Control max-age can push the
+	// next refresh, in refresh intervals.
+	maxAgeIntervals = 4
+)
+
+// RefreshConfig configures the refresh loop run by Client.Refresh.
+type RefreshConfig struct {
+	// Interval is the time between refreshes while they succeed.
+	Interval time.Duration
+
+	// Jitter spreads every delay uniformly over plus or minus this
+	// fraction of itself, so that servers started together do not refresh
+	// together. 0 disables it.
+	Jitter float64
+
+	// Trigger, if not nil, starts a refresh whenever it receives.
+	Trigger <-chan struct{}
+
+	// OnRefresh, if not nil, is called after every refresh attempt.
+	OnRefresh func(RefreshResult)
+}
+
+// RefreshResult describes one refresh attempt.
+type RefreshResult struct {
+	// Blocklist is the blocklist being served after the attempt; nil if
+	// none has been fetched yet.
+	Blocklist *Blocklist
+
+	// Changed reports whether the attempt published a new blocklist.
+	Changed bool
+
+	Err      error
+	Duration time.Duration
+
+	// Next is the delay until the next scheduled attempt.
+	Next time.Duration
+}
+
+// Refresh fetches the blocklist on a schedule until ctx is done. After a
+// success the next refresh is one interval away, or as long as the API's
+// Cache-Control max-age if that is longer (at most maxAgeIntervals
+// intervals). After a failure it is retried with exponential backoff from
+// minRefreshBackoff up to the interval. Every delay is jittered.
+func (c *Client) Refresh(ctx context.Context, cfg RefreshConfig) {
+	rng := rand.New(rand.NewSource(time.Now().UnixNano()))
+	failures := 0
+
+	timer := time.NewTimer(refreshDelay(cfg.Interval, cfg.Jitter, 0, 0, rng.Float64()))
+	defer timer.Stop()
+
+	for {
+		select {
+		case <-ctx.Done():
+			return
+		case <-cfg.Trigger:
+			if !timer.Stop() {
+				select {
+				case <-timer.C:
+				default:
+				}
+			}
+		case <-timer.C:
+		}
+
+		start := time.Now()
+		previous := c.blocklist.Load()
+		_, err := c.FetchBlocklist(ctx)
+		if ctx.Err() != nil {
+			return
+		}
+		if err != nil {
+			failures++
+		} else {
+			failures = 0
+		}
+
+		next := refreshDelay(cfg.Interval, cfg.Jitter, failures, time.Duration(c.maxAge.Load()), rng.Float64())
+		timer.Reset(next)
+
+		if cfg.OnRefresh != nil {
+			current := c.blocklist.Load()
+			cfg.OnRefresh(RefreshResult{
+				Blocklist: current,
+				Changed:   current != previous,
+				Err:       err,
+				Duration:  time.Since(start),
+				Next:      next,
+			})
+		}
+	}
+}
+
+// refreshDelay returns the delay before the next refresh, given the number
+// of consecutive failures, the max-age of the last answer and a uniform
+// random number r in [0, 1) for the jitter.
+func refreshDelay(interval time.Duration, jitter float64, failures int, maxAge time.Duration, r float64) time.Duration {
+	d := interval
+	switch {
+	case failures > 0:
+		d = minRefreshBackoff
+		for i := 1; i < failures && d < interval; i++ {
+			d *= 2
+		}
+		d = min(d, interval)
+	case maxAge > interval:
+		d = min(maxAge, maxAgeIntervals*interval)
+	}
+	return d + time.Duration(float64(d)*jitter*(2*r-1))
+}
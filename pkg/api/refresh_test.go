@@ -0,0 +1,119 @@
+package api
+
+import (
+	"context"
+	"encoding/json"
+	"net/http"
+	"net/http/httptest"
+	"testing"
+	"time"
+)
+
+func TestRefreshDelay(t *testing.T) {
+	interval := 15 * time.Minute
+	tests := []struct {
+		name     string
+		failures int
+		maxAge   time.Duration
+		want     time.Duration
+	}{
+		{"success", 0, 0, interval},
+		{"shorter max-age", 0, time.Minute, interval},
+		{"longer max-age", 0, 30 * time.Minute, 30 * time.Minute},
+		{"max-age capped", 0, 24 * time.Hour, maxAgeIntervals * interval},
+		{"first failure", 1, 0, minRefreshBackoff},
+		{"third failure", 3, 0, 4 * minRefreshBackoff},
+		{"backoff capped", 20, 0, interval},
+		{"failure ignores max-age", 1, time.Hour, minRefreshBackoff},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			// r = 0.5 is the middle of the jitter range
+			if got := refreshDelay(interval, 0.1, tt.failures, tt.maxAge, 0.5); got != tt.want {
+				t.Errorf("Expected %v, got %v", tt.want, got)
+			}
+		})
+	}
+}
+
+func TestRefreshDelayJitter(t *testing.T) {
+	interval := 10 * time.Minute
+	if got := refreshDelay(interval, 0.1, 0, 0, 0); got != 9*time.Minute {
+		t.Errorf("Expected lowest delay 9m, got %v", got)
+	}
+	if got := refreshDelay(interval, 0.1, 0, 0, 0.999999); got < 10*time.Minute || got > 11*time.Minute {
+		t.Errorf("Expected highest delay just under 11m, got %v", got)
+	}
+	if got := refreshDelay(interval, 0, 0, 0, 0); got != interval {
+		t.Errorf("Expected no jitter, got %v", got)
+	}
+}
+
+func TestRefreshTrigger(t *testing.T) {
+	server := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		json.NewEncoder(w).Encode(map[string]OPLBlocklistEntry{
+			"Test": {MatchingURLRegexes: []string{"example.com"}},
+		})
+	}))
+	defer server.Close()
+
+	client := NewClient(server.URL, "", 10*time.Second)
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+
+	trigger := make(chan struct{})
+	results := make(chan RefreshResult, 1)
+	go client.Refresh(ctx, RefreshConfig{
+		Interval:  time.Hour,
+		Jitter:    0.1,
+		Trigger:   trigger,
+		OnRefresh: func(res RefreshResult) { results <- res },
+	})
+
+	trigger <- struct{}{}
+	select {
+	case res := <-results:
+		if res.Err != nil {
+			t.Fatalf("Refresh failed: %v", res.Err)
+		}
+		if !res.Changed || res.Blocklist == nil || res.Blocklist != client.GetCachedBlocklist() {
+			t.Error("Expected triggered refresh to publish a new blocklist")
+		}
+		if res.Next < 54*time.Minute || res.Next > 66*time.Minute {
+			t.Errorf("Expected next refresh in about an hour, got %v", res.Next)
+		}
+	case <-time.After(5 * time.Second):
+		t.Fatal("Triggered refresh did not run")
+	}
+}
+
+func TestRefreshBacksOffOnFailure(t *testing.T) {
+	server := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		w.WriteHeader(http.StatusServiceUnavailable)
+	}))
+	defer server.Close()
+
+	client := NewClient(server.URL, "", 10*time.Second)
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+
+	trigger := make(chan struct{})
+	results := make(chan RefreshResult, 1)
+	go client.Refresh(ctx, RefreshConfig{
+		Interval:  time.Hour,
+		Trigger:   trigger,
+		OnRefresh: func(res RefreshResult) { results <- res },
+	})
+
+	for _, want := range []time.Duration{minRefreshBackoff, 2 * minRefreshBackoff} {
+		trigger <- struct{}{}
+		res := <-results
+		if res.Err == nil {
+			t.Fatal("Expected refresh to fail")
+		}
+		if res.Next != want {
+			t.Errorf("Expected retry in %v, got %v", want, res.Next)
+		}
+	}
+}
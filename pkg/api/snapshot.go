@@ -0,0 +1,367 @@
+package api
+
+import (
+	"bufio"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"hash/crc32"
+	"io"
+	"os"
+	"path/filepath"
+	"time"
+)
+
+// Snapshot file layout. All integers are little-endian.
+//
+//	header:   magic [8]byte | version uint32 | crc32 uint32 | body length uint64
+//	body:     string table | metadata | records | sources
+//
+// The string table is a count, count+1 offsets and the concatenated string
+// bytes; everything after it refers to strings by table position, so each
+// distinct string is stored once. The CRC (Castagnoli) covers the body.
+// Sources carry their entry fingerprints, so the first refresh after a
+// warm start is a diff against the snapshot.
+const (
+	snapshotMagic     = "OPLBLSNP"
+	snapshotVersion   = 3
+	snapshotHeaderLen = 24
+
+	// recordFields is the number of string fields of a BlockListItem.
+	recordFields = 21
+)
+
+var (
+	// ErrSnapshotInvalid is returned when a snapshot file is not a
+	// blocklist snapshot, was written by an unsupported version, or fails
+	// its checksum.
+	ErrSnapshotInvalid = errors.New("invalid blocklist snapshot")
+
+	snapshotCRC = crc32.MakeTable(crc32.Castagnoli)
+)
+
+// SaveSnapshot writes the current blocklist to path in a compact binary
+// form. The file is written to a temporary name next to path and renamed
+// into place, so readers never see a partial snapshot.
+func (c *Client) SaveSnapshot(path string) error {
+	if c.blocklist.Load() == nil {
+		return fmt.Errorf("no blocklist to save")
+	}
+
+	tmp, err := os.CreateTemp(filepath.Dir(path), ".blocklist-*.tmp")
+	if err != nil {
+		return fmt.Errorf("creating snapshot: %w", err)
+	}
+	defer os.Remove(tmp.Name())
+
+	w := bufio.NewWriter(tmp)
+	err = c.WriteSnapshot(w)
+	if err == nil {
+		err = w.Flush()
+	}
+	if err != nil {
+		tmp.Close()
+		return fmt.Errorf("writing snapshot: %w", err)
+	}
+	if err := tmp.Sync(); err != nil {
+		tmp.Close()
+		return fmt.Errorf("writing snapshot: %w", err)
+	}
+	if err := tmp.Close(); err != nil {
+		return fmt.Errorf("writing snapshot: %w", err)
+	}
+	if err := os.Rename(tmp.Name(), path); err != nil {
+		return fmt.Errorf("installing snapshot: %w", err)
+	}
+	return nil
+}
+
+// WriteSnapshot writes the current blocklist to w in the form SaveSnapshot
+// stores, for ReadSnapshot to load in another process.
+func (c *Client) WriteSnapshot(w io.Writer) error {
+	blocklist := c.blocklist.Load()
+	if blocklist == nil {
+		return fmt.Errorf("no blocklist to save")
+	}
+
+	body := encodeSnapshotBody(blocklist)
+	var header [snapshotHeaderLen]byte
+	copy(header[:8], snapshotMagic)
+	binary.LittleEndian.PutUint32(header[8:], snapshotVersion)
+	binary.LittleEndian.PutUint32(header[12:], crc32.Checksum(body, snapshotCRC))
+	binary.LittleEndian.PutUint64(header[16:], uint64(len(body)))
+	if _, err := w.Write(header[:]); err != nil {
+		return err
+	}
+	_, err := w.Write(body)
+	return err
+}
+
+// ReadSnapshot publishes the blocklist read from r, as written by
+// WriteSnapshot or SaveSnapshot.
+func (c *Client) ReadSnapshot(r io.Reader) (*Blocklist, error) {
+	data, err := io.ReadAll(r)
+	if err != nil {
+		return nil, fmt.Errorf("reading snapshot: %w", err)
+	}
+	blocklist, err := decodeSnapshot(data)
+	if err != nil {
+		return nil, err
+	}
+	c.blocklist.Store(blocklist)
+	return blocklist, nil
+}
+
+// LoadSnapshot publishes the blocklist stored at path, as written by
+// SaveSnapshot. The file is memory-mapped where supported and its string
+// table is copied out in one allocation, so loading costs little more than
+// rebuilding the lookup maps and compiling the regular patterns. The
+// mapping is released before LoadSnapshot returns, so the blocklist does
+// not depend on the file afterwards. The snapshot keeps its content hash,
+// so the next FetchBlocklist only downloads the list if it has changed
+// since.
+func (c *Client) LoadSnapshot(path string) (*Blocklist, error) {
+	data, release, err := mapFile(path)
+	if err != nil {
+		return nil, fmt.Errorf("reading snapshot: %w", err)
+	}
+	blocklist, err := decodeSnapshot(data)
+	release()
+	if err != nil {
+		return nil, err
+	}
+	c.blocklist.Store(blocklist)
+	return blocklist, nil
+}
+
+func encodeSnapshotBody(b *Blocklist) []byte {
+	var enc snapshotEncoder
+	enc.strings = map[string]uint32{"": 0}
+	enc.table = []string{""}
+
+	var meta []byte
+	meta = enc.appendString(meta, b.Version)
+	meta = enc.appendString(meta, b.GeneratedAt)
+	meta = enc.appendString(meta, b.contentHash)
+	var fetchedAt int64
+	if !b.fetchedAt.IsZero() {
+		fetchedAt = b.fetchedAt.UnixNano()
+	}
+	meta = binary.LittleEndian.AppendUint64(meta, uint64(fetchedAt))
+
+	meta = binary.LittleEndian.AppendUint32(meta, uint32(len(b.records)))
+	for i := range b.records {
+		for _, f := range recordStrings(&b.records[i]) {
+			meta = enc.appendString(meta, *f)
+		}
+	}
+
+	meta = binary.LittleEndian.AppendUint32(meta, uint32(len(b.sources)))
+	for _, src := range b.sources {
+		meta = enc.appendString(meta, src.employer.ID)
+		meta = enc.appendString(meta, src.employer.Name)
+		meta = binary.LittleEndian.AppendUint32(meta, uint32(src.employer.URLCount))
+		meta = binary.LittleEndian.AppendUint64(meta, src.hash)
+		meta = binary.LittleEndian.AppendUint32(meta, uint32(src.record))
+		meta = binary.LittleEndian.AppendUint32(meta, uint32(len(src.patterns)))
+		for _, p := range src.patterns {
+			meta = enc.appendString(meta, p.URL)
+			meta = enc.appendString(meta, p.Domain)
+			meta = enc.appendString(meta, p.Expr)
+		}
+	}
+
+	// String table first, so a reader can resolve references as it goes.
+	body := binary.LittleEndian.AppendUint32(nil, uint32(len(enc.table)))
+	var off uint32
+	for _, s := range enc.table {
+		body = binary.LittleEndian.AppendUint32(body, off)
+		off += uint32(len(s))
+	}
+	body = binary.LittleEndian.AppendUint32(body, off)
+	for _, s := range enc.table {
+		body = append(body, s...)
+	}
+	return append(body, meta...)
+}
+
+type snapshotEncoder struct {
+	strings map[string]uint32
+	table   []string
+}
+
+// appendString appends the table position of s, adding s to the table the
+// first time it is seen.
+func (e *snapshotEncoder) appendString(buf []byte, s string) []byte {
+	i, ok := e.strings[s]
+	if !ok {
+		i = uint32(len(e.table))
+		e.strings[s] = i
+		e.table = append(e.table, s)
+	}
+	return binary.LittleEndian.AppendUint32(buf, i)
+}
+
+// recordStrings lists the string fields of item in snapshot order.
+func recordStrings(item *BlockListItem) [recordFields]*string {
+	a := &item.ActionDetails
+	return [recordFields]*string{
+		&item.URL, &item.Domain, &item.Employer, &item.EmployerID, &item.Label,
+		&item.Category, &item.Reason, &item.StartDate, &item.MoreInfoURL, &item.Location,
+		&a.ID, &a.Organization, &a.ActionType, &a.Status, &a.StartDate, &a.Description,
+		&a.Demands, &a.Location, &a.ContactInfo, &a.UnionLogoURL, &a.LearnMoreURL,
+	}
+}
+
+func decodeSnapshot(data []byte) (*Blocklist, error) {
+	if len(data) < snapshotHeaderLen || string(data[:8]) != snapshotMagic {
+		return nil, fmt.Errorf("%w: bad header", ErrSnapshotInvalid)
+	}
+	if v := binary.LittleEndian.Uint32(data[8:]); v != snapshotVersion {
+		return nil, fmt.Errorf("%w: unsupported version %d", ErrSnapshotInvalid, v)
+	}
+	body := data[snapshotHeaderLen:]
+	if n := binary.LittleEndian.Uint64(data[16:]); n != uint64(len(body)) {
+		return nil, fmt.Errorf("%w: length mismatch", ErrSnapshotInvalid)
+	}
+	if crc32.Checksum(body, snapshotCRC) != binary.LittleEndian.Uint32(data[12:]) {
+		return nil, fmt.Errorf("%w: checksum mismatch", ErrSnapshotInvalid)
+	}
+
+	d := snapshotDecoder{buf: body}
+	d.readTable()
+
+	b := &Blocklist{}
+	b.Version = d.string()
+	b.GeneratedAt = d.string()
+	b.contentHash = d.string()
+	if fetchedAt := int64(d.uint64()); fetchedAt != 0 {
+		b.fetchedAt = time.Unix(0, fetchedAt)
+	}
+
+	b.records = make([]BlockListItem, d.count(4*recordFields))
+	for i := range b.records {
+		for _, f := range recordStrings(&b.records[i]) {
+			*f = d.string()
+		}
+	}
+
+	n := d.count(24)
+	b.sources = make(map[string]*employerSource, n)
+	index := newIndexBuilder(nil)
+	for i := 0; i < n && d.err == nil; i++ {
+		src := &employerSource{
+			employer: Employer{ID: d.string(), Name: d.string(), URLCount: int(d.uint32())},
+			hash:     d.uint64(),
+			record:   d.record(len(b.records)),
+		}
+		src.patterns = make([]blockPattern, d.count(12))
+		for j := range src.patterns {
+			src.patterns[j] = blockPattern{URL: d.string(), Domain: d.string(), Expr: d.string()}
+			index.add(src.patterns[j].Domain, src.record)
+		}
+		b.sources[src.employer.Name] = src
+	}
+	if d.err != nil {
+		return nil, fmt.Errorf("%w: %v", ErrSnapshotInvalid, d.err)
+	}
+
+	b.index = index.finish(b.records)
+	b.regexes = newRegexSet(b.sources)
+	b.fillFromSources()
+	return b, nil
+}
+
+// snapshotDecoder reads a snapshot body. After the first out-of-range read
+// it returns zero values and records the error, so callers check once at
+// the end.
+type snapshotDecoder struct {
+	buf   []byte
+	pos   int
+	table []string
+	err   error
+}
+
+func (d *snapshotDecoder) fail(msg string) {
+	if d.err == nil {
+		d.err = errors.New(msg)
+	}
+}
+
+func (d *snapshotDecoder) uint32() uint32 {
+	if d.err != nil || len(d.buf)-d.pos < 4 {
+		d.fail("truncated")
+		return 0
+	}
+	v := binary.LittleEndian.Uint32(d.buf[d.pos:])
+	d.pos += 4
+	return v
+}
+
+func (d *snapshotDecoder) uint64() uint64 {
+	if d.err != nil || len(d.buf)-d.pos < 8 {
+		d.fail("truncated")
+		return 0
+	}
+	v := binary.LittleEndian.Uint64(d.buf[d.pos:])
+	d.pos += 8
+	return v
+}
+
+// count reads an element count, rejecting counts that could not fit in
+// the rest of the body at size bytes per element.
+func (d *snapshotDecoder) count(size int) int {
+	n := int(d.uint32())
+	if n > (len(d.buf)-d.pos)/size {
+		d.fail("count out of range")
+		return 0
+	}
+	return n
+}
+
+func (d *snapshotDecoder) record(records int) int32 {
+	r := d.uint32()
+	if int(r) >= records {
+		d.fail("record out of range")
+		return 0
+	}
+	return int32(r)
+}
+
+func (d *snapshotDecoder) string() string {
+	i := d.uint32()
+	if int(i) >= len(d.table) {
+		d.fail("string out of range")
+		return ""
+	}
+	return d.table[i]
+}
+
+// readTable reads the string table. The string bytes are copied into one
+// heap string that every table entry slices, so no entry refers to the
+// body and a single allocation holds them all.
+func (d *snapshotDecoder) readTable() {
+	n := d.count(4)
+	offsets := make([]uint32, n+1)
+	for i := range offsets {
+		offsets[i] = d.uint32()
+	}
+	if d.err != nil {
+		return
+	}
+	if int(offsets[n]) > len(d.buf)-d.pos {
+		d.fail("string table out of range")
+		return
+	}
+	blob := string(d.buf[d.pos : d.pos+int(offsets[n])])
+	d.table = make([]string, n)
+	for i := 0; i < n; i++ {
+		start, end := offsets[i], offsets[i+1]
+		if start > end || int(end) > len(blob) {
+			d.fail("string table out of range")
+			return
+		}
+		d.table[i] = blob[start:end]
+	}
+	d.pos += int(offsets[n])
+}
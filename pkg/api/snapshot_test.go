@@ -0,0 +1,248 @@
+package api
+
+import (
+	"bytes"
+	"context"
+	"errors"
+	"net/http"
+	"net/http/httptest"
+	"os"
+	"path/filepath"
+	"strings"
+	"testing"
+	"time"
+)
+
+func newSnapshotClient(t *testing.T) *Client {
+	t.Helper()
+
+	body := `{
+		"Test Corp": {
+			"moreInfoUrl": "https://union.org",
+			"matchingUrlRegexes": ["example.com", "shop.example.com"],
+			"actionDetails": {"id": "emp-1", "actionType": "strike", "description": "Workers on strike", "contactInfo": "picket@union.org"}
+		},
+		"Other Inc": {
+			"matchingUrlRegexes": ["other.org", "^https?://[a-z]+[0-9]\\.other\\.net"],
+			"actionDetails": {"id": "emp-2", "actionType": "boycott"}
+		}
+	}`
+	blocklist, err := decodeBlocklist(bytes.NewReader([]byte(body)), nil)
+	if err != nil {
+		t.Fatalf("decodeBlocklist failed: %v", err)
+	}
+	blocklist.fetchedAt = time.Unix(1700000000, 0)
+	blocklist.contentHash = "abc123"
+
+	client := NewClient("https://api.example.com", "", 10*time.Second)
+	client.blocklist.Store(blocklist)
+	return client
+}
+
+func TestSnapshotRoundTrip(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "blocklist.snap")
+	if err := newSnapshotClient(t).SaveSnapshot(path); err != nil {
+		t.Fatalf("SaveSnapshot failed: %v", err)
+	}
+
+	client := NewClient("https://api.example.com", "", 10*time.Second)
+	blocklist, err := client.LoadSnapshot(path)
+	if err != nil {
+		t.Fatalf("LoadSnapshot failed: %v", err)
+	}
+
+	if blocklist.TotalURLs != 4 || len(blocklist.Employers) != 2 || blocklist.index.len() != 3 {
+		t.Errorf("Unexpected sizes: urls=%d employers=%d domains=%d",
+			blocklist.TotalURLs, len(blocklist.Employers), blocklist.index.len())
+	}
+	if items := blocklist.Items(); len(items) != 4 || items[0].Employer != "Other Inc" || items[len(items)-1].Employer != "Test Corp" {
+		t.Errorf("Expected 4 items ordered by employer, got %+v", items)
+	}
+	if blocklist.contentHash != "abc123" {
+		t.Errorf("Expected content hash abc123, got %q", blocklist.contentHash)
+	}
+	if !client.LastFetchTime().Equal(time.Unix(1700000000, 0)) {
+		t.Errorf("Expected original fetch time, got %v", client.LastFetchTime())
+	}
+
+	item, blocked := client.CheckDomain("www.shop.example.com")
+	if !blocked {
+		t.Fatal("Expected www.shop.example.com to be blocked")
+	}
+	if item.Employer != "Test Corp" || item.ActionDetails.ContactInfo != "picket@union.org" || item.MoreInfoURL != "https://union.org" {
+		t.Errorf("Unexpected item %+v", item)
+	}
+	if item, _ := client.CheckDomain("other.org"); item == nil || item.ActionDetails.ActionType != "boycott" {
+		t.Errorf("Expected other.org to be blocked for a boycott, got %+v", item)
+	}
+	if item, _ := client.CheckDomain("web1.other.net"); item == nil || item.Employer != "Other Inc" {
+		t.Errorf("Expected web1.other.net to match a regular pattern, got %+v", item)
+	}
+	if _, blocked := client.CheckDomain("notblocked.com"); blocked {
+		t.Error("Expected notblocked.com not to be blocked")
+	}
+}
+
+func TestLoadSnapshotOutlivesFile(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "blocklist.snap")
+	if err := newSnapshotClient(t).SaveSnapshot(path); err != nil {
+		t.Fatalf("SaveSnapshot failed: %v", err)
+	}
+	client := NewClient("https://api.example.com", "", 10*time.Second)
+	if _, err := client.LoadSnapshot(path); err != nil {
+		t.Fatalf("LoadSnapshot failed: %v", err)
+	}
+
+	// Overwrite the file in place with something shorter
+	if err := os.WriteFile(path, bytes.Repeat([]byte{'x'}, 16), 0o644); err != nil {
+		t.Fatal(err)
+	}
+	item, blocked := client.CheckDomain("www.shop.example.com")
+	if !blocked || item.Employer != "Test Corp" || item.ActionDetails.ContactInfo != "picket@union.org" {
+		t.Errorf("Expected the loaded blocklist to be unaffected by the file, got %+v", item)
+	}
+}
+
+func TestSnapshotStream(t *testing.T) {
+	var buf bytes.Buffer
+	if err := newSnapshotClient(t).WriteSnapshot(&buf); err != nil {
+		t.Fatalf("WriteSnapshot failed: %v", err)
+	}
+	client := NewClient("https://api.example.com", "", 10*time.Second)
+	blocklist, err := client.ReadSnapshot(&buf)
+	if err != nil {
+		t.Fatalf("ReadSnapshot failed: %v", err)
+	}
+	if blocklist.TotalURLs != 4 {
+		t.Errorf("Expected 4 URLs, got %d", blocklist.TotalURLs)
+	}
+	if _, blocked := client.CheckDomain("www.shop.example.com"); !blocked {
+		t.Error("Expected www.shop.example.com to be blocked")
+	}
+	if _, err := client.ReadSnapshot(strings.NewReader("not a snapshot")); !errors.Is(err, ErrSnapshotInvalid) {
+		t.Errorf("Expected ErrSnapshotInvalid, got %v", err)
+	}
+}
+
+func TestSnapshotSupportsDiffRefresh(t *testing.T) {
+	saved := newSnapshotClient(t)
+	path := filepath.Join(t.TempDir(), "blocklist.snap")
+	if err := saved.SaveSnapshot(path); err != nil {
+		t.Fatalf("SaveSnapshot failed: %v", err)
+	}
+	loaded, err := NewClient("https://api.example.com", "", 10*time.Second).LoadSnapshot(path)
+	if err != nil {
+		t.Fatalf("LoadSnapshot failed: %v", err)
+	}
+
+	// Re-decoding the same entries against the snapshot reuses all of them.
+	for name, src := range saved.GetCachedBlocklist().sources {
+		if got := loaded.sources[name]; got == nil || got.hash != src.hash || got.record != src.record {
+			t.Errorf("Expected source %q to survive the snapshot, got %+v", name, got)
+		}
+	}
+}
+
+func TestSnapshotRevalidatesWithStoredHash(t *testing.T) {
+	path := filepath.Join(t.TempDir(), "blocklist.snap")
+	if err := newSnapshotClient(t).SaveSnapshot(path); err != nil {
+		t.Fatalf("SaveSnapshot failed: %v", err)
+	}
+
+	var gotHash string
+	server := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		gotHash = r.URL.Query().Get("hash")
+		w.WriteHeader(http.StatusNotModified)
+	}))
+	defer server.Close()
+
+	client := NewClient(server.URL, "", 10*time.Second)
+	loaded, err := client.LoadSnapshot(path)
+	if err != nil {
+		t.Fatalf("LoadSnapshot failed: %v", err)
+	}
+	fetched, err := client.FetchBlocklist(context.Background())
+	if err != nil {
+		t.Fatalf("FetchBlocklist failed: %v", err)
+	}
+	if gotHash != "abc123" {
+		t.Errorf("Expected revalidation with hash abc123, got %q", gotHash)
+	}
+	if fetched != loaded {
+		t.Error("Expected the snapshot to stay current after 304")
+	}
+}
+
+func TestSnapshotRejectsCorruption(t *testing.T) {
+	dir := t.TempDir()
+	path := filepath.Join(dir, "blocklist.snap")
+	if err := newSnapshotClient(t).SaveSnapshot(path); err != nil {
+		t.Fatalf("SaveSnapshot failed: %v", err)
+	}
+	good, err := os.ReadFile(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	tests := []struct {
+		name   string
+		mutate func([]byte) []byte
+	}{
+		{"flipped body byte", func(b []byte) []byte { b[len(b)/2] ^= 0xFF; return b }},
+		{"truncated", func(b []byte) []byte { return b[:len(b)-10] }},
+		{"bad magic", func(b []byte) []byte { b[0] = 'X'; return b }},
+		{"future version", func(b []byte) []byte { b[8] = 99; return b }},
+		{"empty", func(b []byte) []byte { return b[:0] }},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			bad := filepath.Join(dir, tt.name+".snap")
+			if err := os.WriteFile(bad, tt.mutate(append([]byte(nil), good...)), 0644); err != nil {
+				t.Fatal(err)
+			}
+			client := NewClient("https://api.example.com", "", 10*time.Second)
+			if _, err := client.LoadSnapshot(bad); err == nil {
+				t.Error("Expected LoadSnapshot to fail")
+			}
+			if client.GetCachedBlocklist() != nil {
+				t.Error("Expected no blocklist to be published")
+			}
+		})
+	}
+}
+
+func TestSnapshotInvalidError(t *testing.T) {
+	if _, err := decodeSnapshot([]byte("not a snapshot at all, really")); !errors.Is(err, ErrSnapshotInvalid) {
+		t.Errorf("Expected ErrSnapshotInvalid, got %v", err)
+	}
+}
+
+func TestLoadSnapshotMissingFile(t *testing.T) {
+	client := NewClient("https://api.example.com", "", 10*time.Second)
+	_, err := client.LoadSnapshot(filepath.Join(t.TempDir(), "missing.snap"))
+	if !errors.Is(err, os.ErrNotExist) {
+		t.Errorf("Expected a not-exist error, got %v", err)
+	}
+}
+
+func BenchmarkLoadSnapshot100k(b *testing.B) {
+	blocklist, err := decodeBlocklist(bytes.NewReader(syntheticBlocklist(1000, 100000)), nil)
+	if err != nil {
+		b.Fatal(err)
+	}
+	client := NewClient("https://api.example.com", "", 10*time.Second)
+	client.blocklist.Store(blocklist)
+	path := filepath.Join(b.TempDir(), "blocklist.snap")
+	if err := client.SaveSnapshot(path); err != nil {
+		b.Fatal(err)
+	}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := client.LoadSnapshot(path); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
@@ -4,7 +4,10 @@ package config
 import (
 	"encoding/json"
 	"fmt"
+	"net"
+	"net/netip"
 	"os"
+	"strings"
 	"time"
 )
 
@@ -31,11 +34,111 @@ type DNSConfig struct {
 	// UpstreamDNS is the list of upstream DNS servers
 	UpstreamDNS []string `json:"upstream_dns"`
 
-	// CacheTTL is how long to cache DNS responses
+	// CacheTTL is the maximum time to cache a DNS response (0 disables caching)
 	CacheTTL Duration `json:"cache_ttl"`
 
+	// CacheSize is the maximum number of cached DNS responses
+	CacheSize int `json:"cache_size"`
+
+	// CacheStaleTTL is how long expired responses are kept to be served
+	// when upstreams fail or are slow (0 disables serve-stale)
+	CacheStaleTTL Duration `json:"cache_stale_ttl"`
+
+	// CachePrefetch refreshes hot cached responses before they expire
+	CachePrefetch bool `json:"cache_prefetch"`
+
 	// QueryTimeout is the timeout for upstream DNS queries
 	QueryTimeout Duration `json:"query_timeout"`
+
+	// Listeners is the number of SO_REUSEPORT sockets opened per protocol
+	// (0 uses one per CPU, 1 disables SO_REUSEPORT)
+	Listeners int `json:"listeners"`
+
+	// UDPBatch enables batched recvmmsg/sendmmsg UDP I/O on Linux
+	UDPBatch bool `json:"udp_batch"`
+
+	// DoTListenAddr is the DNS-over-TLS listen address, usually port 853
+	// (empty disables DNS-over-TLS)
+	DoTListenAddr string `json:"dot_listen_addr"`
+
+	// DoHListenAddr is the DNS-over-HTTPS listen address, usually port 443
+	// (empty disables DNS-over-HTTPS)
+	DoHListenAddr string `json:"doh_listen_addr"`
+
+	// TLSCertFile and TLSKeyFile are the PEM certificate and key for
+	// DNS-over-TLS and DNS-over-HTTPS
+	TLSCertFile string `json:"tls_cert_file"`
+	TLSKeyFile  string `json:"tls_key_file"`
+
+	// TCPIdleTimeout closes TCP, TLS and HTTPS connections that have sent
+	// no query for this long
+	TCPIdleTimeout Duration `json:"tcp_idle_timeout"`
+
+	// StreamMaxInflight is how many queries per TLS or HTTPS connection
+	// are handled at once
+	StreamMaxInflight int `json:"stream_max_inflight"`
+
+	// StreamMaxConns is the most connections kept open per TLS or HTTPS
+	// listener
+	StreamMaxConns int `json:"stream_max_conns"`
+
+	// ForwardWorkers is how many queries may be forwarded upstream at once
+	// (0 means no limit)
+	ForwardWorkers int `json:"forward_workers"`
+
+	// ForwardQueue is how many more queries may wait for a free worker
+	// before queries are refused
+	ForwardQueue int `json:"forward_queue"`
+
+	// RateLimitQPS is the average queries per second allowed from each
+	// client /24 or /56 prefix (0 disables rate limiting)
+	RateLimitQPS float64 `json:"rate_limit_qps"`
+
+	// RateLimitBurst is how many queries a prefix may send at once
+	// (0 means twice RateLimitQPS)
+	RateLimitBurst int `json:"rate_limit_burst"`
+
+	// LocalZones are domains answered by the server itself; names in
+	// them without a local record get NXDOMAIN
+	LocalZones []string `json:"local_zones"`
+
+	// LocalRecords are records served locally, in zone-file format such
+	// as "nas.home.arpa. 300 IN A 192.168.1.10"
+	LocalRecords []string `json:"local_records"`
+
+	// SpecialUseNames answers localhost, the special-use domains such as
+	// .invalid and .local, and the reverse zones of loopback and
+	// documentation addresses locally instead of forwarding them.
+	// home.arpa and private reverse zones are always forwarded, since LAN
+	// resolvers serve them.
+	SpecialUseNames bool `json:"special_use_names"`
+
+	// Views give the clients in some subnets their own way of answering
+	// blocked names; other clients get 0.0.0.0 and :: with a 60s TTL
+	Views []ViewConfig `json:"views"`
+}
+
+// ViewConfig is the blocking policy of the clients in some subnets.
+type ViewConfig struct {
+	// Name identifies the view in the block log
+	Name string `json:"name"`
+
+	// Subnets are the client prefixes in the view, such as "10.1.0.0/16".
+	// A client belongs to the view with its most specific matching prefix.
+	Subnets []string `json:"subnets"`
+
+	// Mode is how blocked names are answered: sinkhole (0.0.0.0 and ::),
+	// nxdomain, redirect (to RedirectIPv4 and RedirectIPv6) or allow (not
+	// blocked)
+	Mode string `json:"mode"`
+
+	// TTL is the TTL of blocked answers (0 means 60s)
+	TTL Duration `json:"ttl"`
+
+	// RedirectIPv4 and RedirectIPv6 are the answers of the redirect mode,
+	// such as the address of a page explaining the action
+	RedirectIPv4 string `json:"redirect_ipv4,omitempty"`
+	RedirectIPv6 string `json:"redirect_ipv6,omitempty"`
 }
 
 // APIConfig holds Online Picketline API settings.
@@ -49,8 +152,16 @@ type APIConfig struct {
 	// RefreshInterval is how often to refresh the blocklist
 	RefreshInterval Duration `json:"refresh_interval"`
 
+	// RefreshJitter spreads each refresh over plus or minus this fraction
+	// of the interval, so servers started together do not refresh together
+	RefreshJitter float64 `json:"refresh_jitter"`
+
 	// Timeout is the HTTP request timeout
 	Timeout Duration `json:"timeout"`
+
+	// SnapshotPath is where the last fetched blocklist is saved, so a restart
+	// can serve it immediately while the API is revalidated (empty disables)
+	SnapshotPath string `json:"snapshot_path"`
 }
 
 // LoggingConfig holds logging settings.
@@ -60,6 +171,14 @@ type LoggingConfig struct {
 
 	// Format is the log format (json, text)
 	Format string `json:"format"`
+
+	// BlockLogBuffer is how many blocked-query log entries may wait for the
+	// log writer before the oldest are dropped
+	BlockLogBuffer int `json:"block_log_buffer"`
+
+	// BlockLogPerDomain is the most blocked-query log entries written per
+	// domain each second (0 means no limit)
+	BlockLogPerDomain int `json:"block_log_per_domain"`
 }
 
 // StatsConfig holds stats reporting settings.
@@ -77,6 +196,21 @@ type StatsConfig struct {
 	// ReportURL is the URL to POST stats reports to.
 	// Defaults to {api.base_url}/dns-stats/report
 	ReportURL string `json:"report_url"`
+
+	// ReportGzip sends stats reports gzip-compressed
+	ReportGzip bool `json:"report_gzip"`
+
+	// MetricsAddr is the address of an HTTP listener serving Prometheus
+	// metrics at /metrics. Empty disables it.
+	MetricsAddr string `json:"metrics_addr"`
+
+	// Pprof also serves net/http/pprof profiles on the metrics listener
+	Pprof bool `json:"pprof"`
+
+	// Analytics adds per-type and per-RCODE counts, distinct name and
+	// client estimates and the busiest client prefixes to the metrics and
+	// reports
+	Analytics bool `json:"analytics"`
 }
 
 // Duration is a wrapper for time.Duration that supports JSON marshaling.
@@ -115,15 +249,29 @@ func (d *Duration) UnmarshalJSON(b []byte) error {
 func DefaultConfig() *Config {
 	return &Config{
 		DNS: DNSConfig{
-			ListenAddr:   "0.0.0.0:53",
-			UpstreamDNS:  []string{"8.8.8.8:53", "8.8.4.4:53"},
-			CacheTTL:     Duration{5 * time.Minute},
-			QueryTimeout: Duration{5 * time.Second},
+			ListenAddr:    "0.0.0.0:53",
+			UpstreamDNS:   []string{"8.8.8.8:53", "8.8.4.4:53"},
+			CacheTTL:      Duration{5 * time.Minute},
+			CacheSize:     10000,
+			CacheStaleTTL: Duration{time.Hour},
+			CachePrefetch: true,
+			QueryTimeout:  Duration{5 * time.Second},
+			UDPBatch:      true,
+
+			TCPIdleTimeout:    Duration{10 * time.Second},
+			StreamMaxInflight: 32,
+			StreamMaxConns:    4096,
+
+			ForwardWorkers: 1024,
+			ForwardQueue:   4096,
+
+			SpecialUseNames: true,
 		},
 		API: APIConfig{
 			BaseURL:         "https://onlinepicketline.com/api",
 			APIKey:          "",
 			RefreshInterval: Duration{15 * time.Minute},
+			RefreshJitter:   0.1,
 			Timeout:         Duration{10 * time.Second},
 		},
 		Stats: StatsConfig{
@@ -131,10 +279,16 @@ func DefaultConfig() *Config {
 			ReportInterval: Duration{5 * time.Minute},
 			InstanceID:     "",
 			ReportURL:      "",
+			ReportGzip:     true,
+			MetricsAddr:    "",
+			Pprof:          false,
+			Analytics:      false,
 		},
 		Logging: LoggingConfig{
-			Level:  "info",
-			Format: "text",
+			Level:             "info",
+			Format:            "text",
+			BlockLogBuffer:    1024,
+			BlockLogPerDomain: 10,
 		},
 	}
 }
@@ -195,6 +349,9 @@ func (c *Config) applyEnvOverrides() {
 	if v := os.Getenv("STATS_REPORT_URL"); v != "" {
 		c.Stats.ReportURL = v
 	}
+	if v := os.Getenv("STATS_METRICS_ADDR"); v != "" {
+		c.Stats.MetricsAddr = v
+	}
 }
 
 // Save saves the configuration to a JSON file.
@@ -219,8 +376,103 @@ func (c *Config) Validate() error {
 	if len(c.DNS.UpstreamDNS) == 0 {
 		return fmt.Errorf("dns.upstream_dns is required")
 	}
+	if c.DNS.Listeners < 0 {
+		return fmt.Errorf("dns.listeners must not be negative")
+	}
+	if c.DNS.CacheTTL.Duration > 0 && c.DNS.CacheSize <= 0 {
+		return fmt.Errorf("dns.cache_size must be positive when dns.cache_ttl is set")
+	}
+	if c.DNS.CacheStaleTTL.Duration < 0 {
+		return fmt.Errorf("dns.cache_stale_ttl must not be negative")
+	}
+	if (c.DNS.DoTListenAddr != "" || c.DNS.DoHListenAddr != "") && (c.DNS.TLSCertFile == "" || c.DNS.TLSKeyFile == "") {
+		return fmt.Errorf("dns.tls_cert_file and dns.tls_key_file are required for DNS-over-TLS and DNS-over-HTTPS")
+	}
+	if c.DNS.TCPIdleTimeout.Duration < 0 {
+		return fmt.Errorf("dns.tcp_idle_timeout must not be negative")
+	}
+	if c.DNS.StreamMaxInflight < 0 || c.DNS.StreamMaxConns < 0 {
+		return fmt.Errorf("dns.stream_max_inflight and dns.stream_max_conns must not be negative")
+	}
+	if c.DNS.ForwardWorkers < 0 || c.DNS.ForwardQueue < 0 {
+		return fmt.Errorf("dns.forward_workers and dns.forward_queue must not be negative")
+	}
+	if c.DNS.RateLimitQPS < 0 || c.DNS.RateLimitBurst < 0 {
+		return fmt.Errorf("dns.rate_limit_qps and dns.rate_limit_burst must not be negative")
+	}
+	for _, zone := range c.DNS.LocalZones {
+		if strings.Trim(zone, ".") == "" {
+			return fmt.Errorf("dns.local_zones must not contain empty names or the root")
+		}
+	}
+	views := make(map[string]bool, len(c.DNS.Views))
+	for _, v := range c.DNS.Views {
+		if err := v.validate(); err != nil {
+			return err
+		}
+		if views[v.Name] {
+			return fmt.Errorf("dns.views: duplicate view %q", v.Name)
+		}
+		views[v.Name] = true
+	}
 	if c.API.BaseURL == "" {
 		return fmt.Errorf("api.base_url is required")
 	}
+	if c.API.RefreshInterval.Duration <= 0 {
+		return fmt.Errorf("api.refresh_interval must be positive")
+	}
+	if c.API.RefreshJitter < 0 || c.API.RefreshJitter >= 1 {
+		return fmt.Errorf("api.refresh_jitter must be at least 0 and less than 1")
+	}
+	if c.Stats.Enabled && c.Stats.ReportInterval.Duration <= 0 {
+		return fmt.Errorf("stats.report_interval must be positive when stats are enabled")
+	}
+	if c.Stats.MetricsAddr != "" {
+		if _, _, err := net.SplitHostPort(c.Stats.MetricsAddr); err != nil {
+			return fmt.Errorf("stats.metrics_addr: %w", err)
+		}
+	} else if c.Stats.Pprof {
+		return fmt.Errorf("stats.pprof requires stats.metrics_addr")
+	}
+	if c.Logging.BlockLogBuffer <= 0 {
+		return fmt.Errorf("logging.block_log_buffer must be positive")
+	}
+	if c.Logging.BlockLogPerDomain < 0 {
+		return fmt.Errorf("logging.block_log_per_domain must not be negative")
+	}
+	return nil
+}
+
+// validate checks one entry of dns.views.
+func (v *ViewConfig) validate() error {
+	if v.Name == "" {
+		return fmt.Errorf("dns.views: every view needs a name")
+	}
+	if len(v.Subnets) == 0 {
+		return fmt.Errorf("dns.views: view %q has no subnets", v.Name)
+	}
+	for _, subnet := range v.Subnets {
+		if _, err := netip.ParsePrefix(subnet); err != nil {
+			return fmt.Errorf("dns.views: view %q: %w", v.Name, err)
+		}
+	}
+	if v.TTL.Duration < 0 {
+		return fmt.Errorf("dns.views: view %q has a negative ttl", v.Name)
+	}
+	switch v.Mode {
+	case "", "sinkhole", "nxdomain", "allow":
+	case "redirect":
+		if v.RedirectIPv4 == "" && v.RedirectIPv6 == "" {
+			return fmt.Errorf("dns.views: view %q needs redirect_ipv4 or redirect_ipv6", v.Name)
+		}
+		if addr, err := netip.ParseAddr(v.RedirectIPv4); v.RedirectIPv4 != "" && (err != nil || !addr.Is4()) {
+			return fmt.Errorf("dns.views: view %q: redirect_ipv4 %q is not an IPv4 address", v.Name, v.RedirectIPv4)
+		}
+		if addr, err := netip.ParseAddr(v.RedirectIPv6); v.RedirectIPv6 != "" && (err != nil || !addr.Is6() || addr.Is4In6()) {
+			return fmt.Errorf("dns.views: view %q: redirect_ipv6 %q is not an IPv6 address", v.Name, v.RedirectIPv6)
+		}
+	default:
+		return fmt.Errorf("dns.views: view %q has unknown mode %q", v.Name, v.Mode)
+	}
 	return nil
 }
@@ -107,11 +107,141 @@ func TestConfigValidate(t *testing.T) {
 			modify:  func(c *Config) { c.DNS.UpstreamDNS = nil },
 			wantErr: "dns.upstream_dns",
 		},
+		{
+			name:    "negative listeners",
+			modify:  func(c *Config) { c.DNS.Listeners = -1 },
+			wantErr: "dns.listeners",
+		},
+		{
+			name: "cache enabled without size",
+			modify: func(c *Config) {
+				c.DNS.CacheSize = 0
+			},
+			wantErr: "dns.cache_size",
+		},
+		{
+			name:    "negative stale TTL",
+			modify:  func(c *Config) { c.DNS.CacheStaleTTL = Duration{-time.Second} },
+			wantErr: "dns.cache_stale_ttl",
+		},
+		{
+			name: "DNS-over-TLS with certificate",
+			modify: func(c *Config) {
+				c.DNS.DoTListenAddr = "0.0.0.0:853"
+				c.DNS.TLSCertFile = "/etc/opl-dns/cert.pem"
+				c.DNS.TLSKeyFile = "/etc/opl-dns/key.pem"
+			},
+			wantErr: "",
+		},
+		{
+			name:    "DNS-over-HTTPS without certificate",
+			modify:  func(c *Config) { c.DNS.DoHListenAddr = "0.0.0.0:443" },
+			wantErr: "dns.tls_cert_file",
+		},
+		{
+			name:    "negative TCP idle timeout",
+			modify:  func(c *Config) { c.DNS.TCPIdleTimeout = Duration{-time.Second} },
+			wantErr: "dns.tcp_idle_timeout",
+		},
+		{
+			name:    "negative stream in-flight limit",
+			modify:  func(c *Config) { c.DNS.StreamMaxInflight = -1 },
+			wantErr: "dns.stream_max_inflight",
+		},
+		{
+			name:    "negative forward queue",
+			modify:  func(c *Config) { c.DNS.ForwardQueue = -1 },
+			wantErr: "dns.forward_queue",
+		},
+		{
+			name:    "negative rate limit",
+			modify:  func(c *Config) { c.DNS.RateLimitQPS = -5 },
+			wantErr: "dns.rate_limit_qps",
+		},
+		{
+			name:    "root local zone",
+			modify:  func(c *Config) { c.DNS.LocalZones = []string{"lan", "."} },
+			wantErr: "dns.local_zones",
+		},
+		{
+			name: "views",
+			modify: func(c *Config) {
+				c.DNS.Views = []ViewConfig{
+					{Name: "guests", Subnets: []string{"10.2.0.0/16", "fd00:2::/32"}, Mode: "nxdomain", TTL: Duration{5 * time.Minute}},
+					{Name: "office", Subnets: []string{"10.1.0.0/16"}, Mode: "redirect", RedirectIPv4: "10.1.0.80"},
+				}
+			},
+			wantErr: "",
+		},
+		{
+			name: "view with bad subnet",
+			modify: func(c *Config) {
+				c.DNS.Views = []ViewConfig{{Name: "guests", Subnets: []string{"10.2.0.0"}}}
+			},
+			wantErr: "dns.views",
+		},
+		{
+			name: "redirect view without address",
+			modify: func(c *Config) {
+				c.DNS.Views = []ViewConfig{{Name: "office", Subnets: []string{"10.1.0.0/16"}, Mode: "redirect"}}
+			},
+			wantErr: "redirect_ipv4",
+		},
+		{
+			name: "duplicate view",
+			modify: func(c *Config) {
+				c.DNS.Views = []ViewConfig{
+					{Name: "lab", Subnets: []string{"10.3.0.0/16"}, Mode: "allow"},
+					{Name: "lab", Subnets: []string{"10.4.0.0/16"}, Mode: "allow"},
+				}
+			},
+			wantErr: "duplicate view",
+		},
+		{
+			name:    "zero report interval",
+			modify:  func(c *Config) { c.Stats.Enabled = true; c.Stats.ReportInterval = Duration{0} },
+			wantErr: "stats.report_interval",
+		},
+		{
+			name:    "metrics listener",
+			modify:  func(c *Config) { c.Stats.MetricsAddr = "127.0.0.1:9153"; c.Stats.Pprof = true },
+			wantErr: "",
+		},
+		{
+			name:    "invalid metrics address",
+			modify:  func(c *Config) { c.Stats.MetricsAddr = "9153" },
+			wantErr: "stats.metrics_addr",
+		},
+		{
+			name:    "pprof without metrics listener",
+			modify:  func(c *Config) { c.Stats.Pprof = true },
+			wantErr: "stats.pprof",
+		},
 		{
 			name:    "missing API base URL",
 			modify:  func(c *Config) { c.API.BaseURL = "" },
 			wantErr: "api.base_url",
 		},
+		{
+			name:    "zero refresh interval",
+			modify:  func(c *Config) { c.API.RefreshInterval = Duration{0} },
+			wantErr: "api.refresh_interval",
+		},
+		{
+			name:    "refresh jitter of a whole interval",
+			modify:  func(c *Config) { c.API.RefreshJitter = 1 },
+			wantErr: "api.refresh_jitter",
+		},
+		{
+			name:    "zero block log buffer",
+			modify:  func(c *Config) { c.Logging.BlockLogBuffer = 0 },
+			wantErr: "logging.block_log_buffer",
+		},
+		{
+			name:    "negative block log per-domain limit",
+			modify:  func(c *Config) { c.Logging.BlockLogPerDomain = -1 },
+			wantErr: "logging.block_log_per_domain",
+		},
 	}
 
 	for _, tt := range tests {
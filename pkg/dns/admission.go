@@ -0,0 +1,233 @@
+package dns
+
+import (
+	"encoding/binary"
+	"math/rand"
+	"net/netip"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/miekg/dns"
+)
+
+const (
+	// Clients are rate limited by prefix rather than by address, so that
+	// an IPv6 client cannot escape its limit by rotating through its own
+	// subnet. The sizes follow those commonly used for DNS response rate
+	// limiting.
+	rateLimitIPv4Prefix = 24
+	rateLimitIPv6Prefix = 56
+
+	// The rate limiter table has rateLimitShards*rateLimitSets sets of
+	// rateLimitWays buckets, about 1.5 MB, however many clients there are.
+	rateLimitShards = 64
+	rateLimitSets   = 256
+	rateLimitWays   = 4
+)
+
+// rateLimiter is a token bucket per client prefix, kept in a fixed-size
+// set-associative table. Prefixes hash to a set of rateLimitWays buckets;
+// a prefix not in its set replaces the bucket with the most tokens once
+// refilled, and starts full. A prefix being limited has an emptier bucket
+// than any newcomer, so a flood of distinct, possibly spoofed, sources
+// evicts the newcomers and buckets that have refilled anyway rather than
+// resetting the abuser's. Memory stays fixed.
+type rateLimiter struct {
+	rate  float64 // tokens per nanosecond
+	burst float64
+	seed  uint64
+
+	shards  [rateLimitShards]rateShard
+	limited atomic.Int64
+}
+
+type rateShard struct {
+	mu   sync.Mutex
+	sets [rateLimitSets][rateLimitWays]rateSlot
+}
+
+type rateSlot struct {
+	key    uint64
+	tokens float64
+	last   int64 // nanoseconds; 0 when unused
+}
+
+// newRateLimiter allows each prefix qps queries per second on average and
+// bursts of up to burst queries.
+func newRateLimiter(qps float64, burst int) *rateLimiter {
+	return &rateLimiter{
+		rate:  qps / float64(time.Second),
+		burst: float64(burst),
+		seed:  rand.Uint64(),
+	}
+}
+
+// allow reports whether a query from addr at now is within its prefix's
+// rate, and takes a token if so.
+func (rl *rateLimiter) allow(addr netip.Addr, now time.Time) bool {
+	key := prefixKey(addr)
+	shard, set := rl.set(key)
+	ns := now.UnixNano()
+
+	shard.mu.Lock()
+	var slot *rateSlot
+	victim, victimTokens := &set[0], -1.0
+	for i := range set {
+		way := &set[i]
+		if way.last == 0 {
+			if victimTokens < rl.burst {
+				victim, victimTokens = way, rl.burst
+			}
+			continue
+		}
+		tokens := rl.refilled(way, ns)
+		if way.key == key {
+			slot = way
+			slot.tokens = tokens
+			break
+		}
+		if tokens > victimTokens {
+			victim, victimTokens = way, tokens
+		}
+	}
+	if slot == nil {
+		slot = victim
+		slot.key = key
+		slot.tokens = rl.burst
+	}
+	slot.last = ns
+	ok := slot.tokens >= 1
+	if ok {
+		slot.tokens--
+	}
+	shard.mu.Unlock()
+
+	if !ok {
+		rl.limited.Add(1)
+	}
+	return ok
+}
+
+// set returns the shard and bucket set of a prefix key.
+func (rl *rateLimiter) set(key uint64) (*rateShard, *[rateLimitWays]rateSlot) {
+	h := mix64(key ^ rl.seed)
+	shard := &rl.shards[h%rateLimitShards]
+	return shard, &shard.sets[(h>>32)%rateLimitSets]
+}
+
+// refilled returns the tokens of an in-use bucket at ns.
+func (rl *rateLimiter) refilled(slot *rateSlot, ns int64) float64 {
+	if elapsed := ns - slot.last; elapsed > 0 {
+		return min(rl.burst, slot.tokens+float64(elapsed)*rl.rate)
+	}
+	return slot.tokens
+}
+
+// prefixKey packs the rate-limited prefix of addr into a uint64. The low
+// byte, which an IPv6 /56 leaves zero, marks IPv4 keys so the families
+// cannot collide.
+func prefixKey(addr netip.Addr) uint64 {
+	addr = addr.Unmap()
+	if addr.Is4() {
+		b := addr.As4()
+		return uint64(binary.BigEndian.Uint32(b[:])>>(32-rateLimitIPv4Prefix))<<8 | 1
+	}
+	b := addr.As16()
+	return binary.BigEndian.Uint64(b[:8]) >> (64 - rateLimitIPv6Prefix) << (64 - rateLimitIPv6Prefix)
+}
+
+// mix64 is the splitmix64 finalizer.
+func mix64(x uint64) uint64 {
+	x ^= x >> 30
+	x *= 0xbf58476d1ce4e5b9
+	x ^= x >> 27
+	x *= 0x94d049bb133111eb
+	x ^= x >> 31
+	return x
+}
+
+// forwardLimiter bounds how many queries are being forwarded upstream at
+// once. Queries beyond the limit wait in a queue of bounded length for at
+// most the query timeout; beyond that they are refused at once, so a burst
+// costs a fixed number of goroutines blocked on upstreams instead of one
+// per packet.
+type forwardLimiter struct {
+	slots   chan struct{}
+	queue   int64
+	wait    atomic.Int64 // nanoseconds
+	waiting atomic.Int64
+	refused atomic.Int64
+}
+
+func newForwardLimiter(workers, queue int, wait time.Duration) *forwardLimiter {
+	l := &forwardLimiter{
+		slots: make(chan struct{}, workers),
+		queue: int64(queue),
+	}
+	l.setWait(wait)
+	return l
+}
+
+// setWait changes how long queued queries wait for a slot.
+func (l *forwardLimiter) setWait(wait time.Duration) {
+	l.wait.Store(int64(wait))
+}
+
+// acquire takes a forwarding slot, waiting if the queue has room. It
+// reports false if the query should be refused.
+func (l *forwardLimiter) acquire() bool {
+	if l.tryAcquire() {
+		return true
+	}
+	if l.waiting.Add(1) > l.queue {
+		l.waiting.Add(-1)
+		l.refused.Add(1)
+		return false
+	}
+	defer l.waiting.Add(-1)
+
+	timer := time.NewTimer(time.Duration(l.wait.Load()))
+	defer timer.Stop()
+	select {
+	case l.slots <- struct{}{}:
+		return true
+	case <-timer.C:
+		l.refused.Add(1)
+		return false
+	}
+}
+
+// tryAcquire takes a forwarding slot only if one is free.
+func (l *forwardLimiter) tryAcquire() bool {
+	select {
+	case l.slots <- struct{}{}:
+		return true
+	default:
+		return false
+	}
+}
+
+func (l *forwardLimiter) release() {
+	<-l.slots
+}
+
+// limitedReply is the answer to a query over its client's rate: a
+// truncated response over UDP, which a real client retries over TCP while
+// a spoofed source cannot, and REFUSED otherwise.
+func limitedReply(r *dns.Msg, udp bool) *dns.Msg {
+	m := newReply(r)
+	if udp {
+		m.Truncated = true
+	} else {
+		m.Rcode = dns.RcodeRefused
+	}
+	return m
+}
+
+// refusedReply is the answer to a query the server is too busy to forward.
+func refusedReply(r *dns.Msg) *dns.Msg {
+	m := newReply(r)
+	m.Rcode = dns.RcodeRefused
+	return m
+}
@@ -0,0 +1,209 @@
+package dns
+
+import (
+	"io"
+	"log/slog"
+	"net/netip"
+	"testing"
+	"time"
+
+	"github.com/miekg/dns"
+	"github.com/online-picket-line/opl-for-dns/pkg/api"
+)
+
+func TestRateLimiterBurstAndRefill(t *testing.T) {
+	rl := newRateLimiter(10, 5)
+	client := netip.MustParseAddr("192.0.2.1")
+	now := time.Unix(1700000000, 0)
+
+	for i := 0; i < 5; i++ {
+		if !rl.allow(client, now) {
+			t.Fatalf("Query %d of the burst was limited", i+1)
+		}
+	}
+	if rl.allow(client, now) {
+		t.Error("Expected the query after the burst to be limited")
+	}
+	if rl.allow(client, now.Add(50*time.Millisecond)) {
+		t.Error("Expected no token after half the refill interval")
+	}
+	if !rl.allow(client, now.Add(100*time.Millisecond)) {
+		t.Error("Expected a token after 100ms at 10 qps")
+	}
+	if got := rl.limited.Load(); got != 2 {
+		t.Errorf("Expected 2 limited queries, got %d", got)
+	}
+}
+
+func TestRateLimiterPrefixes(t *testing.T) {
+	tests := []struct {
+		a, b string
+		same bool
+	}{
+		{"192.0.2.1", "192.0.2.200", true},
+		{"192.0.2.1", "192.0.3.1", false},
+		{"192.0.2.1", "::ffff:192.0.2.9", true},
+		{"2001:db8:0:1::1", "2001:db8:0:ff::2", true},
+		{"2001:db8:0:1::1", "2001:db8:0:100::1", false},
+		{"0.0.0.1", "::1", false},
+	}
+
+	for _, tt := range tests {
+		a, b := prefixKey(netip.MustParseAddr(tt.a)), prefixKey(netip.MustParseAddr(tt.b))
+		if (a == b) != tt.same {
+			t.Errorf("prefixKey(%s) == prefixKey(%s) is %v, want %v", tt.a, tt.b, a == b, tt.same)
+		}
+	}
+}
+
+func TestRateLimiterSeparatesClients(t *testing.T) {
+	rl := newRateLimiter(1, 1)
+	now := time.Now()
+
+	if !rl.allow(netip.MustParseAddr("192.0.2.1"), now) {
+		t.Fatal("Expected the first query to be allowed")
+	}
+	if rl.allow(netip.MustParseAddr("192.0.2.2"), now) {
+		t.Error("Expected a client in the same /24 to share the limit")
+	}
+	if !rl.allow(netip.MustParseAddr("198.51.100.1"), now) {
+		t.Error("Expected another prefix to have its own limit")
+	}
+}
+
+// collidingClients returns n clients in distinct /24s whose prefixes all
+// map to the same bucket set of rl.
+func collidingClients(t *testing.T, rl *rateLimiter, n int) []netip.Addr {
+	t.Helper()
+	first := netip.MustParseAddr("10.0.0.1")
+	_, want := rl.set(prefixKey(first))
+	clients := []netip.Addr{first}
+	for i := uint32(1); i < 1<<22 && len(clients) < n; i++ {
+		addr := netip.AddrFrom4([4]byte{byte(10 + i>>16), byte(i >> 8), byte(i), 1})
+		if _, set := rl.set(prefixKey(addr)); set == want {
+			clients = append(clients, addr)
+		}
+	}
+	if len(clients) < n {
+		t.Fatalf("Found only %d colliding prefixes", len(clients))
+	}
+	return clients
+}
+
+func TestRateLimiterCollisionsKeepAbuserLimited(t *testing.T) {
+	// Two prefixes sharing a set, and more prefixes than the set has ways
+	for _, n := range []int{2, rateLimitWays + 1, 4 * rateLimitWays} {
+		rl := newRateLimiter(1, 5)
+		clients := collidingClients(t, rl, n)
+		abuser, others := clients[0], clients[1:]
+		now := time.Unix(1700000000, 0)
+
+		allowed := 0
+		for round := 0; round < 50; round++ {
+			now = now.Add(time.Millisecond)
+			if rl.allow(abuser, now) {
+				allowed++
+			}
+			// Every other prefix queries once per round, in turn
+			rl.allow(others[round%len(others)], now)
+		}
+		// 5 tokens of burst, and well under one refilled in 50ms
+		if allowed > 5 {
+			t.Errorf("%d colliding prefixes: abuser was allowed %d of 50 queries", n, allowed)
+		}
+	}
+}
+
+func TestRateLimiterDoesNotAllocate(t *testing.T) {
+	rl := newRateLimiter(1000, 1000)
+	client := netip.MustParseAddr("2001:db8::1")
+	now := time.Now()
+	allocs := testing.AllocsPerRun(100, func() {
+		rl.allow(client, now)
+	})
+	if allocs != 0 {
+		t.Errorf("Expected no allocations, got %v", allocs)
+	}
+}
+
+func TestForwardLimiterQueuesThenRefuses(t *testing.T) {
+	l := newForwardLimiter(1, 1, time.Second)
+	if !l.acquire() {
+		t.Fatal("Expected the first slot to be free")
+	}
+
+	queued := make(chan bool)
+	go func() { queued <- l.acquire() }()
+	for l.waiting.Load() == 0 {
+		time.Sleep(time.Millisecond)
+	}
+
+	// The queue is full, so this is refused without waiting
+	start := time.Now()
+	if l.acquire() {
+		t.Error("Expected a query beyond the queue to be refused")
+	}
+	if elapsed := time.Since(start); elapsed > 100*time.Millisecond {
+		t.Errorf("Refusal took %v, expected it to be immediate", elapsed)
+	}
+
+	l.release()
+	if !<-queued {
+		t.Error("Expected the queued query to get the released slot")
+	}
+	if l.tryAcquire() {
+		t.Error("Expected no free slot while the queued query holds it")
+	}
+	if got := l.refused.Load(); got != 1 {
+		t.Errorf("Expected 1 refused query, got %d", got)
+	}
+}
+
+func TestForwardLimiterWaitTimeout(t *testing.T) {
+	l := newForwardLimiter(1, 10, 20*time.Millisecond)
+	l.acquire()
+	if l.acquire() {
+		t.Error("Expected the queued query to give up after the wait")
+	}
+	if got := l.waiting.Load(); got != 0 {
+		t.Errorf("Expected no waiting queries, got %d", got)
+	}
+}
+
+func TestServeDNSRateLimited(t *testing.T) {
+	logger := slog.New(slog.NewTextHandler(io.Discard, nil))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	apiClient.SetBlocklistForTesting([]api.BlockListItem{{URL: "https://example.com", Employer: "Test Corp"}})
+	server, err := NewServer("127.0.0.1:5353", []string{"8.8.8.8:53"}, 5*time.Second, apiClient, nil, logger,
+		WithRateLimit(1, 1))
+	if err != nil {
+		t.Fatalf("NewServer failed: %v", err)
+	}
+	defer server.Stop()
+
+	r := new(dns.Msg)
+	r.SetQuestion("www.example.com.", dns.TypeA)
+
+	w := &mockDNSWriter{}
+	server.ServeDNS(w, r)
+	if w.msg == nil || len(w.msg.Answer) != 1 {
+		t.Fatalf("Expected the first query to be answered, got %v", w.msg)
+	}
+
+	w = &mockDNSWriter{}
+	server.ServeDNS(w, r)
+	if w.msg == nil || !w.msg.Truncated || len(w.msg.Answer) != 0 {
+		t.Errorf("Expected an empty truncated answer over UDP, got %v", w.msg)
+	}
+}
+
+func BenchmarkRateLimiterAllow(b *testing.B) {
+	rl := newRateLimiter(1e9, 1e9)
+	b.ReportAllocs()
+	b.RunParallel(func(pb *testing.PB) {
+		now := time.Now()
+		for i := 0; pb.Next(); i++ {
+			rl.allow(netip.AddrFrom4([4]byte{10, byte(i >> 16), byte(i >> 8), byte(i)}), now)
+		}
+	})
+}
@@ -0,0 +1,291 @@
+//go:build linux
+
+package dns
+
+import (
+	"net"
+	"sync"
+	"syscall"
+
+	"golang.org/x/net/ipv4"
+	"golang.org/x/net/ipv6"
+)
+
+const (
+	// udpBatchSize is the most datagrams moved per recvmmsg/sendmmsg call.
+	udpBatchSize = 32
+
+	// udpBatchBufSize is the receive buffer per datagram, large enough for
+	// any EDNS0 query we accept.
+	udpBatchBufSize = 4096
+)
+
+// batchIO is implemented by both ipv4.PacketConn and ipv6.PacketConn;
+// their Message types are the same underlying x/net/internal/socket type.
+type batchIO interface {
+	ReadBatch(ms []ipv4.Message, flags int) (int, error)
+	WriteBatch(ms []ipv4.Message, flags int) (int, error)
+}
+
+// batchUDP wraps a UDP socket in a batchConn, which reads and writes many
+// datagrams per system call.
+func batchUDP(conn *net.UDPConn) (net.PacketConn, error) {
+	c, err := newBatchConn(conn)
+	if err != nil {
+		return nil, err
+	}
+	return c, nil
+}
+
+// batchAddr is the client address handed to miekg/dns for each datagram.
+// It remembers which local address the query arrived on, so the reply
+// leaves from the same address on multi-homed hosts.
+type batchAddr struct {
+	net.UDPAddr
+	dst     net.IP
+	ifIndex int
+}
+
+// batchConn is a net.PacketConn that reads with recvmmsg and writes with
+// sendmmsg. miekg/dns has a single reader per socket, which drains a batch
+// one datagram at a time; replies from handler goroutines are queued and
+// flushed together by a writer goroutine.
+type batchConn struct {
+	*net.UDPConn
+	io batchIO
+
+	// withDst is set when the socket is bound to an unspecified address and
+	// replies need their source address set from the query's destination.
+	withDst   bool
+	ipv6      bool
+	oobLen    int
+	readMu    sync.Mutex
+	readMsgs  []ipv4.Message
+	readNext  int
+	readCount int
+
+	// writeMu guards closed: WriteTo holds it shared while queueing, so
+	// that once Close has set closed under it nothing more is queued and
+	// writes can be closed for the writer goroutine to drain
+	writeMu   sync.RWMutex
+	closed    bool
+	writes    chan outPacket
+	flushed   chan struct{}
+	closeOnce sync.Once
+}
+
+type outPacket struct {
+	buf  *[]byte
+	n    int
+	addr *net.UDPAddr
+	oob  []byte
+}
+
+var batchBufPool = sync.Pool{
+	New: func() any {
+		b := make([]byte, udpBatchBufSize)
+		return &b
+	},
+}
+
+func newBatchConn(conn *net.UDPConn) (*batchConn, error) {
+	local := conn.LocalAddr().(*net.UDPAddr)
+	c := &batchConn{
+		UDPConn: conn,
+		withDst: local.IP == nil || local.IP.IsUnspecified(),
+		ipv6:    local.IP != nil && local.IP.To4() == nil,
+		writes:  make(chan outPacket, 4*udpBatchSize),
+		flushed: make(chan struct{}),
+	}
+
+	if c.ipv6 {
+		p := ipv6.NewPacketConn(conn)
+		if c.withDst {
+			if err := p.SetControlMessage(ipv6.FlagDst|ipv6.FlagInterface, true); err != nil {
+				return nil, err
+			}
+			c.oobLen = len(ipv6.NewControlMessage(ipv6.FlagDst | ipv6.FlagInterface))
+		}
+		c.io = p
+	} else {
+		p := ipv4.NewPacketConn(conn)
+		if c.withDst {
+			if err := p.SetControlMessage(ipv4.FlagDst|ipv4.FlagInterface, true); err != nil {
+				return nil, err
+			}
+			c.oobLen = len(ipv4.NewControlMessage(ipv4.FlagDst | ipv4.FlagInterface))
+		}
+		c.io = p
+	}
+
+	c.readMsgs = make([]ipv4.Message, udpBatchSize)
+	for i := range c.readMsgs {
+		c.readMsgs[i].Buffers = [][]byte{make([]byte, udpBatchBufSize)}
+		if c.oobLen > 0 {
+			c.readMsgs[i].OOB = make([]byte, c.oobLen)
+		}
+	}
+
+	go c.flushLoop()
+	return c, nil
+}
+
+// ReadFrom returns the next datagram, refilling the batch with a single
+// recvmmsg call when it is empty. Read deadlines apply to that call only;
+// datagrams already in the batch are returned regardless.
+func (c *batchConn) ReadFrom(b []byte) (int, net.Addr, error) {
+	c.readMu.Lock()
+	defer c.readMu.Unlock()
+
+	if c.readNext >= c.readCount {
+		for i := range c.readMsgs {
+			c.readMsgs[i].OOB = c.readMsgs[i].OOB[:cap(c.readMsgs[i].OOB)]
+		}
+		n, err := c.io.ReadBatch(c.readMsgs, 0)
+		if err != nil {
+			return 0, nil, err
+		}
+		c.readNext, c.readCount = 0, n
+	}
+
+	msg := &c.readMsgs[c.readNext]
+	c.readNext++
+
+	n := copy(b, msg.Buffers[0][:msg.N])
+	src, _ := msg.Addr.(*net.UDPAddr)
+	if src == nil {
+		return n, msg.Addr, nil
+	}
+
+	addr := &batchAddr{UDPAddr: *src}
+	if c.withDst && msg.NN > 0 {
+		c.parseDst(addr, msg.OOB[:msg.NN])
+	}
+	return n, addr, nil
+}
+
+func (c *batchConn) parseDst(addr *batchAddr, oob []byte) {
+	if c.ipv6 {
+		var cm ipv6.ControlMessage
+		if cm.Parse(oob) == nil {
+			addr.dst, addr.ifIndex = cm.Dst, cm.IfIndex
+		}
+		return
+	}
+	var cm ipv4.ControlMessage
+	if cm.Parse(oob) == nil {
+		addr.dst, addr.ifIndex = cm.Dst, cm.IfIndex
+	}
+}
+
+// WriteTo queues a reply for the writer goroutine. The datagram is copied,
+// so the caller may reuse b as soon as WriteTo returns.
+func (c *batchConn) WriteTo(b []byte, addr net.Addr) (int, error) {
+	var out outPacket
+	switch a := addr.(type) {
+	case *batchAddr:
+		out.addr = &a.UDPAddr
+		if a.dst != nil {
+			out.oob = c.sourceOOB(a.dst, a.ifIndex)
+		}
+	case *net.UDPAddr:
+		out.addr = a
+	default:
+		return 0, &net.OpError{Op: "write", Net: "udp", Addr: addr, Err: syscall.EAFNOSUPPORT}
+	}
+	if len(b) > udpBatchBufSize {
+		// Too large to pool; send it directly.
+		n, _, err := c.UDPConn.WriteMsgUDP(b, out.oob, out.addr)
+		return n, err
+	}
+
+	out.buf = batchBufPool.Get().(*[]byte)
+	out.n = copy(*out.buf, b)
+
+	c.writeMu.RLock()
+	defer c.writeMu.RUnlock()
+	if c.closed {
+		batchBufPool.Put(out.buf)
+		return 0, net.ErrClosed
+	}
+	c.writes <- out
+	return len(b), nil
+}
+
+func (c *batchConn) sourceOOB(src net.IP, ifIndex int) []byte {
+	if c.ipv6 {
+		return (&ipv6.ControlMessage{Src: src, IfIndex: ifIndex}).Marshal()
+	}
+	return (&ipv4.ControlMessage{Src: src, IfIndex: ifIndex}).Marshal()
+}
+
+// flushLoop writes queued replies. It blocks for the first reply, then
+// takes whatever else is already queued, so an idle server adds no delay
+// and a busy one sends up to udpBatchSize replies per sendmmsg call. It
+// returns once Close has closed writes and every queued reply is sent.
+func (c *batchConn) flushLoop() {
+	defer close(c.flushed)
+	msgs := make([]ipv4.Message, udpBatchSize)
+	pending := make([]outPacket, 0, udpBatchSize)
+
+	for {
+		out, ok := <-c.writes
+		if !ok {
+			return
+		}
+		pending = append(pending, out)
+	drain:
+		for len(pending) < udpBatchSize {
+			select {
+			case out, ok := <-c.writes:
+				if !ok {
+					break drain
+				}
+				pending = append(pending, out)
+			default:
+				break drain
+			}
+		}
+
+		for i, out := range pending {
+			msgs[i] = ipv4.Message{
+				Buffers: [][]byte{(*out.buf)[:out.n]},
+				OOB:     out.oob,
+				Addr:    out.addr,
+			}
+		}
+		c.writeAll(msgs[:len(pending)])
+
+		for i := range pending {
+			batchBufPool.Put(pending[i].buf)
+			pending[i] = outPacket{}
+		}
+		pending = pending[:0]
+	}
+}
+
+// writeAll sends every message, retrying after partial writes and skipping
+// a datagram the kernel rejects so one bad address cannot stall the rest.
+func (c *batchConn) writeAll(msgs []ipv4.Message) {
+	for len(msgs) > 0 {
+		n, _ := c.io.WriteBatch(msgs, 0)
+		if n <= 0 {
+			n = 1
+		}
+		msgs = msgs[n:]
+	}
+}
+
+// Close stops accepting replies, waits for the writer goroutine to send
+// those already queued, which WriteTo has reported as written, and then
+// closes the socket.
+func (c *batchConn) Close() error {
+	c.closeOnce.Do(func() {
+		c.writeMu.Lock()
+		c.closed = true
+		c.writeMu.Unlock()
+		close(c.writes)
+		<-c.flushed
+	})
+	return c.UDPConn.Close()
+}
@@ -0,0 +1,123 @@
+//go:build linux
+
+package dns
+
+import (
+	"fmt"
+	"net"
+	"testing"
+	"time"
+)
+
+// listenBatch opens a batched UDP socket on addr.
+func listenBatch(t *testing.T, addr string) net.PacketConn {
+	t.Helper()
+	conn, err := listenUDP(addr, false)
+	if err != nil {
+		t.Fatalf("listen: %v", err)
+	}
+	pc, err := batchUDP(conn)
+	if err != nil {
+		conn.Close()
+		t.Fatalf("batchUDP failed: %v", err)
+	}
+	return pc
+}
+
+func TestBatchConnEcho(t *testing.T) {
+	pc := listenBatch(t, "127.0.0.1:0")
+	defer pc.Close()
+
+	go func() {
+		buf := make([]byte, 512)
+		for {
+			n, addr, err := pc.ReadFrom(buf)
+			if err != nil {
+				return
+			}
+			pc.WriteTo(buf[:n], addr)
+		}
+	}()
+
+	client, err := net.Dial("udp", pc.LocalAddr().String())
+	if err != nil {
+		t.Fatalf("dial: %v", err)
+	}
+	defer client.Close()
+
+	const packets = 3 * udpBatchSize
+	for i := 0; i < packets; i++ {
+		fmt.Fprintf(client, "packet-%d", i)
+	}
+
+	seen := make(map[string]bool)
+	buf := make([]byte, 512)
+	client.SetReadDeadline(time.Now().Add(2 * time.Second))
+	for len(seen) < packets {
+		n, err := client.Read(buf)
+		if err != nil {
+			t.Fatalf("read after %d echoes: %v", len(seen), err)
+		}
+		seen[string(buf[:n])] = true
+	}
+}
+
+func TestBatchConnSourceAddress(t *testing.T) {
+	pc := listenBatch(t, "0.0.0.0:0")
+	defer pc.Close()
+
+	client, err := net.Dial("udp", net.JoinHostPort("127.0.0.1", fmt.Sprint(pc.LocalAddr().(*net.UDPAddr).Port)))
+	if err != nil {
+		t.Fatalf("dial: %v", err)
+	}
+	defer client.Close()
+	client.Write([]byte("ping"))
+
+	buf := make([]byte, 64)
+	pc.SetReadDeadline(time.Now().Add(2 * time.Second))
+	_, addr, err := pc.ReadFrom(buf)
+	if err != nil {
+		t.Fatalf("ReadFrom failed: %v", err)
+	}
+	ba, ok := addr.(*batchAddr)
+	if !ok {
+		t.Fatalf("Expected *batchAddr, got %T", addr)
+	}
+	if !ba.dst.Equal(net.IPv4(127, 0, 0, 1)) {
+		t.Errorf("Expected destination 127.0.0.1, got %v", ba.dst)
+	}
+}
+
+func TestBatchConnCloseSendsQueuedReplies(t *testing.T) {
+	pc := listenBatch(t, "127.0.0.1:0")
+
+	client, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+	if err != nil {
+		t.Fatalf("listen: %v", err)
+	}
+	defer client.Close()
+	client.SetReadBuffer(1 << 20)
+
+	// More replies than one sendmmsg call takes, so some are still queued
+	// when Close is called
+	const packets = 3 * udpBatchSize
+	for i := 0; i < packets; i++ {
+		if _, err := pc.WriteTo([]byte(fmt.Sprintf("reply-%d", i)), client.LocalAddr()); err != nil {
+			t.Fatalf("WriteTo failed: %v", err)
+		}
+	}
+	if err := pc.Close(); err != nil {
+		t.Fatalf("Close failed: %v", err)
+	}
+	if _, err := pc.WriteTo([]byte("late"), client.LocalAddr()); err == nil {
+		t.Error("Expected WriteTo after Close to fail")
+	}
+
+	buf := make([]byte, 64)
+	client.SetReadDeadline(time.Now().Add(2 * time.Second))
+	for i := 0; i < packets; i++ {
+		if _, err := client.Read(buf); err != nil {
+			t.Fatalf("Expected %d replies, got %d: %v", packets, i, err)
+		}
+	}
+}
@@ -0,0 +1,11 @@
+//go:build !linux
+
+package dns
+
+import "net"
+
+// batchUDP reports that this platform has no batched packet engine by
+// returning a nil connection; the listener then serves the plain socket.
+func batchUDP(conn *net.UDPConn) (net.PacketConn, error) {
+	return nil, nil
+}
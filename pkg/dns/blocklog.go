@@ -0,0 +1,219 @@
+package dns
+
+import (
+	"context"
+	"hash/maphash"
+	"log/slog"
+	"net/netip"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+const (
+	// blockLogSamplerSlots is the size of the per-domain rate-limit table.
+	// Domains hashing to the same slot share a budget.
+	blockLogSamplerSlots = 4096
+
+	// blockLogSummaryInterval is how often dropped and suppressed entry
+	// counts are reported.
+	blockLogSummaryInterval = 10 * time.Second
+)
+
+// blockEvent is a blocked query waiting to be logged. Fields are kept raw
+// and only formatted on the writer goroutine.
+type blockEvent struct {
+	at         time.Time
+	domain     string
+	client     netip.Addr
+	employer   string
+	actionType string
+	view       string
+}
+
+// blockLogger writes "Blocking domain" log lines off the query path.
+// Events go into a bounded ring buffer drained by one writer goroutine;
+// when the buffer is full the oldest event is overwritten. A per-domain
+// rate limit keeps a flood of queries for one blocked name from crowding
+// everything else out of the buffer.
+type blockLogger struct {
+	logger     *slog.Logger
+	perDomain  int32
+	samplerKey maphash.Seed
+	sampler    []samplerSlot
+
+	mu    sync.Mutex
+	ring  []blockEvent
+	head  int
+	count int
+
+	dropped    atomic.Int64
+	suppressed atomic.Int64
+
+	wake      chan struct{}
+	done      chan struct{}
+	finished  chan struct{}
+	startOnce sync.Once
+	closeOnce sync.Once
+}
+
+// samplerSlot counts log entries for the domains hashing to it within the
+// current one-second window.
+type samplerSlot struct {
+	window atomic.Int64
+	count  atomic.Int32
+}
+
+// newBlockLogger returns a block logger holding up to bufferSize pending
+// entries and logging at most perDomain entries per domain per second
+// (0 means no per-domain limit). The writer goroutine is started by the
+// first entry, so a server that blocks nothing runs none.
+func newBlockLogger(logger *slog.Logger, bufferSize, perDomain int) *blockLogger {
+	if bufferSize < 1 {
+		bufferSize = 1
+	}
+	l := &blockLogger{
+		logger:     logger,
+		perDomain:  int32(perDomain),
+		samplerKey: maphash.MakeSeed(),
+		ring:       make([]blockEvent, bufferSize),
+		wake:       make(chan struct{}, 1),
+		done:       make(chan struct{}),
+		finished:   make(chan struct{}),
+	}
+	if perDomain > 0 {
+		l.sampler = make([]samplerSlot, blockLogSamplerSlots)
+	}
+	return l
+}
+
+// log queues an entry without blocking.
+func (l *blockLogger) log(ev blockEvent) {
+	if !l.logger.Enabled(context.Background(), slog.LevelInfo) {
+		return
+	}
+	ev.at = time.Now()
+	if !l.allow(ev.domain, ev.at) {
+		l.suppressed.Add(1)
+		return
+	}
+
+	l.mu.Lock()
+	tail := (l.head + l.count) % len(l.ring)
+	if l.count == len(l.ring) {
+		l.head = (l.head + 1) % len(l.ring)
+		l.dropped.Add(1)
+	} else {
+		l.count++
+	}
+	l.ring[tail] = ev
+	l.mu.Unlock()
+
+	l.startOnce.Do(func() { go l.run() })
+	select {
+	case l.wake <- struct{}{}:
+	default:
+	}
+}
+
+// allow applies the per-domain rate limit. Slot updates race benignly: at
+// worst a few extra entries get through when a window rolls over.
+func (l *blockLogger) allow(domain string, now time.Time) bool {
+	if l.sampler == nil {
+		return true
+	}
+	slot := &l.sampler[maphash.String(l.samplerKey, domain)%blockLogSamplerSlots]
+	window := now.Unix()
+	if slot.window.Load() != window {
+		slot.window.Store(window)
+		slot.count.Store(0)
+	}
+	return slot.count.Add(1) <= l.perDomain
+}
+
+// Stats returns how many entries were dropped because the buffer was full
+// and how many were suppressed by the per-domain limit.
+func (l *blockLogger) Stats() (dropped, suppressed int64) {
+	return l.dropped.Load(), l.suppressed.Load()
+}
+
+func (l *blockLogger) run() {
+	defer close(l.finished)
+
+	summary := time.NewTicker(blockLogSummaryInterval)
+	defer summary.Stop()
+
+	var batch []blockEvent
+	var lastDropped, lastSuppressed int64
+	for {
+		select {
+		case <-l.wake:
+			batch = l.drain(batch[:0])
+			l.write(batch)
+		case <-summary.C:
+			dropped, suppressed := l.Stats()
+			if dropped != lastDropped || suppressed != lastSuppressed {
+				l.logger.Warn("Block log entries not written",
+					"dropped", dropped-lastDropped,
+					"suppressed", suppressed-lastSuppressed,
+				)
+				lastDropped, lastSuppressed = dropped, suppressed
+			}
+		case <-l.done:
+			l.write(l.drain(batch[:0]))
+			return
+		}
+	}
+}
+
+// drain moves all pending events into batch.
+func (l *blockLogger) drain(batch []blockEvent) []blockEvent {
+	l.mu.Lock()
+	defer l.mu.Unlock()
+
+	for ; l.count > 0; l.count-- {
+		batch = append(batch, l.ring[l.head])
+		l.ring[l.head] = blockEvent{}
+		l.head = (l.head + 1) % len(l.ring)
+	}
+	return batch
+}
+
+// write emits the entries, keeping the time each query was blocked.
+func (l *blockLogger) write(batch []blockEvent) {
+	ctx := context.Background()
+	handler := l.logger.Handler()
+	for _, ev := range batch {
+		r := slog.NewRecord(ev.at, slog.LevelInfo, "Blocking domain", 0)
+		r.AddAttrs(
+			slog.String("domain", ev.domain),
+			slog.String("client", clientString(ev.client)),
+			slog.String("employer", ev.employer),
+			slog.String("action_type", ev.actionType),
+		)
+		if ev.view != "" {
+			r.AddAttrs(slog.String("view", ev.view))
+		}
+		handler.Handle(ctx, r)
+	}
+}
+
+func clientString(addr netip.Addr) string {
+	if !addr.IsValid() {
+		return ""
+	}
+	return addr.String()
+}
+
+// close flushes pending entries and stops the writer goroutine, if it was
+// started. No writer is started afterwards.
+func (l *blockLogger) close() {
+	l.closeOnce.Do(func() {
+		started := true
+		l.startOnce.Do(func() { started = false })
+		close(l.done)
+		if started {
+			<-l.finished
+		}
+	})
+}
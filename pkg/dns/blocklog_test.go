@@ -0,0 +1,196 @@
+package dns
+
+import (
+	"bytes"
+	"context"
+	"fmt"
+	"hash/maphash"
+	"io"
+	"log/slog"
+	"net/netip"
+	"runtime"
+	"strings"
+	"sync"
+	"testing"
+	"time"
+)
+
+// lockedBuffer is a bytes.Buffer safe for the writer goroutine and the test
+// to share.
+type lockedBuffer struct {
+	mu  sync.Mutex
+	buf bytes.Buffer
+}
+
+func (b *lockedBuffer) Write(p []byte) (int, error) {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	return b.buf.Write(p)
+}
+
+func (b *lockedBuffer) String() string {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	return b.buf.String()
+}
+
+func TestBlockLoggerWritesEntries(t *testing.T) {
+	var out lockedBuffer
+	l := newBlockLogger(slog.New(slog.NewTextHandler(&out, nil)), 16, 0)
+
+	l.log(blockEvent{
+		domain:     "example.com",
+		client:     netip.MustParseAddr("192.0.2.10"),
+		employer:   "Example Corp",
+		actionType: "strike",
+	})
+	l.close()
+
+	got := out.String()
+	for _, want := range []string{`msg="Blocking domain"`, "domain=example.com", "client=192.0.2.10", `employer="Example Corp"`, "action_type=strike"} {
+		if !strings.Contains(got, want) {
+			t.Errorf("Expected log output to contain %q, got %q", want, got)
+		}
+	}
+}
+
+// stallingHandler records the domain of each entry and blocks in Handle
+// until released, standing in for a slow log sink.
+type stallingHandler struct {
+	entered chan struct{}
+	release chan struct{}
+
+	mu      sync.Mutex
+	domains []string
+}
+
+func (h *stallingHandler) Enabled(context.Context, slog.Level) bool { return true }
+func (h *stallingHandler) WithAttrs([]slog.Attr) slog.Handler       { return h }
+func (h *stallingHandler) WithGroup(string) slog.Handler            { return h }
+
+func (h *stallingHandler) Handle(_ context.Context, r slog.Record) error {
+	r.Attrs(func(a slog.Attr) bool {
+		if a.Key == "domain" {
+			h.mu.Lock()
+			h.domains = append(h.domains, a.Value.String())
+			h.mu.Unlock()
+		}
+		return true
+	})
+	select {
+	case h.entered <- struct{}{}:
+	default:
+	}
+	<-h.release
+	return nil
+}
+
+func TestBlockLoggerDropsOldestWhenWriterStalls(t *testing.T) {
+	h := &stallingHandler{entered: make(chan struct{}, 1), release: make(chan struct{})}
+	l := newBlockLogger(slog.New(h), 2, 0)
+
+	l.log(blockEvent{domain: "first.example"})
+	<-h.entered // the writer is now stuck on the first entry
+
+	done := make(chan struct{})
+	go func() {
+		for _, d := range []string{"a.example", "b.example", "c.example"} {
+			l.log(blockEvent{domain: d})
+		}
+		close(done)
+	}()
+	select {
+	case <-done:
+	case <-time.After(time.Second):
+		t.Fatal("log blocked behind a stalled writer")
+	}
+
+	close(h.release)
+	l.close()
+
+	want := []string{"first.example", "b.example", "c.example"}
+	if strings.Join(h.domains, ",") != strings.Join(want, ",") {
+		t.Errorf("Expected entries %v, got %v", want, h.domains)
+	}
+	if dropped, _ := l.Stats(); dropped != 1 {
+		t.Errorf("Expected 1 dropped entry, got %d", dropped)
+	}
+}
+
+func TestBlockLoggerPerDomainLimit(t *testing.T) {
+	var out lockedBuffer
+	l := newBlockLogger(slog.New(slog.NewTextHandler(&out, nil)), 1024, 3)
+
+	for i := 0; i < 50; i++ {
+		l.log(blockEvent{domain: "flood.example"})
+	}
+	l.log(blockEvent{domain: "other.example"})
+	l.close()
+
+	got := out.String()
+	// The one-second window may roll over during the loop, which admits
+	// another few entries, but never all of them.
+	if n := strings.Count(got, "domain=flood.example"); n < 3 || n > 6 {
+		t.Errorf("Expected 3 to 6 entries for the flooded domain, got %d", n)
+	}
+	if !strings.Contains(got, "domain=other.example") {
+		t.Errorf("Expected other domains to be logged, got %q", got)
+	}
+	if _, suppressed := l.Stats(); suppressed < 44 {
+		t.Errorf("Expected at least 44 suppressed entries, got %d", suppressed)
+	}
+}
+
+func TestBlockLoggerCollidingDomainsShareBudget(t *testing.T) {
+	var out lockedBuffer
+	l := newBlockLogger(slog.New(slog.NewTextHandler(&out, nil)), 1024, 3)
+
+	slotOf := func(domain string) uint64 {
+		return maphash.String(l.samplerKey, domain) % blockLogSamplerSlots
+	}
+	other := ""
+	for i := 0; other == ""; i++ {
+		if d := fmt.Sprintf("d%d.example", i); slotOf(d) == slotOf("flood.example") {
+			other = d
+		}
+	}
+
+	// Alternating names in one slot must not reset each other's count
+	for i := 0; i < 50; i++ {
+		l.log(blockEvent{domain: "flood.example"})
+		l.log(blockEvent{domain: other})
+	}
+	l.close()
+
+	// As above, a window rollover may admit a few more
+	if n := strings.Count(out.String(), "Blocking domain"); n < 3 || n > 6 {
+		t.Errorf("Expected 3 to 6 entries for the shared slot, got %d", n)
+	}
+}
+
+func TestBlockLoggerStartsWriterLazily(t *testing.T) {
+	before := runtime.NumGoroutine()
+	l := newBlockLogger(slog.New(slog.NewTextHandler(io.Discard, nil)), 16, 0)
+	if after := runtime.NumGoroutine(); after > before {
+		t.Errorf("Expected no writer goroutine before the first entry, got %d more goroutines", after-before)
+	}
+	l.close()
+	// Entries after close do not start a writer
+	l.log(blockEvent{domain: "late.example"})
+	if after := runtime.NumGoroutine(); after > before {
+		t.Errorf("Expected no writer goroutine after close, got %d more goroutines", after-before)
+	}
+}
+
+func TestBlockLoggerSkipsDisabledLevel(t *testing.T) {
+	var out lockedBuffer
+	logger := slog.New(slog.NewTextHandler(&out, &slog.HandlerOptions{Level: slog.LevelWarn}))
+	l := newBlockLogger(logger, 16, 0)
+
+	l.log(blockEvent{domain: "example.com"})
+	l.close()
+
+	if got := out.String(); got != "" {
+		t.Errorf("Expected no output below the configured level, got %q", got)
+	}
+}
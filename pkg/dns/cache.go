@@ -0,0 +1,493 @@
+package dns
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"hash/maphash"
+	"io"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/miekg/dns"
+	"github.com/online-picket-line/opl-for-dns/pkg/stats"
+)
+
+const (
+	// cacheShards is the number of independently locked cache shards.
+	cacheShards = 64
+
+	// staleAnswerTTL is the TTL given to records in stale answers, as
+	// recommended by RFC 8767 section 4.
+	staleAnswerTTL = 30
+
+	// prefetchFraction is the share of an entry's lifetime left at which
+	// a hit triggers a background refresh.
+	prefetchFraction = 10
+)
+
+// Cache is a sharded, TTL-aware cache of upstream DNS responses.
+// Both positive answers and negative answers (NXDOMAIN/NODATA, RFC 2308)
+// are cached. TTLs in returned messages are lowered as entries age.
+//
+// With a stale TTL, expired entries are kept for that much longer so they
+// can be served when upstreams fail (RFC 8767).
+type Cache struct {
+	shards     [cacheShards]cacheShard
+	seed       maphash.Seed
+	maxTTL     time.Duration
+	staleTTL   time.Duration
+	shardLimit int
+
+	statsCollector *stats.Collector
+
+	// now is the clock used for expiry; replaced in tests.
+	now func() time.Time
+}
+
+type cacheShard struct {
+	mu      sync.RWMutex
+	entries map[cacheKey]*cacheEntry
+}
+
+// cacheKey identifies a cached response. Names are stored lowercased. The
+// DO and CD bits are part of the key, since upstreams answer them
+// differently: with DNSSEC records, and without validating.
+type cacheKey struct {
+	name   string
+	qtype  uint16
+	qclass uint16
+	do     bool
+	cd     bool
+}
+
+type cacheEntry struct {
+	msg     *dns.Msg
+	stored  time.Time
+	expires time.Time
+
+	// prefetching is set once a hit has claimed this entry's refresh
+	prefetching atomic.Bool
+}
+
+// CacheOption configures optional Cache features.
+type CacheOption func(*Cache)
+
+// WithStaleTTL keeps responses for up to d after they expire, to be served
+// by GetStale. Zero, the default, drops them on expiry.
+func WithStaleTTL(d time.Duration) CacheOption {
+	return func(c *Cache) {
+		c.staleTTL = d
+	}
+}
+
+// NewCache creates a response cache holding at most maxEntries responses.
+// TTLs longer than maxTTL are capped to maxTTL.
+func NewCache(maxTTL time.Duration, maxEntries int, statsCollector *stats.Collector, opts ...CacheOption) *Cache {
+	shardLimit := maxEntries / cacheShards
+	if shardLimit < 1 {
+		shardLimit = 1
+	}
+
+	c := &Cache{
+		seed:           maphash.MakeSeed(),
+		maxTTL:         maxTTL,
+		shardLimit:     shardLimit,
+		statsCollector: statsCollector,
+		now:            time.Now,
+	}
+	for i := range c.shards {
+		c.shards[i].entries = make(map[cacheKey]*cacheEntry)
+	}
+	for _, opt := range opts {
+		opt(c)
+	}
+	return c
+}
+
+// Get returns a cached response for the request, with its ID and question
+// taken from the request and its TTLs reduced by the time spent in cache.
+// No TTL exceeds the time the entry has left, so clients do not keep a
+// record longer than the cache would.
+func (c *Cache) Get(r *dns.Msg) (*dns.Msg, bool) {
+	resp, _, ok := c.get(r)
+	return resp, ok
+}
+
+// get is Get that also reports whether the caller should refresh the entry
+// in the background: it is in the last tenth of its lifetime and no other
+// hit has claimed the refresh yet.
+func (c *Cache) get(r *dns.Msg) (resp *dns.Msg, prefetch, ok bool) {
+	entry, now := c.lookup(r)
+	if entry == nil || !now.Before(entry.expires) {
+		if c.statsCollector != nil {
+			c.statsCollector.RecordCacheMiss()
+		}
+		return nil, false, false
+	}
+
+	resp = entry.msg.Copy()
+	resp.Id = r.Id
+	resp.Question = append(resp.Question[:0], r.Question[0])
+	remaining := (entry.expires.Sub(now) + time.Second - 1) / time.Second
+	ageTTLs(resp, uint32(now.Sub(entry.stored)/time.Second), uint32(remaining))
+
+	if c.statsCollector != nil {
+		c.statsCollector.RecordCacheHit()
+	}
+
+	lifetime := entry.expires.Sub(entry.stored)
+	if entry.expires.Sub(now)*prefetchFraction < lifetime {
+		prefetch = entry.prefetching.CompareAndSwap(false, true)
+	}
+	return resp, prefetch, true
+}
+
+// GetStale returns an expired response for the request that is still
+// within the stale TTL, with its ID and question taken from the request
+// and every TTL set to 30 seconds.
+func (c *Cache) GetStale(r *dns.Msg) (*dns.Msg, bool) {
+	entry := c.staleEntry(r)
+	if entry == nil {
+		return nil, false
+	}
+	return staleReply(r, entry), true
+}
+
+// staleEntry returns the entry for r if it has expired but may still be
+// served stale.
+func (c *Cache) staleEntry(r *dns.Msg) *cacheEntry {
+	if c.staleTTL <= 0 {
+		return nil
+	}
+	entry, now := c.lookup(r)
+	if entry == nil || now.Before(entry.expires) || !now.Before(entry.expires.Add(c.staleTTL)) {
+		return nil
+	}
+	return entry
+}
+
+func (c *Cache) lookup(r *dns.Msg) (*cacheEntry, time.Time) {
+	key, ok := newCacheKey(r)
+	if !ok {
+		return nil, time.Time{}
+	}
+
+	shard := c.shard(key)
+	shard.mu.RLock()
+	entry := shard.entries[key]
+	shard.mu.RUnlock()
+	return entry, c.now()
+}
+
+func staleReply(r *dns.Msg, entry *cacheEntry) *dns.Msg {
+	resp := entry.msg.Copy()
+	resp.Id = r.Id
+	resp.Question = append(resp.Question[:0], r.Question[0])
+	setTTLs(resp, staleAnswerTTL)
+	return resp
+}
+
+// Set stores an upstream response for the request if it is cacheable.
+func (c *Cache) Set(r *dns.Msg, resp *dns.Msg) {
+	key, ok := newCacheKey(r)
+	if !ok {
+		return
+	}
+
+	ttl, ok := responseTTL(resp)
+	if !ok {
+		return
+	}
+	lifetime := time.Duration(ttl) * time.Second
+	if lifetime > c.maxTTL {
+		lifetime = c.maxTTL
+	}
+	if lifetime <= 0 {
+		return
+	}
+
+	now := c.now()
+	c.insert(key, &cacheEntry{
+		msg:     resp.Copy(),
+		stored:  now,
+		expires: now.Add(lifetime),
+	}, now)
+}
+
+// insert stores an entry, evicting another if its shard is full.
+func (c *Cache) insert(key cacheKey, entry *cacheEntry, now time.Time) {
+	shard := c.shard(key)
+	shard.mu.Lock()
+	if _, exists := shard.entries[key]; !exists && len(shard.entries) >= c.shardLimit {
+		shard.evict(now, c.staleTTL)
+	}
+	shard.entries[key] = entry
+	shard.mu.Unlock()
+}
+
+// Len returns the number of cached responses, including expired ones that
+// have not been evicted yet.
+func (c *Cache) Len() int {
+	n := 0
+	for i := range c.shards {
+		shard := &c.shards[i]
+		shard.mu.RLock()
+		n += len(shard.entries)
+		shard.mu.RUnlock()
+	}
+	return n
+}
+
+func (c *Cache) shard(key cacheKey) *cacheShard {
+	h := maphash.String(c.seed, key.name) ^ uint64(key.qtype)<<1
+	return &c.shards[h%cacheShards]
+}
+
+// evict makes room for one entry. Entries too old to be served even stale
+// are dropped first, then stale ones; otherwise an arbitrary entry is
+// removed. Go's randomized map iteration makes this a cheap approximation
+// of random eviction. The caller must hold the shard's write lock.
+func (s *cacheShard) evict(now time.Time, staleTTL time.Duration) {
+	const maxScan = 8
+
+	var victim *cacheKey
+	victimExpired := false
+	scanned := 0
+	for key, entry := range s.entries {
+		if !now.Before(entry.expires.Add(staleTTL)) {
+			delete(s.entries, key)
+			return
+		}
+		if expired := !now.Before(entry.expires); victim == nil || (expired && !victimExpired) {
+			k := key
+			victim = &k
+			victimExpired = expired
+		}
+		scanned++
+		if scanned >= maxScan {
+			break
+		}
+	}
+	if victim != nil {
+		delete(s.entries, *victim)
+	}
+}
+
+// newCacheKey builds the cache key for a request. Only single-question
+// queries are cacheable.
+func newCacheKey(r *dns.Msg) (cacheKey, bool) {
+	if len(r.Question) != 1 {
+		return cacheKey{}, false
+	}
+	q := r.Question[0]
+
+	do := false
+	if opt := r.IsEdns0(); opt != nil {
+		do = opt.Do()
+	}
+
+	return cacheKey{
+		name:   strings.ToLower(q.Name),
+		qtype:  q.Qtype,
+		qclass: q.Qclass,
+		do:     do,
+		cd:     r.CheckingDisabled,
+	}, true
+}
+
+// responseTTL returns how long a response may be cached, in seconds.
+// Positive answers use the smallest answer TTL. Negative answers use the
+// SOA TTL capped by its MINIMUM field, as described in RFC 2308.
+func responseTTL(resp *dns.Msg) (uint32, bool) {
+	if resp.Truncated {
+		return 0, false
+	}
+
+	switch resp.Rcode {
+	case dns.RcodeSuccess:
+		if len(resp.Answer) > 0 {
+			ttl := resp.Answer[0].Header().Ttl
+			for _, rr := range resp.Answer[1:] {
+				if rr.Header().Ttl < ttl {
+					ttl = rr.Header().Ttl
+				}
+			}
+			return ttl, true
+		}
+		return negativeTTL(resp)
+	case dns.RcodeNameError:
+		return negativeTTL(resp)
+	default:
+		return 0, false
+	}
+}
+
+func negativeTTL(resp *dns.Msg) (uint32, bool) {
+	for _, rr := range resp.Ns {
+		if soa, ok := rr.(*dns.SOA); ok {
+			ttl := soa.Hdr.Ttl
+			if soa.Minttl < ttl {
+				ttl = soa.Minttl
+			}
+			return ttl, true
+		}
+	}
+	return 0, false
+}
+
+// setTTLs sets the TTL of every record in the message to ttl.
+func setTTLs(m *dns.Msg, ttl uint32) {
+	for _, section := range [][]dns.RR{m.Answer, m.Ns, m.Extra} {
+		for _, rr := range section {
+			if hdr := rr.Header(); hdr.Rrtype != dns.TypeOPT {
+				hdr.Ttl = ttl
+			}
+		}
+	}
+}
+
+// ageTTLs lowers the TTL of every record in the message by elapsed seconds,
+// and caps it at limit seconds.
+func ageTTLs(m *dns.Msg, elapsed, limit uint32) {
+	for _, section := range [][]dns.RR{m.Answer, m.Ns, m.Extra} {
+		for _, rr := range section {
+			hdr := rr.Header()
+			if hdr.Rrtype == dns.TypeOPT {
+				continue
+			}
+			if hdr.Ttl > elapsed {
+				hdr.Ttl -= elapsed
+			} else {
+				hdr.Ttl = 0
+			}
+			hdr.Ttl = min(hdr.Ttl, limit)
+		}
+	}
+}
+
+// cacheSnapshotMagic begins the cache contents written by WriteSnapshot.
+const cacheSnapshotMagic = "OPLDNSC1"
+
+// Bits of the flags byte of a cache snapshot entry. Snapshots from before
+// the CD bit was keyed only ever set cacheFlagDO.
+const (
+	cacheFlagDO = 1 << iota
+	cacheFlagCD
+)
+
+// WriteSnapshot writes the cached responses to w, to be loaded by
+// ReadSnapshot in another process, and returns how many it wrote. Each
+// entry is its key, its storage and expiry times, and the response in wire
+// format. Shards are copied one at a time, so queries are not held up.
+func (c *Cache) WriteSnapshot(w io.Writer) (int, error) {
+	if _, err := io.WriteString(w, cacheSnapshotMagic); err != nil {
+		return 0, err
+	}
+
+	written := 0
+	var keys []cacheKey
+	var entries []*cacheEntry
+	var buf []byte
+	for i := range c.shards {
+		shard := &c.shards[i]
+		keys, entries = keys[:0], entries[:0]
+		shard.mu.RLock()
+		for key, entry := range shard.entries {
+			keys = append(keys, key)
+			entries = append(entries, entry)
+		}
+		shard.mu.RUnlock()
+
+		for j, entry := range entries {
+			// Packing can set fields of the message, so it packs a copy
+			wire, err := entry.msg.Copy().Pack()
+			if err != nil || len(keys[j].name) > 0xFFFF || len(wire) > 0xFFFF {
+				continue
+			}
+			key := keys[j]
+			buf = binary.BigEndian.AppendUint16(buf[:0], uint16(len(key.name)))
+			buf = append(buf, key.name...)
+			buf = binary.BigEndian.AppendUint16(buf, key.qtype)
+			buf = binary.BigEndian.AppendUint16(buf, key.qclass)
+			var flags byte
+			if key.do {
+				flags |= cacheFlagDO
+			}
+			if key.cd {
+				flags |= cacheFlagCD
+			}
+			buf = append(buf, flags)
+			buf = binary.BigEndian.AppendUint64(buf, uint64(entry.stored.UnixNano()))
+			buf = binary.BigEndian.AppendUint64(buf, uint64(entry.expires.UnixNano()))
+			buf = binary.BigEndian.AppendUint16(buf, uint16(len(wire)))
+			buf = append(buf, wire...)
+			if _, err := w.Write(buf); err != nil {
+				return written, err
+			}
+			written++
+		}
+	}
+	return written, nil
+}
+
+// ReadSnapshot adds the responses written by WriteSnapshot to the cache and
+// returns how many it added. Entries too old to be served, even stale, are
+// skipped, and lifetimes are capped to the cache's maximum TTL.
+func (c *Cache) ReadSnapshot(r io.Reader) (int, error) {
+	magic := make([]byte, len(cacheSnapshotMagic))
+	if _, err := io.ReadFull(r, magic); err != nil {
+		return 0, fmt.Errorf("reading cache snapshot: %w", err)
+	}
+	if string(magic) != cacheSnapshotMagic {
+		return 0, errors.New("reading cache snapshot: unknown format")
+	}
+
+	now := c.now()
+	added := 0
+	var fixed [2 + 2 + 1 + 8 + 8 + 2]byte
+	var size [2]byte
+	for {
+		if _, err := io.ReadFull(r, size[:]); err != nil {
+			if err == io.EOF {
+				return added, nil
+			}
+			return added, fmt.Errorf("reading cache snapshot: %w", err)
+		}
+		name := make([]byte, binary.BigEndian.Uint16(size[:]))
+		if _, err := io.ReadFull(r, name); err != nil {
+			return added, fmt.Errorf("reading cache snapshot: %w", err)
+		}
+		if _, err := io.ReadFull(r, fixed[:]); err != nil {
+			return added, fmt.Errorf("reading cache snapshot: %w", err)
+		}
+		wire := make([]byte, binary.BigEndian.Uint16(fixed[len(fixed)-2:]))
+		if _, err := io.ReadFull(r, wire); err != nil {
+			return added, fmt.Errorf("reading cache snapshot: %w", err)
+		}
+
+		key := cacheKey{
+			name:   string(name),
+			qtype:  binary.BigEndian.Uint16(fixed[0:]),
+			qclass: binary.BigEndian.Uint16(fixed[2:]),
+			do:     fixed[4]&cacheFlagDO != 0,
+			cd:     fixed[4]&cacheFlagCD != 0,
+		}
+		stored := time.Unix(0, int64(binary.BigEndian.Uint64(fixed[5:])))
+		expires := time.Unix(0, int64(binary.BigEndian.Uint64(fixed[13:])))
+		if expires.Sub(stored) > c.maxTTL {
+			expires = stored.Add(c.maxTTL)
+		}
+		if !now.Before(expires.Add(c.staleTTL)) {
+			continue
+		}
+		msg := new(dns.Msg)
+		if err := msg.Unpack(wire); err != nil {
+			continue
+		}
+		c.insert(key, &cacheEntry{msg: msg, stored: stored, expires: expires}, now)
+		added++
+	}
+}
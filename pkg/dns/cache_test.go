@@ -0,0 +1,372 @@
+package dns
+
+import (
+	"bytes"
+	"net"
+	"strings"
+	"testing"
+	"time"
+
+	"github.com/miekg/dns"
+	"github.com/online-picket-line/opl-for-dns/pkg/stats"
+)
+
+// fakeClock is a manually advanced clock for cache tests.
+type fakeClock struct {
+	t time.Time
+}
+
+func (f *fakeClock) now() time.Time { return f.t }
+
+func newTestCache(maxTTL time.Duration, maxEntries int, collector *stats.Collector, opts ...CacheOption) (*Cache, *fakeClock) {
+	clock := &fakeClock{t: time.Unix(1700000000, 0)}
+	c := NewCache(maxTTL, maxEntries, collector, opts...)
+	c.now = clock.now
+	return c, clock
+}
+
+func answerFor(r *dns.Msg, ttl uint32) *dns.Msg {
+	resp := new(dns.Msg)
+	resp.SetReply(r)
+	resp.Answer = append(resp.Answer, &dns.A{
+		Hdr: dns.RR_Header{Name: r.Question[0].Name, Rrtype: dns.TypeA, Class: dns.ClassINET, Ttl: ttl},
+		A:   net.ParseIP("192.0.2.1"),
+	})
+	return resp
+}
+
+func TestCacheHitAgesTTL(t *testing.T) {
+	collector := stats.NewCollector()
+	c, clock := newTestCache(5*time.Minute, 100, collector)
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+	c.Set(r, answerFor(r, 120))
+
+	clock.t = clock.t.Add(30 * time.Second)
+
+	q := new(dns.Msg)
+	q.SetQuestion("Example.ORG.", dns.TypeA)
+	resp, ok := c.Get(q)
+	if !ok {
+		t.Fatal("Expected cache hit")
+	}
+	if resp.Id != q.Id {
+		t.Errorf("Expected response ID %d, got %d", q.Id, resp.Id)
+	}
+	if resp.Question[0].Name != "Example.ORG." {
+		t.Errorf("Expected question name to be echoed, got %s", resp.Question[0].Name)
+	}
+	if ttl := resp.Answer[0].Header().Ttl; ttl != 90 {
+		t.Errorf("Expected aged TTL 90, got %d", ttl)
+	}
+
+	hits, misses := collector.CacheSnapshot()
+	if hits != 1 || misses != 0 {
+		t.Errorf("Expected 1 hit and 0 misses, got %d and %d", hits, misses)
+	}
+}
+
+func TestCacheExpiry(t *testing.T) {
+	c, clock := newTestCache(5*time.Minute, 100, nil)
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+	c.Set(r, answerFor(r, 60))
+
+	clock.t = clock.t.Add(61 * time.Second)
+	if _, ok := c.Get(r); ok {
+		t.Error("Expected expired entry to miss")
+	}
+}
+
+func TestCacheServeStale(t *testing.T) {
+	c, clock := newTestCache(5*time.Minute, 100, nil, WithStaleTTL(time.Hour))
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+	c.Set(r, answerFor(r, 60))
+
+	if _, ok := c.GetStale(r); ok {
+		t.Error("Expected a fresh entry not to be served stale")
+	}
+
+	clock.t = clock.t.Add(10 * time.Minute)
+	if _, ok := c.Get(r); ok {
+		t.Error("Expected expired entry to miss")
+	}
+	q := new(dns.Msg)
+	q.SetQuestion("EXAMPLE.org.", dns.TypeA)
+	resp, ok := c.GetStale(q)
+	if !ok {
+		t.Fatal("Expected a stale answer within the stale TTL")
+	}
+	if resp.Id != q.Id || resp.Question[0].Name != "EXAMPLE.org." {
+		t.Errorf("Expected the request's ID and question, got %d %v", resp.Id, resp.Question)
+	}
+	if ttl := resp.Answer[0].Header().Ttl; ttl != staleAnswerTTL {
+		t.Errorf("Expected stale TTL %d, got %d", staleAnswerTTL, ttl)
+	}
+
+	clock.t = clock.t.Add(time.Hour)
+	if _, ok := c.GetStale(r); ok {
+		t.Error("Expected no stale answer past the stale TTL")
+	}
+}
+
+func TestCacheServeStaleDisabled(t *testing.T) {
+	c, clock := newTestCache(5*time.Minute, 100, nil)
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+	c.Set(r, answerFor(r, 60))
+
+	clock.t = clock.t.Add(61 * time.Second)
+	if _, ok := c.GetStale(r); ok {
+		t.Error("Expected no stale answers without a stale TTL")
+	}
+}
+
+func TestCachePrefetchClaimedOnce(t *testing.T) {
+	c, clock := newTestCache(5*time.Minute, 100, nil)
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+	c.Set(r, answerFor(r, 100))
+
+	clock.t = clock.t.Add(85 * time.Second)
+	if _, prefetch, ok := c.get(r); !ok || prefetch {
+		t.Errorf("Expected a hit without prefetch at 85%% of the TTL, got ok=%v prefetch=%v", ok, prefetch)
+	}
+
+	clock.t = clock.t.Add(10 * time.Second)
+	if _, prefetch, ok := c.get(r); !ok || !prefetch {
+		t.Errorf("Expected the first hit near expiry to prefetch, got ok=%v prefetch=%v", ok, prefetch)
+	}
+	if _, prefetch, _ := c.get(r); prefetch {
+		t.Error("Expected only one hit to claim the prefetch")
+	}
+
+	// A refreshed entry can be prefetched again
+	c.Set(r, answerFor(r, 100))
+	clock.t = clock.t.Add(95 * time.Second)
+	if _, prefetch, _ := c.get(r); !prefetch {
+		t.Error("Expected the refreshed entry to prefetch near its expiry")
+	}
+}
+
+func TestCacheEvictsStaleFirst(t *testing.T) {
+	c, clock := newTestCache(5*time.Minute, cacheShards, nil, WithStaleTTL(time.Hour))
+
+	// Fill one shard with a stale entry and a fresh one, then add a third.
+	var names []string
+	for i := 0; len(names) < 3; i++ {
+		name := dns.Fqdn(net.IPv4(10, 0, byte(i>>8), byte(i)).String() + ".example.org")
+		key := cacheKey{name: name, qtype: dns.TypeA, qclass: dns.ClassINET}
+		if len(names) == 0 || c.shard(key) == c.shard(cacheKey{name: names[0], qtype: dns.TypeA, qclass: dns.ClassINET}) {
+			names = append(names, name)
+		}
+	}
+	set := func(name string, ttl uint32) *dns.Msg {
+		r := new(dns.Msg)
+		r.SetQuestion(name, dns.TypeA)
+		c.Set(r, answerFor(r, ttl))
+		return r
+	}
+
+	// With room for two entries per shard, the third set evicts the stale one.
+	c.shardLimit = 2
+	stale := set(names[0], 10)
+	clock.t = clock.t.Add(time.Minute)
+	fresh := set(names[1], 300)
+	set(names[2], 300)
+
+	if _, ok := c.Get(fresh); !ok {
+		t.Error("Expected the fresh entry to survive eviction")
+	}
+	if _, ok := c.GetStale(stale); ok {
+		t.Error("Expected the stale entry to be evicted first")
+	}
+}
+
+func TestCacheMaxTTL(t *testing.T) {
+	c, clock := newTestCache(10*time.Second, 100, nil)
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+	c.Set(r, answerFor(r, 3600))
+
+	clock.t = clock.t.Add(11 * time.Second)
+	if _, ok := c.Get(r); ok {
+		t.Error("Expected entry to expire at the configured maximum TTL")
+	}
+}
+
+func TestCacheNegative(t *testing.T) {
+	c, clock := newTestCache(5*time.Minute, 100, nil)
+
+	r := new(dns.Msg)
+	r.SetQuestion("missing.example.org.", dns.TypeA)
+	resp := new(dns.Msg)
+	resp.SetRcode(r, dns.RcodeNameError)
+	resp.Ns = append(resp.Ns, &dns.SOA{
+		Hdr:    dns.RR_Header{Name: "example.org.", Rrtype: dns.TypeSOA, Class: dns.ClassINET, Ttl: 3600},
+		Ns:     "ns.example.org.",
+		Mbox:   "admin.example.org.",
+		Minttl: 30,
+	})
+	c.Set(r, resp)
+
+	cached, ok := c.Get(r)
+	if !ok {
+		t.Fatal("Expected negative answer to be cached")
+	}
+	if cached.Rcode != dns.RcodeNameError {
+		t.Errorf("Expected NXDOMAIN, got %d", cached.Rcode)
+	}
+
+	clock.t = clock.t.Add(31 * time.Second)
+	if _, ok := c.Get(r); ok {
+		t.Error("Expected negative entry to expire after SOA minimum")
+	}
+}
+
+func TestCacheSkipsUncacheable(t *testing.T) {
+	c, _ := newTestCache(5*time.Minute, 100, nil)
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+
+	servfail := new(dns.Msg)
+	servfail.SetRcode(r, dns.RcodeServerFailure)
+	c.Set(r, servfail)
+
+	truncated := answerFor(r, 60)
+	truncated.Truncated = true
+	c.Set(r, truncated)
+
+	// NODATA without an SOA has no negative TTL
+	c.Set(r, new(dns.Msg).SetReply(r))
+
+	if c.Len() != 0 {
+		t.Errorf("Expected nothing cached, got %d entries", c.Len())
+	}
+}
+
+func TestCacheKeyIncludesDO(t *testing.T) {
+	c, _ := newTestCache(5*time.Minute, 100, nil)
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+	c.Set(r, answerFor(r, 60))
+
+	withDO := new(dns.Msg)
+	withDO.SetQuestion("example.org.", dns.TypeA)
+	withDO.SetEdns0(1232, true)
+	if _, ok := c.Get(withDO); ok {
+		t.Error("Expected DO-bit query not to share the plain entry")
+	}
+}
+
+func TestCacheKeyIncludesCD(t *testing.T) {
+	c, _ := newTestCache(5*time.Minute, 100, nil)
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+	c.Set(r, answerFor(r, 60))
+
+	// A CD=1 answer may hold records that failed validation
+	withCD := new(dns.Msg)
+	withCD.SetQuestion("example.org.", dns.TypeA)
+	withCD.CheckingDisabled = true
+	if _, ok := c.Get(withCD); ok {
+		t.Error("Expected CD-bit query not to share the plain entry")
+	}
+	if key, _ := newCacheKey(withCD); !key.cd {
+		t.Error("Expected the key of a CD-bit query to record the bit")
+	}
+}
+
+func TestCacheCapsTTLsAtRemainingLifetime(t *testing.T) {
+	c, clock := newTestCache(60*time.Second, 100, nil)
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+	resp := answerFor(r, 3600)
+	resp.Ns = append(resp.Ns, &dns.NS{
+		Hdr: dns.RR_Header{Name: "example.org.", Rrtype: dns.TypeNS, Class: dns.ClassINET, Ttl: 86400},
+		Ns:  "ns.example.org.",
+	})
+	c.Set(r, resp)
+
+	clock.t = clock.t.Add(20 * time.Second)
+	cached, ok := c.Get(r)
+	if !ok {
+		t.Fatal("Expected cache hit")
+	}
+	for _, rr := range append(cached.Answer, cached.Ns...) {
+		if rr.Header().Ttl != 40 {
+			t.Errorf("Expected TTL capped at the 40s the entry has left, got %d for %s", rr.Header().Ttl, rr)
+		}
+	}
+}
+
+func TestCacheBounded(t *testing.T) {
+	c, _ := newTestCache(5*time.Minute, cacheShards, nil)
+
+	for i := 0; i < 10*cacheShards; i++ {
+		r := new(dns.Msg)
+		r.SetQuestion(dns.Fqdn(net.IPv4(10, 0, byte(i>>8), byte(i)).String()+".example.org"), dns.TypeA)
+		c.Set(r, answerFor(r, 60))
+	}
+
+	if c.Len() > cacheShards {
+		t.Errorf("Expected at most %d entries, got %d", cacheShards, c.Len())
+	}
+}
+
+func TestCacheSnapshotRoundTrip(t *testing.T) {
+	// Room for more than one entry per shard, as two entries share a name
+	c, clock := newTestCache(5*time.Minute, 4*cacheShards, nil)
+	fresh := new(dns.Msg)
+	fresh.SetQuestion("example.org.", dns.TypeA)
+	c.Set(fresh, answerFor(fresh, 120))
+	old := new(dns.Msg)
+	old.SetQuestion("old.example.org.", dns.TypeA)
+	c.Set(old, answerFor(old, 10))
+
+	checking := new(dns.Msg)
+	checking.SetQuestion("example.org.", dns.TypeA)
+	checking.CheckingDisabled = true
+	c.Set(checking, answerFor(checking, 100))
+
+	clock.t = clock.t.Add(30 * time.Second)
+	var buf bytes.Buffer
+	if n, err := c.WriteSnapshot(&buf); err != nil || n != 3 {
+		t.Fatalf("WriteSnapshot: wrote %d entries, error %v", n, err)
+	}
+
+	loaded, loadedClock := newTestCache(5*time.Minute, 4*cacheShards, nil, WithStaleTTL(0))
+	loadedClock.t = clock.t
+	if n, err := loaded.ReadSnapshot(&buf); err != nil || n != 2 {
+		t.Fatalf("ReadSnapshot: expected only the unexpired entries, got %d, error %v", n, err)
+	}
+	resp, ok := loaded.Get(fresh)
+	if !ok {
+		t.Fatal("Expected loaded entry to hit")
+	}
+	if ttl := resp.Answer[0].Header().Ttl; ttl != 90 {
+		t.Errorf("Expected the entry to keep its age, got TTL %d", ttl)
+	}
+	resp, ok = loaded.Get(checking)
+	if !ok {
+		t.Fatal("Expected loaded CD-bit entry to hit")
+	}
+	if ttl := resp.Answer[0].Header().Ttl; ttl != 70 {
+		t.Errorf("Expected the CD-bit entry to keep its own answer, got TTL %d", ttl)
+	}
+
+	if _, err := loaded.ReadSnapshot(strings.NewReader("not a snapshot")); err == nil {
+		t.Error("Expected error for unknown format")
+	}
+}
@@ -0,0 +1,71 @@
+package dns
+
+import (
+	"sync"
+
+	"github.com/miekg/dns"
+)
+
+// flightGroup coalesces concurrent upstream exchanges for the same
+// question. When a popular record expires from the cache, the first query
+// for it goes upstream and the others that arrive before the answer wait
+// for that exchange instead of sending their own.
+type flightGroup struct {
+	mu      sync.Mutex
+	flights map[cacheKey]*flight
+}
+
+// flight is one upstream exchange and the queries waiting on it.
+type flight struct {
+	done    chan struct{}
+	resp    *dns.Msg
+	err     error
+	waiters int
+}
+
+// do runs exchange for key, or waits for the exchange already running for
+// it. shared reports whether resp is also being returned to other callers,
+// in which case it must be copied before it is modified.
+func (g *flightGroup) do(key cacheKey, exchange func() (*dns.Msg, error)) (resp *dns.Msg, shared bool, err error) {
+	g.mu.Lock()
+	if f, ok := g.flights[key]; ok {
+		f.waiters++
+		g.mu.Unlock()
+		<-f.done
+		return f.resp, true, f.err
+	}
+	if g.flights == nil {
+		g.flights = make(map[cacheKey]*flight)
+	}
+	f := &flight{done: make(chan struct{})}
+	g.flights[key] = f
+	g.mu.Unlock()
+
+	f.resp, f.err = exchange()
+
+	g.mu.Lock()
+	delete(g.flights, key)
+	shared = f.waiters > 0
+	g.mu.Unlock()
+	close(f.done)
+	return f.resp, shared, f.err
+}
+
+// flightResult is the outcome of a flight, for passing over a channel.
+type flightResult struct {
+	resp   *dns.Msg
+	shared bool
+	err    error
+}
+
+// replyFor adapts an upstream response to the request r it answers: the
+// request's ID and its question, with the name in the case the client sent
+// it. Shared responses are copied first.
+func replyFor(r, resp *dns.Msg, shared bool) *dns.Msg {
+	if shared {
+		resp = resp.Copy()
+		resp.Question = append(resp.Question[:0], r.Question...)
+	}
+	resp.Id = r.Id
+	return resp
+}
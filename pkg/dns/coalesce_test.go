@@ -0,0 +1,117 @@
+package dns
+
+import (
+	"errors"
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"testing"
+
+	"github.com/miekg/dns"
+)
+
+// waitForWaiters blocks until n callers are waiting on the flight for key.
+func waitForWaiters(g *flightGroup, key cacheKey, n int) {
+	for {
+		g.mu.Lock()
+		f := g.flights[key]
+		ready := f != nil && f.waiters >= n
+		g.mu.Unlock()
+		if ready {
+			return
+		}
+		runtime.Gosched()
+	}
+}
+
+func TestFlightGroupCoalesces(t *testing.T) {
+	var g flightGroup
+	key := cacheKey{name: "example.com.", qtype: dns.TypeA, qclass: dns.ClassINET}
+	want := new(dns.Msg)
+
+	var calls atomic.Int32
+	release := make(chan struct{})
+	exchange := func() (*dns.Msg, error) {
+		calls.Add(1)
+		<-release
+		return want, nil
+	}
+
+	const callers = 10
+	var wg sync.WaitGroup
+	var sharedCount atomic.Int32
+	for i := 0; i < callers; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			resp, shared, err := g.do(key, exchange)
+			if err != nil || resp != want {
+				t.Errorf("Expected the shared response, got %v, %v", resp, err)
+			}
+			if shared {
+				sharedCount.Add(1)
+			}
+		}()
+	}
+	waitForWaiters(&g, key, callers-1)
+	close(release)
+	wg.Wait()
+
+	if n := calls.Load(); n != 1 {
+		t.Errorf("Expected one upstream exchange, got %d", n)
+	}
+	if n := sharedCount.Load(); n != callers {
+		t.Errorf("Expected all %d callers to see a shared response, got %d", callers, n)
+	}
+	if len(g.flights) != 0 {
+		t.Errorf("Expected the finished flight to be removed, %d left", len(g.flights))
+	}
+}
+
+func TestFlightGroupSeparatesKeysAndErrors(t *testing.T) {
+	var g flightGroup
+	errUpstream := errors.New("upstream failed")
+
+	resp, shared, err := g.do(cacheKey{name: "a.example.", qtype: dns.TypeA}, func() (*dns.Msg, error) {
+		return nil, errUpstream
+	})
+	if resp != nil || shared || !errors.Is(err, errUpstream) {
+		t.Errorf("Expected the unshared error, got %v, %v, %v", resp, shared, err)
+	}
+
+	// Nothing is left over from the failed flight
+	var calls int
+	for _, qtype := range []uint16{dns.TypeA, dns.TypeAAAA} {
+		g.do(cacheKey{name: "a.example.", qtype: qtype}, func() (*dns.Msg, error) {
+			calls++
+			return new(dns.Msg), nil
+		})
+	}
+	if calls != 2 {
+		t.Errorf("Expected each question to be exchanged, got %d calls", calls)
+	}
+}
+
+func TestReplyForRewritesIDAndCase(t *testing.T) {
+	leader := new(dns.Msg)
+	leader.SetQuestion("www.example.com.", dns.TypeA)
+	resp := answerFor(leader, 300)
+
+	waiter := new(dns.Msg)
+	waiter.SetQuestion("WWW.Example.COM.", dns.TypeA)
+	waiter.Id = leader.Id + 1
+
+	reply := replyFor(waiter, resp, true)
+	if reply == resp {
+		t.Fatal("Expected a shared response to be copied")
+	}
+	if reply.Id != waiter.Id || reply.Question[0].Name != "WWW.Example.COM." {
+		t.Errorf("Expected the waiter's ID and question, got %d %v", reply.Id, reply.Question)
+	}
+	if resp.Id != leader.Id || resp.Question[0].Name != "www.example.com." {
+		t.Error("Expected the shared response to be left unchanged")
+	}
+	if len(reply.Answer) != 1 {
+		t.Errorf("Expected the answer to be kept, got %v", reply.Answer)
+	}
+}
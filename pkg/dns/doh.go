@@ -0,0 +1,122 @@
+package dns
+
+import (
+	"encoding/base64"
+	"fmt"
+	"io"
+	"net"
+	"net/http"
+	"net/netip"
+	"strings"
+
+	"github.com/miekg/dns"
+)
+
+const (
+	// dohPath is where DNS-over-HTTPS queries are accepted (RFC 8484
+	// section 3 leaves the path to the server; this is the usual one).
+	dohPath = "/dns-query"
+
+	dohContentType = "application/dns-message"
+)
+
+// serveDoH answers a DNS-over-HTTPS query (RFC 8484). GET requests carry
+// the query base64url-encoded in the "dns" parameter and POST requests in
+// the body.
+func (s *Server) serveDoH(w http.ResponseWriter, req *http.Request) {
+	var packed []byte
+	switch req.Method {
+	case http.MethodGet:
+		// RFC 8484 section 4.1 omits padding, but accept it
+		param := strings.TrimRight(req.URL.Query().Get("dns"), "=")
+		b, err := base64.RawURLEncoding.DecodeString(param)
+		if err != nil || len(b) == 0 {
+			http.Error(w, "missing or invalid dns parameter", http.StatusBadRequest)
+			return
+		}
+		packed = b
+	case http.MethodPost:
+		if ct := req.Header.Get("Content-Type"); ct != dohContentType {
+			http.Error(w, fmt.Sprintf("content type must be %s", dohContentType), http.StatusUnsupportedMediaType)
+			return
+		}
+		b, err := io.ReadAll(io.LimitReader(req.Body, dns.MaxMsgSize+1))
+		if err != nil {
+			http.Error(w, "reading query", http.StatusBadRequest)
+			return
+		}
+		if len(b) > dns.MaxMsgSize {
+			http.Error(w, "query too large", http.StatusRequestEntityTooLarge)
+			return
+		}
+		packed = b
+	default:
+		w.Header().Set("Allow", "GET, POST")
+		http.Error(w, "method not allowed", http.StatusMethodNotAllowed)
+		return
+	}
+
+	r := new(dns.Msg)
+	if err := r.Unpack(packed); err != nil {
+		http.Error(w, "malformed DNS query", http.StatusBadRequest)
+		return
+	}
+
+	s.ServeDNS(newDoHWriter(w, req), r)
+}
+
+// dohWriter is the dns.ResponseWriter for a DNS-over-HTTPS query. HTTP/2
+// runs each request on its own goroutine and answers on its own stream, so
+// the queries on a connection are answered in whatever order they finish.
+type dohWriter struct {
+	w      http.ResponseWriter
+	local  net.Addr
+	remote net.Addr
+}
+
+func newDoHWriter(w http.ResponseWriter, req *http.Request) *dohWriter {
+	dw := &dohWriter{w: w}
+	if addr, ok := req.Context().Value(http.LocalAddrContextKey).(net.Addr); ok {
+		dw.local = addr
+	}
+	// The remote address is kept as a *net.TCPAddr so the block log can
+	// record the client as for other transports
+	if ap, err := netip.ParseAddrPort(req.RemoteAddr); err == nil {
+		dw.remote = net.TCPAddrFromAddrPort(ap)
+	} else {
+		dw.remote = &net.TCPAddr{}
+	}
+	return dw
+}
+
+func (dw *dohWriter) LocalAddr() net.Addr  { return dw.local }
+func (dw *dohWriter) RemoteAddr() net.Addr { return dw.remote }
+
+// WriteMsg packs m and sends it as the HTTP response, cacheable for as long
+// as its shortest TTL (RFC 8484 section 5.1).
+func (dw *dohWriter) WriteMsg(m *dns.Msg) error {
+	bufp := packBufPool.Get().(*[]byte)
+	defer packBufPool.Put(bufp)
+
+	packed, err := m.PackBuffer((*bufp)[2:])
+	if err != nil {
+		http.Error(dw.w, "packing response", http.StatusInternalServerError)
+		return err
+	}
+	if ttl, ok := responseTTL(m); ok {
+		dw.w.Header().Set("Cache-Control", fmt.Sprintf("max-age=%d", ttl))
+	}
+	_, err = dw.Write(packed)
+	return err
+}
+
+// Write sends a packed DNS message as the HTTP response.
+func (dw *dohWriter) Write(b []byte) (int, error) {
+	dw.w.Header().Set("Content-Type", dohContentType)
+	return dw.w.Write(b)
+}
+
+func (dw *dohWriter) Close() error        { return nil }
+func (dw *dohWriter) TsigStatus() error   { return nil }
+func (dw *dohWriter) TsigTimersOnly(bool) {}
+func (dw *dohWriter) Hijack()             {}
@@ -0,0 +1,123 @@
+package dns
+
+import (
+	"bytes"
+	"encoding/base64"
+	"io"
+	"log/slog"
+	"net/http"
+	"net/http/httptest"
+	"testing"
+	"time"
+
+	"github.com/miekg/dns"
+	"github.com/online-picket-line/opl-for-dns/pkg/api"
+)
+
+func newDoHTestServer(t *testing.T) *Server {
+	t.Helper()
+
+	logger := slog.New(slog.NewTextHandler(io.Discard, nil))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	apiClient.SetBlocklistForTesting([]api.BlockListItem{{URL: "https://example.com", Employer: "Test Corp"}})
+	serverTLS, _ := testTLSConfig(t)
+	server, err := NewServer("127.0.0.1:5353", []string{"8.8.8.8:53"}, 5*time.Second, apiClient, nil, logger,
+		WithTLS(serverTLS, "", "127.0.0.1:0"))
+	if err != nil {
+		t.Fatalf("NewServer failed: %v", err)
+	}
+	t.Cleanup(func() { server.Stop() })
+	return server
+}
+
+func packedQuery(t *testing.T, name string) []byte {
+	t.Helper()
+	m := query(name)
+	m.Id = 0 // RFC 8484 section 4.1
+	b, err := m.Pack()
+	if err != nil {
+		t.Fatal(err)
+	}
+	return b
+}
+
+// checkSinkholeResponse checks that rec holds the blocked answer for
+// www.example.com.
+func checkSinkholeResponse(t *testing.T, rec *httptest.ResponseRecorder) {
+	t.Helper()
+
+	if rec.Code != http.StatusOK {
+		t.Fatalf("Expected status 200, got %d: %s", rec.Code, rec.Body.String())
+	}
+	if ct := rec.Header().Get("Content-Type"); ct != dohContentType {
+		t.Errorf("Expected content type %s, got %q", dohContentType, ct)
+	}
+	resp := new(dns.Msg)
+	if err := resp.Unpack(rec.Body.Bytes()); err != nil {
+		t.Fatalf("Unpack failed: %v", err)
+	}
+	if len(resp.Answer) != 1 {
+		t.Fatalf("Expected 1 answer, got %d", len(resp.Answer))
+	}
+	if a, ok := resp.Answer[0].(*dns.A); !ok || !a.A.IsUnspecified() {
+		t.Errorf("Expected 0.0.0.0, got %v", resp.Answer[0])
+	}
+}
+
+func TestServeDoHGet(t *testing.T) {
+	server := newDoHTestServer(t)
+
+	param := base64.RawURLEncoding.EncodeToString(packedQuery(t, "www.example.com."))
+	req := httptest.NewRequest(http.MethodGet, dohPath+"?dns="+param, nil)
+	rec := httptest.NewRecorder()
+	server.doh.Handler.ServeHTTP(rec, req)
+
+	checkSinkholeResponse(t, rec)
+}
+
+func TestServeDoHPost(t *testing.T) {
+	server := newDoHTestServer(t)
+
+	req := httptest.NewRequest(http.MethodPost, dohPath, bytes.NewReader(packedQuery(t, "www.example.com.")))
+	req.Header.Set("Content-Type", dohContentType)
+	rec := httptest.NewRecorder()
+	server.doh.Handler.ServeHTTP(rec, req)
+
+	checkSinkholeResponse(t, rec)
+}
+
+func TestServeDoHRejectsBadRequests(t *testing.T) {
+	server := newDoHTestServer(t)
+
+	tests := []struct {
+		name string
+		req  *http.Request
+		code int
+	}{
+		{"missing parameter", httptest.NewRequest(http.MethodGet, dohPath, nil), http.StatusBadRequest},
+		{"invalid base64", httptest.NewRequest(http.MethodGet, dohPath+"?dns=!!", nil), http.StatusBadRequest},
+		{"truncated message", httptest.NewRequest(http.MethodGet, dohPath+"?dns=AAAB", nil), http.StatusBadRequest},
+		{"wrong content type", httptest.NewRequest(http.MethodPost, dohPath, bytes.NewReader(packedQuery(t, "a."))), http.StatusUnsupportedMediaType},
+		{"wrong method", httptest.NewRequest(http.MethodPut, dohPath, nil), http.StatusMethodNotAllowed},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			rec := httptest.NewRecorder()
+			server.doh.Handler.ServeHTTP(rec, tt.req)
+			if rec.Code != tt.code {
+				t.Errorf("Expected status %d, got %d", tt.code, rec.Code)
+			}
+		})
+	}
+}
+
+func TestNewServerRequiresTLSConfig(t *testing.T) {
+	logger := slog.New(slog.NewTextHandler(io.Discard, nil))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	_, err := NewServer("127.0.0.1:5353", []string{"8.8.8.8:53"}, 5*time.Second, apiClient, nil, logger,
+		WithTLS(nil, "127.0.0.1:853", ""))
+	if err == nil {
+		t.Error("Expected an error for DNS-over-TLS without a certificate")
+	}
+}
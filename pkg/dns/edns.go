@@ -0,0 +1,72 @@
+package dns
+
+import (
+	"github.com/miekg/dns"
+)
+
+// ednsUDPSize is the EDNS0 UDP buffer size advertised to upstreams and
+// clients. 1232 bytes fits in the minimum IPv6 MTU with room for headers,
+// so answers are never fragmented (DNS Flag Day 2020); larger answers are
+// fetched over TCP instead.
+const ednsUDPSize = 1232
+
+// upstreamQuery returns r as it should be sent upstream: with an OPT
+// record advertising ednsUDPSize, whatever the client advertised. The
+// client's DO bit, EDNS version and options are kept. r is not modified.
+func upstreamQuery(r *dns.Msg) *dns.Msg {
+	opt := r.IsEdns0()
+	if opt != nil && opt.UDPSize() == ednsUDPSize {
+		return r
+	}
+
+	q := *r
+	q.Extra = make([]dns.RR, 0, len(r.Extra)+1)
+	for _, rr := range r.Extra {
+		if rr.Header().Rrtype != dns.TypeOPT {
+			q.Extra = append(q.Extra, rr)
+		}
+	}
+
+	o := &dns.OPT{Hdr: dns.RR_Header{Name: ".", Rrtype: dns.TypeOPT}}
+	if opt != nil {
+		// The TTL field holds the extended RCODE, version and DO bit
+		o.Hdr.Ttl = opt.Hdr.Ttl
+		o.Option = opt.Option
+	}
+	o.SetUDPSize(ednsUDPSize)
+	q.Extra = append(q.Extra, o)
+	return &q
+}
+
+// fitReply adapts an upstream answer to the client that asked r. Clients
+// that sent no OPT record get none back (RFC 6891 section 7); the others
+// are told our own buffer size rather than the upstream's. Over UDP the
+// answer is then cut down to the client's buffer size, 512 bytes without
+// EDNS, and marked truncated only if records had to be dropped; other
+// transports take the whole answer. resp is modified and returned.
+func fitReply(w dns.ResponseWriter, r, resp *dns.Msg) *dns.Msg {
+	clientOpt := r.IsEdns0()
+	for i, rr := range resp.Extra {
+		opt, ok := rr.(*dns.OPT)
+		if !ok {
+			continue
+		}
+		if clientOpt == nil {
+			resp.Extra = append(resp.Extra[:i], resp.Extra[i+1:]...)
+		} else {
+			opt.SetUDPSize(ednsUDPSize)
+		}
+		break
+	}
+
+	if w.RemoteAddr().Network() != "udp" {
+		return resp
+	}
+	size := dns.MinMsgSize
+	if clientOpt != nil {
+		size = max(int(clientOpt.UDPSize()), dns.MinMsgSize)
+	}
+	// Truncate compresses the answer only if it does not fit as it is
+	resp.Truncate(size)
+	return resp
+}
@@ -0,0 +1,125 @@
+package dns
+
+import (
+	"fmt"
+	"net"
+	"testing"
+
+	"github.com/miekg/dns"
+)
+
+// tcpDNSWriter is a mockDNSWriter for a client connected over TCP.
+type tcpDNSWriter struct {
+	mockDNSWriter
+}
+
+func (m *tcpDNSWriter) RemoteAddr() net.Addr {
+	return &net.TCPAddr{IP: net.ParseIP("192.168.1.50"), Port: 12345}
+}
+
+func TestUpstreamQuery(t *testing.T) {
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+
+	q := upstreamQuery(r)
+	opt := q.IsEdns0()
+	if opt == nil {
+		t.Fatal("Expected upstream query to carry an OPT record")
+	}
+	if opt.UDPSize() != ednsUDPSize {
+		t.Errorf("Expected UDP size %d, got %d", ednsUDPSize, opt.UDPSize())
+	}
+	if opt.Do() {
+		t.Error("Expected DO bit to stay clear")
+	}
+	if r.IsEdns0() != nil {
+		t.Error("Expected client query to be left unchanged")
+	}
+}
+
+func TestUpstreamQueryKeepsClientEDNS(t *testing.T) {
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+	r.SetEdns0(4096, true)
+
+	q := upstreamQuery(r)
+	opt := q.IsEdns0()
+	if opt == nil || opt.UDPSize() != ednsUDPSize || !opt.Do() {
+		t.Fatalf("Expected OPT with UDP size %d and DO set, got %v", ednsUDPSize, opt)
+	}
+	if n := len(q.Extra); n != 1 {
+		t.Errorf("Expected one OPT record, got %d extra records", n)
+	}
+	if size := r.IsEdns0().UDPSize(); size != 4096 {
+		t.Errorf("Expected client query to keep UDP size 4096, got %d", size)
+	}
+
+	r.IsEdns0().SetUDPSize(ednsUDPSize)
+	if upstreamQuery(r) != r {
+		t.Error("Expected query already advertising our size to be sent as is")
+	}
+}
+
+// largeReply answers r with n A records and an OPT record, as an upstream
+// asked with EDNS would.
+func largeReply(r *dns.Msg, n int) *dns.Msg {
+	m := new(dns.Msg)
+	m.SetReply(r)
+	for i := 0; i < n; i++ {
+		m.Answer = append(m.Answer, &dns.A{
+			Hdr: dns.RR_Header{Name: fmt.Sprintf("host%d.example.org.", i), Rrtype: dns.TypeA, Class: dns.ClassINET, Ttl: 60},
+			A:   net.IPv4(192, 0, 2, byte(i)),
+		})
+	}
+	m.SetEdns0(4096, false)
+	return m
+}
+
+func TestFitReplyTruncatesForUDPClient(t *testing.T) {
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+
+	resp := fitReply(&mockDNSWriter{}, r, largeReply(r, 100))
+	if resp.IsEdns0() != nil {
+		t.Error("Expected OPT record to be removed for a client without EDNS")
+	}
+	if !resp.Truncated {
+		t.Error("Expected oversized answer to be truncated")
+	}
+	if n := resp.Len(); n > dns.MinMsgSize {
+		t.Errorf("Expected answer to fit in %d bytes, got %d", dns.MinMsgSize, n)
+	}
+	if len(resp.Answer) == 0 {
+		t.Error("Expected truncated answer to keep the records that fit")
+	}
+}
+
+func TestFitReplyUsesClientBufferSize(t *testing.T) {
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+	r.SetEdns0(4096, false)
+
+	resp := fitReply(&mockDNSWriter{}, r, largeReply(r, 100))
+	if resp.Truncated {
+		t.Error("Expected answer within the client's buffer not to be truncated")
+	}
+	if len(resp.Answer) != 100 {
+		t.Errorf("Expected all 100 records, got %d", len(resp.Answer))
+	}
+	if opt := resp.IsEdns0(); opt == nil || opt.UDPSize() != ednsUDPSize {
+		t.Errorf("Expected OPT record advertising %d, got %v", ednsUDPSize, opt)
+	}
+}
+
+func TestFitReplyKeepsWholeAnswerOverTCP(t *testing.T) {
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+
+	resp := fitReply(&tcpDNSWriter{}, r, largeReply(r, 100))
+	if resp.Truncated || len(resp.Answer) != 100 {
+		t.Errorf("Expected whole answer over TCP, got %d records (truncated %v)", len(resp.Answer), resp.Truncated)
+	}
+	if resp.IsEdns0() != nil {
+		t.Error("Expected OPT record to be removed for a client without EDNS")
+	}
+}
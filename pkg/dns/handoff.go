@@ -0,0 +1,400 @@
+package dns
+
+import (
+	"bufio"
+	"context"
+	"errors"
+	"fmt"
+	"io"
+	"net"
+	"os"
+	"strconv"
+	"strings"
+	"sync"
+
+	"github.com/online-picket-line/opl-for-dns/pkg/api"
+)
+
+// handoffEnv passes the files handed over by Server.Upgrade to the new
+// process, as comma-separated name=descriptor pairs. Sockets are named by
+// network and address, such as "udp 0.0.0.0:53"; "ready" is the pipe the
+// new process reports readiness on, "cache" holds the cache contents and
+// "blocklist" a snapshot of the blocklist.
+const handoffEnv = "OPL_DNS_HANDOFF"
+
+// Handoff is what a process started by Server.Upgrade inherits from the
+// process it replaces: listening sockets, which keep their queued queries
+// and connections, the blocklist, the contents of the response cache, and a
+// pipe to report readiness on.
+type Handoff struct {
+	mu        sync.Mutex
+	sockets   map[string][]*os.File
+	cache     *os.File
+	blocklist *os.File
+	ready     *os.File
+}
+
+// InheritHandoff returns what the parent process handed over, or nil if
+// this process was not started by Server.Upgrade.
+func InheritHandoff() (*Handoff, error) {
+	spec, ok := os.LookupEnv(handoffEnv)
+	if !ok {
+		return nil, nil
+	}
+	os.Unsetenv(handoffEnv)
+
+	h := &Handoff{sockets: make(map[string][]*os.File)}
+	for _, field := range strings.Split(spec, ",") {
+		name, fdText, ok := strings.Cut(field, "=")
+		fd, err := strconv.Atoi(fdText)
+		if !ok || err != nil || fd < 3 {
+			return nil, fmt.Errorf("invalid %s entry %q", handoffEnv, field)
+		}
+		f := os.NewFile(uintptr(fd), name)
+		switch name {
+		case "ready":
+			h.ready = f
+		case "cache":
+			h.cache = f
+		case "blocklist":
+			h.blocklist = f
+		default:
+			h.sockets[name] = append(h.sockets[name], f)
+		}
+	}
+	return h, nil
+}
+
+// claim removes and returns every inherited socket with the given name.
+func (h *Handoff) claim(name string) []*os.File {
+	if h == nil {
+		return nil
+	}
+	h.mu.Lock()
+	defer h.mu.Unlock()
+	files := h.sockets[name]
+	delete(h.sockets, name)
+	return files
+}
+
+// LoadCache fills cache with the responses the parent process had cached.
+// The cache contents can only be loaded once.
+func (h *Handoff) LoadCache(cache *Cache) (int, error) {
+	h.mu.Lock()
+	f := h.cache
+	h.cache = nil
+	h.mu.Unlock()
+	if f == nil {
+		return 0, nil
+	}
+	defer f.Close()
+	return cache.ReadSnapshot(bufio.NewReader(f))
+}
+
+// LoadBlocklist publishes the blocklist the parent process was serving to
+// client. It returns nil if the parent had none; the blocklist can only be
+// loaded once.
+func (h *Handoff) LoadBlocklist(client *api.Client) (*api.Blocklist, error) {
+	h.mu.Lock()
+	f := h.blocklist
+	h.blocklist = nil
+	h.mu.Unlock()
+	if f == nil {
+		return nil, nil
+	}
+	defer f.Close()
+	return client.ReadSnapshot(bufio.NewReader(f))
+}
+
+// Ready tells the parent process that this one is serving, so that it can
+// shut down. Inherited sockets that no listener has claimed are closed, so
+// call it once every listener has been created.
+func (h *Handoff) Ready() error {
+	h.mu.Lock()
+	for name, files := range h.sockets {
+		for _, f := range files {
+			f.Close()
+		}
+		delete(h.sockets, name)
+	}
+	for _, f := range []**os.File{&h.cache, &h.blocklist} {
+		if *f != nil {
+			(*f).Close()
+			*f = nil
+		}
+	}
+	ready := h.ready
+	h.ready = nil
+	h.mu.Unlock()
+
+	if ready == nil {
+		return nil
+	}
+	defer ready.Close()
+	_, err := ready.Write([]byte{1})
+	return err
+}
+
+// fileSocket is a listening socket whose descriptor Upgrade can duplicate.
+type fileSocket interface {
+	File() (*os.File, error)
+}
+
+type handoffSocket struct {
+	name string
+	conn fileSocket
+}
+
+func socketName(network, addr string) string {
+	return network + " " + addr
+}
+
+// listenConfig returns the options for new listening sockets.
+func listenConfig(reusePort bool) *net.ListenConfig {
+	lc := &net.ListenConfig{}
+	if reusePort {
+		lc.Control = reusePortControl
+	}
+	return lc
+}
+
+// listenUDP opens a UDP socket on addr.
+func listenUDP(addr string, reusePort bool) (*net.UDPConn, error) {
+	pc, err := listenConfig(reusePort).ListenPacket(context.Background(), "udp", addr)
+	if err != nil {
+		return nil, err
+	}
+	return pc.(*net.UDPConn), nil
+}
+
+// listenTCP opens a TCP listener on addr.
+func listenTCP(addr string, reusePort bool) (*net.TCPListener, error) {
+	ln, err := listenConfig(reusePort).Listen(context.Background(), "tcp", addr)
+	if err != nil {
+		return nil, err
+	}
+	return ln.(*net.TCPListener), nil
+}
+
+// takeInherited returns a socket the previous process listened on with the
+// given name, or nil if none is left.
+func (s *Server) takeInherited(name string) *os.File {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	files := s.inherited[name]
+	if len(files) == 0 {
+		return nil
+	}
+	s.inherited[name] = files[1:]
+	return files[0]
+}
+
+// closeInherited closes the sockets with the given name that were
+// inherited but not needed, such as when fewer listeners are configured.
+func (s *Server) closeInherited(name string) {
+	s.mu.Lock()
+	files := s.inherited[name]
+	delete(s.inherited, name)
+	s.mu.Unlock()
+	for _, f := range files {
+		f.Close()
+	}
+}
+
+func (s *Server) addSocket(name string, conn fileSocket) {
+	s.mu.Lock()
+	s.sockets = append(s.sockets, handoffSocket{name: name, conn: conn})
+	s.mu.Unlock()
+}
+
+// listenUDP returns a UDP socket for addr, taking over one from the
+// previous process if there is one left.
+func (s *Server) listenUDP(addr string, reusePort bool) (*net.UDPConn, error) {
+	name := socketName("udp", addr)
+	var conn *net.UDPConn
+	if f := s.takeInherited(name); f != nil {
+		pc, err := net.FilePacketConn(f)
+		f.Close()
+		if err != nil {
+			return nil, fmt.Errorf("inherited socket %s: %w", name, err)
+		}
+		var ok bool
+		if conn, ok = pc.(*net.UDPConn); !ok {
+			pc.Close()
+			return nil, fmt.Errorf("inherited socket %s is not a UDP socket", name)
+		}
+	} else {
+		var err error
+		if conn, err = listenUDP(addr, reusePort); err != nil {
+			return nil, err
+		}
+	}
+	s.addSocket(name, conn)
+	return conn, nil
+}
+
+// listenTCP returns a TCP listener for addr, taking over one from the
+// previous process if there is one left.
+func (s *Server) listenTCP(addr string, reusePort bool) (*net.TCPListener, error) {
+	name := socketName("tcp", addr)
+	var ln *net.TCPListener
+	if f := s.takeInherited(name); f != nil {
+		l, err := net.FileListener(f)
+		f.Close()
+		if err != nil {
+			return nil, fmt.Errorf("inherited socket %s: %w", name, err)
+		}
+		var ok bool
+		if ln, ok = l.(*net.TCPListener); !ok {
+			l.Close()
+			return nil, fmt.Errorf("inherited socket %s is not a TCP listener", name)
+		}
+	} else {
+		var err error
+		if ln, err = listenTCP(addr, reusePort); err != nil {
+			return nil, err
+		}
+	}
+	s.addSocket(name, ln)
+	return ln, nil
+}
+
+// Listen opens a TCP listener on addr for another service of the process,
+// such as the metrics endpoint, that Upgrade hands over along with the DNS
+// listeners. It must be called before Handoff.Ready.
+func (s *Server) Listen(addr string) (net.Listener, error) {
+	name := socketName("tcp", addr)
+	s.mu.Lock()
+	if _, ok := s.inherited[name]; !ok {
+		s.inherited[name] = s.handoff.claim(name)
+	}
+	s.mu.Unlock()
+	ln, err := s.listenTCP(addr, false)
+	s.closeInherited(name)
+	if err != nil {
+		return nil, err
+	}
+	return ln, nil
+}
+
+// Upgrade starts a new instance of the running program that takes over the
+// server's listening sockets, the blocklist and, when caching is enabled,
+// the cache contents. It returns once the new process reports that it is serving,
+// after which the caller should shut the server down: until then both
+// processes answer from the shared sockets, so no query is dropped. If the
+// new process exits or ctx is done before it is ready, it is killed and
+// this server carries on alone.
+func (s *Server) Upgrade(ctx context.Context) (*os.Process, error) {
+	exe, err := os.Executable()
+	if err != nil {
+		return nil, fmt.Errorf("finding executable: %w", err)
+	}
+
+	readyR, readyW, err := os.Pipe()
+	if err != nil {
+		return nil, fmt.Errorf("creating readiness pipe: %w", err)
+	}
+	defer readyR.Close()
+
+	names := []string{"ready"}
+	files := []*os.File{readyW}
+	defer func() {
+		for _, f := range files {
+			f.Close()
+		}
+	}()
+
+	s.mu.Lock()
+	sockets := append([]handoffSocket(nil), s.sockets...)
+	s.mu.Unlock()
+	for _, sock := range sockets {
+		f, err := sock.conn.File()
+		if err != nil {
+			return nil, fmt.Errorf("socket %s: %w", sock.name, err)
+		}
+		names = append(names, sock.name)
+		files = append(files, f)
+	}
+
+	if s.apiClient.GetCachedBlocklist() != nil {
+		f, err := writeHandoffFile("blocklist", s.apiClient.WriteSnapshot)
+		if err != nil {
+			return nil, err
+		}
+		names = append(names, "blocklist")
+		files = append(files, f)
+	}
+	if s.cache != nil {
+		f, err := writeHandoffFile("cache", func(w io.Writer) error {
+			_, err := s.cache.WriteSnapshot(w)
+			return err
+		})
+		if err != nil {
+			return nil, err
+		}
+		names = append(names, "cache")
+		files = append(files, f)
+	}
+
+	// The new process sees its inherited files from descriptor 3 on
+	spec := make([]string, len(names))
+	for i, name := range names {
+		spec[i] = name + "=" + strconv.Itoa(3+i)
+	}
+	proc, err := os.StartProcess(exe, os.Args, &os.ProcAttr{
+		Env:   append(os.Environ(), handoffEnv+"="+strings.Join(spec, ",")),
+		Files: append([]*os.File{os.Stdin, os.Stdout, os.Stderr}, files...),
+	})
+	if err != nil {
+		return nil, fmt.Errorf("starting new process: %w", err)
+	}
+	// Only the new process holds the write end now, so the read fails if
+	// it exits
+	readyW.Close()
+	files = files[1:]
+
+	ready := make(chan error, 1)
+	go func() {
+		var b [1]byte
+		_, err := readyR.Read(b[:])
+		ready <- err
+	}()
+	select {
+	case err = <-ready:
+		if err != nil {
+			err = errors.New("new process exited before it was ready")
+		}
+	case <-ctx.Done():
+		err = fmt.Errorf("waiting for new process: %w", ctx.Err())
+	}
+	if err != nil {
+		proc.Kill()
+		go proc.Wait()
+		return nil, err
+	}
+	return proc, nil
+}
+
+// writeHandoffFile writes what write produces to an unlinked temporary
+// file, positioned at its start.
+func writeHandoffFile(what string, write func(io.Writer) error) (*os.File, error) {
+	f, err := os.CreateTemp("", "opl-dns-"+what+"-*")
+	if err != nil {
+		return nil, fmt.Errorf("creating %s file: %w", what, err)
+	}
+	os.Remove(f.Name())
+
+	w := bufio.NewWriter(f)
+	err = write(w)
+	if err == nil {
+		err = w.Flush()
+	}
+	if err == nil {
+		_, err = f.Seek(0, 0)
+	}
+	if err != nil {
+		f.Close()
+		return nil, fmt.Errorf("writing %s file: %w", what, err)
+	}
+	return f, nil
+}
@@ -0,0 +1,262 @@
+//go:build unix
+
+package dns
+
+import (
+	"context"
+	"io"
+	"log/slog"
+	"net"
+	"net/http"
+	"net/http/httptest"
+	"os"
+	"strconv"
+	"syscall"
+	"testing"
+	"time"
+
+	"github.com/miekg/dns"
+	"github.com/online-picket-line/opl-for-dns/pkg/api"
+)
+
+// dupFd returns a copy of the socket's descriptor for a handoff to own.
+func dupFd(t *testing.T, conn fileSocket) string {
+	t.Helper()
+	f, err := conn.File()
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer f.Close()
+	fd, err := syscall.Dup(int(f.Fd()))
+	if err != nil {
+		t.Fatal(err)
+	}
+	return strconv.Itoa(fd)
+}
+
+// inheritSockets opens UDP and TCP sockets on a free loopback port and
+// passes them through the handoff variable as Upgrade would, closing this
+// process's own copies so that only the inherited ones remain. It returns
+// the sockets' address.
+func inheritSockets(t *testing.T) string {
+	t.Helper()
+	udp, err := net.ListenUDP("udp", &net.UDPAddr{IP: net.IPv4(127, 0, 0, 1)})
+	if err != nil {
+		t.Fatal(err)
+	}
+	addr := udp.LocalAddr().String()
+	tcp, err := net.Listen("tcp", addr)
+	if err != nil {
+		udp.Close()
+		t.Fatal(err)
+	}
+	spec := "udp " + addr + "=" + dupFd(t, udp) + ",tcp " + addr + "=" + dupFd(t, tcp.(*net.TCPListener))
+	udp.Close()
+	tcp.Close()
+	t.Setenv(handoffEnv, spec)
+	return addr
+}
+
+// startHandoffServer starts UDP and TCP listeners on the sockets passed by
+// inheritSockets, forwarding to upstream and blocking example.com, and
+// waits until both answer.
+func startHandoffServer(t *testing.T, upstream string) (*Server, string) {
+	t.Helper()
+	addr := inheritSockets(t)
+	h, err := InheritHandoff()
+	if err != nil {
+		t.Fatalf("InheritHandoff: %v", err)
+	}
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	apiClient.SetBlocklistForTesting([]api.BlockListItem{{URL: "https://example.com", Employer: "Test Corp"}})
+	logger := slog.New(slog.NewTextHandler(io.Discard, nil))
+	server, err := NewServer(addr, []string{upstream}, 2*time.Second, apiClient, nil, logger, WithHandoff(h))
+	if err != nil {
+		t.Fatalf("NewServer: %v", err)
+	}
+	go server.Start()
+	go server.StartTCP()
+
+	for _, network := range []string{"udp", "tcp"} {
+		c := &dns.Client{Net: network, Timeout: 200 * time.Millisecond}
+		r := new(dns.Msg)
+		r.SetQuestion("www.example.com.", dns.TypeA)
+		var resp *dns.Msg
+		for i := 0; i < 25 && resp == nil; i++ {
+			if resp, _, err = c.Exchange(r, addr); err != nil {
+				time.Sleep(20 * time.Millisecond)
+			}
+		}
+		if resp == nil {
+			server.Stop()
+			t.Fatalf("No %s answer from inherited socket: %v", network, err)
+		}
+		if len(resp.Answer) != 1 || !resp.Answer[0].(*dns.A).A.Equal(net.IPv4zero) {
+			t.Errorf("Expected %s sinkhole answer, got %v", network, resp)
+		}
+	}
+	return server, addr
+}
+
+func TestInheritHandoffNotInherited(t *testing.T) {
+	t.Setenv(handoffEnv, "")
+	os.Unsetenv(handoffEnv)
+	h, err := InheritHandoff()
+	if h != nil || err != nil {
+		t.Errorf("Expected no handoff, got %v and %v", h, err)
+	}
+	if files := h.claim("udp :53"); files != nil {
+		t.Errorf("Expected nil handoff to have no sockets, got %v", files)
+	}
+}
+
+func TestInheritHandoffInvalid(t *testing.T) {
+	for _, spec := range []string{"ready", "ready=x", "udp :53=1"} {
+		t.Setenv(handoffEnv, spec)
+		if _, err := InheritHandoff(); err == nil {
+			t.Errorf("Expected error for %q", spec)
+		}
+	}
+}
+
+func TestHandoffReady(t *testing.T) {
+	readyR, readyW, err := os.Pipe()
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer readyR.Close()
+	sockR, sockW, err := os.Pipe()
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer sockW.Close()
+
+	// The handoff owns its descriptors, so it is given copies
+	readyFd, err := syscall.Dup(int(readyW.Fd()))
+	if err != nil {
+		t.Fatal(err)
+	}
+	readyW.Close()
+	sockFd, err := syscall.Dup(int(sockR.Fd()))
+	if err != nil {
+		t.Fatal(err)
+	}
+	sockR.Close()
+
+	t.Setenv(handoffEnv, "ready="+strconv.Itoa(readyFd)+",udp :53="+strconv.Itoa(sockFd))
+	h, err := InheritHandoff()
+	if err != nil {
+		t.Fatalf("InheritHandoff: %v", err)
+	}
+	if _, ok := os.LookupEnv(handoffEnv); ok {
+		t.Error("Expected the handoff variable to be cleared")
+	}
+	if files := h.claim("tcp :53"); len(files) != 0 {
+		t.Errorf("Expected no TCP socket, got %v", files)
+	}
+
+	if err := h.Ready(); err != nil {
+		t.Fatalf("Ready: %v", err)
+	}
+	var b [1]byte
+	if n, err := readyR.Read(b[:]); n != 1 || err != nil {
+		t.Errorf("Expected readiness byte, got %d bytes and %v", n, err)
+	}
+	// The unclaimed socket was closed
+	if files := h.claim("udp :53"); len(files) != 0 {
+		t.Errorf("Expected unclaimed sockets to be released, got %v", files)
+	}
+}
+
+func TestHandoffLoadBlocklist(t *testing.T) {
+	upstream := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		io.WriteString(w, `{"Test Corp": {"matchingUrlRegexes": ["example.com"]}}`)
+	}))
+	defer upstream.Close()
+	parent := api.NewClient(upstream.URL, "", 10*time.Second)
+	if _, err := parent.FetchBlocklist(context.Background()); err != nil {
+		t.Fatalf("FetchBlocklist: %v", err)
+	}
+
+	f, err := writeHandoffFile("blocklist", parent.WriteSnapshot)
+	if err != nil {
+		t.Fatalf("writeHandoffFile: %v", err)
+	}
+	fd, err := syscall.Dup(int(f.Fd()))
+	f.Close()
+	if err != nil {
+		t.Fatal(err)
+	}
+	t.Setenv(handoffEnv, "blocklist="+strconv.Itoa(fd))
+	h, err := InheritHandoff()
+	if err != nil {
+		t.Fatalf("InheritHandoff: %v", err)
+	}
+
+	child := api.NewClient(upstream.URL, "", 10*time.Second)
+	if blocklist, err := h.LoadBlocklist(child); err != nil || blocklist == nil {
+		t.Fatalf("LoadBlocklist: %v, %v", blocklist, err)
+	}
+	if _, blocked := child.CheckDomain("www.example.com"); !blocked {
+		t.Error("Expected the inherited blocklist to be served")
+	}
+	if blocklist, err := h.LoadBlocklist(child); blocklist != nil || err != nil {
+		t.Errorf("Expected the blocklist to be loaded only once, got %v, %v", blocklist, err)
+	}
+}
+
+func TestServerServesInheritedSockets(t *testing.T) {
+	// startHandoffServer fails unless both inherited sockets answer, as
+	// nothing else is listening on their address
+	server, _ := startHandoffServer(t, "127.0.0.1:1")
+	if err := server.Stop(); err != nil {
+		t.Errorf("Stop: %v", err)
+	}
+}
+
+func TestShutdownDrainsInFlightQueries(t *testing.T) {
+	// The upstream answers slowly, so the query is in flight when the
+	// shutdown starts
+	pc, err := net.ListenPacket("udp", "127.0.0.1:0")
+	if err != nil {
+		t.Fatal(err)
+	}
+	upstream := &dns.Server{PacketConn: pc, Handler: dns.HandlerFunc(func(w dns.ResponseWriter, r *dns.Msg) {
+		time.Sleep(300 * time.Millisecond)
+		w.WriteMsg(answerFor(r, 60))
+	})}
+	go upstream.ActivateAndServe()
+	defer upstream.Shutdown()
+
+	server, addr := startHandoffServer(t, pc.LocalAddr().String())
+
+	answered := make(chan error, 1)
+	go func() {
+		r := new(dns.Msg)
+		r.SetQuestion("forwarded.example.org.", dns.TypeA)
+		resp, _, err := (&dns.Client{Timeout: 2 * time.Second}).Exchange(r, addr)
+		if err == nil && len(resp.Answer) != 1 {
+			err = io.ErrUnexpectedEOF
+		}
+		answered <- err
+	}()
+	time.Sleep(100 * time.Millisecond)
+
+	start := time.Now()
+	ctx, cancel := context.WithTimeout(context.Background(), 5*time.Second)
+	defer cancel()
+	if err := server.Shutdown(ctx); err != nil {
+		t.Errorf("Shutdown: %v", err)
+	}
+	if elapsed := time.Since(start); elapsed < 150*time.Millisecond {
+		t.Errorf("Expected Shutdown to wait for the in-flight query, returned after %v", elapsed)
+	}
+	if err := <-answered; err != nil {
+		t.Errorf("Expected the in-flight query to be answered, got %v", err)
+	}
+
+	if conn, err := net.DialTimeout("tcp", addr, time.Second); err == nil {
+		conn.Close()
+		t.Error("Expected the TCP listener to be closed")
+	}
+}
@@ -0,0 +1,240 @@
+package dns
+
+import (
+	"fmt"
+	"strings"
+
+	"github.com/miekg/dns"
+)
+
+// localNegativeTTL is the TTL and negative-caching time of the SOA records
+// synthesized for local zones. It is short so that configuration changes
+// reach clients quickly.
+const localNegativeTTL = 300
+
+// LocalZones answers queries for names served by the server itself rather
+// than forwarded: configured records, configured zones, and optionally the
+// special-use names of RFC 6761 and the locally served reverse zones of
+// RFC 6303. It is built once at startup and never modified afterwards, so
+// lookups need no locking.
+//
+// A name with records gets them, or an empty NOERROR answer for other
+// types. A name without records below a local zone gets NXDOMAIN. Other
+// names are not answered locally.
+type LocalZones struct {
+	// names maps normalized owner names to their records. Zone apexes own
+	// their SOA; empty non-terminals inside zones have no records.
+	names map[string][]dns.RR
+
+	// zones maps normalized zone apexes to their zone
+	zones map[string]*localZone
+}
+
+type localZone struct {
+	soa dns.RR
+
+	// redirect gives names below the apex the apex's records instead of
+	// NXDOMAIN, as RFC 6761 section 6.3 asks for localhost
+	redirect bool
+}
+
+// NewLocalZones compiles the local zones and records. zones are domain
+// names; records are resource records in zone-file format, such as
+// "nas.home.arpa. 300 IN A 192.168.1.10", whose TTL defaults to an hour.
+// With specialUse, the RFC 6761 and RFC 6303 names are served too;
+// configured records may be added inside them.
+func NewLocalZones(zones, records []string, specialUse bool) (*LocalZones, error) {
+	lz := &LocalZones{
+		names: make(map[string][]dns.RR),
+		zones: make(map[string]*localZone),
+	}
+
+	if specialUse {
+		for _, zone := range specialUseZones() {
+			lz.addZone(zone)
+		}
+		lz.zones["localhost"].redirect = true
+		records = append(append([]string(nil), specialUseRecords...), records...)
+	}
+	for _, zone := range zones {
+		name := normalizeName(zone)
+		if name == "" {
+			return nil, fmt.Errorf("invalid local zone %q", zone)
+		}
+		lz.addZone(name)
+	}
+
+	for _, record := range records {
+		rr, err := dns.NewRR(record)
+		if err != nil {
+			return nil, fmt.Errorf("invalid local record %q: %w", record, err)
+		}
+		if rr == nil || rr.Header().Class != dns.ClassINET {
+			return nil, fmt.Errorf("invalid local record %q: expected an IN record", record)
+		}
+		if err := lz.addRecord(rr); err != nil {
+			return nil, fmt.Errorf("invalid local record %q: %w", record, err)
+		}
+	}
+	return lz, nil
+}
+
+func (lz *LocalZones) addZone(name string) {
+	if _, ok := lz.zones[name]; ok {
+		return
+	}
+	soa := localSOA(name)
+	lz.zones[name] = &localZone{soa: soa}
+	lz.names[name] = append(lz.names[name], soa)
+}
+
+func (lz *LocalZones) addRecord(rr dns.RR) error {
+	hdr := rr.Header()
+	name := normalizeName(hdr.Name)
+	if name == "" {
+		return fmt.Errorf("records for the root are not supported")
+	}
+	hdr.Name = dns.Fqdn(name)
+
+	for _, other := range lz.names[name] {
+		otherType := other.Header().Rrtype
+		if (hdr.Rrtype == dns.TypeCNAME || otherType == dns.TypeCNAME) && otherType != dns.TypeSOA {
+			return fmt.Errorf("a CNAME cannot share its name with other records")
+		}
+	}
+	lz.names[name] = append(lz.names[name], rr)
+
+	// Parents between the name and its zone exist, without records
+	if _, zone, ok := lz.zoneOf(name); ok {
+		for parent := name; parent != zone; {
+			parent = parent[strings.IndexByte(parent, '.')+1:]
+			if _, ok := lz.names[parent]; !ok {
+				lz.names[parent] = nil
+			}
+		}
+	}
+	return nil
+}
+
+// zoneOf returns the closest local zone enclosing a normalized name, and
+// its apex.
+func (lz *LocalZones) zoneOf(name string) (*localZone, string, bool) {
+	for {
+		if zone, ok := lz.zones[name]; ok {
+			return zone, name, true
+		}
+		i := strings.IndexByte(name, '.')
+		if i < 0 {
+			return nil, "", false
+		}
+		name = name[i+1:]
+	}
+}
+
+// answer returns the local answer to r, whose question name normalizes to
+// name, or nil if the name is not served locally.
+func (lz *LocalZones) answer(r *dns.Msg, name string) *dns.Msg {
+	q := r.Question[0]
+	if q.Qclass != dns.ClassINET || name == "" {
+		return nil
+	}
+
+	rrs, exists := lz.names[name]
+	zone, apex, inZone := lz.zoneOf(name)
+	if !exists {
+		if !inZone {
+			return nil
+		}
+		if zone.redirect {
+			rrs, exists = lz.names[apex], true
+		}
+	}
+
+	m := newReply(r)
+	m.Authoritative = true
+	if exists {
+		for _, rr := range rrs {
+			t := rr.Header().Rrtype
+			if t == q.Qtype || t == dns.TypeCNAME || q.Qtype == dns.TypeANY {
+				m.Answer = append(m.Answer, withOwner(rr, q.Name))
+			}
+		}
+	} else {
+		m.Rcode = dns.RcodeNameError
+	}
+
+	if len(m.Answer) == 0 {
+		// Negative answers carry the zone's SOA so that they are cached
+		// (RFC 2308); a name outside any zone stands in for its own
+		if inZone {
+			m.Ns = append(m.Ns, zone.soa)
+		} else {
+			m.Ns = append(m.Ns, localSOA(name))
+		}
+	}
+	return m
+}
+
+// localSOA synthesizes the SOA of a local zone.
+func localSOA(apex string) *dns.SOA {
+	return &dns.SOA{
+		Hdr:     dns.RR_Header{Name: dns.Fqdn(apex), Rrtype: dns.TypeSOA, Class: dns.ClassINET, Ttl: localNegativeTTL},
+		Ns:      "localhost.",
+		Mbox:    "nobody.invalid.",
+		Serial:  1,
+		Refresh: 3600,
+		Retry:   1200,
+		Expire:  604800,
+		Minttl:  localNegativeTTL,
+	}
+}
+
+// withOwner returns rr owned by name as the client spelled it. Records
+// already owned by exactly that name are shared, not copied; answers are
+// never modified once built.
+func withOwner(rr dns.RR, name string) dns.RR {
+	if rr.Header().Name == name {
+		return rr
+	}
+	rr = dns.Copy(rr)
+	rr.Header().Name = name
+	return rr
+}
+
+// normalizeName returns a domain name lowercased and without its trailing
+// dot, as queryContext normalizes query names.
+func normalizeName(name string) string {
+	return strings.ToLower(strings.TrimSuffix(name, "."))
+}
+
+// specialUseZones returns the zones answered locally with specialUse: the
+// special-use domain names that must not be sent to the global DNS
+// (RFC 6761, RFC 6762, RFC 7686) and the reverse zones of loopback,
+// unspecified, broadcast and documentation addresses (RFC 6303 section 4).
+//
+// home.arpa (RFC 8375) and the reverse zones of private and link-local
+// addresses are left out: on home and office networks the router or a LAN
+// resolver serves them, and answering NXDOMAIN would hide those names.
+// They can be listed in local_zones where nothing upstream serves them.
+func specialUseZones() []string {
+	return []string{
+		"localhost", "invalid", "test", "local", "onion",
+
+		"0.in-addr.arpa", "127.in-addr.arpa",
+		"2.0.192.in-addr.arpa", "100.51.198.in-addr.arpa",
+		"113.0.203.in-addr.arpa", "255.255.255.255.in-addr.arpa",
+
+		strings.Repeat("0.", 32) + "ip6.arpa",
+		"1." + strings.Repeat("0.", 31) + "ip6.arpa",
+		"8.b.d.0.1.0.0.2.ip6.arpa",
+	}
+}
+
+// specialUseRecords are the loopback answers for localhost and its reverse
+// names.
+var specialUseRecords = []string{
+	"localhost. 3600 IN A 127.0.0.1",
+	"localhost. 3600 IN AAAA ::1",
+	"1.0.0.127.in-addr.arpa. 3600 IN PTR localhost.",
+	"1." + strings.Repeat("0.", 31) + "ip6.arpa. 3600 IN PTR localhost.",
+}
@@ -0,0 +1,218 @@
+package dns
+
+import (
+	"io"
+	"log/slog"
+	"net"
+	"strings"
+	"testing"
+	"time"
+
+	"github.com/miekg/dns"
+	"github.com/online-picket-line/opl-for-dns/pkg/api"
+	"github.com/online-picket-line/opl-for-dns/pkg/stats"
+)
+
+// localAnswer asks zones for name and type as a client would.
+func localAnswer(zones *LocalZones, name string, qtype uint16) *dns.Msg {
+	r := new(dns.Msg)
+	r.SetQuestion(name, qtype)
+	qc := newQueryContext(name)
+	defer qc.release()
+	return zones.answer(r, qc.domain)
+}
+
+func TestLocalZonesRecords(t *testing.T) {
+	zones, err := NewLocalZones([]string{"lan"}, []string{
+		"nas.lan. 300 IN A 192.168.1.10",
+		"printer.office.lan. IN A 192.168.1.20",
+		"www.lan. IN CNAME nas.lan.",
+	}, false)
+	if err != nil {
+		t.Fatalf("NewLocalZones: %v", err)
+	}
+
+	m := localAnswer(zones, "NAS.lan.", dns.TypeA)
+	if m == nil || m.Rcode != dns.RcodeSuccess || !m.Authoritative || len(m.Answer) != 1 {
+		t.Fatalf("Expected one authoritative answer, got %v", m)
+	}
+	a, ok := m.Answer[0].(*dns.A)
+	if !ok || !a.A.Equal(net.ParseIP("192.168.1.10")) || a.Hdr.Ttl != 300 {
+		t.Errorf("Unexpected answer %v", m.Answer[0])
+	}
+	if a.Hdr.Name != "NAS.lan." {
+		t.Errorf("Expected the owner name as the client spelled it, got %q", a.Hdr.Name)
+	}
+
+	if m := localAnswer(zones, "printer.office.lan.", dns.TypeA); m == nil || len(m.Answer) != 1 || m.Answer[0].Header().Ttl != 3600 {
+		t.Errorf("Expected record with the default TTL, got %v", m)
+	}
+	if m := localAnswer(zones, "www.lan.", dns.TypeAAAA); m == nil || len(m.Answer) != 1 || m.Answer[0].Header().Rrtype != dns.TypeCNAME {
+		t.Errorf("Expected the CNAME for any type, got %v", m)
+	}
+}
+
+func TestLocalZonesNegativeAnswers(t *testing.T) {
+	zones, err := NewLocalZones([]string{"lan"}, []string{"printer.office.lan. IN A 192.168.1.20"}, false)
+	if err != nil {
+		t.Fatalf("NewLocalZones: %v", err)
+	}
+
+	tests := []struct {
+		name  string
+		qtype uint16
+		rcode int
+	}{
+		{"missing.lan.", dns.TypeA, dns.RcodeNameError},
+		{"a.b.missing.lan.", dns.TypeA, dns.RcodeNameError},
+		{"printer.office.lan.", dns.TypeAAAA, dns.RcodeSuccess},
+		// office.lan exists because a name below it does
+		{"office.lan.", dns.TypeA, dns.RcodeSuccess},
+		{"lan.", dns.TypeA, dns.RcodeSuccess},
+	}
+	for _, tt := range tests {
+		m := localAnswer(zones, tt.name, tt.qtype)
+		if m == nil {
+			t.Errorf("%s: expected a local answer", tt.name)
+			continue
+		}
+		if m.Rcode != tt.rcode || len(m.Answer) != 0 {
+			t.Errorf("%s: expected rcode %d and no answers, got %d and %v", tt.name, tt.rcode, m.Rcode, m.Answer)
+		}
+		if len(m.Ns) != 1 || m.Ns[0].Header().Rrtype != dns.TypeSOA || m.Ns[0].Header().Name != "lan." {
+			t.Errorf("%s: expected the zone's SOA in the authority section, got %v", tt.name, m.Ns)
+		}
+	}
+
+	if m := localAnswer(zones, "lan.", dns.TypeSOA); m == nil || len(m.Answer) != 1 {
+		t.Errorf("Expected the zone's SOA at its apex, got %v", m)
+	}
+	if m := localAnswer(zones, "example.com.", dns.TypeA); m != nil {
+		t.Errorf("Expected names outside local zones to be forwarded, got %v", m)
+	}
+}
+
+func TestLocalZonesRecordOutsideZone(t *testing.T) {
+	zones, err := NewLocalZones(nil, []string{"intranet.example.com. IN A 10.0.0.5"}, false)
+	if err != nil {
+		t.Fatalf("NewLocalZones: %v", err)
+	}
+	if m := localAnswer(zones, "intranet.example.com.", dns.TypeA); m == nil || len(m.Answer) != 1 {
+		t.Errorf("Expected the local record, got %v", m)
+	}
+	if m := localAnswer(zones, "intranet.example.com.", dns.TypeAAAA); m == nil || m.Rcode != dns.RcodeSuccess || len(m.Ns) != 1 {
+		t.Errorf("Expected NODATA with a SOA, got %v", m)
+	}
+	for _, name := range []string{"www.example.com.", "sub.intranet.example.com."} {
+		if m := localAnswer(zones, name, dns.TypeA); m != nil {
+			t.Errorf("Expected %s to be forwarded, got %v", name, m)
+		}
+	}
+}
+
+func TestLocalZonesSpecialUse(t *testing.T) {
+	zones, err := NewLocalZones(nil, []string{"50.2.0.192.in-addr.arpa. IN PTR doc.example."}, true)
+	if err != nil {
+		t.Fatalf("NewLocalZones: %v", err)
+	}
+
+	for _, name := range []string{
+		"localhost.", "app.localhost.",
+	} {
+		m := localAnswer(zones, name, dns.TypeA)
+		if m == nil || len(m.Answer) != 1 || !m.Answer[0].(*dns.A).A.Equal(net.IPv4(127, 0, 0, 1)) {
+			t.Errorf("Expected %s to resolve to 127.0.0.1, got %v", name, m)
+		}
+	}
+	if m := localAnswer(zones, "localhost.", dns.TypeAAAA); m == nil || len(m.Answer) != 1 {
+		t.Errorf("Expected localhost to resolve to ::1, got %v", m)
+	}
+
+	for _, name := range []string{
+		"printer.local.", "foo.invalid.", "example.test.", "xyz.onion.",
+		"5.0.0.127.in-addr.arpa.", "1.2.0.192.in-addr.arpa.",
+		"b.a.9.8.7.6.5.0.4.0.0.0.3.0.0.0.2.0.0.0.1.0.0.0.8.b.d.0.1.0.0.2.ip6.arpa.",
+	} {
+		if m := localAnswer(zones, name, dns.TypePTR); m == nil || m.Rcode != dns.RcodeNameError {
+			t.Errorf("Expected NXDOMAIN for %s, got %v", name, m)
+		}
+	}
+
+	if m := localAnswer(zones, "1.0.0.127.in-addr.arpa.", dns.TypePTR); m == nil || len(m.Answer) != 1 {
+		t.Errorf("Expected a PTR for 127.0.0.1, got %v", m)
+	}
+	if m := localAnswer(zones, "50.2.0.192.in-addr.arpa.", dns.TypePTR); m == nil || len(m.Answer) != 1 {
+		t.Errorf("Expected configured PTR inside a special-use zone, got %v", m)
+	}
+
+	// Public names are not local, and neither are the names a LAN
+	// resolver serves: home.arpa and private and link-local reverse zones
+	for _, name := range []string{
+		"example.com.", "localhost.example.com.", "router.home.arpa.",
+		"1.1.168.192.in-addr.arpa.", "5.0.0.10.in-addr.arpa.", "1.0.20.172.in-addr.arpa.", "1.1.254.169.in-addr.arpa.",
+		"b.a.9.8.7.6.5.0.4.0.0.0.3.0.0.0.2.0.0.0.1.0.0.0.0.0.0.0.0.0.d.f.ip6.arpa.",
+	} {
+		if m := localAnswer(zones, name, dns.TypeA); m != nil {
+			t.Errorf("Expected %s to be forwarded, got %v", name, m)
+		}
+	}
+}
+
+func TestNewLocalZonesErrors(t *testing.T) {
+	tests := []struct {
+		name    string
+		zones   []string
+		records []string
+		wantErr string
+	}{
+		{"root zone", []string{"."}, nil, "invalid local zone"},
+		{"bad record", nil, []string{"nas.lan. IN A not-an-address"}, "invalid local record"},
+		{"CNAME with other data", nil, []string{"www.lan. IN A 192.168.1.10", "www.lan. IN CNAME nas.lan."}, "CNAME"},
+	}
+	for _, tt := range tests {
+		_, err := NewLocalZones(tt.zones, tt.records, false)
+		if err == nil || !strings.Contains(err.Error(), tt.wantErr) {
+			t.Errorf("%s: expected error containing %q, got %v", tt.name, tt.wantErr, err)
+		}
+	}
+}
+
+func TestServeDNSLocalZone(t *testing.T) {
+	logger := slog.New(slog.NewTextHandler(io.Discard, nil))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	apiClient.SetBlocklistForTesting([]api.BlockListItem{{URL: "https://blocked.lan", Employer: "Test Corp"}})
+	zones, err := NewLocalZones([]string{"lan"}, []string{"nas.lan. IN A 192.168.1.10"}, true)
+	if err != nil {
+		t.Fatalf("NewLocalZones: %v", err)
+	}
+	collector := stats.NewCollector()
+	// The upstream is unreachable, so any forwarded query would fail
+	server, _ := NewServer("127.0.0.1:5353", []string{"127.0.0.1:1"}, time.Second, apiClient, collector, logger,
+		WithLocalZones(zones))
+
+	r := new(dns.Msg)
+	r.SetQuestion("nas.lan.", dns.TypeA)
+	w := &mockDNSWriter{}
+	server.ServeDNS(w, r)
+	if w.msg == nil || len(w.msg.Answer) != 1 {
+		t.Fatalf("Expected local answer, got %v", w.msg)
+	}
+
+	r.SetQuestion("wpad.lan.", dns.TypeA)
+	server.ServeDNS(w, r)
+	if w.msg.Rcode != dns.RcodeNameError {
+		t.Errorf("Expected NXDOMAIN, got rcode %d", w.msg.Rcode)
+	}
+
+	// The blocklist still comes first
+	r.SetQuestion("blocked.lan.", dns.TypeA)
+	server.ServeDNS(w, r)
+	if w.msg.Rcode != dns.RcodeSuccess || len(w.msg.Answer) != 1 {
+		t.Errorf("Expected blocked name to be sinkholed, got %v", w.msg)
+	}
+
+	total, blocked, forwarded, _ := collector.Snapshot()
+	if total != 3 || blocked != 1 || forwarded != 0 {
+		t.Errorf("Expected 3 queries with 1 blocked and none forwarded, got %d, %d and %d", total, blocked, forwarded)
+	}
+}
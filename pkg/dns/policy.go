@@ -0,0 +1,223 @@
+package dns
+
+import (
+	"fmt"
+	"net/netip"
+)
+
+// BlockMode is how a view answers queries for blocked names.
+type BlockMode int
+
+const (
+	// BlockSinkhole answers A and AAAA queries with 0.0.0.0 and ::, so
+	// that connections fail immediately
+	BlockSinkhole BlockMode = iota
+
+	// BlockNXDomain answers queries of every type that the name does not
+	// exist
+	BlockNXDomain
+
+	// BlockRedirect answers A and AAAA queries with the view's redirect
+	// addresses, such as those of a page explaining the action
+	BlockRedirect
+
+	// BlockAllow exempts the view's clients: blocked names are resolved
+	// as usual
+	BlockAllow
+)
+
+// ParseBlockMode returns the mode with the given configuration name:
+// "sinkhole" (or ""), "nxdomain", "redirect" or "allow".
+func ParseBlockMode(name string) (BlockMode, error) {
+	switch name {
+	case "", "sinkhole":
+		return BlockSinkhole, nil
+	case "nxdomain":
+		return BlockNXDomain, nil
+	case "redirect":
+		return BlockRedirect, nil
+	case "allow":
+		return BlockAllow, nil
+	}
+	return 0, fmt.Errorf("unknown block mode %q", name)
+}
+
+// View is the blocking policy of the clients in some subnets. Views only
+// differ in how blocked names are answered; they all check the one
+// blocklist the API client holds.
+type View struct {
+	// Name identifies the view in the block log
+	Name string
+
+	// Subnets are the client prefixes the view applies to. A client
+	// belongs to the view with its most specific matching prefix.
+	Subnets []netip.Prefix
+
+	Mode BlockMode
+
+	// TTL is the TTL of blocked answers, in seconds; 0 means sinkholeTTL
+	TTL uint32
+
+	// RedirectA and RedirectAAAA are the answers of BlockRedirect. When
+	// one is not set, queries of its type get an empty answer.
+	RedirectA    netip.Addr
+	RedirectAAAA netip.Addr
+
+	// a and aaaa are the answers' rdata, nil for an empty answer
+	a, aaaa []byte
+}
+
+// defaultView is the policy of clients outside every view, and of all
+// clients when no views are configured.
+var defaultView = View{Mode: BlockSinkhole, TTL: sinkholeTTL, a: zeroIPv4[:], aaaa: zeroIPv6[:]}
+
+// Policies maps clients to views by longest-prefix match on their
+// address. It is built once and never modified, so queries read it
+// without locking.
+type Policies struct {
+	views  []View
+	v4, v6 prefixTable
+}
+
+// NewPolicies builds the view table. Clients matching none of the views
+// get the default policy of sinkholing with a 60-second TTL; a view of
+// 0.0.0.0/0 and ::/0 changes that.
+func NewPolicies(views []View) (*Policies, error) {
+	p := &Policies{views: make([]View, len(views))}
+	names := make(map[string]bool, len(views))
+	for i, v := range views {
+		if v.Name == "" {
+			return nil, fmt.Errorf("view %d has no name", i+1)
+		}
+		if names[v.Name] {
+			return nil, fmt.Errorf("duplicate view %q", v.Name)
+		}
+		names[v.Name] = true
+		if len(v.Subnets) == 0 {
+			return nil, fmt.Errorf("view %q has no subnets", v.Name)
+		}
+
+		if v.TTL == 0 {
+			v.TTL = sinkholeTTL
+		}
+		switch v.Mode {
+		case BlockSinkhole:
+			v.a, v.aaaa = zeroIPv4[:], zeroIPv6[:]
+		case BlockRedirect:
+			if !v.RedirectA.IsValid() && !v.RedirectAAAA.IsValid() {
+				return nil, fmt.Errorf("view %q redirects but has no redirect address", v.Name)
+			}
+			if v.RedirectA.IsValid() {
+				if !v.RedirectA.Is4() {
+					return nil, fmt.Errorf("view %q: %s is not an IPv4 address", v.Name, v.RedirectA)
+				}
+				a := v.RedirectA.As4()
+				v.a = a[:]
+			}
+			if v.RedirectAAAA.IsValid() {
+				if !v.RedirectAAAA.Is6() || v.RedirectAAAA.Is4In6() {
+					return nil, fmt.Errorf("view %q: %s is not an IPv6 address", v.Name, v.RedirectAAAA)
+				}
+				aaaa := v.RedirectAAAA.As16()
+				v.aaaa = aaaa[:]
+			}
+		}
+		p.views[i] = v
+
+		for _, prefix := range v.Subnets {
+			if !prefix.IsValid() {
+				return nil, fmt.Errorf("view %q has an invalid subnet", v.Name)
+			}
+			prefix = prefix.Masked()
+			table := &p.v6
+			if prefix.Addr().Is4() {
+				table = &p.v4
+			}
+			if !table.insert(prefix, i+1) {
+				return nil, fmt.Errorf("subnet %s is in more than one view", prefix)
+			}
+		}
+	}
+	return p, nil
+}
+
+// view returns the policy of client. It is safe to call on a nil
+// Policies, which gives every client the default policy.
+func (p *Policies) view(client netip.Addr) *View {
+	if p == nil {
+		return &defaultView
+	}
+	var i int
+	if client.Is4() {
+		a := client.As4()
+		i = p.v4.lookup(a[:])
+	} else if client.Is6() {
+		a := client.As16()
+		i = p.v6.lookup(a[:])
+	}
+	if i == 0 {
+		return &defaultView
+	}
+	return &p.views[i-1]
+}
+
+// prefixTable is a binary trie over address bits, one level per bit,
+// holding every node in one slice. Looking an address up walks at most
+// as many nodes as the longest prefix has bits, remembering the last view
+// passed, so the most specific prefix wins.
+type prefixTable struct {
+	nodes []prefixNode
+}
+
+// prefixNode is one bit position of the trie. Children are node indexes,
+// 0 meaning none since the root is never a child; view is the view index
+// plus one of a prefix ending here, 0 if none does.
+type prefixNode struct {
+	child [2]uint32
+	view  int32
+}
+
+// insert adds prefix, which must be masked, for view. It reports false if
+// the prefix already has a view.
+func (t *prefixTable) insert(prefix netip.Prefix, view int) bool {
+	if len(t.nodes) == 0 {
+		t.nodes = append(t.nodes, prefixNode{})
+	}
+	addr := prefix.Addr().AsSlice()
+	n := uint32(0)
+	for bit := 0; bit < prefix.Bits(); bit++ {
+		b := addr[bit/8] >> (7 - bit%8) & 1
+		next := t.nodes[n].child[b]
+		if next == 0 {
+			next = uint32(len(t.nodes))
+			t.nodes = append(t.nodes, prefixNode{})
+			t.nodes[n].child[b] = next
+		}
+		n = next
+	}
+	if t.nodes[n].view != 0 {
+		return false
+	}
+	t.nodes[n].view = int32(view)
+	return true
+}
+
+// lookup returns the view index plus one of the most specific prefix
+// containing addr, or 0 if none does.
+func (t *prefixTable) lookup(addr []byte) int {
+	if len(t.nodes) == 0 {
+		return 0
+	}
+	view := t.nodes[0].view
+	n := uint32(0)
+	for bit := 0; bit < len(addr)*8; bit++ {
+		n = t.nodes[n].child[addr[bit/8]>>(7-bit%8)&1]
+		if n == 0 {
+			break
+		}
+		if v := t.nodes[n].view; v != 0 {
+			view = v
+		}
+	}
+	return int(view)
+}
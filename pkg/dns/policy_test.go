@@ -0,0 +1,185 @@
+package dns
+
+import (
+	"io"
+	"log/slog"
+	"net"
+	"net/netip"
+	"strings"
+	"testing"
+	"time"
+
+	"github.com/miekg/dns"
+	"github.com/online-picket-line/opl-for-dns/pkg/api"
+)
+
+func prefixes(subnets ...string) []netip.Prefix {
+	out := make([]netip.Prefix, len(subnets))
+	for i, s := range subnets {
+		out[i] = netip.MustParsePrefix(s)
+	}
+	return out
+}
+
+func TestPoliciesLongestPrefixMatch(t *testing.T) {
+	p, err := NewPolicies([]View{
+		{Name: "campus", Subnets: prefixes("10.0.0.0/8", "2001:db8::/32"), Mode: BlockNXDomain},
+		{Name: "lab", Subnets: prefixes("10.1.2.0/24", "2001:db8:1::/48"), Mode: BlockAllow},
+		{Name: "host", Subnets: prefixes("10.1.2.3/32"), Mode: BlockSinkhole},
+	})
+	if err != nil {
+		t.Fatalf("NewPolicies: %v", err)
+	}
+
+	tests := []struct {
+		client string
+		want   string
+	}{
+		{"10.9.9.9", "campus"},
+		{"10.1.2.4", "lab"},
+		{"10.1.2.3", "host"},
+		{"192.0.2.1", ""},
+		{"2001:db8:2::1", "campus"},
+		{"2001:db8:1:ffff::1", "lab"},
+		{"2001:db9::1", ""},
+		// IPv4 prefixes do not cover IPv6 addresses
+		{"::ffff:10.1.2.4", ""},
+	}
+	for _, tt := range tests {
+		if got := p.view(netip.MustParseAddr(tt.client)).Name; got != tt.want {
+			t.Errorf("%s: expected view %q, got %q", tt.client, tt.want, got)
+		}
+	}
+	if v := p.view(netip.Addr{}); v != &defaultView {
+		t.Errorf("Expected clients without an address to get the default view, got %q", v.Name)
+	}
+
+	var nilPolicies *Policies
+	if v := nilPolicies.view(netip.MustParseAddr("10.1.2.3")); v != &defaultView {
+		t.Errorf("Expected nil policies to give the default view, got %q", v.Name)
+	}
+}
+
+func TestPoliciesDefaultRoute(t *testing.T) {
+	p, err := NewPolicies([]View{
+		{Name: "everyone", Subnets: prefixes("0.0.0.0/0", "::/0"), Mode: BlockNXDomain, TTL: 300},
+	})
+	if err != nil {
+		t.Fatalf("NewPolicies: %v", err)
+	}
+	for _, client := range []string{"192.0.2.1", "2001:db8::1"} {
+		if v := p.view(netip.MustParseAddr(client)); v.Name != "everyone" || v.TTL != 300 {
+			t.Errorf("%s: expected the catch-all view, got %+v", client, v)
+		}
+	}
+}
+
+func TestNewPoliciesErrors(t *testing.T) {
+	tests := []struct {
+		name    string
+		views   []View
+		wantErr string
+	}{
+		{"no name", []View{{Subnets: prefixes("10.0.0.0/8")}}, "no name"},
+		{"no subnets", []View{{Name: "a"}}, "no subnets"},
+		{"duplicate name", []View{{Name: "a", Subnets: prefixes("10.0.0.0/8")}, {Name: "a", Subnets: prefixes("10.1.0.0/16")}}, "duplicate view"},
+		// 10.1.0.0/8 masks to the same prefix as 10.0.0.0/8
+		{"shared subnet", []View{{Name: "a", Subnets: prefixes("10.0.0.0/8")}, {Name: "b", Subnets: prefixes("10.1.0.0/8")}}, "more than one view"},
+		{"redirect without address", []View{{Name: "a", Subnets: prefixes("10.0.0.0/8"), Mode: BlockRedirect}}, "no redirect address"},
+		{"redirect to wrong family", []View{{Name: "a", Subnets: prefixes("10.0.0.0/8"), Mode: BlockRedirect, RedirectA: netip.MustParseAddr("2001:db8::1")}}, "not an IPv4 address"},
+	}
+	for _, tt := range tests {
+		_, err := NewPolicies(tt.views)
+		if err == nil || !strings.Contains(err.Error(), tt.wantErr) {
+			t.Errorf("%s: expected error containing %q, got %v", tt.name, tt.wantErr, err)
+		}
+	}
+	if _, err := ParseBlockMode("refuse"); err == nil {
+		t.Error("Expected error for unknown block mode")
+	}
+}
+
+func TestBlockWireMatchesPackedMsg(t *testing.T) {
+	p, err := NewPolicies([]View{
+		{Name: "redirect", Subnets: prefixes("10.0.0.0/8"), Mode: BlockRedirect, TTL: 30, RedirectA: netip.MustParseAddr("10.0.0.80")},
+	})
+	if err != nil {
+		t.Fatalf("NewPolicies: %v", err)
+	}
+	v := p.view(netip.MustParseAddr("10.1.1.1"))
+
+	// AAAA has no redirect address, so gets an empty answer
+	for _, qtype := range []uint16{dns.TypeA, dns.TypeAAAA} {
+		r := new(dns.Msg)
+		r.SetQuestion("www.example.com.", qtype)
+
+		m := blockReply(r, v)
+		m.Compress = true
+		want, err := m.Pack()
+		if err != nil {
+			t.Fatalf("Pack failed: %v", err)
+		}
+		got, ok := appendBlockAnswer(nil, r, v)
+		if !ok {
+			t.Fatal("appendBlockAnswer refused a plain name")
+		}
+		if string(got) != string(want) {
+			t.Errorf("qtype %d: wire response differs from packed dns.Msg\n got: %x\nwant: %x", qtype, got, want)
+		}
+	}
+}
+
+// clientWriter is a mockDNSWriter for queries from a given client.
+type clientWriter struct {
+	mockDNSWriter
+	client net.IP
+}
+
+func (w *clientWriter) RemoteAddr() net.Addr {
+	return &net.UDPAddr{IP: w.client, Port: 12345}
+}
+
+func TestServeDNSViews(t *testing.T) {
+	logger := slog.New(slog.NewTextHandler(io.Discard, nil))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	apiClient.SetBlocklistForTesting([]api.BlockListItem{{URL: "https://example.com", Employer: "Test Corp"}})
+	policies, err := NewPolicies([]View{
+		{Name: "guests", Subnets: prefixes("10.2.0.0/16"), Mode: BlockNXDomain, TTL: 300},
+		{Name: "office", Subnets: prefixes("10.1.0.0/16"), Mode: BlockRedirect, RedirectA: netip.MustParseAddr("10.1.0.80")},
+		{Name: "lab", Subnets: prefixes("10.1.9.0/24"), Mode: BlockAllow},
+	})
+	if err != nil {
+		t.Fatalf("NewPolicies: %v", err)
+	}
+	// The upstream is unreachable, so forwarded queries fail
+	server, _ := NewServer("127.0.0.1:5353", []string{"127.0.0.1:1"}, 100*time.Millisecond, apiClient, nil, logger,
+		WithPolicies(policies))
+
+	query := func(client string, qtype uint16) *dns.Msg {
+		r := new(dns.Msg)
+		r.SetQuestion("www.example.com.", qtype)
+		w := &clientWriter{client: net.ParseIP(client)}
+		server.ServeDNS(w, r)
+		return w.msg
+	}
+
+	m := query("10.2.3.4", dns.TypeMX)
+	if m == nil || m.Rcode != dns.RcodeNameError || len(m.Ns) != 1 || m.Ns[0].Header().Ttl != 300 {
+		t.Errorf("Expected NXDOMAIN with a 300s SOA for any type, got %v", m)
+	}
+
+	m = query("10.1.3.4", dns.TypeA)
+	if m == nil || len(m.Answer) != 1 || !m.Answer[0].(*dns.A).A.Equal(net.ParseIP("10.1.0.80")) || m.Answer[0].Header().Ttl != sinkholeTTL {
+		t.Errorf("Expected redirect to 10.1.0.80, got %v", m)
+	}
+
+	m = query("10.1.9.4", dns.TypeA)
+	if m == nil || m.Rcode != dns.RcodeServerFailure {
+		t.Errorf("Expected exempt client's query to be forwarded, got %v", m)
+	}
+
+	m = query("192.0.2.1", dns.TypeA)
+	if m == nil || len(m.Answer) != 1 || !m.Answer[0].(*dns.A).A.Equal(net.IPv4zero) {
+		t.Errorf("Expected default sinkhole, got %v", m)
+	}
+}
@@ -0,0 +1,76 @@
+package dns
+
+import (
+	"strings"
+	"sync"
+	"unsafe"
+)
+
+// queryContext is the per-query scratch state of ServeDNS. Contexts are
+// pooled, so normalizing the query name does not allocate.
+type queryContext struct {
+	buf []byte
+
+	// domain is the query name lowercased and without its trailing dot.
+	// It aliases buf when the name had to be rewritten, so it is only
+	// valid until the context is released; see durableDomain.
+	domain  string
+	aliased bool
+}
+
+var queryContextPool = sync.Pool{
+	New: func() any {
+		return &queryContext{buf: make([]byte, 0, 255)}
+	},
+}
+
+// newQueryContext returns a pooled context for a query for name. Names that
+// are already lowercase, as stub resolvers send them, are used in place;
+// others are lowercased into the context's buffer. DNS names compare
+// case-insensitively in ASCII only (RFC 4343), and miekg/dns escapes other
+// bytes in presentation format, so no Unicode case mapping is needed.
+func newQueryContext(name string) *queryContext {
+	qc := queryContextPool.Get().(*queryContext)
+	name = strings.TrimSuffix(name, ".")
+
+	upper := -1
+	for i := 0; i < len(name); i++ {
+		if 'A' <= name[i] && name[i] <= 'Z' {
+			upper = i
+			break
+		}
+	}
+	if upper < 0 {
+		qc.domain = name
+		return qc
+	}
+
+	buf := append(qc.buf[:0], name...)
+	for i := upper; i < len(buf); i++ {
+		if c := buf[i]; 'A' <= c && c <= 'Z' {
+			buf[i] = c + 'a' - 'A'
+		}
+	}
+	qc.buf = buf
+	qc.domain = unsafe.String(unsafe.SliceData(buf), len(buf))
+	qc.aliased = true
+	return qc
+}
+
+// durableDomain returns the normalized query name as a string that stays
+// valid after the context is released, copying it only if it aliases the
+// context's buffer.
+func (qc *queryContext) durableDomain() string {
+	if qc.aliased {
+		return strings.Clone(qc.domain)
+	}
+	return qc.domain
+}
+
+// release returns the context to the pool. Neither it nor its domain may be
+// used afterwards.
+func (qc *queryContext) release() {
+	qc.domain = ""
+	qc.aliased = false
+	queryContextPool.Put(qc)
+}
@@ -0,0 +1,49 @@
+package dns
+
+import "testing"
+
+func TestQueryContextDomain(t *testing.T) {
+	tests := []struct {
+		name    string
+		want    string
+		aliased bool
+	}{
+		{"www.example.com.", "www.example.com", false},
+		{"www.example.com", "www.example.com", false},
+		{"WWW.Example.COM.", "www.example.com", true},
+		{"www.example.coM.", "www.example.com", true},
+		{".", "", false},
+		{"", "", false},
+	}
+
+	for _, tt := range tests {
+		qc := newQueryContext(tt.name)
+		if qc.domain != tt.want || qc.aliased != tt.aliased {
+			t.Errorf("newQueryContext(%q): got (%q, %v), want (%q, %v)", tt.name, qc.domain, qc.aliased, tt.want, tt.aliased)
+		}
+		qc.release()
+	}
+}
+
+func TestQueryContextDurableDomain(t *testing.T) {
+	qc := newQueryContext("Blocked.Example.COM.")
+	durable := qc.durableDomain()
+	qc.release()
+
+	// Reusing the pooled buffer must not change the copy
+	newQueryContext("OTHER.EXAMPLE.ORG.").release()
+	if durable != "blocked.example.com" {
+		t.Errorf("Expected the durable domain to survive release, got %q", durable)
+	}
+}
+
+func TestQueryContextZeroAllocs(t *testing.T) {
+	for _, name := range []string{"www.example.com.", "WWW.Example.COM."} {
+		allocs := testing.AllocsPerRun(100, func() {
+			newQueryContext(name).release()
+		})
+		if allocs != 0 {
+			t.Errorf("newQueryContext(%q): expected 0 allocs, got %v", name, allocs)
+		}
+	}
+}
@@ -0,0 +1,14 @@
+//go:build !(aix || darwin || dragonfly || freebsd || linux || netbsd || openbsd)
+
+package dns
+
+import (
+	"errors"
+	"syscall"
+)
+
+// reusePortControl reports that this platform cannot share a listen
+// address between sockets.
+func reusePortControl(network, address string, c syscall.RawConn) error {
+	return errors.New("SO_REUSEPORT is not supported on this platform")
+}
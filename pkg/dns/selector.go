@@ -0,0 +1,201 @@
+package dns
+
+import (
+	"context"
+	"errors"
+	"math/rand"
+	"sort"
+	"sync/atomic"
+	"time"
+
+	"github.com/miekg/dns"
+)
+
+const (
+	// initialRTT is assumed for upstreams that have not answered yet, so
+	// they are tried early rather than starved.
+	initialRTT = 50 * time.Millisecond
+
+	// minHedgeDelay and maxHedgeDelay bound the wait before a query is also
+	// sent to the next-best upstream.
+	minHedgeDelay = 10 * time.Millisecond
+	maxHedgeDelay = 1 * time.Second
+
+	// exploreOneIn is how often upstreams are tried in random order, so an
+	// upstream that recovered from a bad spell gets fresh samples.
+	exploreOneIn = 100
+)
+
+var errNoUpstreams = errors.New("no upstream DNS servers configured")
+
+// upstreamHealth tracks a smoothed RTT and failure rate for one upstream,
+// using the TCP retransmission-timer estimator from RFC 6298. Updates are
+// plain atomic loads and stores: an occasional lost sample under
+// contention is harmless and keeps the query path lock-free.
+type upstreamHealth struct {
+	srtt     atomic.Int64 // smoothed RTT in nanoseconds; 0 until first sample
+	rttvar   atomic.Int64 // RTT variation in nanoseconds
+	failRate atomic.Int64 // failure rate scaled by 1<<16
+}
+
+// observeSuccess folds a successful exchange's RTT into the estimate.
+func (h *upstreamHealth) observeSuccess(rtt time.Duration) {
+	sample := int64(rtt)
+	srtt := h.srtt.Load()
+	if srtt == 0 {
+		h.srtt.Store(sample)
+		h.rttvar.Store(sample / 2)
+	} else {
+		rttvar := h.rttvar.Load()
+		diff := srtt - sample
+		if diff < 0 {
+			diff = -diff
+		}
+		h.rttvar.Store(rttvar - rttvar/4 + diff/4)
+		h.srtt.Store(srtt - srtt/8 + sample/8)
+	}
+
+	f := h.failRate.Load()
+	h.failRate.Store(f - f/8)
+}
+
+// observeFailure records a failed or timed-out exchange.
+func (h *upstreamHealth) observeFailure() {
+	f := h.failRate.Load()
+	h.failRate.Store(f - f/8 + (1<<16)/8)
+}
+
+// score ranks upstreams; lower is better. The expected RTT is inflated by
+// the failure rate so an upstream that drops packets sinks in the ranking.
+func (h *upstreamHealth) score() int64 {
+	srtt := h.srtt.Load()
+	if srtt == 0 {
+		srtt = int64(initialRTT)
+	}
+	return srtt + srtt*8*h.failRate.Load()>>16
+}
+
+// hedgeDelay approximates the upstream's p95 RTT as SRTT + 2*RTTVAR; a
+// reply slower than that is unusual enough to be worth racing.
+func (h *upstreamHealth) hedgeDelay() time.Duration {
+	srtt := h.srtt.Load()
+	if srtt == 0 {
+		return 2 * initialRTT
+	}
+	d := time.Duration(srtt + 2*h.rttvar.Load())
+	if d < minHedgeDelay {
+		return minHedgeDelay
+	}
+	if d > maxHedgeDelay {
+		return maxHedgeDelay
+	}
+	return d
+}
+
+// rankUpstreams returns the upstreams ordered best first.
+func rankUpstreams(upstreams []*upstream) []*upstream {
+	ranked := make([]*upstream, len(upstreams))
+	copy(ranked, upstreams)
+
+	if rand.Intn(exploreOneIn) == 0 {
+		rand.Shuffle(len(ranked), func(i, j int) { ranked[i], ranked[j] = ranked[j], ranked[i] })
+		return ranked
+	}
+
+	sort.SliceStable(ranked, func(i, j int) bool {
+		return ranked[i].health.score() < ranked[j].health.score()
+	})
+	return ranked
+}
+
+type exchangeResult struct {
+	upstream *upstream
+	resp     *dns.Msg
+	err      error
+}
+
+// usable reports whether an upstream reply should end the race. SERVFAIL
+// and REFUSED usually mean that upstream is unhealthy, so another may do
+// better; they are only returned when nothing better arrives.
+func usable(resp *dns.Msg) bool {
+	return resp.Rcode != dns.RcodeServerFailure && resp.Rcode != dns.RcodeRefused
+}
+
+// exchange resolves a query through the upstreams. It asks the best-ranked
+// upstream first, sends the query to the next one if no answer arrives
+// within the hedge delay or the current attempt fails, and returns the
+// first usable answer. The whole exchange is bounded by queryTimeout.
+func (s *Server) exchange(r *dns.Msg) (*dns.Msg, error) {
+	fwd := s.fwd.Load()
+	if len(fwd.upstreams) == 0 {
+		return nil, errNoUpstreams
+	}
+	ranked := rankUpstreams(fwd.upstreams)
+
+	ctx, cancel := context.WithTimeout(context.Background(), fwd.queryTimeout)
+	defer cancel()
+
+	results := make(chan exchangeResult, len(ranked))
+	launch := func(u *upstream) {
+		go func() {
+			start := time.Now()
+			resp, err := u.exchange(ctx, r)
+			switch {
+			case err == nil && usable(resp):
+				rtt := time.Since(start)
+				u.health.observeSuccess(rtt)
+				if u.rtt != nil {
+					u.rtt.Observe(rtt)
+				}
+			case errors.Is(err, context.Canceled):
+				// Lost the race; says nothing about this upstream.
+			default:
+				u.health.observeFailure()
+			}
+			results <- exchangeResult{upstream: u, resp: resp, err: err}
+		}()
+	}
+
+	launch(ranked[0])
+	next, inFlight := 1, 1
+	hedge := time.NewTimer(ranked[0].health.hedgeDelay())
+	defer hedge.Stop()
+
+	var fallback *dns.Msg
+	var lastErr error
+	for inFlight > 0 {
+		select {
+		case res := <-results:
+			inFlight--
+			if res.err == nil {
+				if usable(res.resp) {
+					return res.resp, nil
+				}
+				fallback = res.resp
+			} else {
+				lastErr = res.err
+				s.logger.Debug("Upstream DNS query failed",
+					"upstream", res.upstream,
+					"error", res.err,
+				)
+			}
+			if next < len(ranked) {
+				launch(ranked[next])
+				next++
+				inFlight++
+			}
+		case <-hedge.C:
+			if next < len(ranked) {
+				launch(ranked[next])
+				hedge.Reset(ranked[next].health.hedgeDelay())
+				next++
+				inFlight++
+			}
+		}
+	}
+
+	if fallback != nil {
+		return fallback, nil
+	}
+	return nil, lastErr
+}
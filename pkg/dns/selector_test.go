@@ -0,0 +1,110 @@
+package dns
+
+import (
+	"log/slog"
+	"os"
+	"testing"
+	"time"
+
+	"github.com/miekg/dns"
+	"github.com/online-picket-line/opl-for-dns/pkg/api"
+)
+
+func newForwardingServer(t *testing.T, upstreams ...string) *Server {
+	t.Helper()
+
+	logger := slog.New(slog.NewTextHandler(os.Stdout, nil))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	server, err := NewServer("127.0.0.1:5353", upstreams, 2*time.Second, apiClient, nil, logger)
+	if err != nil {
+		t.Fatalf("NewServer failed: %v", err)
+	}
+	t.Cleanup(func() { server.Stop() })
+	return server
+}
+
+func TestUpstreamHealthRanksFailuresLast(t *testing.T) {
+	healthy, _ := newUpstream("192.0.2.1:53")
+	flaky, _ := newUpstream("192.0.2.2:53")
+
+	for i := 0; i < 10; i++ {
+		healthy.health.observeSuccess(30 * time.Millisecond)
+		flaky.health.observeSuccess(20 * time.Millisecond)
+		flaky.health.observeFailure()
+	}
+
+	if flaky.health.score() <= healthy.health.score() {
+		t.Errorf("Expected flaky upstream to score worse: flaky=%d healthy=%d",
+			flaky.health.score(), healthy.health.score())
+	}
+}
+
+func TestUpstreamHealthHedgeDelay(t *testing.T) {
+	var h upstreamHealth
+	if d := h.hedgeDelay(); d != 2*initialRTT {
+		t.Errorf("Expected default hedge delay %v, got %v", 2*initialRTT, d)
+	}
+
+	h.observeSuccess(100 * time.Microsecond)
+	if d := h.hedgeDelay(); d != minHedgeDelay {
+		t.Errorf("Expected hedge delay clamped to %v, got %v", minHedgeDelay, d)
+	}
+
+	for i := 0; i < 50; i++ {
+		h.observeSuccess(10 * time.Second)
+	}
+	if d := h.hedgeDelay(); d != maxHedgeDelay {
+		t.Errorf("Expected hedge delay clamped to %v, got %v", maxHedgeDelay, d)
+	}
+}
+
+func TestExchangeHedgesSlowUpstream(t *testing.T) {
+	slow := startTestUpstream(t, "udp", func(w dns.ResponseWriter, r *dns.Msg) {
+		time.Sleep(time.Second)
+		echoHandler(w, r)
+	})
+	fast := startTestUpstream(t, "udp", echoHandler)
+
+	server := newForwardingServer(t, slow, fast)
+	// Make the slow upstream look best so it is always asked first.
+	server.fwd.Load().upstreams[0].health.observeSuccess(time.Millisecond)
+	server.fwd.Load().upstreams[1].health.observeSuccess(time.Second)
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+
+	start := time.Now()
+	resp, err := server.exchange(r)
+	if err != nil {
+		t.Fatalf("exchange failed: %v", err)
+	}
+	if len(resp.Answer) != 1 {
+		t.Errorf("Expected 1 answer, got %d", len(resp.Answer))
+	}
+	if elapsed := time.Since(start); elapsed > 500*time.Millisecond {
+		t.Errorf("Expected hedged answer well before the slow upstream, took %v", elapsed)
+	}
+}
+
+func TestExchangeSkipsServfail(t *testing.T) {
+	broken := startTestUpstream(t, "udp", func(w dns.ResponseWriter, r *dns.Msg) {
+		m := new(dns.Msg)
+		m.SetRcode(r, dns.RcodeServerFailure)
+		w.WriteMsg(m)
+	})
+	working := startTestUpstream(t, "udp", echoHandler)
+
+	server := newForwardingServer(t, broken, working)
+	server.fwd.Load().upstreams[0].health.observeSuccess(time.Millisecond)
+
+	r := new(dns.Msg)
+	r.SetQuestion("example.org.", dns.TypeA)
+
+	resp, err := server.exchange(r)
+	if err != nil {
+		t.Fatalf("exchange failed: %v", err)
+	}
+	if resp.Rcode != dns.RcodeSuccess {
+		t.Errorf("Expected answer from the working upstream, got rcode %d", resp.Rcode)
+	}
+}
@@ -3,149 +3,653 @@ package dns
 
 import (
 	"context"
+	"crypto/tls"
+	"errors"
 	"fmt"
 	"log/slog"
 	"net"
-	"strings"
+	"net/http"
+	"net/netip"
+	"os"
+	"runtime"
 	"sync"
+	"sync/atomic"
 	"time"
 
 	"github.com/miekg/dns"
 	"github.com/online-picket-line/opl-for-dns/pkg/api"
 	"github.com/online-picket-line/opl-for-dns/pkg/stats"
+	"golang.org/x/net/netutil"
 )
 
 // Server is a DNS server that blocks domains involved in labor disputes.
 type Server struct {
-	listenAddr   string
-	upstreamDNS  []string
-	queryTimeout time.Duration
+	listenAddr string
+
+	// fwd holds the upstreams and query timeout; Reconfigure swaps it
+	fwd      atomic.Pointer[forwardConfig]
+	reloadMu sync.Mutex
+
+	// retiredTCPRetries keeps the TCP retry count of removed upstreams
+	retiredTCPRetries atomic.Int64
 
 	apiClient      *api.Client
 	statsCollector *stats.Collector
 	logger         *slog.Logger
 
-	server *dns.Server
-	mu     sync.RWMutex
+	// cache holds upstream responses; nil when caching is disabled
+	cache *Cache
+
+	// prefetch refreshes hot cache entries before they expire
+	prefetch bool
+
+	// localZones answers locally served names; nil when there are none
+	localZones *LocalZones
+
+	// policies picks each client's view; nil gives every client the
+	// default policy
+	policies *Policies
+
+	// flights coalesces identical questions being forwarded at once
+	flights flightGroup
+
+	// listeners is the number of SO_REUSEPORT sockets opened per protocol
+	listeners int
+
+	// udpBatch enables the recvmmsg/sendmmsg packet engine where available
+	udpBatch bool
+
+	// blockLog writes blocked-query log lines off the query path
+	blockLog          *blockLogger
+	blockLogBuffer    int
+	blockLogPerDomain int
+
+	// Encrypted transports; an empty address leaves one disabled
+	tlsConfig *tls.Config
+	dotAddr   string
+	dohAddr   string
+	dot       *streamServer
+	doh       *http.Server
+
+	// Admission control; nil when disabled
+	forwards       *forwardLimiter
+	forwardWorkers int
+	forwardQueue   int
+	rateLimit      *rateLimiter
+
+	// Limits for TCP, DNS-over-TLS and DNS-over-HTTPS connections
+	streamIdleTimeout time.Duration
+	streamInFlight    int
+	streamConns       int
+
+	// handoff is what a previous process passed on through Upgrade; nil
+	// when the server was started afresh
+	handoff   *Handoff
+	inherited map[string][]*os.File
+
+	// sockets are the listening sockets Upgrade hands over
+	sockets []handoffSocket
+
+	servers []*dns.Server
+	mu      sync.RWMutex
+}
+
+// forwardConfig is the part of the server's configuration that can be
+// changed while it runs.
+type forwardConfig struct {
+	upstreams    []*upstream
+	queryTimeout time.Duration
+}
+
+// Option configures optional Server features.
+type Option func(*Server)
+
+// WithCache enables answering repeated queries from the given response cache.
+func WithCache(cache *Cache) Option {
+	return func(s *Server) {
+		s.cache = cache
+	}
+}
+
+// WithPrefetch enables refreshing cached responses in the background when
+// they are hit in the last tenth of their lifetime, so names that are
+// queried continuously never wait on an upstream round trip.
+func WithPrefetch(enabled bool) Option {
+	return func(s *Server) {
+		s.prefetch = enabled
+	}
+}
+
+// WithPolicies answers blocked names for each client as its view in
+// policies says, instead of sinkholing them for everyone.
+func WithPolicies(policies *Policies) Option {
+	return func(s *Server) {
+		s.policies = policies
+	}
+}
+
+// WithLocalZones answers the names in zones locally instead of forwarding
+// them. Blocked names are still blocked.
+func WithLocalZones(zones *LocalZones) Option {
+	return func(s *Server) {
+		s.localZones = zones
+	}
+}
+
+// WithHandoff makes the server take over the listening sockets that a
+// previous process passed on through Upgrade, instead of opening new ones
+// where it can.
+func WithHandoff(h *Handoff) Option {
+	return func(s *Server) {
+		s.handoff = h
+	}
+}
+
+// WithListeners sets how many UDP and TCP sockets the server opens on its
+// listen address. With more than one, the sockets share the port through
+// SO_REUSEPORT and the kernel spreads packets across them, so each socket
+// gets its own receive queue and reader goroutine. Zero or less uses
+// GOMAXPROCS.
+func WithListeners(n int) Option {
+	return func(s *Server) {
+		s.listeners = n
+	}
+}
+
+// WithUDPBatch enables batched UDP I/O. On Linux each UDP listener then
+// reads and writes up to 32 datagrams per recvmmsg/sendmmsg system call;
+// on other platforms the standard per-packet path is used.
+func WithUDPBatch(enabled bool) Option {
+	return func(s *Server) {
+		s.udpBatch = enabled
+	}
+}
+
+// WithBlockLog sizes the asynchronous blocked-query log. Up to bufferSize
+// entries wait for the log writer before the oldest are dropped, and at most
+// perDomain entries are logged per domain each second (0 means no limit).
+func WithBlockLog(bufferSize, perDomain int) Option {
+	return func(s *Server) {
+		s.blockLogBuffer = bufferSize
+		s.blockLogPerDomain = perDomain
+	}
 }
 
+// WithTLS enables DNS-over-TLS (RFC 7858) on dotAddr and DNS-over-HTTPS
+// (RFC 8484) on dohAddr, both with the certificate in config. An empty
+// address leaves that transport disabled.
+func WithTLS(config *tls.Config, dotAddr, dohAddr string) Option {
+	return func(s *Server) {
+		s.tlsConfig = config
+		s.dotAddr = dotAddr
+		s.dohAddr = dohAddr
+	}
+}
+
+// WithStreamLimits tunes the connection-oriented transports. Connections
+// without a query for idleTimeout are closed; at most inFlight queries per
+// DNS-over-TLS connection, or streams per DNS-over-HTTPS connection, are
+// handled at once; and at most maxConns connections are kept open per
+// encrypted listener. Zero keeps the default for a limit.
+func WithStreamLimits(idleTimeout time.Duration, inFlight, maxConns int) Option {
+	return func(s *Server) {
+		if idleTimeout > 0 {
+			s.streamIdleTimeout = idleTimeout
+		}
+		if inFlight > 0 {
+			s.streamInFlight = inFlight
+		}
+		if maxConns > 0 {
+			s.streamConns = maxConns
+		}
+	}
+}
+
+// WithForwardLimit bounds how many queries are forwarded upstream at once
+// to workers. Up to queue more wait for a free slot, for at most the query
+// timeout; the rest are answered REFUSED straight away. Zero workers
+// leaves forwarding unbounded.
+func WithForwardLimit(workers, queue int) Option {
+	return func(s *Server) {
+		s.forwardWorkers = workers
+		s.forwardQueue = queue
+	}
+}
+
+// WithRateLimit limits each client /24 (IPv4) or /56 (IPv6) prefix to qps
+// queries per second, with bursts of up to burst. Queries over the limit
+// are answered with an empty truncated response over UDP, sending real
+// clients to TCP, and REFUSED over other transports. Zero qps disables
+// rate limiting.
+func WithRateLimit(qps float64, burst int) Option {
+	return func(s *Server) {
+		if qps > 0 {
+			if burst < 1 {
+				burst = max(1, int(2*qps))
+			}
+			s.rateLimit = newRateLimiter(qps, burst)
+		} else {
+			s.rateLimit = nil
+		}
+	}
+}
+
+// defaultBlockLogBuffer is the blocked-query log buffer size used when
+// WithBlockLog is not given.
+const defaultBlockLogBuffer = 1024
+
 // NewServer creates a new DNS server.
-func NewServer(listenAddr string, upstreamDNS []string, queryTimeout time.Duration, apiClient *api.Client, statsCollector *stats.Collector, logger *slog.Logger) (*Server, error) {
+func NewServer(listenAddr string, upstreamDNS []string, queryTimeout time.Duration, apiClient *api.Client, statsCollector *stats.Collector, logger *slog.Logger, opts ...Option) (*Server, error) {
 	if listenAddr == "" {
 		return nil, fmt.Errorf("listen address is required")
 	}
 
-	return &Server{
+	upstreams := make([]*upstream, 0, len(upstreamDNS))
+	for _, spec := range upstreamDNS {
+		u, err := newUpstream(spec)
+		if err != nil {
+			return nil, err
+		}
+		upstreams = append(upstreams, u)
+	}
+
+	s := &Server{
 		listenAddr:     listenAddr,
-		upstreamDNS:    upstreamDNS,
-		queryTimeout:   queryTimeout,
 		apiClient:      apiClient,
 		statsCollector: statsCollector,
 		logger:         logger,
-	}, nil
+		listeners:      1,
+		blockLogBuffer: defaultBlockLogBuffer,
+
+		streamIdleTimeout: defaultStreamIdleTimeout,
+		streamInFlight:    defaultStreamInFlight,
+		streamConns:       defaultStreamConns,
+	}
+	s.fwd.Store(&forwardConfig{upstreams: upstreams, queryTimeout: queryTimeout})
+	for _, opt := range opts {
+		opt(s)
+	}
+	if s.listeners <= 0 {
+		s.listeners = runtime.GOMAXPROCS(0)
+	}
+	if s.forwardWorkers > 0 {
+		s.forwards = newForwardLimiter(s.forwardWorkers, max(0, s.forwardQueue), queryTimeout)
+	}
+	if (s.dotAddr != "" || s.dohAddr != "") && s.tlsConfig == nil {
+		return nil, fmt.Errorf("TLS configuration is required for DNS-over-TLS and DNS-over-HTTPS")
+	}
+	if s.dotAddr != "" {
+		config := s.tlsConfig.Clone()
+		config.NextProtos = []string{"dot"}
+		s.dot = newStreamServer(s.dotAddr, config, s, s.streamIdleTimeout, s.streamInFlight, s.streamConns)
+	}
+	if s.dohAddr != "" {
+		s.doh = s.newDoHServer()
+	}
+	s.inherited = make(map[string][]*os.File)
+	for _, name := range []string{
+		socketName("udp", s.listenAddr), socketName("tcp", s.listenAddr),
+		socketName("tcp", s.dotAddr), socketName("tcp", s.dohAddr),
+	} {
+		if files := s.handoff.claim(name); len(files) > 0 {
+			s.inherited[name] = files
+		}
+	}
+	s.blockLog = newBlockLogger(logger, s.blockLogBuffer, s.blockLogPerDomain)
+	if statsCollector != nil {
+		s.registerMetrics(statsCollector)
+	}
+	return s, nil
 }
 
-// Start starts the DNS server.
-func (s *Server) Start() error {
-	s.mu.Lock()
-	s.server = &dns.Server{
-		Addr:    s.listenAddr,
-		Net:     "udp",
-		Handler: s,
+// Reconfigure replaces the upstreams and query timeout of a running
+// server without touching its listeners or cache. Upstreams that are kept,
+// matched by their configured form, keep their connections and health
+// history. Queries already in flight finish on the old set; removed
+// upstreams are closed once those queries have timed out.
+func (s *Server) Reconfigure(upstreamDNS []string, queryTimeout time.Duration) error {
+	s.reloadMu.Lock()
+	defer s.reloadMu.Unlock()
+
+	old := s.fwd.Load()
+	kept := make(map[string]*upstream, len(old.upstreams))
+	for _, u := range old.upstreams {
+		kept[u.String()] = u
+	}
+
+	upstreams := make([]*upstream, 0, len(upstreamDNS))
+	for _, spec := range upstreamDNS {
+		u, err := newUpstream(spec)
+		if err != nil {
+			return err
+		}
+		if prev, ok := kept[u.String()]; ok {
+			delete(kept, u.String())
+			u = prev
+		} else if s.statsCollector != nil {
+			u.rtt = s.statsCollector.UpstreamRTT(u.String())
+		}
+		upstreams = append(upstreams, u)
 	}
-	s.mu.Unlock()
 
-	s.logger.Info("Starting DNS server", "addr", s.listenAddr)
-	return s.server.ListenAndServe()
+	s.fwd.Store(&forwardConfig{upstreams: upstreams, queryTimeout: queryTimeout})
+	if s.forwards != nil {
+		s.forwards.setWait(queryTimeout)
+	}
+	for _, u := range kept {
+		s.retireUpstream(u, old.queryTimeout)
+	}
+	return nil
+}
+
+// retireUpstream closes an upstream removed by Reconfigure after delay.
+func (s *Server) retireUpstream(u *upstream, delay time.Duration) {
+	time.AfterFunc(delay, func() {
+		u.close()
+		s.retiredTCPRetries.Add(u.tcpRetries.Load())
+	})
+}
+
+// registerMetrics adds the server's upstream and internal state to the
+// metrics exported by the stats collector.
+func (s *Server) registerMetrics(c *stats.Collector) {
+	for _, u := range s.fwd.Load().upstreams {
+		u.rtt = c.UpstreamRTT(u.String())
+	}
+	c.RegisterCounter("opl_dns_upstream_tcp_retries_total", "Truncated UDP answers fetched again from the upstream over TCP.", func() float64 {
+		n := s.retiredTCPRetries.Load()
+		for _, u := range s.fwd.Load().upstreams {
+			n += u.tcpRetries.Load()
+		}
+		return float64(n)
+	})
+	if s.cache != nil {
+		c.RegisterGauge("opl_dns_cache_entries", "Responses held in the response cache.", func() float64 {
+			return float64(s.cache.Len())
+		})
+	}
+	if s.forwards != nil {
+		c.RegisterGauge("opl_dns_forwards_waiting", "Queries waiting for a forwarding slot.", func() float64 {
+			return float64(s.forwards.waiting.Load())
+		})
+		c.RegisterCounter("opl_dns_forwards_refused_total", "Queries refused because the forward limit and queue were full.", func() float64 {
+			return float64(s.forwards.refused.Load())
+		})
+	}
+	if s.rateLimit != nil {
+		c.RegisterCounter("opl_dns_rate_limited_total", "Queries over their client prefix's rate limit.", func() float64 {
+			return float64(s.rateLimit.limited.Load())
+		})
+	}
+	c.RegisterCounter("opl_dns_block_log_dropped_total", "Block log events dropped because the log buffer was full.", func() float64 {
+		dropped, _ := s.blockLog.Stats()
+		return float64(dropped)
+	})
+	c.RegisterCounter("opl_dns_block_log_suppressed_total", "Block log events suppressed by the per-domain limit.", func() float64 {
+		_, suppressed := s.blockLog.Stats()
+		return float64(suppressed)
+	})
+}
+
+// Start starts the DNS server.
+func (s *Server) Start() error {
+	s.logger.Info("Starting DNS server", "addr", s.listenAddr, "listeners", s.listeners)
+	return s.serve("udp")
 }
 
 // StartTCP starts the DNS server on TCP.
 func (s *Server) StartTCP() error {
-	tcpServer := &dns.Server{
-		Addr:    s.listenAddr,
-		Net:     "tcp",
-		Handler: s,
+	s.logger.Info("Starting DNS server (TCP)", "addr", s.listenAddr, "listeners", s.listeners)
+	return s.serve("tcp")
+}
+
+// StartDoT starts the DNS-over-TLS listener.
+func (s *Server) StartDoT() error {
+	if s.dot == nil {
+		return errors.New("DNS-over-TLS is not configured")
+	}
+	s.logger.Info("Starting DNS server (TLS)", "addr", s.dotAddr)
+	ln, err := s.listenTCP(s.dotAddr, false)
+	if err != nil {
+		return err
+	}
+	return s.dot.serve(tls.NewListener(ln, s.dot.tlsConfig))
+}
+
+// StartDoH starts the DNS-over-HTTPS listener.
+func (s *Server) StartDoH() error {
+	if s.doh == nil {
+		return errors.New("DNS-over-HTTPS is not configured")
+	}
+	s.logger.Info("Starting DNS server (HTTPS)", "addr", s.dohAddr, "path", dohPath)
+	ln, err := s.listenTCP(s.dohAddr, false)
+	if err != nil {
+		return err
+	}
+	err = s.doh.ServeTLS(netutil.LimitListener(ln, s.streamConns), "", "")
+	if errors.Is(err, http.ErrServerClosed) {
+		return nil
+	}
+	return err
+}
+
+// newDoHServer builds the DNS-over-HTTPS server. HTTP/2 is negotiated
+// through ALPN, with older clients falling back to HTTP/1.1 keep-alive.
+func (s *Server) newDoHServer() *http.Server {
+	mux := http.NewServeMux()
+	mux.HandleFunc(dohPath, s.serveDoH)
+	return &http.Server{
+		Addr:              s.dohAddr,
+		Handler:           mux,
+		TLSConfig:         s.tlsConfig.Clone(),
+		ReadHeaderTimeout: s.streamIdleTimeout,
+		IdleTimeout:       s.streamIdleTimeout,
+		ErrorLog:          slog.NewLogLogger(s.logger.Handler(), slog.LevelDebug),
+		HTTP2: &http.HTTP2Config{
+			MaxConcurrentStreams: s.streamInFlight,
+		},
 	}
-	s.logger.Info("Starting DNS server (TCP)", "addr", s.listenAddr)
-	return tcpServer.ListenAndServe()
 }
 
-// Stop stops the DNS server.
+// serve runs the configured number of listeners for one protocol and blocks
+// until they have all stopped. If any listener fails, the others for that
+// protocol are shut down and the first error is returned.
+func (s *Server) serve(network string) error {
+	servers := make([]*dns.Server, s.listeners)
+	closeSockets := func() {
+		for _, srv := range servers {
+			if srv == nil {
+				continue
+			}
+			if srv.PacketConn != nil {
+				srv.PacketConn.Close()
+			}
+			if srv.Listener != nil {
+				srv.Listener.Close()
+			}
+		}
+	}
+
+	// The sockets are opened here rather than by miekg/dns, so that they
+	// can be inherited from and handed over to another process
+	reusePort := s.listeners > 1
+	for i := range servers {
+		servers[i] = &dns.Server{
+			Addr:    s.listenAddr,
+			Net:     network,
+			Handler: s,
+			UDPSize: ednsUDPSize,
+		}
+		if network == "tcp" {
+			// Keep connections open for as many queries as clients send,
+			// closing them only once idle
+			servers[i].IdleTimeout = func() time.Duration { return s.streamIdleTimeout }
+			servers[i].MaxTCPQueries = -1
+
+			ln, err := s.listenTCP(s.listenAddr, reusePort)
+			if err != nil {
+				closeSockets()
+				return err
+			}
+			servers[i].Listener = ln
+			continue
+		}
+
+		conn, err := s.listenUDP(s.listenAddr, reusePort)
+		if err != nil {
+			closeSockets()
+			return err
+		}
+		servers[i].PacketConn = conn
+		if s.udpBatch {
+			pc, err := batchUDP(conn)
+			if err != nil {
+				closeSockets()
+				return err
+			}
+			if pc != nil {
+				servers[i].PacketConn = pc
+			}
+		}
+	}
+	s.closeInherited(socketName(network, s.listenAddr))
+
+	s.mu.Lock()
+	s.servers = append(s.servers, servers...)
+	s.mu.Unlock()
+
+	errs := make(chan error, len(servers))
+	for _, srv := range servers {
+		go func(srv *dns.Server) {
+			errs <- srv.ActivateAndServe()
+		}(srv)
+	}
+
+	var firstErr error
+	for range servers {
+		if err := <-errs; err != nil && firstErr == nil {
+			firstErr = err
+			for _, srv := range servers {
+				srv.Shutdown()
+			}
+		}
+	}
+	return firstErr
+}
+
+// Stop stops all listeners together, giving queries in flight until the
+// query timeout to be answered.
 func (s *Server) Stop() error {
-	s.mu.RLock()
-	server := s.server
-	s.mu.RUnlock()
+	ctx, cancel := context.WithTimeout(context.Background(), s.fwd.Load().queryTimeout+time.Second)
+	defer cancel()
+	return s.Shutdown(ctx)
+}
+
+// Shutdown stops the server gracefully: every listener stops reading new
+// queries at once, and the queries already received are answered until ctx
+// is done, after which the remaining connections and upstreams are closed.
+func (s *Server) Shutdown(ctx context.Context) error {
+	s.mu.Lock()
+	servers := s.servers
+	s.servers = nil
+	s.mu.Unlock()
 
-	if server != nil {
-		return server.Shutdown()
+	var wg sync.WaitGroup
+	errs := make([]error, len(servers)+2)
+	for i, srv := range servers {
+		wg.Add(1)
+		go func(i int, srv *dns.Server) {
+			defer wg.Done()
+			errs[i] = srv.ShutdownContext(ctx)
+		}(i, srv)
 	}
-	return nil
+	if s.dot != nil {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			errs[len(servers)] = s.dot.shutdown(ctx)
+		}()
+	}
+	if s.doh != nil {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			errs[len(servers)+1] = s.doh.Shutdown(ctx)
+		}()
+	}
+	wg.Wait()
+
+	for _, u := range s.fwd.Load().upstreams {
+		u.close()
+	}
+	s.blockLog.close()
+	return errors.Join(errs...)
 }
 
 // ServeDNS handles DNS queries.
 func (s *Server) ServeDNS(w dns.ResponseWriter, r *dns.Msg) {
-	m := new(dns.Msg)
-	m.SetReply(r)
-	m.Authoritative = false
-	m.RecursionAvailable = true
-
 	if len(r.Question) == 0 {
-		w.WriteMsg(m)
+		w.WriteMsg(newReply(r))
 		return
 	}
 
+	start := time.Now()
 	q := r.Question[0]
-	domain := strings.ToLower(strings.TrimSuffix(q.Name, "."))
-
-	// Get client IP
-	clientIP := ""
-	if addr, ok := w.RemoteAddr().(*net.UDPAddr); ok {
-		clientIP = addr.IP.String()
-	} else if addr, ok := w.RemoteAddr().(*net.TCPAddr); ok {
-		clientIP = addr.IP.String()
-	}
-
-	// Check if domain is blocked
-	if q.Qtype == dns.TypeA || q.Qtype == dns.TypeAAAA {
-		if item, blocked := s.apiClient.CheckDomain(domain); blocked {
-			s.logger.Info("Blocking domain",
-				"domain", domain,
-				"client", clientIP,
-				"employer", item.Employer,
-				"action_type", item.ActionDetails.ActionType,
-			)
-
-			// Return 0.0.0.0 for A queries, :: for AAAA queries
-			// This causes connections to fail immediately
-			if q.Qtype == dns.TypeA {
-				rr := &dns.A{
-					Hdr: dns.RR_Header{
-						Name:   q.Name,
-						Rrtype: dns.TypeA,
-						Class:  dns.ClassINET,
-						Ttl:    60,
-					},
-					A: net.IPv4zero,
-				}
-				m.Answer = append(m.Answer, rr)
-			} else if q.Qtype == dns.TypeAAAA {
-				rr := &dns.AAAA{
-					Hdr: dns.RR_Header{
-						Name:   q.Name,
-						Rrtype: dns.TypeAAAA,
-						Class:  dns.ClassINET,
-						Ttl:    60,
-					},
-					AAAA: net.IPv6zero,
-				}
-				m.Answer = append(m.Answer, rr)
+	qc := newQueryContext(q.Name)
+	defer qc.release()
+
+	// Rate-limited queries are counted too, so that the clients being
+	// limited show up among the heaviest
+	client := clientAddr(w)
+	if s.statsCollector != nil {
+		s.statsCollector.RecordQueryDetails(qc.domain, q.Qtype, client)
+	}
+
+	if s.rateLimit != nil && !s.rateLimit.allow(client, start) {
+		s.writeMsg(w, limitedReply(r, w.RemoteAddr().Network() == "udp"))
+		return
+	}
+
+	// Check if domain is blocked. NXDOMAIN views block every type, so
+	// that no record of a blocked name resolves; the others only answer
+	// address queries.
+	view := s.policies.view(client)
+	if view.Mode == BlockNXDomain || (view.Mode != BlockAllow && (q.Qtype == dns.TypeA || q.Qtype == dns.TypeAAAA)) {
+		if item, blocked := s.apiClient.CheckDomain(qc.domain); blocked {
+			// The log and stats keep the name beyond this query
+			domain := qc.durableDomain()
+			s.blockLog.log(blockEvent{
+				domain:     domain,
+				client:     client,
+				employer:   item.Employer,
+				actionType: item.ActionDetails.ActionType,
+				view:       view.Name,
+			})
+
+			rcode := dns.RcodeSuccess
+			if view.Mode == BlockNXDomain {
+				rcode = dns.RcodeNameError
+				w.WriteMsg(blockReply(r, view))
+			} else if !writeSinkhole(w, r, view) {
+				w.WriteMsg(blockReply(r, view))
 			}
 
 			if s.statsCollector != nil {
 				s.statsCollector.RecordBlock(domain)
+				s.statsCollector.RecordRcode(rcode)
+				s.statsCollector.ObserveQuery(stats.PathBlock, time.Since(start))
 			}
+			return
+		}
+	}
 
-			w.WriteMsg(m)
+	if s.localZones != nil {
+		if m := s.localZones.answer(r, qc.domain); m != nil {
+			s.writeMsg(w, fitReply(w, r, m))
+			if s.statsCollector != nil {
+				s.statsCollector.RecordLocal()
+				s.statsCollector.ObserveQuery(stats.PathLocal, time.Since(start))
+			}
 			return
 		}
 	}
@@ -154,34 +658,180 @@ func (s *Server) ServeDNS(w dns.ResponseWriter, r *dns.Msg) {
 	if s.statsCollector != nil {
 		s.statsCollector.RecordQuery()
 	}
-	s.forwardQuery(w, r, m)
-}
 
-// forwardQuery forwards a DNS query to upstream DNS servers.
-func (s *Server) forwardQuery(w dns.ResponseWriter, r *dns.Msg, m *dns.Msg) {
-	c := new(dns.Client)
-	c.Timeout = s.queryTimeout
+	if s.cache != nil {
+		if resp, prefetch, ok := s.cache.get(r); ok {
+			s.writeMsg(w, fitReply(w, r, resp))
+			s.observeQuery(stats.PathCacheHit, start)
+			if prefetch && s.prefetch {
+				s.prefetchQuery(r)
+			}
+			return
+		}
+	}
 
-	for _, upstream := range s.upstreamDNS {
-		resp, _, err := c.Exchange(r, upstream)
-		if err != nil {
-			s.logger.Debug("Upstream DNS query failed",
-				"upstream", upstream,
-				"error", err,
-			)
-			continue
+	// Only the forward path can block, so only it is bounded
+	if s.forwards != nil {
+		if !s.forwards.acquire() {
+			s.writeMsg(w, refusedReply(r))
+			return
 		}
+		defer s.forwards.release()
+	}
+	s.forwardQuery(w, r)
+	s.observeQuery(stats.PathForward, start)
+}
 
-		// Copy response
-		resp.Id = r.Id
-		w.WriteMsg(resp)
+// prefetchQuery refreshes the cached answer to r in the background. When
+// the forward limit is reached the refresh is skipped; the entry is
+// refreshed on a later hit or once it expires.
+func (s *Server) prefetchQuery(r *dns.Msg) {
+	if s.forwards == nil {
+		go s.resolve(r)
+		return
+	}
+	if !s.forwards.tryAcquire() {
 		return
 	}
+	go func() {
+		defer s.forwards.release()
+		s.resolve(r)
+	}()
+}
+
+// clientAddr returns the address of the client that sent a query, or the
+// zero Addr if the transport does not have one.
+func clientAddr(w dns.ResponseWriter) netip.Addr {
+	if addr, ok := w.RemoteAddr().(interface{ AddrPort() netip.AddrPort }); ok {
+		return addr.AddrPort().Addr().Unmap()
+	}
+	return netip.Addr{}
+}
 
-	// All upstreams failed
-	s.logger.Error("All upstream DNS servers failed")
-	m.Rcode = dns.RcodeServerFailure
+// writeMsg writes the answer m and records its RCODE.
+func (s *Server) writeMsg(w dns.ResponseWriter, m *dns.Msg) {
 	w.WriteMsg(m)
+	if s.statsCollector != nil {
+		s.statsCollector.RecordRcode(m.Rcode)
+	}
+}
+
+// observeQuery records the latency of a query that started at start.
+func (s *Server) observeQuery(path stats.QueryPath, start time.Time) {
+	if s.statsCollector != nil {
+		s.statsCollector.ObserveQuery(path, time.Since(start))
+	}
+}
+
+// newReply creates an empty, non-authoritative reply to r.
+func newReply(r *dns.Msg) *dns.Msg {
+	m := new(dns.Msg)
+	m.SetReply(r)
+	m.Authoritative = false
+	m.RecursionAvailable = true
+	return m
+}
+
+// sinkholeReply builds the default blocked-domain answer as a dns.Msg.
+func sinkholeReply(r *dns.Msg) *dns.Msg {
+	return blockReply(r, &defaultView)
+}
+
+// blockReply builds view v's answer to the blocked query r as a dns.Msg.
+// It is the fallback for questions writeSinkhole cannot encode directly,
+// and the only path for NXDOMAIN answers, which carry a SOA so that
+// resolvers cache them for the view's TTL.
+func blockReply(r *dns.Msg, v *View) *dns.Msg {
+	m := newReply(r)
+	q := r.Question[0]
+	if v.Mode == BlockNXDomain {
+		m.Rcode = dns.RcodeNameError
+		soa := localSOA(q.Name)
+		soa.Hdr.Ttl, soa.Minttl = v.TTL, v.TTL
+		m.Ns = append(m.Ns, soa)
+		return m
+	}
+
+	hdr := dns.RR_Header{
+		Name:   q.Name,
+		Rrtype: q.Qtype,
+		Class:  dns.ClassINET,
+		Ttl:    v.TTL,
+	}
+	if q.Qtype == dns.TypeA && v.a != nil {
+		m.Answer = append(m.Answer, &dns.A{Hdr: hdr, A: net.IP(v.a)})
+	} else if q.Qtype == dns.TypeAAAA && v.aaaa != nil {
+		m.Answer = append(m.Answer, &dns.AAAA{Hdr: hdr, AAAA: net.IP(v.aaaa)})
+	}
+	return m
+}
+
+// staleAnswerDelay is how long a query with a stale answer available waits
+// for upstreams before being given the stale answer, following the client
+// response timer suggested by RFC 8767 section 5.
+const staleAnswerDelay = 1800 * time.Millisecond
+
+// forwardQuery forwards a DNS query to upstream DNS servers. If upstreams
+// fail or are slow and the cache holds an expired answer that may still be
+// served, that answer is given instead; the upstream exchange carries on
+// and refreshes the cache when it completes.
+func (s *Server) forwardQuery(w dns.ResponseWriter, r *dns.Msg) {
+	var stale *cacheEntry
+	if s.cache != nil {
+		stale = s.cache.staleEntry(r)
+	}
+
+	if stale == nil {
+		resp, shared, err := s.resolve(r)
+		if err != nil {
+			m := newReply(r)
+			m.Rcode = dns.RcodeServerFailure
+			s.writeMsg(w, m)
+			return
+		}
+		s.writeMsg(w, fitReply(w, r, replyFor(r, resp, shared)))
+		return
+	}
+
+	results := make(chan flightResult, 1)
+	go func() {
+		resp, shared, err := s.resolve(r)
+		results <- flightResult{resp: resp, shared: shared, err: err}
+	}()
+	timer := time.NewTimer(staleAnswerDelay)
+	defer timer.Stop()
+
+	select {
+	case res := <-results:
+		if res.err == nil && usable(res.resp) {
+			s.writeMsg(w, fitReply(w, r, replyFor(r, res.resp, res.shared)))
+			return
+		}
+	case <-timer.C:
+	}
+	s.writeMsg(w, fitReply(w, r, staleReply(r, stale)))
+}
+
+// resolve answers r through the upstreams and caches the response.
+// Identical questions resolved at the same time share one upstream
+// exchange; shared reports whether resp is also returned to other callers.
+func (s *Server) resolve(r *dns.Msg) (resp *dns.Msg, shared bool, err error) {
+	exchange := func() (*dns.Msg, error) {
+		resp, err := s.exchange(upstreamQuery(r))
+		switch {
+		case err != nil:
+			s.logger.Error("All upstream DNS servers failed", "error", err)
+		case s.cache != nil:
+			s.cache.Set(r, resp)
+		}
+		return resp, err
+	}
+
+	if key, ok := newCacheKey(r); ok {
+		return s.flights.do(key, exchange)
+	}
+	resp, err = exchange()
+	return resp, false, err
 }
 
 // BlockedDomainInfo holds information about why a domain is blocked.
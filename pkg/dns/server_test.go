@@ -1,14 +1,18 @@
 package dns
 
 import (
+	"fmt"
+	"io"
 	"log/slog"
 	"net"
 	"os"
+	"sync/atomic"
 	"testing"
 	"time"
 
 	"github.com/miekg/dns"
 	"github.com/online-picket-line/opl-for-dns/pkg/api"
+	"github.com/online-picket-line/opl-for-dns/pkg/stats"
 )
 
 func TestNewServer(t *testing.T) {
@@ -50,22 +54,60 @@ func TestNewServerEmptyListenAddr(t *testing.T) {
 	}
 }
 
+func TestServerReconfigure(t *testing.T) {
+	logger := slog.New(slog.NewTextHandler(io.Discard, nil))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+
+	server, err := NewServer("127.0.0.1:5353", []string{"8.8.8.8:53", "tls://1.1.1.1"}, 5*time.Second, apiClient, stats.NewCollector(), logger,
+		WithForwardLimit(4, 4))
+	if err != nil {
+		t.Fatalf("NewServer failed: %v", err)
+	}
+	old := server.fwd.Load()
+	kept := old.upstreams[1]
+
+	if err := server.Reconfigure([]string{"tls://1.1.1.1:853", "9.9.9.9:53"}, 2*time.Second); err != nil {
+		t.Fatalf("Reconfigure failed: %v", err)
+	}
+	fwd := server.fwd.Load()
+	if len(fwd.upstreams) != 2 {
+		t.Fatalf("Expected 2 upstreams, got %d", len(fwd.upstreams))
+	}
+	if fwd.upstreams[0] != kept {
+		t.Error("Expected an upstream still configured to be kept with its connections")
+	}
+	if fwd.upstreams[1].String() != "9.9.9.9:53" || fwd.upstreams[1].rtt == nil {
+		t.Errorf("Expected new upstream 9.9.9.9:53 with an RTT histogram, got %s", fwd.upstreams[1])
+	}
+	if fwd.queryTimeout != 2*time.Second {
+		t.Errorf("Expected query timeout 2s, got %v", fwd.queryTimeout)
+	}
+	if wait := time.Duration(server.forwards.wait.Load()); wait != 2*time.Second {
+		t.Errorf("Expected forward queue wait 2s, got %v", wait)
+	}
+
+	if err := server.Reconfigure([]string{"not an address"}, time.Second); err == nil {
+		t.Error("Expected error for an invalid upstream")
+	}
+	if server.fwd.Load() != fwd {
+		t.Error("Expected a failed reconfigure to leave the running configuration alone")
+	}
+}
+
 func TestGetBlockedDomainInfo(t *testing.T) {
 	logger := slog.New(slog.NewTextHandler(os.Stdout, nil))
 	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
 
 	// Setup blocklist
-	apiClient.SetBlocklistForTesting(&api.Blocklist{
-		BlockList: []api.BlockListItem{
-			{
-				URL:      "https://example.com",
-				Employer: "Test Corp",
-				Location: "Test City",
-				ActionDetails: api.ActionDetails{
-					ActionType:   "strike",
-					Description:  "Test strike",
-					Organization: "Test Union",
-				},
+	apiClient.SetBlocklistForTesting([]api.BlockListItem{
+		{
+			URL:      "https://example.com",
+			Employer: "Test Corp",
+			Location: "Test City",
+			ActionDetails: api.ActionDetails{
+				ActionType:   "strike",
+				Description:  "Test strike",
+				Organization: "Test Union",
 			},
 		},
 	})
@@ -124,6 +166,297 @@ func TestServeDNSEmptyQuestion(t *testing.T) {
 	}
 }
 
+func TestServeDNSBlockedSinkhole(t *testing.T) {
+	logger := slog.New(slog.NewTextHandler(os.Stdout, nil))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	apiClient.SetBlocklistForTesting([]api.BlockListItem{{URL: "https://example.com", Employer: "Test Corp"}})
+	server, _ := NewServer("127.0.0.1:5353", []string{"8.8.8.8:53"}, 5*time.Second, apiClient, nil, logger)
+
+	tests := []struct {
+		qtype uint16
+		want  net.IP
+	}{
+		{dns.TypeA, net.IPv4zero},
+		{dns.TypeAAAA, net.IPv6zero},
+	}
+
+	for _, tt := range tests {
+		r := new(dns.Msg)
+		r.SetQuestion("WWW.Example.com.", tt.qtype)
+
+		w := &mockDNSWriter{}
+		server.ServeDNS(w, r)
+
+		if w.msg == nil {
+			t.Fatal("Expected response message")
+		}
+		if w.msg.Id != r.Id || !w.msg.Response || !w.msg.RecursionDesired || !w.msg.RecursionAvailable {
+			t.Errorf("Unexpected header: %+v", w.msg.MsgHdr)
+		}
+		if len(w.msg.Question) != 1 || w.msg.Question[0].Name != "WWW.Example.com." {
+			t.Errorf("Expected question to be echoed, got %v", w.msg.Question)
+		}
+		if len(w.msg.Answer) != 1 {
+			t.Fatalf("Expected 1 answer, got %d", len(w.msg.Answer))
+		}
+		hdr := w.msg.Answer[0].Header()
+		if hdr.Rrtype != tt.qtype || hdr.Ttl != sinkholeTTL || hdr.Name != "WWW.Example.com." {
+			t.Errorf("Unexpected answer header: %+v", hdr)
+		}
+		var got net.IP
+		switch rr := w.msg.Answer[0].(type) {
+		case *dns.A:
+			got = rr.A
+		case *dns.AAAA:
+			got = rr.AAAA
+		}
+		if !got.Equal(tt.want) {
+			t.Errorf("Expected %v, got %v", tt.want, got)
+		}
+	}
+}
+
+func TestServeDNSRecordsAnalytics(t *testing.T) {
+	logger := slog.New(slog.NewTextHandler(io.Discard, nil))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	apiClient.SetBlocklistForTesting([]api.BlockListItem{{URL: "https://example.com", Employer: "Test Corp"}})
+	collector := stats.NewCollector()
+	collector.EnableAnalytics()
+	server, _ := NewServer("127.0.0.1:5353", []string{"8.8.8.8:53"}, 5*time.Second, apiClient, collector, logger)
+
+	r := new(dns.Msg)
+	r.SetQuestion("www.example.com.", dns.TypeAAAA)
+	server.ServeDNS(&mockDNSWriter{}, r)
+
+	a, _ := collector.Analytics(1)
+	if a.QueryTypes["AAAA"] != 1 || a.ResponseCodes["NOERROR"] != 1 {
+		t.Errorf("Expected one AAAA query answered NOERROR, got %v and %v", a.QueryTypes, a.ResponseCodes)
+	}
+	if len(a.TopClientPrefixes) != 1 || a.TopClientPrefixes[0].Prefix != "192.168.1.0/24" {
+		t.Errorf("Expected client prefix 192.168.1.0/24, got %v", a.TopClientPrefixes)
+	}
+}
+
+func TestSinkholeWireMatchesPackedMsg(t *testing.T) {
+	for _, qtype := range []uint16{dns.TypeA, dns.TypeAAAA} {
+		r := new(dns.Msg)
+		r.SetQuestion("www.example.com.", qtype)
+		r.CheckingDisabled = true
+
+		m := sinkholeReply(r)
+		m.Compress = true
+		want, err := m.Pack()
+		if err != nil {
+			t.Fatalf("Pack failed: %v", err)
+		}
+		got, ok := appendSinkhole(nil, r)
+		if !ok {
+			t.Fatal("appendSinkhole refused a plain name")
+		}
+		if string(got) != string(want) {
+			t.Errorf("qtype %d: wire response differs from packed dns.Msg\n got: %x\nwant: %x", qtype, got, want)
+		}
+	}
+}
+
+func TestAppendWireName(t *testing.T) {
+	tests := []struct {
+		name string
+		want []byte
+		ok   bool
+	}{
+		{".", []byte{0}, true},
+		{"example.com.", []byte("\x07example\x03com\x00"), true},
+		{"example.com", nil, false},
+		{"a..b.", nil, false},
+		{"we\\.ird.", nil, false},
+	}
+
+	for _, tt := range tests {
+		got, ok := appendWireName(nil, tt.name)
+		if ok != tt.ok {
+			t.Errorf("appendWireName(%q): expected ok=%v, got %v", tt.name, tt.ok, ok)
+			continue
+		}
+		if ok && string(got) != string(tt.want) {
+			t.Errorf("appendWireName(%q): expected %x, got %x", tt.name, tt.want, got)
+		}
+	}
+}
+
+func TestServerReusePortListeners(t *testing.T) {
+	logger := slog.New(slog.NewTextHandler(os.Stdout, nil))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	apiClient.SetBlocklistForTesting([]api.BlockListItem{{URL: "https://example.com", Employer: "Test Corp"}})
+
+	// Reserve a free port; every listener must bind the same one.
+	pc, err := net.ListenPacket("udp", "127.0.0.1:0")
+	if err != nil {
+		t.Fatalf("listen: %v", err)
+	}
+	addr := pc.LocalAddr().String()
+	pc.Close()
+
+	server, _ := NewServer(addr, []string{"8.8.8.8:53"}, 5*time.Second, apiClient, nil, logger, WithListeners(4))
+
+	done := make(chan error, 1)
+	go func() { done <- server.Start() }()
+
+	m := new(dns.Msg)
+	m.SetQuestion("example.com.", dns.TypeA)
+	c := &dns.Client{Timeout: 200 * time.Millisecond}
+
+	var resp *dns.Msg
+	for attempt := 0; attempt < 20; attempt++ {
+		if resp, _, err = c.Exchange(m, addr); err == nil {
+			break
+		}
+	}
+	if err != nil {
+		t.Fatalf("query failed: %v", err)
+	}
+	if len(resp.Answer) != 1 {
+		t.Errorf("Expected 1 answer, got %d", len(resp.Answer))
+	}
+
+	server.mu.RLock()
+	listeners := len(server.servers)
+	server.mu.RUnlock()
+	if listeners != 4 {
+		t.Errorf("Expected 4 listeners, got %d", listeners)
+	}
+
+	if err := server.Stop(); err != nil {
+		t.Errorf("Stop failed: %v", err)
+	}
+	select {
+	case err := <-done:
+		if err != nil {
+			t.Errorf("Start returned error: %v", err)
+		}
+	case <-time.After(2 * time.Second):
+		t.Error("Start did not return after Stop")
+	}
+}
+
+// benchmarkServer returns a server that blocks example.com and caches
+// answers. Logging is limited to warnings so that the block log writer,
+// which formats entries on its own goroutine, does not count against the
+// query path.
+func benchmarkServer(b *testing.B) *Server {
+	b.Helper()
+	logger := slog.New(slog.NewTextHandler(io.Discard, &slog.HandlerOptions{Level: slog.LevelWarn}))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	apiClient.SetBlocklistForTesting([]api.BlockListItem{{URL: "https://example.com", Employer: "Test Corp"}})
+	server, err := NewServer("127.0.0.1:5353", []string{"8.8.8.8:53"}, 5*time.Second, apiClient,
+		stats.NewCollector(), logger, WithCache(NewCache(time.Hour, 1024, nil)))
+	if err != nil {
+		b.Fatal(err)
+	}
+	b.Cleanup(func() { server.Stop() })
+	return server
+}
+
+// BenchmarkServeDNSBlocked measures the blocked path, which answers from the
+// wire-format sinkhole encoder and should not allocate.
+func BenchmarkServeDNSBlocked(b *testing.B) {
+	server := benchmarkServer(b)
+	r := new(dns.Msg)
+	r.SetQuestion("www.example.com.", dns.TypeA)
+	w := &discardWriter{}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		server.ServeDNS(w, r)
+	}
+}
+
+// BenchmarkServeDNSForwardCached measures the forward path answered from the
+// cache. The only allocations should be the copied response message.
+func BenchmarkServeDNSForwardCached(b *testing.B) {
+	server := benchmarkServer(b)
+	for _, name := range []string{"www.allowed.org.", "WWW.Allowed.ORG."} {
+		r := new(dns.Msg)
+		r.SetQuestion(name, dns.TypeA)
+		server.cache.Set(r, answerFor(r, 300))
+		w := &discardWriter{}
+
+		b.Run(name, func(b *testing.B) {
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				server.ServeDNS(w, r)
+			}
+		})
+	}
+}
+
+// BenchmarkServeDNSBlockedParallel measures the blocked path from many
+// goroutines, as with several listeners.
+func BenchmarkServeDNSBlockedParallel(b *testing.B) {
+	server := benchmarkServer(b)
+	r := new(dns.Msg)
+	r.SetQuestion("www.example.com.", dns.TypeA)
+
+	b.ReportAllocs()
+	b.RunParallel(func(pb *testing.PB) {
+		w := &discardWriter{}
+		for pb.Next() {
+			server.ServeDNS(w, r)
+		}
+	})
+}
+
+// BenchmarkServeDNSForward measures the uncached forward path against an
+// upstream on the loopback interface, including the exchange itself.
+func BenchmarkServeDNSForward(b *testing.B) {
+	logger := slog.New(slog.NewTextHandler(io.Discard, &slog.HandlerOptions{Level: slog.LevelWarn}))
+	apiClient := api.NewClient("https://api.example.com", "", 10*time.Second)
+	apiClient.SetBlocklistForTesting(nil)
+	upstream := startTestUpstream(b, "udp", echoHandler)
+	server, err := NewServer("127.0.0.1:5353", []string{upstream}, 5*time.Second, apiClient, stats.NewCollector(), logger)
+	if err != nil {
+		b.Fatal(err)
+	}
+	b.Cleanup(func() { server.Stop() })
+
+	r := new(dns.Msg)
+	r.SetQuestion("www.allowed.org.", dns.TypeA)
+
+	b.Run("Serial", func(b *testing.B) {
+		w := &discardWriter{}
+		b.ReportAllocs()
+		for i := 0; i < b.N; i++ {
+			server.ServeDNS(w, r)
+		}
+	})
+	b.Run("Parallel", func(b *testing.B) {
+		b.ReportAllocs()
+		var worker atomic.Int32
+		b.RunParallel(func(pb *testing.PB) {
+			// Each goroutine asks for its own name, so that the
+			// exchanges are not coalesced.
+			r := new(dns.Msg)
+			r.SetQuestion(fmt.Sprintf("w%d.allowed.org.", worker.Add(1)), dns.TypeA)
+			w := &discardWriter{}
+			for pb.Next() {
+				server.ServeDNS(w, r)
+			}
+		})
+	})
+}
+
+// discardWriter is a dns.ResponseWriter that drops everything written to it.
+type discardWriter struct {
+	mockDNSWriter
+}
+
+var discardRemoteAddr = &net.UDPAddr{IP: net.IPv4(192, 168, 1, 50), Port: 12345}
+
+func (d *discardWriter) RemoteAddr() net.Addr        { return discardRemoteAddr }
+func (d *discardWriter) WriteMsg(*dns.Msg) error     { return nil }
+func (d *discardWriter) Write(b []byte) (int, error) { return len(b), nil }
+
 // mockDNSWriter is a mock implementation of dns.ResponseWriter
 type mockDNSWriter struct {
 	msg *dns.Msg
@@ -142,8 +475,13 @@ func (m *mockDNSWriter) WriteMsg(msg *dns.Msg) error {
 	return nil
 }
 
-func (m *mockDNSWriter) Write([]byte) (int, error) {
-	return 0, nil
+func (m *mockDNSWriter) Write(b []byte) (int, error) {
+	msg := new(dns.Msg)
+	if err := msg.Unpack(b); err != nil {
+		return 0, err
+	}
+	m.msg = msg
+	return len(b), nil
 }
 
 func (m *mockDNSWriter) Close() error {
@@ -0,0 +1,137 @@
+package dns
+
+import (
+	"encoding/binary"
+	"strings"
+	"sync"
+
+	"github.com/miekg/dns"
+)
+
+// sinkholeTTL is the TTL of the 0.0.0.0 / :: answers given for blocked
+// domains.
+const sinkholeTTL = 60
+
+// sinkholeBufPool holds buffers for encoding sinkhole responses. A response
+// is the 12-byte header, the question (name of at most 255 bytes plus
+// type and class) and a 28-byte AAAA answer at most.
+var sinkholeBufPool = sync.Pool{
+	New: func() any {
+		b := make([]byte, 0, 12+255+4+28)
+		return &b
+	},
+}
+
+// writeSinkhole answers a blocked A or AAAA query as view v says, with
+// its addresses and TTL, by encoding the response directly in wire
+// format, without building a dns.Msg. It reports false if the question
+// cannot be encoded this way, in which case the caller should use the
+// dns.Msg path.
+func writeSinkhole(w dns.ResponseWriter, r *dns.Msg, v *View) bool {
+	bufp := sinkholeBufPool.Get().(*[]byte)
+	defer sinkholeBufPool.Put(bufp)
+
+	buf, ok := appendBlockAnswer((*bufp)[:0], r, v)
+	if !ok {
+		return false
+	}
+	*bufp = buf
+	w.Write(buf)
+	return true
+}
+
+// appendSinkhole appends the default sinkhole response for r to buf.
+func appendSinkhole(buf []byte, r *dns.Msg) ([]byte, bool) {
+	return appendBlockAnswer(buf, r, &defaultView)
+}
+
+// appendBlockAnswer appends the response of view v to the blocked query r.
+// The response matches what dns.Msg.SetReply plus one A/AAAA record would
+// pack to: the request's ID, opcode, RD and CD bits with QR and RA set,
+// the echoed question, and an answer whose owner name is a compression
+// pointer to the question at offset 12. A view without an address of the
+// query's type gives no answer record.
+func appendBlockAnswer(buf []byte, r *dns.Msg, v *View) ([]byte, bool) {
+	if len(r.Question) != 1 {
+		return buf, false
+	}
+	q := r.Question[0]
+
+	var rdata []byte
+	switch q.Qtype {
+	case dns.TypeA:
+		rdata = v.a
+	case dns.TypeAAAA:
+		rdata = v.aaaa
+	default:
+		return buf, false
+	}
+	ancount := uint16(1)
+	if rdata == nil {
+		ancount = 0
+	}
+
+	flags := uint16(1<<15) | uint16(r.Opcode&0xF)<<11 | 1<<7 // QR, opcode, RA
+	if r.Opcode == dns.OpcodeQuery {
+		if r.RecursionDesired {
+			flags |= 1 << 8
+		}
+		if r.CheckingDisabled {
+			flags |= 1 << 4
+		}
+	}
+
+	buf = binary.BigEndian.AppendUint16(buf, r.Id)
+	buf = binary.BigEndian.AppendUint16(buf, flags)
+	buf = binary.BigEndian.AppendUint16(buf, 1)       // QDCOUNT
+	buf = binary.BigEndian.AppendUint16(buf, ancount) // ANCOUNT
+	buf = binary.BigEndian.AppendUint16(buf, 0)       // NSCOUNT
+	buf = binary.BigEndian.AppendUint16(buf, 0)       // ARCOUNT
+
+	buf, ok := appendWireName(buf, q.Name)
+	if !ok {
+		return buf, false
+	}
+	buf = binary.BigEndian.AppendUint16(buf, q.Qtype)
+	buf = binary.BigEndian.AppendUint16(buf, q.Qclass)
+	if rdata == nil {
+		return buf, true
+	}
+
+	buf = binary.BigEndian.AppendUint16(buf, 0xC000|12) // pointer to question name
+	buf = binary.BigEndian.AppendUint16(buf, q.Qtype)
+	buf = binary.BigEndian.AppendUint16(buf, dns.ClassINET)
+	buf = binary.BigEndian.AppendUint32(buf, v.TTL)
+	buf = binary.BigEndian.AppendUint16(buf, uint16(len(rdata)))
+	buf = append(buf, rdata...)
+	return buf, true
+}
+
+var (
+	zeroIPv4 [4]byte
+	zeroIPv6 [16]byte
+)
+
+// appendWireName appends a fully qualified presentation-format name as
+// uncompressed wire-format labels. Names with escape sequences are left to
+// miekg/dns.
+func appendWireName(buf []byte, name string) ([]byte, bool) {
+	if name == "." {
+		return append(buf, 0), true
+	}
+	if !strings.HasSuffix(name, ".") || strings.IndexByte(name, '\\') >= 0 || len(name) > 254 {
+		return buf, false
+	}
+
+	for start := 0; start < len(name); {
+		end := start + strings.IndexByte(name[start:], '.')
+		n := end - start
+		if n == 0 || n > 63 {
+			return buf, false
+		}
+		buf = append(buf, byte(n))
+		buf = append(buf, name[start:end]...)
+		start = end + 1
+	}
+	return append(buf, 0), true
+}
@@ -0,0 +1,304 @@
+package dns
+
+import (
+	"bufio"
+	"context"
+	"crypto/tls"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"net"
+	"sync"
+	"time"
+
+	"github.com/miekg/dns"
+)
+
+const (
+	// defaultStreamIdleTimeout is how long a TCP, DNS-over-TLS or
+	// DNS-over-HTTPS connection may sit without a query before it is
+	// closed, as suggested by RFC 7766 section 6.2.3.
+	defaultStreamIdleTimeout = 10 * time.Second
+
+	// defaultStreamInFlight is how many queries on one connection are
+	// handled at once before the server stops reading from it.
+	defaultStreamInFlight = 32
+
+	// defaultStreamConns caps the open DNS-over-TLS connections.
+	defaultStreamConns = 4096
+)
+
+// NewTLSConfig loads a certificate and key for the DNS-over-TLS and
+// DNS-over-HTTPS listeners. crypto/tls issues session tickets and rotates
+// their keys itself, so returning clients resume without a full handshake.
+func NewTLSConfig(certFile, keyFile string) (*tls.Config, error) {
+	cert, err := tls.LoadX509KeyPair(certFile, keyFile)
+	if err != nil {
+		return nil, fmt.Errorf("loading TLS certificate: %w", err)
+	}
+	return &tls.Config{
+		Certificates: []tls.Certificate{cert},
+		MinVersion:   tls.VersionTLS12,
+	}, nil
+}
+
+// streamServer serves DNS over TLS (RFC 7858). Unlike dns.Server, which
+// answers the queries on a connection one at a time, it handles up to
+// inFlight of them concurrently and writes each answer as soon as it is
+// ready, so a slow upstream answer does not hold up the blocked and cached
+// answers behind it (RFC 7766 section 6.2.1.1). Each connection costs one
+// reader goroutine plus one per query in flight.
+type streamServer struct {
+	addr        string
+	tlsConfig   *tls.Config
+	handler     dns.Handler
+	idleTimeout time.Duration
+	inFlight    int
+	conns       chan struct{} // one token per open connection
+
+	mu       sync.Mutex
+	listener net.Listener
+	active   map[net.Conn]struct{}
+	closed   bool
+	wg       sync.WaitGroup
+}
+
+func newStreamServer(addr string, tlsConfig *tls.Config, handler dns.Handler, idleTimeout time.Duration, inFlight, maxConns int) *streamServer {
+	return &streamServer{
+		addr:        addr,
+		tlsConfig:   tlsConfig,
+		handler:     handler,
+		idleTimeout: idleTimeout,
+		inFlight:    inFlight,
+		conns:       make(chan struct{}, maxConns),
+		active:      make(map[net.Conn]struct{}),
+	}
+}
+
+// serve accepts connections from ln until shutdown is called.
+func (ss *streamServer) serve(ln net.Listener) error {
+	ss.mu.Lock()
+	if ss.closed {
+		ss.mu.Unlock()
+		ln.Close()
+		return nil
+	}
+	ss.listener = ln
+	ss.mu.Unlock()
+
+	var backoff time.Duration
+	for {
+		conn, err := ln.Accept()
+		if err != nil {
+			if ss.isClosed() {
+				return nil
+			}
+			// Back off on errors such as running out of file
+			// descriptors, as net/http does
+			var ne net.Error
+			if !errors.As(err, &ne) {
+				return err
+			}
+			backoff = min(max(2*backoff, 5*time.Millisecond), time.Second)
+			time.Sleep(backoff)
+			continue
+		}
+		backoff = 0
+
+		// Past the connection limit, close new connections rather than
+		// letting them queue; clients fall back to another transport.
+		select {
+		case ss.conns <- struct{}{}:
+		default:
+			conn.Close()
+			continue
+		}
+		if !ss.track(conn) {
+			conn.Close()
+			<-ss.conns
+			return nil
+		}
+		go ss.serveConn(conn)
+	}
+}
+
+// track records an accepted connection so shutdown can stop it. It
+// reports false once the server is shutting down.
+func (ss *streamServer) track(conn net.Conn) bool {
+	ss.mu.Lock()
+	defer ss.mu.Unlock()
+	if ss.closed {
+		return false
+	}
+	ss.active[conn] = struct{}{}
+	ss.wg.Add(1)
+	return true
+}
+
+func (ss *streamServer) isClosed() bool {
+	ss.mu.Lock()
+	defer ss.mu.Unlock()
+	return ss.closed
+}
+
+// serveConn reads queries from conn until it is idle, the client closes it
+// or the server shuts down, then closes it once the queries in flight have
+// been answered.
+func (ss *streamServer) serveConn(conn net.Conn) {
+	var queries sync.WaitGroup
+	defer func() {
+		queries.Wait()
+		conn.Close()
+		ss.mu.Lock()
+		delete(ss.active, conn)
+		ss.mu.Unlock()
+		<-ss.conns
+		ss.wg.Done()
+	}()
+
+	w := &streamWriter{conn: conn, timeout: ss.idleTimeout}
+	rd := bufio.NewReader(conn)
+	sem := make(chan struct{}, ss.inFlight)
+	var frame [2]byte
+	buf := make([]byte, 0, 512)
+	for {
+		conn.SetReadDeadline(time.Now().Add(ss.idleTimeout))
+		if _, err := io.ReadFull(rd, frame[:]); err != nil {
+			return
+		}
+		n := int(binary.BigEndian.Uint16(frame[:]))
+		if n < 12 {
+			return
+		}
+		if cap(buf) < n {
+			buf = make([]byte, n)
+		}
+		buf = buf[:n]
+		if _, err := io.ReadFull(rd, buf); err != nil {
+			return
+		}
+		// Unpack copies everything it keeps, so buf can be reused for the
+		// next query
+		m := new(dns.Msg)
+		if err := m.Unpack(buf); err != nil {
+			return
+		}
+
+		// Stop reading while the connection has inFlight queries pending
+		sem <- struct{}{}
+		queries.Add(1)
+		go func() {
+			defer func() {
+				<-sem
+				queries.Done()
+			}()
+			ss.handler.ServeDNS(w, m)
+		}()
+	}
+}
+
+// shutdown stops accepting connections and stops reading from open ones,
+// then waits for the queries in flight to be answered and every connection
+// to close. Connections still open when ctx is done are closed.
+func (ss *streamServer) shutdown(ctx context.Context) error {
+	ss.mu.Lock()
+	ss.closed = true
+	var err error
+	if ss.listener != nil {
+		err = ss.listener.Close()
+	}
+	for conn := range ss.active {
+		closeRead(conn)
+	}
+	ss.mu.Unlock()
+
+	done := make(chan struct{})
+	go func() {
+		ss.wg.Wait()
+		close(done)
+	}()
+	select {
+	case <-done:
+		return err
+	case <-ctx.Done():
+	}
+
+	ss.mu.Lock()
+	for conn := range ss.active {
+		conn.Close()
+	}
+	ss.mu.Unlock()
+	<-done
+	return errors.Join(err, ctx.Err())
+}
+
+// closeRead ends the reader loop of a connection while leaving it open for
+// the answers still to be written.
+func closeRead(conn net.Conn) {
+	if tc, ok := conn.(*tls.Conn); ok {
+		conn = tc.NetConn()
+	}
+	if tc, ok := conn.(*net.TCPConn); ok {
+		tc.CloseRead()
+		return
+	}
+	conn.SetReadDeadline(time.Now())
+}
+
+// streamWriter is the dns.ResponseWriter for the queries of one stream
+// connection. Answers are written whole under a lock, as they may be
+// ready on several goroutines at once.
+type streamWriter struct {
+	conn    net.Conn
+	timeout time.Duration
+	mu      sync.Mutex
+}
+
+func (w *streamWriter) LocalAddr() net.Addr  { return w.conn.LocalAddr() }
+func (w *streamWriter) RemoteAddr() net.Addr { return w.conn.RemoteAddr() }
+
+// WriteMsg packs m and writes it with its length prefix.
+func (w *streamWriter) WriteMsg(m *dns.Msg) error {
+	bufp := packBufPool.Get().(*[]byte)
+	defer packBufPool.Put(bufp)
+	buf := *bufp
+
+	packed, err := m.PackBuffer(buf[2:])
+	if err != nil {
+		return err
+	}
+	return w.writeFrame(buf, len(packed))
+}
+
+// Write writes a packed message with its length prefix.
+func (w *streamWriter) Write(b []byte) (int, error) {
+	if len(b) > dns.MaxMsgSize {
+		return 0, dns.ErrBuf
+	}
+	bufp := packBufPool.Get().(*[]byte)
+	defer packBufPool.Put(bufp)
+	buf := *bufp
+
+	copy(buf[2:], b)
+	if err := w.writeFrame(buf, len(b)); err != nil {
+		return 0, err
+	}
+	return len(b), nil
+}
+
+// writeFrame writes the n-byte message at buf[2:] with its length in the
+// first two bytes of buf.
+func (w *streamWriter) writeFrame(buf []byte, n int) error {
+	binary.BigEndian.PutUint16(buf, uint16(n))
+	w.mu.Lock()
+	defer w.mu.Unlock()
+	w.conn.SetWriteDeadline(time.Now().Add(w.timeout))
+	_, err := w.conn.Write(buf[:2+n])
+	return err
+}
+
+func (w *streamWriter) Close() error        { return w.conn.Close() }
+func (w *streamWriter) TsigStatus() error   { return nil }
+func (w *streamWriter) TsigTimersOnly(bool) {}
+func (w *streamWriter) Hijack()             {}
@@ -0,0 +1,196 @@
+package dns
+
+import (
+	"context"
+	"crypto/ecdsa"
+	"crypto/elliptic"
+	"crypto/rand"
+	"crypto/tls"
+	"crypto/x509"
+	"crypto/x509/pkix"
+	"math/big"
+	"net"
+	"testing"
+	"time"
+
+	"github.com/miekg/dns"
+)
+
+// testTLSConfig returns a server configuration with a self-signed
+// certificate for 127.0.0.1, and a client configuration trusting it.
+func testTLSConfig(t *testing.T) (server, client *tls.Config) {
+	t.Helper()
+
+	key, err := ecdsa.GenerateKey(elliptic.P256(), rand.Reader)
+	if err != nil {
+		t.Fatal(err)
+	}
+	tmpl := &x509.Certificate{
+		SerialNumber: big.NewInt(1),
+		Subject:      pkix.Name{CommonName: "opl-dns test"},
+		IPAddresses:  []net.IP{net.IPv4(127, 0, 0, 1)},
+		NotBefore:    time.Now().Add(-time.Hour),
+		NotAfter:     time.Now().Add(time.Hour),
+		KeyUsage:     x509.KeyUsageDigitalSignature,
+		ExtKeyUsage:  []x509.ExtKeyUsage{x509.ExtKeyUsageServerAuth},
+	}
+	der, err := x509.CreateCertificate(rand.Reader, tmpl, tmpl, &key.PublicKey, key)
+	if err != nil {
+		t.Fatal(err)
+	}
+	cert, err := x509.ParseCertificate(der)
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	pool := x509.NewCertPool()
+	pool.AddCert(cert)
+	server = &tls.Config{
+		Certificates: []tls.Certificate{{Certificate: [][]byte{der}, PrivateKey: key}},
+		NextProtos:   []string{"dot"},
+	}
+	client = &tls.Config{RootCAs: pool, ServerName: "127.0.0.1", NextProtos: []string{"dot"}}
+	return server, client
+}
+
+// startStreamServer runs a stream server on a loopback port and returns it
+// with its address.
+func startStreamServer(t *testing.T, tlsConfig *tls.Config, handler dns.HandlerFunc, idle time.Duration, maxConns int) (*streamServer, string) {
+	t.Helper()
+
+	ln, err := net.Listen("tcp", "127.0.0.1:0")
+	if err != nil {
+		t.Fatal(err)
+	}
+	ss := newStreamServer(ln.Addr().String(), tlsConfig, handler, idle, 8, maxConns)
+	if tlsConfig != nil {
+		ln = tls.NewListener(ln, tlsConfig)
+	}
+	go ss.serve(ln)
+	t.Cleanup(func() { ss.shutdown(context.Background()) })
+	return ss, ln.Addr().String()
+}
+
+// slowHandler answers "slow." after a delay and everything else at once.
+func slowHandler(w dns.ResponseWriter, r *dns.Msg) {
+	if r.Question[0].Name == "slow." {
+		time.Sleep(200 * time.Millisecond)
+	}
+	echoHandler(w, r)
+}
+
+func query(name string) *dns.Msg {
+	m := new(dns.Msg)
+	m.SetQuestion(name, dns.TypeA)
+	return m
+}
+
+func TestStreamServerAnswersOutOfOrder(t *testing.T) {
+	serverTLS, clientTLS := testTLSConfig(t)
+	_, addr := startStreamServer(t, serverTLS, slowHandler, time.Second, 16)
+
+	tc, err := tls.Dial("tcp", addr, clientTLS)
+	if err != nil {
+		t.Fatalf("dial: %v", err)
+	}
+	conn := &dns.Conn{Conn: tc}
+	defer conn.Close()
+
+	if err := conn.WriteMsg(query("slow.")); err != nil {
+		t.Fatal(err)
+	}
+	if err := conn.WriteMsg(query("fast.")); err != nil {
+		t.Fatal(err)
+	}
+
+	var order []string
+	conn.SetReadDeadline(time.Now().Add(2 * time.Second))
+	for i := 0; i < 2; i++ {
+		resp, err := conn.ReadMsg()
+		if err != nil {
+			t.Fatalf("read answer %d: %v", i, err)
+		}
+		order = append(order, resp.Question[0].Name)
+	}
+	if order[0] != "fast." || order[1] != "slow." {
+		t.Errorf("Expected the fast answer first, got %v", order)
+	}
+}
+
+func TestStreamServerClosesIdleConnections(t *testing.T) {
+	_, addr := startStreamServer(t, nil, echoHandler, 100*time.Millisecond, 16)
+
+	c, err := net.Dial("tcp", addr)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer c.Close()
+
+	c.SetReadDeadline(time.Now().Add(2 * time.Second))
+	start := time.Now()
+	if _, err := c.Read(make([]byte, 1)); err == nil {
+		t.Fatal("Expected the idle connection to be closed")
+	}
+	if elapsed := time.Since(start); elapsed > time.Second {
+		t.Errorf("Connection closed after %v, expected about 100ms", elapsed)
+	}
+}
+
+func TestStreamServerConnectionLimit(t *testing.T) {
+	_, addr := startStreamServer(t, nil, echoHandler, time.Second, 1)
+
+	first, err := dns.Dial("tcp", addr)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer first.Close()
+	// Make sure the first connection has been accepted
+	if err := first.WriteMsg(query("a.")); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := first.ReadMsg(); err != nil {
+		t.Fatalf("first connection: %v", err)
+	}
+
+	second, err := net.Dial("tcp", addr)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer second.Close()
+	second.SetReadDeadline(time.Now().Add(500 * time.Millisecond))
+	if _, err := second.Read(make([]byte, 1)); err == nil || isTimeout(err) {
+		t.Errorf("Expected the connection over the limit to be closed, got %v", err)
+	}
+}
+
+func TestStreamServerShutdownFinishesQueries(t *testing.T) {
+	ss, addr := startStreamServer(t, nil, slowHandler, time.Second, 16)
+
+	conn, err := dns.Dial("tcp", addr)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	if err := conn.WriteMsg(query("slow.")); err != nil {
+		t.Fatal(err)
+	}
+	time.Sleep(50 * time.Millisecond)
+
+	done := make(chan error, 1)
+	go func() { done <- ss.shutdown(context.Background()) }()
+
+	conn.SetReadDeadline(time.Now().Add(2 * time.Second))
+	if _, err := conn.ReadMsg(); err != nil {
+		t.Errorf("Expected the query in flight to be answered, got %v", err)
+	}
+	select {
+	case <-done:
+	case <-time.After(2 * time.Second):
+		t.Error("shutdown did not return")
+	}
+}
+
+func isTimeout(err error) bool {
+	ne, ok := err.(net.Error)
+	return ok && ne.Timeout()
+}
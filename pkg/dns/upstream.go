@@ -0,0 +1,481 @@
+package dns
+
+import (
+	"bufio"
+	"context"
+	"crypto/tls"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"math/rand"
+	"net"
+	"strings"
+	"sync"
+	"sync/atomic"
+
+	"github.com/miekg/dns"
+	"github.com/online-picket-line/opl-for-dns/pkg/stats"
+)
+
+const (
+	// udpSocketsPerUpstream is how many long-lived UDP sockets are kept open
+	// to each upstream. Queries are spread across them round-robin.
+	udpSocketsPerUpstream = 4
+
+	// udpSocketLifetime is how many queries a UDP socket carries before it is
+	// replaced, so the source port keeps changing for spoofing resistance.
+	udpSocketLifetime = 4096
+
+	// streamConnsPerUpstream is how many pipelined TCP/TLS connections are
+	// kept open to each upstream.
+	streamConnsPerUpstream = 2
+
+	// streamPipelineDepth is how many queries may be in flight on one stream
+	// connection before another connection is opened.
+	streamPipelineDepth = 32
+)
+
+var (
+	errConnClosed   = errors.New("upstream connection closed")
+	errIDsExhausted = errors.New("no free query IDs on upstream connection")
+)
+
+// packBufPool holds buffers large enough for any DNS message plus the
+// two-byte TCP length prefix.
+var packBufPool = sync.Pool{
+	New: func() any {
+		b := make([]byte, 2+dns.MaxMsgSize)
+		return &b
+	},
+}
+
+// upstream is a persistent transport to one upstream resolver. UDP queries
+// share a few long-lived sockets and are matched to replies by message ID;
+// TCP and DNS-over-TLS queries are pipelined over reused connections. A UDP
+// upstream also keeps TCP connections, opened on demand, for the answers
+// too large for UDP.
+type upstream struct {
+	addr    string // host:port
+	network string // "udp", "tcp" or "tcp-tls"
+
+	dialer    net.Dialer
+	tlsConfig *tls.Config
+
+	mu     sync.Mutex
+	udp    [udpSocketsPerUpstream]*muxConn
+	stream []*muxConn
+	closed bool
+
+	next atomic.Uint32
+
+	health     upstreamHealth
+	rtt        *stats.Histogram // nil without a stats collector
+	tcpRetries atomic.Int64     // truncated UDP answers fetched again over TCP
+}
+
+// newUpstream parses an upstream_dns entry. Plain "host:port" entries use
+// UDP, "tcp://host:port" uses TCP and "tls://host[:port]" uses DNS-over-TLS.
+func newUpstream(spec string) (*upstream, error) {
+	u := &upstream{network: "udp", addr: spec}
+
+	switch {
+	case strings.HasPrefix(spec, "tcp://"):
+		u.network = "tcp"
+		u.addr = strings.TrimPrefix(spec, "tcp://")
+	case strings.HasPrefix(spec, "tls://"):
+		u.network = "tcp-tls"
+		u.addr = strings.TrimPrefix(spec, "tls://")
+		if _, _, err := net.SplitHostPort(u.addr); err != nil {
+			u.addr = net.JoinHostPort(u.addr, "853")
+		}
+	}
+
+	host, _, err := net.SplitHostPort(u.addr)
+	if err != nil {
+		return nil, fmt.Errorf("invalid upstream %q: %w", spec, err)
+	}
+
+	if u.network == "tcp-tls" {
+		u.tlsConfig = &tls.Config{
+			ServerName:         host,
+			ClientSessionCache: tls.NewLRUClientSessionCache(0),
+			MinVersion:         tls.VersionTLS12,
+		}
+	}
+	return u, nil
+}
+
+// String returns the upstream address as configured.
+func (u *upstream) String() string {
+	switch u.network {
+	case "tcp":
+		return "tcp://" + u.addr
+	case "tcp-tls":
+		return "tls://" + u.addr
+	default:
+		return u.addr
+	}
+}
+
+// exchange sends a query upstream and waits for the matching reply.
+// The reply carries the query's original ID.
+func (u *upstream) exchange(ctx context.Context, m *dns.Msg) (*dns.Msg, error) {
+	if u.network != "udp" {
+		return u.exchangeOn(ctx, m, u.streamConn)
+	}
+
+	resp, err := u.exchangeOn(ctx, m, u.udpConn)
+	if err != nil || !resp.Truncated {
+		return resp, err
+	}
+	// The answer did not fit in the UDP buffer; fetch it whole over TCP
+	// from the same upstream instead of passing the truncation on and
+	// having the client repeat the query over TCP through us. If that
+	// fails the truncated answer still tells the client to retry.
+	u.tcpRetries.Add(1)
+	if full, err := u.exchangeOn(ctx, m, u.streamConn); err == nil {
+		return full, nil
+	}
+	return resp, nil
+}
+
+// exchangeOn sends a query over a connection from conn. A pooled
+// connection may have been closed by the upstream while idle, or retired
+// just after it was handed out; exchangeOn retries once on a fresh
+// connection before giving up.
+func (u *upstream) exchangeOn(ctx context.Context, m *dns.Msg, conn func(context.Context) (*muxConn, error)) (*dns.Msg, error) {
+	for attempt := 0; ; attempt++ {
+		c, err := conn(ctx)
+		if err != nil {
+			return nil, err
+		}
+		resp, err := c.exchange(ctx, m)
+		if err == nil || attempt > 0 || ctx.Err() != nil || !c.failed() {
+			return resp, err
+		}
+	}
+}
+
+// udpConn returns a live UDP socket, dialing a replacement when the chosen
+// slot is empty, broken or has reached its lifetime.
+func (u *upstream) udpConn(ctx context.Context) (*muxConn, error) {
+	slot := u.next.Add(1) % udpSocketsPerUpstream
+
+	u.mu.Lock()
+	defer u.mu.Unlock()
+	if u.closed {
+		return nil, errConnClosed
+	}
+
+	c := u.udp[slot]
+	if c != nil && !c.failed() && c.sent.Add(1) <= udpSocketLifetime {
+		return c, nil
+	}
+	if c != nil {
+		c.retire()
+	}
+
+	conn, err := u.dialer.DialContext(ctx, "udp", u.addr)
+	if err != nil {
+		return nil, err
+	}
+	c = newMuxConn(conn, false)
+	c.sent.Add(1)
+	u.udp[slot] = c
+	return c, nil
+}
+
+// streamConn returns the live TCP/TLS connection with the fewest queries in
+// flight, dialing another one when every connection is busy and the pool
+// is below its limit.
+func (u *upstream) streamConn(ctx context.Context) (*muxConn, error) {
+	u.mu.Lock()
+	defer u.mu.Unlock()
+	if u.closed {
+		return nil, errConnClosed
+	}
+
+	live := u.stream[:0]
+	var best *muxConn
+	for _, c := range u.stream {
+		if c.failed() {
+			continue
+		}
+		live = append(live, c)
+		if best == nil || c.inFlight() < best.inFlight() {
+			best = c
+		}
+	}
+	u.stream = live
+
+	if best != nil && (best.inFlight() < streamPipelineDepth || len(u.stream) >= streamConnsPerUpstream) {
+		return best, nil
+	}
+
+	var conn net.Conn
+	var err error
+	if u.network == "tcp-tls" {
+		d := tls.Dialer{NetDialer: &u.dialer, Config: u.tlsConfig}
+		conn, err = d.DialContext(ctx, "tcp", u.addr)
+	} else {
+		conn, err = u.dialer.DialContext(ctx, "tcp", u.addr)
+	}
+	if err != nil {
+		if best != nil {
+			return best, nil
+		}
+		return nil, err
+	}
+
+	c := newMuxConn(conn, true)
+	u.stream = append(u.stream, c)
+	return c, nil
+}
+
+// close shuts down all pooled connections.
+func (u *upstream) close() {
+	u.mu.Lock()
+	defer u.mu.Unlock()
+
+	u.closed = true
+	for i, c := range u.udp {
+		if c != nil {
+			c.close(errConnClosed)
+			u.udp[i] = nil
+		}
+	}
+	for _, c := range u.stream {
+		c.close(errConnClosed)
+	}
+	u.stream = nil
+}
+
+// muxConn multiplexes concurrent queries over one connection, matching
+// replies to waiting callers by message ID and question.
+type muxConn struct {
+	conn   net.Conn
+	stream bool
+
+	wmu sync.Mutex // serializes writes on stream connections
+
+	mu      sync.Mutex
+	pending map[uint16]*pendingQuery
+	retired bool
+	err     error
+	done    chan struct{}
+
+	sent atomic.Int64
+}
+
+type pendingQuery struct {
+	question dns.Question
+	reply    chan *dns.Msg
+}
+
+func newMuxConn(conn net.Conn, stream bool) *muxConn {
+	c := &muxConn{
+		conn:    conn,
+		stream:  stream,
+		pending: make(map[uint16]*pendingQuery),
+		done:    make(chan struct{}),
+	}
+	go c.readLoop()
+	return c
+}
+
+// exchange writes the query with a connection-unique ID and waits for the
+// reply, the context, or the connection to fail.
+func (c *muxConn) exchange(ctx context.Context, m *dns.Msg) (*dns.Msg, error) {
+	if len(m.Question) != 1 {
+		return nil, fmt.Errorf("upstream queries must have exactly one question")
+	}
+
+	call := &pendingQuery{question: m.Question[0], reply: make(chan *dns.Msg, 1)}
+	id, err := c.register(call)
+	if err != nil {
+		return nil, err
+	}
+	defer c.unregister(id)
+
+	if err := c.write(m, id); err != nil {
+		c.close(err)
+		return nil, err
+	}
+
+	select {
+	case resp := <-call.reply:
+		resp.Id = m.Id
+		return resp, nil
+	case <-c.done:
+		return nil, c.closeErr()
+	case <-ctx.Done():
+		return nil, ctx.Err()
+	}
+}
+
+func (c *muxConn) register(call *pendingQuery) (uint16, error) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	if c.err != nil {
+		return 0, c.err
+	}
+
+	for tries := 0; tries < 64; tries++ {
+		id := uint16(rand.Uint32())
+		if _, taken := c.pending[id]; !taken {
+			c.pending[id] = call
+			return id, nil
+		}
+	}
+	return 0, errIDsExhausted
+}
+
+func (c *muxConn) unregister(id uint16) {
+	c.mu.Lock()
+	delete(c.pending, id)
+	drained := c.retired && len(c.pending) == 0
+	c.mu.Unlock()
+
+	if drained {
+		c.close(errConnClosed)
+	}
+}
+
+// write packs the query under the given ID and sends it in a single write.
+func (c *muxConn) write(m *dns.Msg, id uint16) error {
+	bufp := packBufPool.Get().(*[]byte)
+	defer packBufPool.Put(bufp)
+	buf := *bufp
+
+	q := *m
+	q.Id = id
+	packed, err := q.PackBuffer(buf[2:])
+	if err != nil {
+		return err
+	}
+
+	if !c.stream {
+		_, err = c.conn.Write(packed)
+		return err
+	}
+
+	binary.BigEndian.PutUint16(buf, uint16(len(packed)))
+	c.wmu.Lock()
+	_, err = c.conn.Write(buf[:2+len(packed)])
+	c.wmu.Unlock()
+	return err
+}
+
+func (c *muxConn) readLoop() {
+	buf := make([]byte, dns.MaxMsgSize)
+	var r *bufio.Reader
+	if c.stream {
+		r = bufio.NewReader(c.conn)
+	}
+
+	for {
+		var n int
+		var err error
+		if c.stream {
+			n, err = readFrame(r, buf)
+		} else {
+			n, err = c.conn.Read(buf)
+		}
+		if err != nil {
+			c.close(err)
+			return
+		}
+
+		resp := new(dns.Msg)
+		if err := resp.Unpack(buf[:n]); err != nil {
+			continue
+		}
+		c.deliver(resp)
+	}
+}
+
+// readFrame reads one length-prefixed DNS message from a stream.
+func readFrame(r *bufio.Reader, buf []byte) (int, error) {
+	var prefix [2]byte
+	if _, err := io.ReadFull(r, prefix[:]); err != nil {
+		return 0, err
+	}
+	n := int(binary.BigEndian.Uint16(prefix[:]))
+	if _, err := io.ReadFull(r, buf[:n]); err != nil {
+		return 0, err
+	}
+	return n, nil
+}
+
+// deliver hands a reply to the caller waiting on its ID. Replies whose
+// question does not match the outstanding query are dropped.
+func (c *muxConn) deliver(resp *dns.Msg) {
+	c.mu.Lock()
+	call, ok := c.pending[resp.Id]
+	if ok && questionMatches(resp, call.question) {
+		delete(c.pending, resp.Id)
+	} else {
+		ok = false
+	}
+	c.mu.Unlock()
+
+	if ok {
+		call.reply <- resp
+	}
+}
+
+func questionMatches(resp *dns.Msg, q dns.Question) bool {
+	if len(resp.Question) != 1 {
+		return false
+	}
+	rq := resp.Question[0]
+	return rq.Qtype == q.Qtype && rq.Qclass == q.Qclass && strings.EqualFold(rq.Name, q.Name)
+}
+
+// retire stops the connection from taking new queries; it is closed once
+// its outstanding queries finish.
+func (c *muxConn) retire() {
+	c.mu.Lock()
+	c.retired = true
+	drained := len(c.pending) == 0
+	c.mu.Unlock()
+
+	if drained {
+		c.close(errConnClosed)
+	}
+}
+
+func (c *muxConn) close(err error) {
+	c.mu.Lock()
+	if c.err != nil {
+		c.mu.Unlock()
+		return
+	}
+	c.err = err
+	close(c.done)
+	c.mu.Unlock()
+
+	c.conn.Close()
+}
+
+func (c *muxConn) closeErr() error {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	return c.err
+}
+
+func (c *muxConn) failed() bool {
+	select {
+	case <-c.done:
+		return true
+	default:
+		return false
+	}
+}
+
+func (c *muxConn) inFlight() int {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	return len(c.pending)
+}
@@ -0,0 +1,235 @@
+package dns
+
+import (
+	"context"
+	"net"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/miekg/dns"
+)
+
+// startTestUpstream runs a local DNS server on the given network ("udp" or
+// "tcp") and returns its address.
+func startTestUpstream(t testing.TB, network string, handler dns.HandlerFunc) string {
+	t.Helper()
+
+	started := make(chan struct{})
+	srv := &dns.Server{Net: network, Handler: handler, NotifyStartedFunc: func() { close(started) }}
+
+	var addr string
+	if network == "udp" {
+		pc, err := net.ListenPacket("udp", "127.0.0.1:0")
+		if err != nil {
+			t.Fatalf("listen: %v", err)
+		}
+		srv.PacketConn = pc
+		addr = pc.LocalAddr().String()
+	} else {
+		l, err := net.Listen("tcp", "127.0.0.1:0")
+		if err != nil {
+			t.Fatalf("listen: %v", err)
+		}
+		srv.Listener = l
+		addr = l.Addr().String()
+	}
+
+	go srv.ActivateAndServe()
+	<-started
+	t.Cleanup(func() { srv.Shutdown() })
+	return addr
+}
+
+// echoHandler answers every A query with 192.0.2.1.
+func echoHandler(w dns.ResponseWriter, r *dns.Msg) {
+	m := new(dns.Msg)
+	m.SetReply(r)
+	m.Answer = append(m.Answer, &dns.A{
+		Hdr: dns.RR_Header{Name: r.Question[0].Name, Rrtype: dns.TypeA, Class: dns.ClassINET, Ttl: 60},
+		A:   net.ParseIP("192.0.2.1"),
+	})
+	w.WriteMsg(m)
+}
+
+func TestNewUpstream(t *testing.T) {
+	tests := []struct {
+		spec    string
+		network string
+		addr    string
+		wantErr bool
+	}{
+		{"8.8.8.8:53", "udp", "8.8.8.8:53", false},
+		{"tcp://8.8.8.8:53", "tcp", "8.8.8.8:53", false},
+		{"tls://dns.google", "tcp-tls", "dns.google:853", false},
+		{"tls://1.1.1.1:8853", "tcp-tls", "1.1.1.1:8853", false},
+		{"8.8.8.8", "", "", true},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.spec, func(t *testing.T) {
+			u, err := newUpstream(tt.spec)
+			if tt.wantErr {
+				if err == nil {
+					t.Error("Expected error")
+				}
+				return
+			}
+			if err != nil {
+				t.Fatalf("newUpstream failed: %v", err)
+			}
+			if u.network != tt.network || u.addr != tt.addr {
+				t.Errorf("Expected %s %s, got %s %s", tt.network, tt.addr, u.network, u.addr)
+			}
+		})
+	}
+}
+
+func testUpstreamMultiplexing(t *testing.T, network, spec string) {
+	var queries atomic.Int64
+	addr := startTestUpstream(t, network, func(w dns.ResponseWriter, r *dns.Msg) {
+		queries.Add(1)
+		echoHandler(w, r)
+	})
+
+	u, err := newUpstream(spec + addr)
+	if err != nil {
+		t.Fatalf("newUpstream failed: %v", err)
+	}
+	defer u.close()
+
+	var wg sync.WaitGroup
+	for i := 0; i < 50; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+
+			m := new(dns.Msg)
+			m.SetQuestion(dns.Fqdn(net.IPv4(10, 0, 0, byte(i)).String()+".example.org"), dns.TypeA)
+			m.Id = uint16(i)
+
+			ctx, cancel := context.WithTimeout(context.Background(), 2*time.Second)
+			defer cancel()
+			resp, err := u.exchange(ctx, m)
+			if err != nil {
+				t.Errorf("exchange failed: %v", err)
+				return
+			}
+			if resp.Id != m.Id {
+				t.Errorf("Expected ID %d, got %d", m.Id, resp.Id)
+			}
+			if resp.Question[0].Name != m.Question[0].Name {
+				t.Errorf("Expected answer for %s, got %s", m.Question[0].Name, resp.Question[0].Name)
+			}
+		}(i)
+	}
+	wg.Wait()
+
+	if queries.Load() != 50 {
+		t.Errorf("Expected 50 upstream queries, got %d", queries.Load())
+	}
+}
+
+func TestUpstreamUDPMultiplexing(t *testing.T) {
+	testUpstreamMultiplexing(t, "udp", "")
+}
+
+func TestUpstreamTCPPipelining(t *testing.T) {
+	testUpstreamMultiplexing(t, "tcp", "tcp://")
+}
+
+func TestUpstreamReusesUDPSockets(t *testing.T) {
+	addr := startTestUpstream(t, "udp", echoHandler)
+	u, _ := newUpstream(addr)
+	defer u.close()
+
+	sources := make(map[string]bool)
+	for i := 0; i < 2*udpSocketsPerUpstream; i++ {
+		c, err := u.udpConn(context.Background())
+		if err != nil {
+			t.Fatalf("udpConn failed: %v", err)
+		}
+		sources[c.conn.LocalAddr().String()] = true
+	}
+
+	if len(sources) != udpSocketsPerUpstream {
+		t.Errorf("Expected %d sockets, got %d", udpSocketsPerUpstream, len(sources))
+	}
+}
+
+func TestUpstreamDropsMismatchedReply(t *testing.T) {
+	addr := startTestUpstream(t, "udp", func(w dns.ResponseWriter, r *dns.Msg) {
+		m := new(dns.Msg)
+		m.SetReply(r)
+		m.Question[0].Name = "spoofed.example."
+		w.WriteMsg(m)
+	})
+	u, _ := newUpstream(addr)
+	defer u.close()
+
+	m := new(dns.Msg)
+	m.SetQuestion("example.org.", dns.TypeA)
+
+	ctx, cancel := context.WithTimeout(context.Background(), 200*time.Millisecond)
+	defer cancel()
+	if _, err := u.exchange(ctx, m); err == nil {
+		t.Error("Expected reply with mismatched question to be ignored")
+	}
+}
+
+func TestUpstreamRetriesTruncatedOverTCP(t *testing.T) {
+	// The UDP and TCP servers share a port, as a real upstream's would
+	l, err := net.Listen("tcp", "127.0.0.1:0")
+	if err != nil {
+		t.Fatalf("listen: %v", err)
+	}
+	pc, err := net.ListenPacket("udp", l.Addr().String())
+	if err != nil {
+		l.Close()
+		t.Skipf("UDP port %s unavailable: %v", l.Addr(), err)
+	}
+
+	var udpSize atomic.Int32
+	truncate := func(w dns.ResponseWriter, r *dns.Msg) {
+		if opt := r.IsEdns0(); opt != nil {
+			udpSize.Store(int32(opt.UDPSize()))
+		}
+		m := new(dns.Msg)
+		m.SetReply(r)
+		m.Truncated = true
+		w.WriteMsg(m)
+	}
+	for _, srv := range []*dns.Server{
+		{Listener: l, Handler: dns.HandlerFunc(echoHandler)},
+		{PacketConn: pc, Handler: dns.HandlerFunc(truncate)},
+	} {
+		started := make(chan struct{})
+		srv.NotifyStartedFunc = func() { close(started) }
+		go srv.ActivateAndServe()
+		<-started
+		t.Cleanup(func() { srv.Shutdown() })
+	}
+
+	u, _ := newUpstream(l.Addr().String())
+	defer u.close()
+
+	m := new(dns.Msg)
+	m.SetQuestion("example.org.", dns.TypeA)
+	ctx, cancel := context.WithTimeout(context.Background(), 2*time.Second)
+	defer cancel()
+
+	resp, err := u.exchange(ctx, upstreamQuery(m))
+	if err != nil {
+		t.Fatalf("exchange failed: %v", err)
+	}
+	if resp.Truncated || len(resp.Answer) != 1 {
+		t.Errorf("Expected full answer over TCP, got %d records (truncated %v)", len(resp.Answer), resp.Truncated)
+	}
+	if got := u.tcpRetries.Load(); got != 1 {
+		t.Errorf("Expected 1 TCP retry, got %d", got)
+	}
+	if got := udpSize.Load(); got != ednsUDPSize {
+		t.Errorf("Expected upstream to be offered a %d byte buffer, got %d", ednsUDPSize, got)
+	}
+}
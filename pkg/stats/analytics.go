@@ -0,0 +1,169 @@
+package stats
+
+import (
+	"hash/maphash"
+	"net/netip"
+	"strconv"
+	"sync/atomic"
+)
+
+const (
+	// Client load is attributed to prefixes rather than addresses, as for
+	// the DNS server's rate limiting.
+	clientIPv4Prefix = 24
+	clientIPv6Prefix = 56
+
+	// numQtypeCounters counts query types up to CAA individually; rarer
+	// types share the last counter.
+	numQtypeCounters = 258
+
+	// numRcodeCounters counts the RCODEs that fit in the header; extended
+	// RCODEs share the last counter.
+	numRcodeCounters = 17
+)
+
+// analytics is the optional per-query breakdown enabled by
+// Collector.EnableAnalytics. Its memory is fixed: two HyperLogLog sketches
+// of 16 KiB, the type and RCODE counters, and a heavy-hitter table of
+// client prefixes. Every update is lock-free.
+type analytics struct {
+	seed     maphash.Seed
+	names    hyperLogLog
+	clients  hyperLogLog
+	qtypes   [numQtypeCounters]atomic.Int64
+	rcodes   [numRcodeCounters]atomic.Int64
+	prefixes *heavyHitters
+}
+
+// AnalyticsSnapshot is a point-in-time copy of the query analytics. The
+// counts cover the time since analytics were enabled.
+type AnalyticsSnapshot struct {
+	DistinctNames   int64
+	DistinctClients int64
+
+	// QueryTypes and ResponseCodes are keyed by mnemonic; types and codes
+	// without one use the TYPE<n> or RCODE<n> form
+	QueryTypes    map[string]int64
+	ResponseCodes map[string]int64
+
+	// TopClientPrefixes are the client /24 (IPv4) and /56 (IPv6) prefixes
+	// sending the most queries, highest first
+	TopClientPrefixes []PrefixCount
+}
+
+// PrefixCount holds a client prefix and its estimated query count.
+type PrefixCount struct {
+	Prefix string `json:"prefix"`
+	Count  int64  `json:"count"`
+}
+
+// EnableAnalytics starts recording the per-query details passed to
+// RecordQueryDetails and RecordRcode. It should be called before queries
+// are served; until then those calls do nothing.
+func (c *Collector) EnableAnalytics() {
+	c.analytics.CompareAndSwap(nil, &analytics{
+		seed:     maphash.MakeSeed(),
+		prefixes: newHeavyHitters(),
+	})
+}
+
+// RecordQueryDetails records the normalized name, type and client of a
+// query, if analytics are enabled. client may be the zero Addr when the
+// transport does not provide one. It does not allocate unless the client's
+// prefix starts being tracked.
+func (c *Collector) RecordQueryDetails(name string, qtype uint16, client netip.Addr) {
+	a := c.analytics.Load()
+	if a == nil {
+		return
+	}
+
+	a.names.Add(maphash.String(a.seed, name))
+	a.qtypes[min(int(qtype), numQtypeCounters-1)].Add(1)
+
+	if !client.IsValid() {
+		return
+	}
+	client = client.Unmap()
+	addr := client.As16()
+	a.clients.Add(maphash.Bytes(a.seed, addr[:]))
+
+	bits := clientIPv6Prefix
+	if client.Is4() {
+		bits = clientIPv4Prefix
+	}
+	if prefix, err := client.Prefix(bits); err == nil {
+		var buf [64]byte
+		a.prefixes.AddBytes(prefix.AppendTo(buf[:0]))
+	}
+}
+
+// RecordRcode records the RCODE of an answer, if analytics are enabled.
+func (c *Collector) RecordRcode(rcode int) {
+	if a := c.analytics.Load(); a != nil {
+		a.rcodes[min(max(rcode, 0), numRcodeCounters-1)].Add(1)
+	}
+}
+
+// Analytics returns the query analytics, or false if they are not enabled.
+// Only types and codes that have been seen are included.
+func (c *Collector) Analytics(topPrefixes int) (AnalyticsSnapshot, bool) {
+	a := c.analytics.Load()
+	if a == nil {
+		return AnalyticsSnapshot{}, false
+	}
+
+	snap := AnalyticsSnapshot{
+		DistinctNames:   a.names.Estimate(),
+		DistinctClients: a.clients.Estimate(),
+		QueryTypes:      make(map[string]int64),
+		ResponseCodes:   make(map[string]int64),
+	}
+	for i := range a.qtypes {
+		if n := a.qtypes[i].Load(); n > 0 {
+			snap.QueryTypes[qtypeName(i)] = n
+		}
+	}
+	for i := range a.rcodes {
+		if n := a.rcodes[i].Load(); n > 0 {
+			snap.ResponseCodes[rcodeName(i)] = n
+		}
+	}
+	for _, dc := range a.prefixes.Top(topPrefixes) {
+		snap.TopClientPrefixes = append(snap.TopClientPrefixes, PrefixCount{Prefix: dc.Domain, Count: dc.Count})
+	}
+	return snap, true
+}
+
+// qtypeNames holds the mnemonics of the query types worth telling apart;
+// the stats package does not depend on a DNS library for them.
+var qtypeNames = map[int]string{
+	1: "A", 2: "NS", 5: "CNAME", 6: "SOA", 12: "PTR", 13: "HINFO", 15: "MX",
+	16: "TXT", 28: "AAAA", 33: "SRV", 35: "NAPTR", 43: "DS", 46: "RRSIG",
+	47: "NSEC", 48: "DNSKEY", 50: "NSEC3", 52: "TLSA", 64: "SVCB", 65: "HTTPS",
+	252: "AXFR", 255: "ANY", 257: "CAA",
+}
+
+func qtypeName(i int) string {
+	if i == numQtypeCounters-1 {
+		return "OTHER"
+	}
+	if name, ok := qtypeNames[i]; ok {
+		return name
+	}
+	return "TYPE" + strconv.Itoa(i)
+}
+
+var rcodeNames = [...]string{
+	"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+	"YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH", "NOTZONE",
+}
+
+func rcodeName(i int) string {
+	if i == numRcodeCounters-1 {
+		return "EXTENDED"
+	}
+	if i < len(rcodeNames) {
+		return rcodeNames[i]
+	}
+	return "RCODE" + strconv.Itoa(i)
+}
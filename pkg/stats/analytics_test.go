@@ -0,0 +1,99 @@
+package stats
+
+import (
+	"net/netip"
+	"strconv"
+	"testing"
+)
+
+func TestCollector_AnalyticsDisabled(t *testing.T) {
+	c := NewCollector()
+	c.RecordQueryDetails("example.com", 1, netip.MustParseAddr("192.0.2.1"))
+	c.RecordRcode(0)
+	if _, ok := c.Analytics(10); ok {
+		t.Error("expected no analytics unless enabled")
+	}
+}
+
+func TestCollector_Analytics(t *testing.T) {
+	c := NewCollector()
+	c.EnableAnalytics()
+
+	for i := 0; i < 100; i++ {
+		client := netip.AddrFrom4([4]byte{192, 0, 2, byte(i)})
+		c.RecordQueryDetails("host"+strconv.Itoa(i%10)+".example.com", 1, client)
+		c.RecordRcode(0)
+	}
+	c.RecordQueryDetails("example.com", 28, netip.MustParseAddr("2001:db8::1"))
+	c.RecordQueryDetails("example.com", 28, netip.MustParseAddr("2001:db8::2"))
+	c.RecordQueryDetails("example.com", 65280, netip.Addr{})
+	c.RecordRcode(3)
+	c.RecordRcode(2)
+	c.RecordRcode(23)
+
+	a, ok := c.Analytics(10)
+	if !ok {
+		t.Fatal("expected analytics once enabled")
+	}
+	// The sketches are estimates, close at these small counts
+	if a.DistinctNames < 10 || a.DistinctNames > 12 {
+		t.Errorf("DistinctNames = %d, want about 11", a.DistinctNames)
+	}
+	if a.DistinctClients < 97 || a.DistinctClients > 107 {
+		t.Errorf("DistinctClients = %d, want about 102", a.DistinctClients)
+	}
+	for name, want := range map[string]int64{"A": 100, "AAAA": 2, "OTHER": 1} {
+		if got := a.QueryTypes[name]; got != want {
+			t.Errorf("QueryTypes[%s] = %d, want %d", name, got, want)
+		}
+	}
+	for name, want := range map[string]int64{"NOERROR": 100, "NXDOMAIN": 1, "SERVFAIL": 1, "EXTENDED": 1} {
+		if got := a.ResponseCodes[name]; got != want {
+			t.Errorf("ResponseCodes[%s] = %d, want %d", name, got, want)
+		}
+	}
+
+	want := []PrefixCount{{"192.0.2.0/24", 100}, {"2001:db8::/56", 2}}
+	if len(a.TopClientPrefixes) != len(want) {
+		t.Fatalf("TopClientPrefixes = %v, want %v", a.TopClientPrefixes, want)
+	}
+	for i := range want {
+		if a.TopClientPrefixes[i] != want[i] {
+			t.Errorf("TopClientPrefixes[%d] = %v, want %v", i, a.TopClientPrefixes[i], want[i])
+		}
+	}
+}
+
+func TestCollector_AnalyticsMappedIPv4(t *testing.T) {
+	c := NewCollector()
+	c.EnableAnalytics()
+	c.RecordQueryDetails("example.com", 1, netip.MustParseAddr("::ffff:198.51.100.7"))
+
+	a, _ := c.Analytics(1)
+	if len(a.TopClientPrefixes) != 1 || a.TopClientPrefixes[0].Prefix != "198.51.100.0/24" {
+		t.Errorf("TopClientPrefixes = %v, want 198.51.100.0/24", a.TopClientPrefixes)
+	}
+}
+
+func TestQtypeName(t *testing.T) {
+	for i, want := range map[int]string{1: "A", 65: "HTTPS", 99: "TYPE99", numQtypeCounters - 1: "OTHER"} {
+		if got := qtypeName(i); got != want {
+			t.Errorf("qtypeName(%d) = %q, want %q", i, got, want)
+		}
+	}
+}
+
+func TestCollector_RecordQueryDetailsAllocs(t *testing.T) {
+	c := NewCollector()
+	c.EnableAnalytics()
+	client := netip.MustParseAddr("192.0.2.1")
+	c.RecordQueryDetails("example.com", 1, client)
+
+	allocs := testing.AllocsPerRun(1000, func() {
+		c.RecordQueryDetails("example.com", 1, client)
+		c.RecordRcode(0)
+	})
+	if allocs != 0 {
+		t.Errorf("RecordQueryDetails allocated %.1f times per call, want 0", allocs)
+	}
+}
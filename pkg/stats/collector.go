@@ -3,12 +3,14 @@ package stats
 
 import (
 	"bytes"
+	"compress/gzip"
 	"context"
 	"encoding/json"
+	"errors"
 	"fmt"
+	"io"
 	"log/slog"
 	"net/http"
-	"sort"
 	"sync"
 	"sync/atomic"
 	"time"
@@ -19,7 +21,10 @@ type Collector struct {
 	totalQueries     atomic.Int64
 	queriesBlocked   atomic.Int64
 	queriesForwarded atomic.Int64
+	queriesLocal     atomic.Int64
 	bypassesIssued   atomic.Int64
+	cacheHits        atomic.Int64
+	cacheMisses      atomic.Int64
 
 	// For delta calculation
 	lastReportQueries   atomic.Int64
@@ -28,16 +33,65 @@ type Collector struct {
 	lastReportBypasses  atomic.Int64
 
 	// Top blocked domains tracking
-	mu             sync.Mutex
-	blockedDomains map[string]int64
+	blockedDomains *heavyHitters
+
+	// Query analytics, nil unless enabled
+	analytics atomic.Pointer[analytics]
+
+	// Latency histograms, exported by the metrics handler
+	queryDuration   [numQueryPaths]Histogram
+	refreshDuration Histogram
+	refreshFailures atomic.Int64
+
+	// Histograms and gauges registered at startup
+	mu        sync.Mutex
+	upstreams []namedHistogram
+	gauges    []gauge
 
 	startTime time.Time
 }
 
+// QueryPath is the way a query was answered, for its latency histogram.
+type QueryPath int
+
+const (
+	PathBlock    QueryPath = iota // answered from the blocklist
+	PathForward                   // forwarded to an upstream server
+	PathCacheHit                  // answered from the response cache
+	PathLocal                     // answered from a local zone
+	numQueryPaths
+)
+
+func (p QueryPath) String() string {
+	switch p {
+	case PathBlock:
+		return "block"
+	case PathForward:
+		return "forward"
+	case PathCacheHit:
+		return "cache_hit"
+	case PathLocal:
+		return "local"
+	}
+	return "unknown"
+}
+
+type namedHistogram struct {
+	name string
+	h    *Histogram
+}
+
+// gauge is a value read on every scrape. kind is its type in the
+// exposition format, "gauge" or "counter".
+type gauge struct {
+	name, help, kind string
+	fn               func() float64
+}
+
 // NewCollector creates a new stats collector.
 func NewCollector() *Collector {
 	return &Collector{
-		blockedDomains: make(map[string]int64),
+		blockedDomains: newHeavyHitters(),
 		startTime:      time.Now(),
 	}
 }
@@ -52,10 +106,13 @@ func (c *Collector) RecordQuery() {
 func (c *Collector) RecordBlock(domain string) {
 	c.totalQueries.Add(1)
 	c.queriesBlocked.Add(1)
+	c.blockedDomains.Add(domain)
+}
 
-	c.mu.Lock()
-	c.blockedDomains[domain]++
-	c.mu.Unlock()
+// RecordLocal records a DNS query answered from a local zone.
+func (c *Collector) RecordLocal() {
+	c.totalQueries.Add(1)
+	c.queriesLocal.Add(1)
 }
 
 // RecordBypass records a bypass being issued.
@@ -63,30 +120,81 @@ func (c *Collector) RecordBypass() {
 	c.bypassesIssued.Add(1)
 }
 
-// DomainCount holds a domain and its block count.
-type DomainCount struct {
-	Domain string `json:"domain"`
-	Count  int64  `json:"count"`
+// RecordCacheHit records a forwarded query answered from the response cache.
+func (c *Collector) RecordCacheHit() {
+	c.cacheHits.Add(1)
 }
 
-// TopBlockedDomains returns the top N blocked domains.
-func (c *Collector) TopBlockedDomains(n int) []DomainCount {
-	c.mu.Lock()
-	defer c.mu.Unlock()
+// RecordCacheMiss records a forwarded query that was not in the response cache.
+func (c *Collector) RecordCacheMiss() {
+	c.cacheMisses.Add(1)
+}
 
-	domains := make([]DomainCount, 0, len(c.blockedDomains))
-	for domain, count := range c.blockedDomains {
-		domains = append(domains, DomainCount{Domain: domain, Count: count})
+// ObserveQuery records how long a query took to answer on path.
+func (c *Collector) ObserveQuery(path QueryPath, d time.Duration) {
+	if path >= 0 && path < numQueryPaths {
+		c.queryDuration[path].Observe(d)
 	}
+}
 
-	sort.Slice(domains, func(i, j int) bool {
-		return domains[i].Count > domains[j].Count
-	})
+// RecordRefresh records a blocklist refresh that took d and failed with
+// err, if not nil.
+func (c *Collector) RecordRefresh(d time.Duration, err error) {
+	c.refreshDuration.Observe(d)
+	if err != nil {
+		c.refreshFailures.Add(1)
+	}
+}
 
-	if len(domains) > n {
-		domains = domains[:n]
+// UpstreamRTT returns the round-trip time histogram of the upstream server
+// name, creating it on first use. Callers should look histograms up once
+// and keep them rather than call this per query.
+func (c *Collector) UpstreamRTT(name string) *Histogram {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	for _, u := range c.upstreams {
+		if u.name == name {
+			return u.h
+		}
 	}
-	return domains
+	h := &Histogram{}
+	c.upstreams = append(c.upstreams, namedHistogram{name: name, h: h})
+	return h
+}
+
+// RegisterGauge adds a gauge to the exported metrics. fn is called on every
+// scrape and must be safe for concurrent use. name should carry the
+// "opl_dns_" prefix.
+func (c *Collector) RegisterGauge(name, help string, fn func() float64) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	c.gauges = append(c.gauges, gauge{name: name, help: help, kind: "gauge", fn: fn})
+}
+
+// RegisterCounter is RegisterGauge for a value that only increases, such
+// as a count kept elsewhere. name should end in "_total".
+func (c *Collector) RegisterCounter(name, help string, fn func() float64) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+	c.gauges = append(c.gauges, gauge{name: name, help: help, kind: "counter", fn: fn})
+}
+
+// CacheSnapshot returns the response cache hit and miss counters.
+func (c *Collector) CacheSnapshot() (hits, misses int64) {
+	return c.cacheHits.Load(), c.cacheMisses.Load()
+}
+
+// DomainCount holds a domain and its block count.
+type DomainCount struct {
+	Domain string `json:"domain"`
+	Count  int64  `json:"count"`
+}
+
+// TopBlockedDomains returns the top N blocked domains. Counts are exact
+// while fewer than about a thousand distinct domains have been blocked and
+// estimates beyond that; see heavyHitters.
+func (c *Collector) TopBlockedDomains(n int) []DomainCount {
+	return c.blockedDomains.Top(n)
 }
 
 // Snapshot returns a point-in-time snapshot of all counters.
@@ -133,6 +241,15 @@ type StatsReport struct {
 	BlocklistEmployers   int           `json:"blocklistEmployers"`
 	LastBlocklistRefresh string        `json:"lastBlocklistRefresh,omitempty"`
 	TopBlockedDomains    []DomainCount `json:"topBlockedDomains"`
+	CacheHits            int64         `json:"cacheHits"`
+	CacheMisses          int64         `json:"cacheMisses"`
+
+	// Query analytics, present when enabled. Client prefixes stay on the
+	// local metrics endpoint and are not reported.
+	QueryTypes      map[string]int64 `json:"queryTypes,omitempty"`
+	ResponseCodes   map[string]int64 `json:"responseCodes,omitempty"`
+	DistinctNames   int64            `json:"distinctNames,omitempty"`
+	DistinctClients int64            `json:"distinctClients,omitempty"`
 
 	// Deltas since last report
 	QueriesSinceLastReport   int64 `json:"queriesSinceLastReport"`
@@ -141,7 +258,28 @@ type StatsReport struct {
 	BypassesSinceLastReport  int64 `json:"bypassesSinceLastReport"`
 }
 
-// Reporter periodically sends stats reports to the OPL backend.
+const (
+	// defaultReportTimeout bounds each report request when
+	// ReporterConfig.Timeout is not set.
+	defaultReportTimeout = 10 * time.Second
+
+	// minReportBackoff is the delay before resending after a failure. It
+	// doubles with each further failure, up to the report interval.
+	minReportBackoff = 5 * time.Second
+
+	// reportFlushTimeout bounds the final send on shutdown.
+	reportFlushTimeout = 5 * time.Second
+)
+
+// errReportRejected marks a report the backend refused for good; resending
+// it would not help.
+var errReportRejected = errors.New("stats report rejected")
+
+// Reporter periodically sends stats reports to the OPL backend. Each
+// interval's report is spooled and the spool is sent oldest first, so
+// reports that could not be sent are retried, with backoff, rather than
+// lost. Building a report reads only atomic counters and the lock-free
+// top-domains table, so reporting never holds up the query path.
 type Reporter struct {
 	collector  *Collector
 	instanceID string
@@ -152,6 +290,11 @@ type Reporter struct {
 	httpClient *http.Client
 	logger     *slog.Logger
 
+	// compress gzips report bodies; cleared if the backend answers 415
+	compress bool
+
+	spool *reportSpool
+
 	// Callbacks to get dynamic data
 	getActiveSessions func() int
 	getBlocklistSize  func() (domains int, employers int)
@@ -168,6 +311,13 @@ type ReporterConfig struct {
 	Interval   time.Duration
 	Logger     *slog.Logger
 
+	// Timeout bounds each report request (10s if zero)
+	Timeout time.Duration
+
+	// Compress sends report bodies gzip-encoded. If the backend answers
+	// 415 Unsupported Media Type, reports are sent uncompressed instead.
+	Compress bool
+
 	// Callbacks
 	GetActiveSessions func() int
 	GetBlocklistSize  func() (domains int, employers int)
@@ -176,6 +326,10 @@ type ReporterConfig struct {
 
 // NewReporter creates a stats reporter.
 func NewReporter(cfg ReporterConfig) *Reporter {
+	timeout := cfg.Timeout
+	if timeout <= 0 {
+		timeout = defaultReportTimeout
+	}
 	return &Reporter{
 		collector:         cfg.Collector,
 		instanceID:        cfg.InstanceID,
@@ -184,14 +338,18 @@ func NewReporter(cfg ReporterConfig) *Reporter {
 		apiKey:            cfg.APIKey,
 		interval:          cfg.Interval,
 		logger:            cfg.Logger,
-		httpClient:        &http.Client{Timeout: 10 * time.Second},
+		httpClient:        &http.Client{Timeout: timeout},
+		compress:          cfg.Compress,
+		spool:             newReportSpool(maxSpooledReports),
 		getActiveSessions: cfg.GetActiveSessions,
 		getBlocklistSize:  cfg.GetBlocklistSize,
 		getLastRefresh:    cfg.GetLastRefresh,
 	}
 }
 
-// Start begins periodic reporting. It blocks until the context is cancelled.
+// Start begins periodic reporting. It blocks until the context is
+// cancelled, then spools a final report and spends at most
+// reportFlushTimeout sending what is left.
 func (r *Reporter) Start(ctx context.Context) {
 	ticker := time.NewTicker(r.interval)
 	defer ticker.Stop()
@@ -202,21 +360,88 @@ func (r *Reporter) Start(ctx context.Context) {
 		"reportUrl", r.reportURL,
 	)
 
+	var retry <-chan time.Time
+	failures := 0
 	for {
 		select {
 		case <-ctx.Done():
-			// Send final report before exiting
-			r.sendReport(context.Background())
+			flushCtx, cancel := context.WithTimeout(context.Background(), reportFlushTimeout)
+			r.sendReport(flushCtx)
+			cancel()
+			if n := r.spool.len(); n > 0 {
+				r.logger.Warn("Stats reports not sent before shutdown", "reports", n)
+			}
 			return
 		case <-ticker.C:
-			r.sendReport(ctx)
+			r.spool.push(r.buildReport())
+		case <-retry:
+		}
+
+		if err := r.sendSpool(ctx); err != nil {
+			failures++
+			delay := reportBackoff(failures, r.interval)
+			retry = time.After(delay)
+			r.logger.Warn("Failed to send stats report",
+				"error", err,
+				"spooled", r.spool.len(),
+				"retryIn", delay,
+			)
+		} else {
+			failures = 0
+			retry = nil
 		}
 	}
 }
 
+// reportBackoff returns the delay before resending after the given number
+// of consecutive failures.
+func reportBackoff(failures int, interval time.Duration) time.Duration {
+	d := minReportBackoff
+	for i := 1; i < failures && d < interval; i++ {
+		d *= 2
+	}
+	return min(d, interval)
+}
+
+// sendReport spools a report of the current counters and sends the spool.
 func (r *Reporter) sendReport(ctx context.Context) {
+	r.spool.push(r.buildReport())
+	if err := r.sendSpool(ctx); err != nil {
+		r.logger.Warn("Failed to send stats report", "error", err, "spooled", r.spool.len())
+	}
+}
+
+// sendSpool sends the spooled reports, oldest first, until the spool is
+// empty or a send fails. Reports the backend rejects outright are dropped.
+func (r *Reporter) sendSpool(ctx context.Context) error {
+	for {
+		report, ok := r.spool.front()
+		if !ok {
+			return nil
+		}
+		err := r.post(ctx, report)
+		if errors.Is(err, errReportRejected) {
+			r.logger.Warn("Dropping stats report", "error", err, "instanceId", r.instanceID)
+			err = nil
+		}
+		if err != nil {
+			return err
+		}
+		r.spool.pop()
+		r.logger.Debug("Stats report sent",
+			"totalQueries", report.TotalQueries,
+			"blocked", report.QueriesBlocked,
+			"deltaQueries", report.QueriesSinceLastReport,
+		)
+	}
+}
+
+// buildReport snapshots the counters into a report and starts the next
+// delta period.
+func (r *Reporter) buildReport() StatsReport {
 	total, blocked, forwarded, bypasses := r.collector.Snapshot()
 	dQueries, dBlocked, dForwarded, dBypasses := r.collector.computeDeltas()
+	cacheHits, cacheMisses := r.collector.CacheSnapshot()
 
 	activeSessions := 0
 	if r.getActiveSessions != nil {
@@ -249,46 +474,67 @@ func (r *Reporter) sendReport(ctx context.Context) {
 		BlocklistEmployers:       blocklistEmployers,
 		LastBlocklistRefresh:     lastRefreshStr,
 		TopBlockedDomains:        r.collector.TopBlockedDomains(10),
+		CacheHits:                cacheHits,
+		CacheMisses:              cacheMisses,
 		QueriesSinceLastReport:   dQueries,
 		BlockedSinceLastReport:   dBlocked,
 		ForwardedSinceLastReport: dForwarded,
 		BypassesSinceLastReport:  dBypasses,
 	}
+	if a, ok := r.collector.Analytics(0); ok {
+		report.QueryTypes = a.QueryTypes
+		report.ResponseCodes = a.ResponseCodes
+		report.DistinctNames = a.DistinctNames
+		report.DistinctClients = a.DistinctClients
+	}
+	return report
+}
 
+// post sends one report. Server errors and rate limiting are worth
+// retrying; other 4xx answers wrap errReportRejected.
+func (r *Reporter) post(ctx context.Context, report StatsReport) error {
 	body, err := json.Marshal(report)
 	if err != nil {
-		r.logger.Error("Failed to marshal stats report", "error", err)
-		return
+		return fmt.Errorf("%w: marshaling: %v", errReportRejected, err)
+	}
+
+	compressed := r.compress
+	if compressed {
+		var buf bytes.Buffer
+		zw := gzip.NewWriter(&buf)
+		zw.Write(body)
+		zw.Close()
+		body = buf.Bytes()
 	}
 
 	req, err := http.NewRequestWithContext(ctx, http.MethodPost, r.reportURL, bytes.NewReader(body))
 	if err != nil {
-		r.logger.Error("Failed to create stats report request", "error", err)
-		return
+		return fmt.Errorf("%w: creating request: %v", errReportRejected, err)
 	}
 
 	req.Header.Set("Content-Type", "application/json")
+	if compressed {
+		req.Header.Set("Content-Encoding", "gzip")
+	}
 	req.Header.Set("X-API-Key", r.apiKey)
 	req.Header.Set("User-Agent", fmt.Sprintf("OPL-DNS-Server/%s", r.version))
 
 	resp, err := r.httpClient.Do(req)
 	if err != nil {
-		r.logger.Warn("Failed to send stats report", "error", err)
-		return
+		return fmt.Errorf("sending: %w", err)
 	}
-	defer resp.Body.Close()
-
-	if resp.StatusCode >= 400 {
-		r.logger.Warn("Stats report rejected by server",
-			"status", resp.StatusCode,
-			"instanceId", r.instanceID,
-		)
-		return
+	io.Copy(io.Discard, io.LimitReader(resp.Body, 4096))
+	resp.Body.Close()
+
+	switch {
+	case resp.StatusCode == http.StatusUnsupportedMediaType && compressed:
+		r.logger.Info("Backend does not accept compressed stats reports, sending them uncompressed")
+		r.compress = false
+		return r.post(ctx, report)
+	case resp.StatusCode == http.StatusTooManyRequests || resp.StatusCode >= 500:
+		return fmt.Errorf("backend returned status %d", resp.StatusCode)
+	case resp.StatusCode >= 400:
+		return fmt.Errorf("%w: backend returned status %d", errReportRejected, resp.StatusCode)
 	}
-
-	r.logger.Debug("Stats report sent",
-		"totalQueries", total,
-		"blocked", blocked,
-		"deltaQueries", dQueries,
-	)
+	return nil
 }
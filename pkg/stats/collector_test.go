@@ -1,11 +1,15 @@
 package stats
 
 import (
+	"compress/gzip"
 	"context"
 	"encoding/json"
+	"fmt"
+	"io"
 	"log/slog"
 	"net/http"
 	"net/http/httptest"
+	"sync/atomic"
 	"testing"
 	"time"
 )
@@ -57,6 +61,22 @@ func TestCollector_RecordBypass(t *testing.T) {
 	}
 }
 
+func TestCollector_CacheCounters(t *testing.T) {
+	c := NewCollector()
+
+	c.RecordCacheHit()
+	c.RecordCacheHit()
+	c.RecordCacheMiss()
+
+	hits, misses := c.CacheSnapshot()
+	if hits != 2 {
+		t.Errorf("expected 2 cache hits, got %d", hits)
+	}
+	if misses != 1 {
+		t.Errorf("expected 1 cache miss, got %d", misses)
+	}
+}
+
 func TestCollector_TopBlockedDomains(t *testing.T) {
 	c := NewCollector()
 
@@ -192,3 +212,154 @@ func TestReporter_SendReport(t *testing.T) {
 		t.Errorf("expected blocklist size 42, got %d", receivedReport.BlocklistSize)
 	}
 }
+
+func TestReporter_RetriesSpooledReports(t *testing.T) {
+	var fail atomic.Bool
+	fail.Store(true)
+	var received []StatsReport
+	server := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		if fail.Load() {
+			w.WriteHeader(http.StatusServiceUnavailable)
+			return
+		}
+		var report StatsReport
+		if err := json.NewDecoder(r.Body).Decode(&report); err != nil {
+			t.Errorf("failed to decode report: %v", err)
+		}
+		received = append(received, report)
+	}))
+	defer server.Close()
+
+	c := NewCollector()
+	reporter := NewReporter(ReporterConfig{
+		Collector: c,
+		ReportURL: server.URL,
+		Interval:  time.Second,
+		Logger:    slog.New(slog.NewTextHandler(io.Discard, nil)),
+	})
+
+	c.RecordQuery()
+	c.RecordQuery()
+	reporter.sendReport(context.Background())
+	if reporter.spool.len() != 1 {
+		t.Fatalf("expected failed report to stay spooled, got %d", reporter.spool.len())
+	}
+
+	fail.Store(false)
+	c.RecordQuery()
+	reporter.sendReport(context.Background())
+
+	if len(received) != 2 {
+		t.Fatalf("expected 2 reports, got %d", len(received))
+	}
+	if received[0].QueriesSinceLastReport != 2 || received[1].QueriesSinceLastReport != 1 {
+		t.Errorf("expected deltas 2 then 1, got %d then %d", received[0].QueriesSinceLastReport, received[1].QueriesSinceLastReport)
+	}
+	if reporter.spool.len() != 0 {
+		t.Errorf("expected empty spool, got %d", reporter.spool.len())
+	}
+}
+
+func TestReporter_DropsRejectedReports(t *testing.T) {
+	server := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		w.WriteHeader(http.StatusBadRequest)
+	}))
+	defer server.Close()
+
+	reporter := NewReporter(ReporterConfig{
+		Collector: NewCollector(),
+		ReportURL: server.URL,
+		Interval:  time.Second,
+		Logger:    slog.New(slog.NewTextHandler(io.Discard, nil)),
+	})
+	reporter.sendReport(context.Background())
+
+	if reporter.spool.len() != 0 {
+		t.Errorf("expected rejected report to be dropped, got %d spooled", reporter.spool.len())
+	}
+}
+
+func TestReporter_Compress(t *testing.T) {
+	var encodings []string
+	server := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		encodings = append(encodings, r.Header.Get("Content-Encoding"))
+		body := io.Reader(r.Body)
+		if r.Header.Get("Content-Encoding") == "gzip" {
+			zr, err := gzip.NewReader(r.Body)
+			if err != nil {
+				t.Errorf("failed to read gzip body: %v", err)
+				return
+			}
+			body = zr
+		}
+		var report StatsReport
+		if err := json.NewDecoder(body).Decode(&report); err != nil {
+			t.Errorf("failed to decode report: %v", err)
+		}
+		if report.InstanceID != "test-instance" {
+			t.Errorf("expected instanceId 'test-instance', got %s", report.InstanceID)
+		}
+	}))
+	defer server.Close()
+
+	reporter := NewReporter(ReporterConfig{
+		Collector:  NewCollector(),
+		InstanceID: "test-instance",
+		ReportURL:  server.URL,
+		Interval:   time.Second,
+		Logger:     slog.New(slog.NewTextHandler(io.Discard, nil)),
+		Compress:   true,
+	})
+	reporter.sendReport(context.Background())
+
+	if len(encodings) != 1 || encodings[0] != "gzip" {
+		t.Errorf("expected one gzip request, got %q", encodings)
+	}
+}
+
+func TestReporter_CompressFallback(t *testing.T) {
+	var encodings []string
+	server := httptest.NewServer(http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+		encodings = append(encodings, r.Header.Get("Content-Encoding"))
+		if r.Header.Get("Content-Encoding") != "" {
+			w.WriteHeader(http.StatusUnsupportedMediaType)
+		}
+	}))
+	defer server.Close()
+
+	reporter := NewReporter(ReporterConfig{
+		Collector: NewCollector(),
+		ReportURL: server.URL,
+		Interval:  time.Second,
+		Logger:    slog.New(slog.NewTextHandler(io.Discard, nil)),
+		Compress:  true,
+	})
+	reporter.sendReport(context.Background())
+	reporter.sendReport(context.Background())
+
+	want := []string{"gzip", "", ""}
+	if fmt.Sprint(encodings) != fmt.Sprint(want) {
+		t.Errorf("expected encodings %q, got %q", want, encodings)
+	}
+	if reporter.spool.len() != 0 {
+		t.Errorf("expected both reports sent, got %d spooled", reporter.spool.len())
+	}
+}
+
+func TestReportBackoff(t *testing.T) {
+	interval := time.Minute
+	tests := []struct {
+		failures int
+		want     time.Duration
+	}{
+		{1, minReportBackoff},
+		{2, 2 * minReportBackoff},
+		{3, 4 * minReportBackoff},
+		{10, interval},
+	}
+	for _, tt := range tests {
+		if got := reportBackoff(tt.failures, interval); got != tt.want {
+			t.Errorf("reportBackoff(%d) = %v, want %v", tt.failures, got, tt.want)
+		}
+	}
+}
@@ -0,0 +1,88 @@
+package stats
+
+import (
+	"sync/atomic"
+	"time"
+)
+
+// histogramBounds are the upper bounds of the latency histogram buckets.
+// They span a single in-memory lookup to a slow upstream or a blocklist
+// download.
+var histogramBounds = [...]time.Duration{
+	10 * time.Microsecond,
+	25 * time.Microsecond,
+	50 * time.Microsecond,
+	100 * time.Microsecond,
+	250 * time.Microsecond,
+	500 * time.Microsecond,
+	time.Millisecond,
+	2500 * time.Microsecond,
+	5 * time.Millisecond,
+	10 * time.Millisecond,
+	25 * time.Millisecond,
+	50 * time.Millisecond,
+	100 * time.Millisecond,
+	250 * time.Millisecond,
+	500 * time.Millisecond,
+	time.Second,
+	2500 * time.Millisecond,
+	5 * time.Second,
+	10 * time.Second,
+	30 * time.Second,
+}
+
+// Histogram is a latency histogram with fixed buckets. Observe is
+// lock-free and allocation-free, so it can sit on the query path.
+type Histogram struct {
+	// counts holds one counter per bucket plus a final +Inf bucket. Counts
+	// are per bucket, not cumulative.
+	counts [len(histogramBounds) + 1]atomic.Uint64
+	sum    atomic.Int64 // nanoseconds
+}
+
+// Observe records one duration.
+func (h *Histogram) Observe(d time.Duration) {
+	// Binary search over the bounds for the first one >= d
+	lo, hi := 0, len(histogramBounds)
+	for lo < hi {
+		mid := (lo + hi) / 2
+		if histogramBounds[mid] < d {
+			lo = mid + 1
+		} else {
+			hi = mid
+		}
+	}
+	h.counts[lo].Add(1)
+	h.sum.Add(int64(d))
+}
+
+// HistogramSnapshot is a point-in-time copy of a Histogram.
+type HistogramSnapshot struct {
+	// Counts are cumulative: Counts[i] is the number of observations of at
+	// most Bounds[i], and the last element is the total count.
+	Bounds []time.Duration
+	Counts []uint64
+	Sum    time.Duration
+}
+
+// Snapshot returns the histogram's current counts. Buckets are read one by
+// one while observations continue, so the snapshot may be off by the
+// observations made during the call.
+func (h *Histogram) Snapshot() HistogramSnapshot {
+	s := HistogramSnapshot{
+		Bounds: histogramBounds[:],
+		Counts: make([]uint64, len(h.counts)),
+		Sum:    time.Duration(h.sum.Load()),
+	}
+	var total uint64
+	for i := range h.counts {
+		total += h.counts[i].Load()
+		s.Counts[i] = total
+	}
+	return s
+}
+
+// Count returns the total number of observations.
+func (s HistogramSnapshot) Count() uint64 {
+	return s.Counts[len(s.Counts)-1]
+}
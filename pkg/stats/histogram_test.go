@@ -0,0 +1,65 @@
+package stats
+
+import (
+	"sync"
+	"testing"
+	"time"
+)
+
+func TestHistogram_Observe(t *testing.T) {
+	var h Histogram
+
+	h.Observe(5 * time.Microsecond)  // first bucket
+	h.Observe(10 * time.Microsecond) // bounds are inclusive
+	h.Observe(3 * time.Millisecond)  // 5ms bucket
+	h.Observe(time.Minute)           // +Inf
+
+	s := h.Snapshot()
+	if s.Count() != 4 {
+		t.Errorf("expected 4 observations, got %d", s.Count())
+	}
+	if s.Counts[0] != 2 {
+		t.Errorf("expected 2 observations of at most 10µs, got %d", s.Counts[0])
+	}
+	for i, bound := range s.Bounds {
+		if bound == 5*time.Millisecond && s.Counts[i] != 3 {
+			t.Errorf("expected 3 observations of at most 5ms, got %d", s.Counts[i])
+		}
+	}
+	if s.Counts[len(s.Bounds)-1] != 3 {
+		t.Errorf("expected 3 observations within the last bound, got %d", s.Counts[len(s.Bounds)-1])
+	}
+	want := 15*time.Microsecond + 3*time.Millisecond + time.Minute
+	if s.Sum != want {
+		t.Errorf("expected sum %v, got %v", want, s.Sum)
+	}
+}
+
+func TestHistogram_Concurrent(t *testing.T) {
+	var h Histogram
+	var wg sync.WaitGroup
+	for i := 0; i < 8; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for j := 0; j < 1000; j++ {
+				h.Observe(time.Duration(j) * time.Microsecond)
+			}
+		}()
+	}
+	wg.Wait()
+
+	if got := h.Snapshot().Count(); got != 8000 {
+		t.Errorf("expected 8000 observations, got %d", got)
+	}
+}
+
+func TestHistogram_ObserveDoesNotAllocate(t *testing.T) {
+	var h Histogram
+	allocs := testing.AllocsPerRun(100, func() {
+		h.Observe(time.Millisecond)
+	})
+	if allocs != 0 {
+		t.Errorf("expected no allocations, got %v", allocs)
+	}
+}
@@ -0,0 +1,55 @@
+package stats
+
+import (
+	"math"
+	"math/bits"
+	"sync/atomic"
+)
+
+// hllPrecision is the number of hash bits that select a register. 2^12
+// registers estimate cardinality with a standard error of about 1.6%.
+const hllPrecision = 12
+
+const hllRegisters = 1 << hllPrecision
+
+// hyperLogLog estimates the number of distinct values it has been given,
+// in fixed memory. Values are passed as 64-bit hashes. Add is lock-free.
+type hyperLogLog struct {
+	registers [hllRegisters]atomic.Uint32
+}
+
+// Add records a value by its hash.
+func (h *hyperLogLog) Add(hash uint64) {
+	reg := &h.registers[hash>>(64-hllPrecision)]
+	// The rank is the position of the first set bit in the remaining
+	// bits; the sentinel bit caps it when they are all zero
+	rank := uint32(bits.LeadingZeros64(hash<<hllPrecision|1<<(hllPrecision-1))) + 1
+	for {
+		cur := reg.Load()
+		if rank <= cur || reg.CompareAndSwap(cur, rank) {
+			return
+		}
+	}
+}
+
+// Estimate returns the estimated number of distinct values added.
+func (h *hyperLogLog) Estimate() int64 {
+	const m = float64(hllRegisters)
+	sum := 0.0
+	zeros := 0
+	for i := range h.registers {
+		r := h.registers[i].Load()
+		sum += math.Ldexp(1, -int(r))
+		if r == 0 {
+			zeros++
+		}
+	}
+
+	alpha := 0.7213 / (1 + 1.079/m)
+	estimate := alpha * m * m / sum
+	// Small cardinalities are more accurate by linear counting
+	if estimate <= 2.5*m && zeros > 0 {
+		estimate = m * math.Log(m/float64(zeros))
+	}
+	return int64(estimate + 0.5)
+}
@@ -0,0 +1,36 @@
+package stats
+
+import (
+	"math"
+	"testing"
+)
+
+// splitmix64 is a fixed stand-in for the seeded hash, so the estimates
+// checked here are the same on every run.
+func splitmix64(x uint64) uint64 {
+	x += 0x9e3779b97f4a7c15
+	x = (x ^ x>>30) * 0xbf58476d1ce4e5b9
+	x = (x ^ x>>27) * 0x94d049bb133111eb
+	return x ^ x>>31
+}
+
+func TestHyperLogLog_Empty(t *testing.T) {
+	var h hyperLogLog
+	if n := h.Estimate(); n != 0 {
+		t.Errorf("Estimate() = %d, want 0", n)
+	}
+}
+
+func TestHyperLogLog_Estimate(t *testing.T) {
+	for _, n := range []int{10, 1000, 10000, 100000} {
+		var h hyperLogLog
+		for i := 0; i < n; i++ {
+			// Duplicates must not count
+			h.Add(splitmix64(uint64(i)))
+			h.Add(splitmix64(uint64(i)))
+		}
+		if got := h.Estimate(); math.Abs(float64(got-int64(n))) > 0.05*float64(n)+1 {
+			t.Errorf("Estimate() after %d distinct values = %d, want within 5%%", n, got)
+		}
+	}
+}
@@ -0,0 +1,192 @@
+package stats
+
+import (
+	"bufio"
+	"fmt"
+	"net/http"
+	"net/http/pprof"
+	"runtime"
+	"sort"
+	"strconv"
+	"strings"
+	"time"
+)
+
+// MetricsConfig holds configuration for the metrics handler.
+type MetricsConfig struct {
+	Collector *Collector
+
+	// Pprof also serves the net/http/pprof profiles under /debug/pprof/.
+	Pprof bool
+
+	// Callbacks
+	GetBlocklistSize func() (domains int, employers int)
+	GetLastRefresh   func() time.Time
+}
+
+// NewMetricsHandler returns a handler serving the collector's counters and
+// histograms at /metrics in the Prometheus text exposition format.
+func NewMetricsHandler(cfg MetricsConfig) http.Handler {
+	mux := http.NewServeMux()
+	mux.HandleFunc("/metrics", func(w http.ResponseWriter, r *http.Request) {
+		w.Header().Set("Content-Type", "text/plain; version=0.0.4; charset=utf-8")
+		bw := bufio.NewWriter(w)
+		writeMetrics(bw, cfg)
+		bw.Flush()
+	})
+
+	if cfg.Pprof {
+		mux.HandleFunc("/debug/pprof/", pprof.Index)
+		mux.HandleFunc("/debug/pprof/cmdline", pprof.Cmdline)
+		mux.HandleFunc("/debug/pprof/profile", pprof.Profile)
+		mux.HandleFunc("/debug/pprof/symbol", pprof.Symbol)
+		mux.HandleFunc("/debug/pprof/trace", pprof.Trace)
+	}
+	return mux
+}
+
+func writeMetrics(w *bufio.Writer, cfg MetricsConfig) {
+	c := cfg.Collector
+	_, blocked, forwarded, bypasses := c.Snapshot()
+	hits, misses := c.CacheSnapshot()
+
+	writeHeader(w, "opl_dns_queries_total", "counter", "DNS queries answered, by result.")
+	fmt.Fprintf(w, "opl_dns_queries_total{result=\"blocked\"} %d\n", blocked)
+	fmt.Fprintf(w, "opl_dns_queries_total{result=\"forwarded\"} %d\n", forwarded)
+	fmt.Fprintf(w, "opl_dns_queries_total{result=\"local\"} %d\n", c.queriesLocal.Load())
+	writeCounter(w, "opl_dns_bypasses_total", "Bypass tokens issued.", bypasses)
+	writeCounter(w, "opl_dns_cache_hits_total", "Forwarded queries answered from the response cache.", hits)
+	writeCounter(w, "opl_dns_cache_misses_total", "Forwarded queries not found in the response cache.", misses)
+
+	writeHeader(w, "opl_dns_query_duration_seconds", "histogram", "Time to answer a DNS query, by path.")
+	for p := QueryPath(0); p < numQueryPaths; p++ {
+		writeHistogram(w, "opl_dns_query_duration_seconds", `path="`+p.String()+`"`, c.queryDuration[p].Snapshot())
+	}
+
+	if a, ok := c.Analytics(topClientPrefixes); ok {
+		writeAnalytics(w, a)
+	}
+
+	c.mu.Lock()
+	upstreams := append([]namedHistogram(nil), c.upstreams...)
+	gauges := append([]gauge(nil), c.gauges...)
+	c.mu.Unlock()
+
+	if len(upstreams) > 0 {
+		writeHeader(w, "opl_dns_upstream_rtt_seconds", "histogram", "Round-trip time of exchanges with upstream DNS servers.")
+		for _, u := range upstreams {
+			writeHistogram(w, "opl_dns_upstream_rtt_seconds", `upstream="`+escapeLabel(u.name)+`"`, u.h.Snapshot())
+		}
+	}
+
+	writeHeader(w, "opl_dns_blocklist_refresh_duration_seconds", "histogram", "Time taken by blocklist refreshes.")
+	writeHistogram(w, "opl_dns_blocklist_refresh_duration_seconds", "", c.refreshDuration.Snapshot())
+	writeCounter(w, "opl_dns_blocklist_refresh_failures_total", "Blocklist refreshes that failed.", c.refreshFailures.Load())
+
+	if cfg.GetBlocklistSize != nil {
+		domains, employers := cfg.GetBlocklistSize()
+		writeGauge(w, "opl_dns_blocklist_domains", "Entries in the current blocklist.", float64(domains))
+		writeGauge(w, "opl_dns_blocklist_employers", "Employers in the current blocklist.", float64(employers))
+	}
+	if cfg.GetLastRefresh != nil {
+		var ts float64
+		if last := cfg.GetLastRefresh(); !last.IsZero() {
+			ts = float64(last.UnixNano()) / 1e9
+		}
+		writeGauge(w, "opl_dns_blocklist_last_refresh_timestamp_seconds", "Time of the last successful blocklist fetch.", ts)
+	}
+	for _, g := range gauges {
+		writeHeader(w, g.name, g.kind, g.help)
+		fmt.Fprintf(w, "%s %s\n", g.name, formatFloat(g.fn()))
+	}
+
+	writeGauge(w, "opl_dns_uptime_seconds", "Time since the server started.", c.Uptime().Seconds())
+
+	// ReadMemStats stops the world briefly; at scrape intervals that is
+	// negligible.
+	var ms runtime.MemStats
+	runtime.ReadMemStats(&ms)
+	writeGauge(w, "go_goroutines", "Number of goroutines that currently exist.", float64(runtime.NumGoroutine()))
+	writeGauge(w, "go_memstats_heap_alloc_bytes", "Bytes of allocated heap objects.", float64(ms.HeapAlloc))
+	writeGauge(w, "go_memstats_heap_inuse_bytes", "Bytes in in-use heap spans.", float64(ms.HeapInuse))
+	writeGauge(w, "go_memstats_heap_objects", "Number of allocated heap objects.", float64(ms.HeapObjects))
+	writeGauge(w, "go_memstats_sys_bytes", "Bytes of memory obtained from the OS.", float64(ms.Sys))
+	writeCounter(w, "go_memstats_mallocs_total", "Cumulative count of heap objects allocated.", int64(ms.Mallocs))
+	writeCounter(w, "go_gc_cycles_total", "Completed GC cycles.", int64(ms.NumGC))
+	writeHeader(w, "go_gc_pause_seconds_total", "counter", "Cumulative time spent in GC stop-the-world pauses.")
+	fmt.Fprintf(w, "go_gc_pause_seconds_total %s\n", formatFloat(float64(ms.PauseTotalNs)/1e9))
+}
+
+// topClientPrefixes is the number of client prefixes exported as gauges;
+// the label values are bounded to keep the series count fixed.
+const topClientPrefixes = 10
+
+func writeAnalytics(w *bufio.Writer, a AnalyticsSnapshot) {
+	writeHeader(w, "opl_dns_queries_by_type_total", "counter", "DNS queries received, by query type.")
+	for _, name := range sortedKeys(a.QueryTypes) {
+		fmt.Fprintf(w, "opl_dns_queries_by_type_total{qtype=\"%s\"} %d\n", name, a.QueryTypes[name])
+	}
+	writeHeader(w, "opl_dns_responses_by_rcode_total", "counter", "DNS responses sent, by response code.")
+	for _, name := range sortedKeys(a.ResponseCodes) {
+		fmt.Fprintf(w, "opl_dns_responses_by_rcode_total{rcode=\"%s\"} %d\n", name, a.ResponseCodes[name])
+	}
+	writeGauge(w, "opl_dns_distinct_names", "Estimated number of distinct query names.", float64(a.DistinctNames))
+	writeGauge(w, "opl_dns_distinct_clients", "Estimated number of distinct client addresses.", float64(a.DistinctClients))
+	if len(a.TopClientPrefixes) > 0 {
+		writeHeader(w, "opl_dns_top_client_prefix_queries", "gauge", "Estimated queries from the busiest client prefixes.")
+		for _, p := range a.TopClientPrefixes {
+			fmt.Fprintf(w, "opl_dns_top_client_prefix_queries{prefix=\"%s\"} %d\n", p.Prefix, p.Count)
+		}
+	}
+}
+
+func sortedKeys(m map[string]int64) []string {
+	keys := make([]string, 0, len(m))
+	for k := range m {
+		keys = append(keys, k)
+	}
+	sort.Strings(keys)
+	return keys
+}
+
+func writeHeader(w *bufio.Writer, name, kind, help string) {
+	fmt.Fprintf(w, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, kind)
+}
+
+func writeCounter(w *bufio.Writer, name, help string, v int64) {
+	writeHeader(w, name, "counter", help)
+	fmt.Fprintf(w, "%s %d\n", name, v)
+}
+
+func writeGauge(w *bufio.Writer, name, help string, v float64) {
+	writeHeader(w, name, "gauge", help)
+	fmt.Fprintf(w, "%s %s\n", name, formatFloat(v))
+}
+
+// writeHistogram writes the bucket, sum and count series of one histogram.
+// labels, if not empty, are added to every series.
+func writeHistogram(w *bufio.Writer, name, labels string, s HistogramSnapshot) {
+	sep := ""
+	if labels != "" {
+		sep = ","
+	}
+	for i, bound := range s.Bounds {
+		fmt.Fprintf(w, "%s_bucket{%s%sle=\"%s\"} %d\n", name, labels, sep, formatFloat(bound.Seconds()), s.Counts[i])
+	}
+	fmt.Fprintf(w, "%s_bucket{%s%sle=\"+Inf\"} %d\n", name, labels, sep, s.Count())
+	if labels != "" {
+		labels = "{" + labels + "}"
+	}
+	fmt.Fprintf(w, "%s_sum%s %s\n", name, labels, formatFloat(s.Sum.Seconds()))
+	fmt.Fprintf(w, "%s_count%s %d\n", name, labels, s.Count())
+}
+
+func formatFloat(v float64) string {
+	return strconv.FormatFloat(v, 'g', -1, 64)
+}
+
+var labelEscaper = strings.NewReplacer(`\`, `\\`, `"`, `\"`, "\n", `\n`)
+
+func escapeLabel(v string) string {
+	return labelEscaper.Replace(v)
+}
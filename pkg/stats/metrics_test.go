@@ -0,0 +1,134 @@
+package stats
+
+import (
+	"errors"
+	"io"
+	"net/http"
+	"net/http/httptest"
+	"net/netip"
+	"strings"
+	"testing"
+	"time"
+)
+
+func TestMetricsHandler(t *testing.T) {
+	c := NewCollector()
+	c.RecordBlock("blocked.example.com")
+	c.RecordQuery()
+	c.RecordCacheHit()
+	c.ObserveQuery(PathBlock, 20*time.Microsecond)
+	c.ObserveQuery(PathForward, 30*time.Millisecond)
+	c.UpstreamRTT("tls://1.1.1.1:853").Observe(20 * time.Millisecond)
+	c.RecordRefresh(2*time.Second, nil)
+	c.RecordRefresh(time.Second, errors.New("timeout"))
+	c.RegisterGauge("opl_dns_cache_entries", "Responses held in the response cache.", func() float64 { return 42 })
+
+	srv := httptest.NewServer(NewMetricsHandler(MetricsConfig{
+		Collector:        c,
+		GetBlocklistSize: func() (int, int) { return 1500, 12 },
+		GetLastRefresh:   func() time.Time { return time.Unix(1700000000, 0) },
+	}))
+	defer srv.Close()
+
+	resp, err := http.Get(srv.URL + "/metrics")
+	if err != nil {
+		t.Fatalf("GET /metrics: %v", err)
+	}
+	defer resp.Body.Close()
+	body, _ := io.ReadAll(resp.Body)
+	if !strings.HasPrefix(resp.Header.Get("Content-Type"), "text/plain") {
+		t.Errorf("unexpected content type %q", resp.Header.Get("Content-Type"))
+	}
+
+	for _, want := range []string{
+		`opl_dns_queries_total{result="blocked"} 1`,
+		`opl_dns_queries_total{result="forwarded"} 1`,
+		`opl_dns_cache_hits_total 1`,
+		"# TYPE opl_dns_query_duration_seconds histogram",
+		`opl_dns_query_duration_seconds_bucket{path="block",le="2.5e-05"} 1`,
+		`opl_dns_query_duration_seconds_bucket{path="forward",le="0.025"} 0`,
+		`opl_dns_query_duration_seconds_bucket{path="forward",le="0.05"} 1`,
+		`opl_dns_query_duration_seconds_count{path="cache_hit"} 0`,
+		`opl_dns_upstream_rtt_seconds_sum{upstream="tls://1.1.1.1:853"} 0.02`,
+		`opl_dns_blocklist_refresh_duration_seconds_count 2`,
+		`opl_dns_blocklist_refresh_failures_total 1`,
+		`opl_dns_blocklist_domains 1500`,
+		`opl_dns_blocklist_employers 12`,
+		`opl_dns_blocklist_last_refresh_timestamp_seconds 1.7e+09`,
+		`opl_dns_cache_entries 42`,
+		"go_memstats_heap_alloc_bytes ",
+	} {
+		if !strings.Contains(string(body), want) {
+			t.Errorf("metrics output missing %q", want)
+		}
+	}
+
+	// pprof is off unless enabled
+	resp, err = http.Get(srv.URL + "/debug/pprof/")
+	if err != nil {
+		t.Fatalf("GET /debug/pprof/: %v", err)
+	}
+	resp.Body.Close()
+	if resp.StatusCode != http.StatusNotFound {
+		t.Errorf("expected pprof to be disabled, got status %d", resp.StatusCode)
+	}
+}
+
+func TestMetricsHandler_Analytics(t *testing.T) {
+	c := NewCollector()
+	c.EnableAnalytics()
+	c.RecordQueryDetails("example.com", 28, netip.MustParseAddr("192.0.2.1"))
+	c.RecordRcode(3)
+
+	srv := httptest.NewServer(NewMetricsHandler(MetricsConfig{Collector: c}))
+	defer srv.Close()
+
+	resp, err := http.Get(srv.URL + "/metrics")
+	if err != nil {
+		t.Fatalf("GET /metrics: %v", err)
+	}
+	defer resp.Body.Close()
+	body, _ := io.ReadAll(resp.Body)
+
+	for _, want := range []string{
+		`opl_dns_queries_by_type_total{qtype="AAAA"} 1`,
+		`opl_dns_responses_by_rcode_total{rcode="NXDOMAIN"} 1`,
+		`opl_dns_distinct_names 1`,
+		`opl_dns_distinct_clients 1`,
+		`opl_dns_top_client_prefix_queries{prefix="192.0.2.0/24"} 1`,
+	} {
+		if !strings.Contains(string(body), want) {
+			t.Errorf("metrics output missing %q", want)
+		}
+	}
+}
+
+func TestMetricsHandler_Pprof(t *testing.T) {
+	srv := httptest.NewServer(NewMetricsHandler(MetricsConfig{Collector: NewCollector(), Pprof: true}))
+	defer srv.Close()
+
+	resp, err := http.Get(srv.URL + "/debug/pprof/goroutine?debug=1")
+	if err != nil {
+		t.Fatalf("GET goroutine profile: %v", err)
+	}
+	resp.Body.Close()
+	if resp.StatusCode != http.StatusOK {
+		t.Errorf("expected goroutine profile, got status %d", resp.StatusCode)
+	}
+}
+
+func TestEscapeLabel(t *testing.T) {
+	if got := escapeLabel("a\"b\\c\nd"); got != `a\"b\\c\nd` {
+		t.Errorf("escapeLabel = %q", got)
+	}
+}
+
+func TestCollector_UpstreamRTT(t *testing.T) {
+	c := NewCollector()
+	if c.UpstreamRTT("8.8.8.8:53") != c.UpstreamRTT("8.8.8.8:53") {
+		t.Error("expected the same histogram for the same upstream")
+	}
+	if c.UpstreamRTT("8.8.8.8:53") == c.UpstreamRTT("8.8.4.4:53") {
+		t.Error("expected separate histograms for separate upstreams")
+	}
+}
@@ -0,0 +1,58 @@
+package stats
+
+// maxSpooledReports bounds the reports kept while the backend cannot be
+// reached; at the default five-minute interval it covers over two hours.
+const maxSpooledReports = 32
+
+// reportSpool holds the reports waiting to be sent, oldest first. When it
+// is full the two oldest reports are merged, so an outage costs the
+// backend resolution but never counts. It is not safe for concurrent use.
+type reportSpool struct {
+	reports []StatsReport
+	limit   int
+
+	// merged counts reports folded into an older one
+	merged int64
+}
+
+func newReportSpool(limit int) *reportSpool {
+	return &reportSpool{limit: max(limit, 2)}
+}
+
+// push adds a report at the end of the spool.
+func (s *reportSpool) push(report StatsReport) {
+	if len(s.reports) >= s.limit {
+		s.reports[1] = mergeReports(s.reports[0], s.reports[1])
+		s.reports = append(s.reports[:0], s.reports[1:]...)
+		s.merged++
+	}
+	s.reports = append(s.reports, report)
+}
+
+// front returns the oldest report.
+func (s *reportSpool) front() (StatsReport, bool) {
+	if len(s.reports) == 0 {
+		return StatsReport{}, false
+	}
+	return s.reports[0], true
+}
+
+// pop removes the oldest report.
+func (s *reportSpool) pop() {
+	s.reports[0] = StatsReport{}
+	s.reports = s.reports[1:]
+}
+
+func (s *reportSpool) len() int {
+	return len(s.reports)
+}
+
+// mergeReports combines two consecutive reports into one covering both:
+// the totals and gauges come from the newer one, and the deltas are summed.
+func mergeReports(older, newer StatsReport) StatsReport {
+	newer.QueriesSinceLastReport += older.QueriesSinceLastReport
+	newer.BlockedSinceLastReport += older.BlockedSinceLastReport
+	newer.ForwardedSinceLastReport += older.ForwardedSinceLastReport
+	newer.BypassesSinceLastReport += older.BypassesSinceLastReport
+	return newer
+}
@@ -0,0 +1,56 @@
+package stats
+
+import "testing"
+
+func TestReportSpool_OrderAndPop(t *testing.T) {
+	s := newReportSpool(4)
+	for i := int64(1); i <= 3; i++ {
+		s.push(StatsReport{TotalQueries: i})
+	}
+
+	for want := int64(1); want <= 3; want++ {
+		report, ok := s.front()
+		if !ok {
+			t.Fatalf("expected report %d, spool empty", want)
+		}
+		if report.TotalQueries != want {
+			t.Errorf("expected report %d, got %d", want, report.TotalQueries)
+		}
+		s.pop()
+	}
+	if _, ok := s.front(); ok {
+		t.Error("expected spool to be empty")
+	}
+}
+
+func TestReportSpool_MergesOldestWhenFull(t *testing.T) {
+	s := newReportSpool(3)
+	for i := int64(1); i <= 5; i++ {
+		s.push(StatsReport{TotalQueries: 10 * i, QueriesSinceLastReport: 10, BlockedSinceLastReport: 1})
+	}
+
+	if s.len() != 3 {
+		t.Fatalf("expected 3 spooled reports, got %d", s.len())
+	}
+	if s.merged != 2 {
+		t.Errorf("expected 2 merges, got %d", s.merged)
+	}
+
+	oldest, _ := s.front()
+	if oldest.TotalQueries != 30 {
+		t.Errorf("expected merged report to carry the newer total 30, got %d", oldest.TotalQueries)
+	}
+	if oldest.QueriesSinceLastReport != 30 || oldest.BlockedSinceLastReport != 3 {
+		t.Errorf("expected merged deltas 30/3, got %d/%d", oldest.QueriesSinceLastReport, oldest.BlockedSinceLastReport)
+	}
+
+	var deltas int64
+	for s.len() > 0 {
+		report, _ := s.front()
+		deltas += report.QueriesSinceLastReport
+		s.pop()
+	}
+	if deltas != 50 {
+		t.Errorf("expected no deltas to be lost, got %d of 50", deltas)
+	}
+}
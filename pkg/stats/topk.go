@@ -0,0 +1,172 @@
+package stats
+
+import (
+	"container/heap"
+	"hash/maphash"
+	"sync/atomic"
+)
+
+const (
+	// heavyHittersSlots is the number of keys a heavyHitters table tracks.
+	heavyHittersSlots = 1024
+
+	// heavyHittersProbe is how many neighbouring slots a key may occupy.
+	// A new key that finds all of them taken evicts the smallest.
+	heavyHittersProbe = 8
+)
+
+// heavyHitters estimates the most frequent keys in a stream using a fixed
+// amount of memory. It is a Space-Saving counter with bounded probing: each
+// key hashes to a window of heavyHittersProbe slots, and a new key that
+// finds its window full replaces the slot with the lowest count, inheriting
+// that count plus one. Counts therefore never undercount a tracked key, and
+// keys seen more often than the smallest count in their window are never
+// displaced.
+//
+// Add is lock-free. Concurrent updates of one slot can attribute a handful
+// of increments to a key that is being replaced; the result is an estimate
+// either way.
+type heavyHitters struct {
+	seed  maphash.Seed
+	slots [heavyHittersSlots]heavySlot
+}
+
+type heavySlot struct {
+	entry atomic.Pointer[heavyEntry]
+	count atomic.Int64
+}
+
+// heavyEntry is the immutable key held by a slot.
+type heavyEntry struct {
+	key  string
+	hash uint64
+}
+
+func newHeavyHitters() *heavyHitters {
+	return &heavyHitters{seed: maphash.MakeSeed()}
+}
+
+// Add counts one occurrence of key.
+func (h *heavyHitters) Add(key string) {
+	addKey(h, maphash.String(h.seed, key), key)
+}
+
+// AddBytes counts one occurrence of key. It only copies key when it starts
+// being tracked, so callers can count keys formatted into a reused buffer.
+func (h *heavyHitters) AddBytes(key []byte) {
+	addKey(h, maphash.Bytes(h.seed, key), key)
+}
+
+func addKey[K string | []byte](h *heavyHitters, hash uint64, key K) {
+	start := hash % heavyHittersSlots
+
+	var victim *heavySlot
+	var victimCount int64
+	for i := uint64(0); i < heavyHittersProbe; i++ {
+		slot := &h.slots[(start+i)%heavyHittersSlots]
+		e := slot.entry.Load()
+		if e == nil {
+			if slot.entry.CompareAndSwap(nil, &heavyEntry{key: string(key), hash: hash}) {
+				slot.count.Add(1)
+				return
+			}
+			e = slot.entry.Load()
+		}
+		if e.hash == hash && e.key == string(key) {
+			slot.count.Add(1)
+			return
+		}
+		if c := slot.count.Load(); victim == nil || c < victimCount {
+			victim, victimCount = slot, c
+		}
+	}
+
+	// Take over the least-counted slot in the window. If another writer got
+	// there first, count against whatever it holds now rather than retry.
+	old := victim.entry.Load()
+	victim.entry.CompareAndSwap(old, &heavyEntry{key: string(key), hash: hash})
+	victim.count.Add(1)
+}
+
+// Top returns up to n keys with the highest estimated counts, highest
+// first. It keeps a size-n heap while scanning the table, so it runs in
+// O(slots log n).
+func (h *heavyHitters) Top(n int) []DomainCount {
+	if n <= 0 {
+		return nil
+	}
+
+	top := make(countHeap, 0, n)
+	for i := range h.slots {
+		e := h.slots[i].entry.Load()
+		if e == nil || h.seenBefore(i, e) {
+			continue
+		}
+		dc := DomainCount{Domain: e.key, Count: h.windowCount(i, e)}
+		if len(top) < n {
+			heap.Push(&top, dc)
+		} else if top.less(top[0], dc) {
+			top[0] = dc
+			heap.Fix(&top, 0)
+		}
+	}
+
+	result := make([]DomainCount, len(top))
+	for i := len(result) - 1; i >= 0; i-- {
+		result[i] = heap.Pop(&top).(DomainCount)
+	}
+	return result
+}
+
+// Racing inserts of a new key can leave it in two slots of its probe
+// window. seenBefore and windowCount fold such duplicates into the first.
+
+// seenBefore reports whether e's key is in one of the probe-1 slots before i.
+func (h *heavyHitters) seenBefore(i int, e *heavyEntry) bool {
+	for j := 1; j < heavyHittersProbe; j++ {
+		if other := h.slots[(i-j+heavyHittersSlots)%heavyHittersSlots].entry.Load(); sameKey(other, e) {
+			return true
+		}
+	}
+	return false
+}
+
+// windowCount sums the counts of e's key in slot i and the probe-1 slots
+// after it.
+func (h *heavyHitters) windowCount(i int, e *heavyEntry) int64 {
+	var total int64
+	for j := 0; j < heavyHittersProbe; j++ {
+		slot := &h.slots[(i+j)%heavyHittersSlots]
+		if sameKey(slot.entry.Load(), e) {
+			total += slot.count.Load()
+		}
+	}
+	return total
+}
+
+func sameKey(a, b *heavyEntry) bool {
+	return a != nil && a.hash == b.hash && a.key == b.key
+}
+
+// countHeap is a min-heap of counts, ordered so that its root is the entry
+// Top would drop first: the lowest count, then the greatest domain name.
+type countHeap []DomainCount
+
+func (h countHeap) less(a, b DomainCount) bool {
+	if a.Count != b.Count {
+		return a.Count < b.Count
+	}
+	return a.Domain > b.Domain
+}
+
+func (h countHeap) Len() int           { return len(h) }
+func (h countHeap) Less(i, j int) bool { return h.less(h[i], h[j]) }
+func (h countHeap) Swap(i, j int)      { h[i], h[j] = h[j], h[i] }
+func (h *countHeap) Push(x any)        { *h = append(*h, x.(DomainCount)) }
+
+func (h *countHeap) Pop() any {
+	old := *h
+	x := old[len(old)-1]
+	*h = old[:len(old)-1]
+	return x
+}
@@ -0,0 +1,155 @@
+package stats
+
+import (
+	"fmt"
+	"sync"
+	"testing"
+)
+
+func TestHeavyHitters_ExactForFewKeys(t *testing.T) {
+	h := newHeavyHitters()
+
+	for i := 0; i < 100; i++ {
+		for j := 0; j <= i%10; j++ {
+			h.Add(fmt.Sprintf("domain%d.com", i))
+		}
+	}
+
+	top := h.Top(100)
+	if len(top) != 100 {
+		t.Fatalf("expected 100 domains, got %d", len(top))
+	}
+	for _, dc := range top {
+		var i int
+		fmt.Sscanf(dc.Domain, "domain%d.com", &i)
+		if want := int64(i%10 + 1); dc.Count != want {
+			t.Errorf("expected %s to have count %d, got %d", dc.Domain, want, dc.Count)
+		}
+	}
+	for i := 1; i < len(top); i++ {
+		if top[i].Count > top[i-1].Count {
+			t.Fatalf("expected descending counts, got %d after %d", top[i].Count, top[i-1].Count)
+		}
+	}
+}
+
+func TestHeavyHitters_TiesOrderedByDomain(t *testing.T) {
+	h := newHeavyHitters()
+	h.Add("b.com")
+	h.Add("a.com")
+	h.Add("c.com")
+
+	top := h.Top(2)
+	if len(top) != 2 || top[0].Domain != "a.com" || top[1].Domain != "b.com" {
+		t.Errorf("expected [a.com b.com], got %+v", top)
+	}
+}
+
+func TestHeavyHitters_SurvivesSubdomainFlood(t *testing.T) {
+	h := newHeavyHitters()
+
+	for i := 0; i < 100000; i++ {
+		h.Add(fmt.Sprintf("r%d.flood.example", i))
+		if i%10 == 0 {
+			h.Add("popular.com")
+		}
+	}
+
+	top := h.Top(1)
+	if len(top) != 1 || top[0].Domain != "popular.com" {
+		t.Fatalf("expected popular.com on top, got %+v", top)
+	}
+	if top[0].Count < 10000 {
+		t.Errorf("expected popular.com count of at least 10000, got %d", top[0].Count)
+	}
+
+	tracked := 0
+	for i := range h.slots {
+		if h.slots[i].entry.Load() != nil {
+			tracked++
+		}
+	}
+	if tracked > heavyHittersSlots {
+		t.Errorf("expected at most %d tracked keys, got %d", heavyHittersSlots, tracked)
+	}
+}
+
+func TestHeavyHitters_Concurrent(t *testing.T) {
+	h := newHeavyHitters()
+
+	var wg sync.WaitGroup
+	for g := 0; g < 8; g++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for i := 0; i < 1000; i++ {
+				h.Add(fmt.Sprintf("d%d.com", i%50))
+			}
+		}()
+	}
+	wg.Wait()
+
+	top := h.Top(50)
+	if len(top) != 50 {
+		t.Fatalf("expected 50 domains, got %d", len(top))
+	}
+	for _, dc := range top {
+		if dc.Count != 160 {
+			t.Errorf("expected %s to have count 160, got %d", dc.Domain, dc.Count)
+		}
+	}
+}
+
+func BenchmarkRecordBlock(b *testing.B) {
+	c := NewCollector()
+	domains := make([]string, 4096)
+	for i := range domains {
+		domains[i] = fmt.Sprintf("d%d.example.com", i)
+	}
+
+	b.ReportAllocs()
+	b.RunParallel(func(pb *testing.PB) {
+		i := 0
+		for pb.Next() {
+			c.RecordBlock(domains[i%len(domains)])
+			i++
+		}
+	})
+}
+
+func BenchmarkTopBlockedDomains(b *testing.B) {
+	c := NewCollector()
+	for i := 0; i < 100000; i++ {
+		c.RecordBlock(fmt.Sprintf("d%d.example.com", i))
+	}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		c.TopBlockedDomains(10)
+	}
+}
+
+func TestHeavyHitters_AddBytes(t *testing.T) {
+	h := newHeavyHitters()
+	buf := []byte("192.0.2.0/24")
+	for i := 0; i < 3; i++ {
+		h.AddBytes(buf)
+	}
+	h.Add("192.0.2.0/24")
+	copy(buf, "198.51.100.0")
+	h.AddBytes(buf[:12])
+
+	top := h.Top(2)
+	if len(top) != 2 || top[0].Domain != "192.0.2.0/24" || top[0].Count != 4 {
+		t.Fatalf("expected 192.0.2.0/24 counted 4 times first, got %v", top)
+	}
+	if top[1].Domain != "198.51.100.0" {
+		t.Errorf("expected the reused buffer's second key to be tracked separately, got %q", top[1].Domain)
+	}
+
+	allocs := testing.AllocsPerRun(100, func() { h.AddBytes(buf[:12]) })
+	if allocs != 0 {
+		t.Errorf("expected no allocations counting a tracked key, got %v", allocs)
+	}
+}